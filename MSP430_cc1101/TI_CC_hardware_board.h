@@ -129,4 +129,12 @@
 #define TI_5xx                                         // For MSP430F5529
 #define TI_CC_RF_SER_INTF       TI_CC_SER_INTF_USCIB0  // Interface to CCxxxx
 
+//----------------------------------------------------------------------------
+// FIFO bursts by DMA (5xx USCI_B0 only). Channel 0 is used by the USB API.
+//----------------------------------------------------------------------------
+#define TI_CC_SPI_DMA                                  // Comment out to burst with the CPU
+#define TI_CC_SPI_DMA_MIN       8                      // Shorter bursts are done with the CPU
+#define TI_CC_SPI_DMA_TRIG_RX   18                     // DMA trigger UCB0RXIFG
+#define TI_CC_SPI_DMA_TRIG_TX   19                     // DMA trigger UCB0TXIFG
+
 #endif // _TI_CC_HARDWARE_BOARD_H_
\ No newline at end of file
@@ -1242,6 +1242,15 @@ void TI_CC_PowerupResetCCxxxx(void)
 // Support for 5xx USCI_B0
 //******************************************************************************
 #ifdef TI_5xx
+#ifdef TI_CC_SPI_DMA
+//------------------------------------------------------------------------------
+// Bursts of TI_CC_SPI_DMA_MIN bytes or more are moved by DMA: channel 1 writes
+// TXBUF on UCB0TXIFG and channel 2 reads RXBUF on UCB0RXIFG so that the bytes
+// follow each other at the SPI clock rate. Channel 0 is left to the USB API.
+//------------------------------------------------------------------------------
+static const char TI_CC_SPIDummy = 0;       // Sent to clock the bytes read in
+#endif
+
 void TI_CC_SPISetup(void)
 {
   TI_CC_CSn_PxOUT |= TI_CC_CSn_PIN;
@@ -1259,6 +1268,12 @@ void TI_CC_SPISetup(void)
   TI_CC_SPI_USCIB0_PxDIR |= TI_CC_SPI_USCIB0_SIMO | TI_CC_SPI_USCIB0_UCLK;
                                             // SPI TXD out direction
   UCB0CTL1 &= ~UCSWRST;                     // **Initialize USCI state machine**
+#ifdef TI_CC_SPI_DMA
+  DMACTL0 = (DMACTL0 & 0x00FF) | (TI_CC_SPI_DMA_TRIG_TX << 8);
+                                            // Channel 1 trigger
+  DMACTL1 = (DMACTL1 & 0xFF00) | TI_CC_SPI_DMA_TRIG_RX;
+                                            // Channel 2 trigger
+#endif
 }
 
 void TI_CC_SPIWriteReg(char addr, char value)
@@ -1278,6 +1293,21 @@ void TI_CC_SPIWriteBurstReg(char addr, char *buffer, char count)
 
   TI_CC_CSn_PxOUT &= ~TI_CC_CSn_PIN;        // /CS enable
   while (!(UCB0IFG&UCTXIFG));               // Wait for TXBUF ready
+#ifdef TI_CC_SPI_DMA
+  if ((unsigned char) count >= TI_CC_SPI_DMA_MIN)
+  {
+    __data16_write_addr((unsigned short) &DMA1SA, (unsigned long) buffer);
+    __data16_write_addr((unsigned short) &DMA1DA, (unsigned long) &UCB0TXBUF);
+    DMA1SZ = (unsigned char) count;
+    DMA1CTL = DMADT_0 + DMASRCINCR_3 + DMASRCBYTE + DMADSTBYTE + DMAEN;
+    UCB0TXBUF = addr | TI_CCxxx0_WRITE_BURST; // Send address, data follows
+    while (!(DMA1CTL & DMAIFG));            // Wait for last byte in TXBUF
+    DMA1CTL &= ~DMAIFG;
+    while (UCB0STAT & UCBUSY);              // Wait for TX to complete
+    TI_CC_CSn_PxOUT |= TI_CC_CSn_PIN;       // /CS disable
+    return;
+  }
+#endif
   UCB0TXBUF = addr | TI_CCxxx0_WRITE_BURST; // Send address
   for (i = 0; i < count; i++)
   {
@@ -1312,6 +1342,26 @@ void TI_CC_SPIReadBurstReg(char addr, char *buffer, char count)
   while (!(UCB0IFG&UCTXIFG));               // Wait for TXBUF ready
   UCB0TXBUF = (addr | TI_CCxxx0_READ_BURST);// Send address
   while (UCB0STAT & UCBUSY);                // Wait for TX to complete
+#ifdef TI_CC_SPI_DMA
+  if ((unsigned char) count >= TI_CC_SPI_DMA_MIN)
+  {
+    UCB0IFG &= ~UCRXIFG;                    // Status byte is not kept
+    __data16_write_addr((unsigned short) &DMA2SA, (unsigned long) &UCB0RXBUF);
+    __data16_write_addr((unsigned short) &DMA2DA, (unsigned long) buffer);
+    DMA2SZ = (unsigned char) count;
+    DMA2CTL = DMADT_0 + DMADSTINCR_3 + DMASRCBYTE + DMADSTBYTE + DMAEN;
+    __data16_write_addr((unsigned short) &DMA1SA, (unsigned long) &TI_CC_SPIDummy);
+    __data16_write_addr((unsigned short) &DMA1DA, (unsigned long) &UCB0TXBUF);
+    DMA1SZ = (unsigned char) count - 1;
+    DMA1CTL = DMADT_0 + DMASRCBYTE + DMADSTBYTE + DMAEN;
+    UCB0TXBUF = 0;                          // Dummy write to read 1st data byte, others follow
+    while (!(DMA2CTL & DMAIFG));            // Wait for last byte in buffer
+    DMA2CTL &= ~DMAIFG;
+    DMA1CTL &= ~DMAIFG;
+    TI_CC_CSn_PxOUT |= TI_CC_CSn_PIN;       // /CS disable
+    return;
+  }
+#endif
   UCB0TXBUF = 0;                            // Dummy write to read 1st data byte
   // Addr byte is now being TX'ed, with dummy byte to follow immediately after
   UCB0IFG &= ~UCRXIFG;                      // Clear flag
@@ -54,7 +54,7 @@
 
 #include "msp430_interface.h"
 
-#define UCLK_DIV (MCLK_MHZ/4) // ~4 MHz SPI clock
+#define UCLK_DIV ((2*MCLK_MHZ + 12)/13) // SPI clock up to 6.5 MHz for bursts without delay (5 MHz at 20 MHz MCLK)
 
 void TI_CC_SPISetup(void);
 void TI_CC_PowerupResetCCxxxx(void);
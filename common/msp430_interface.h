@@ -4,7 +4,7 @@
 #include <stdint.h>
 
 #define F_XTAL_MHZ 26
-#define MCLK_MHZ 8
+#define MCLK_MHZ 20 // Highest MCLK at the PMM core level 2 required by USB
 
 typedef enum msp430_block_type_e
 {
@@ -17,7 +17,25 @@ typedef enum msp430_block_type_e
     MSP430_BLOCK_TYPE_RX_CANCEL,
     MSP430_BLOCK_TYPE_RADIO_STATUS,    
     MSP430_BLOCK_TYPE_ECHO_TEST,
-    MSP430_BLOCK_TYPE_ERROR
+    MSP430_BLOCK_TYPE_ERROR,
+    MSP430_BLOCK_TYPE_MODEM,
+    MSP430_BLOCK_TYPE_TX_POWER,
+    MSP430_BLOCK_TYPE_AFC,
+    MSP430_BLOCK_TYPE_REGISTERS,
+    MSP430_BLOCK_TYPE_TX_TIMING,
+    MSP430_BLOCK_TYPE_TIME,
+    MSP430_BLOCK_TYPE_TURNAROUND,
+    MSP430_BLOCK_TYPE_CALIBRATION,
+    MSP430_BLOCK_TYPE_HOP,
+    MSP430_BLOCK_TYPE_HOP_BEACON,
+    MSP430_BLOCK_TYPE_SWEEP,
+    MSP430_BLOCK_TYPE_LATENCY,
+    MSP430_BLOCK_TYPE_FILTER,
+    MSP430_BLOCK_TYPE_FIFO_STATS,
+    MSP430_BLOCK_TYPE_TRACE,
+    MSP430_BLOCK_TYPE_PROFILE,
+    MSP430_BLOCK_TYPE_LOAD_PROFILE,
+    MSP430_BLOCK_TYPE_SELECT_PROFILE
 } msp430_block_type_t;
 
 typedef enum sync_word_e
@@ -69,9 +87,319 @@ struct msp430_radio_parms_s
     uint8_t  patable_freq_i;  // Frequency band index for the PATABLE
     uint8_t  patable_power_i; // Power index in the PATABLE row 
     uint32_t freq_word;       // FREQ[23:0]        24 bit frequency word (FREQ0..FREQ2)
+    uint8_t  fifo_thr;        // FIFO_THR[3:0]      4 bit Rx and Tx FIFO threshold
+    uint8_t  sync1;           // SYNC[15:8]         Sync word high byte
+    uint8_t  sync0;           // SYNC[7:0]          Sync word low byte
 } __attribute__((packed));
 
 typedef struct msp430_radio_parms_s msp430_radio_parms_t;
 
+#define MSP430_INIT_READY  0x01 // Radio reached the IDLE state after the initialization
+#define MSP430_INIT_REUSED 0x02 // Parameters of the active configuration: radio not reset
 
-#endif // _MSP430_INTERFACE_H_
\ No newline at end of file
+// Result of the initialization returned with the MSP430_BLOCK_TYPE_INIT acknowledgement
+struct msp430_init_status_s
+{
+    uint8_t  flags;           // MSP430_INIT_xxx flags
+    uint8_t  marcstate;       // MARCSTATE of the radio after the initialization
+    uint16_t init_us;         // Time taken by the initialization on the MSP430 in microseconds
+} __attribute__((packed));
+
+typedef struct msp430_init_status_s msp430_init_status_t;
+
+// Subset of the radio parameters that can be changed between transmissions without a full init
+struct msp430_modem_parms_s
+{
+    uint8_t  drate_e;         // DRATE_E[3:0]       4 bit data rate exponent
+    uint8_t  drate_m;         // DRATE_M[7:0]       8 bit data rate mantissa
+    uint8_t  deviat_e;        // DEVIATION_E[2:0]   3 bit deviation exponent
+    uint8_t  deviat_m;        // DEVIATION_M[2:0]   3 bit deviation mantissa
+    uint8_t  chanbw_e;        // CHANBW_E[1:0]      2 bit channel bandwidth exponent
+    uint8_t  chanbw_m;        // CHANBW_M[1:0]      2 bit channel bandwidth mantissa
+    uint8_t  mod_word;        // MOD_FORMAT[2:0]    3 bit modulation format word
+    uint8_t  fec_whitening;   // FEC (bit 0) and Data Whitening (bit 1)
+    uint8_t  fifo_thr;        // FIFO_THR[3:0]      4 bit Rx and Tx FIFO threshold
+} __attribute__((packed));
+
+typedef struct msp430_modem_parms_s msp430_modem_parms_t;
+
+#define MSP430_AFC_TRACK 0x01 // Track the frequency offset of received packets
+#define MSP430_AFC_LOAD  0x02 // Load the given frequency offset
+
+// Automatic frequency control command and state
+struct msp430_afc_s
+{
+    uint8_t  mode;            // MSP430_AFC_TRACK and MSP430_AFC_LOAD flags
+    int8_t   freq_offset;     // FSCTRL0 frequency offset in steps of Fxtal/2^14
+    int8_t   last_estimate;   // Last FREQEST reading (returned)
+    uint16_t nb_updates;      // Number of estimates taken into account (returned)
+} __attribute__((packed));
+
+typedef struct msp430_afc_s msp430_afc_t;
+
+#define MSP430_REGISTERS_MAX_ADDR  0x2E // Last configuration register that can be written (TEST0)
+#define MSP430_REGISTERS_MAX_PAIRS 32   // Maximum number of (address, value) pairs in one command
+
+// Transmission timing enforced by the MSP430 with a timer
+struct msp430_tx_timing_s
+{
+    uint32_t keyup_delay_us;  // Delay before the first block transmitted after reception or initialization
+    uint32_t block_delay_us;  // Minimum time from the end of a block to the start of the next one
+} __attribute__((packed));
+
+typedef struct msp430_tx_timing_s msp430_tx_timing_t;
+
+#define MSP430_TX_ACK_STATUS      2 // Position of the status in a Tx acknowledgement block (0: sent)
+#define MSP430_TX_ACK_TIMESTAMPS  3 // Position of the timestamps in a Tx acknowledgement block
+#define MSP430_TX_ACK_RX_ARMED   11 // Position of the time the receiver was armed after the block (0 if not)
+#define MSP430_TX_ACK_SIZE       13 // Payload size of a Tx acknowledgement block
+
+// Timestamps of a block in microseconds of the MSP430 clock (wraps around every 71 minutes).
+// They follow RSSI and LQI in a received block and the status byte in a Tx acknowledgement.
+struct msp430_timestamps_s
+{
+    uint32_t sync_us;         // Sync word sent or detected (GDO0 rising edge)
+    uint32_t end_us;          // End of packet (GDO0 falling edge)
+} __attribute__((packed));
+
+typedef struct msp430_timestamps_s msp430_timestamps_t;
+
+// Reception armed by the MSP430 at the end of each transmission
+struct msp430_turnaround_s
+{
+    uint8_t enable;           // Radio goes to Rx at the end of transmission (TXOFF_MODE = RX)
+    uint8_t rx_block_size;    // Size of the block expected
+} __attribute__((packed));
+
+typedef struct msp430_turnaround_s msp430_turnaround_t;
+
+#define MSP430_TICK_US          65536 // Period of the MSP430 coarse clock used for calibration ages
+#define MSP430_CAL_CACHE_SIZE   16    // Number of channels whose synthesizer calibration is kept
+#define MSP430_CAL_PERIOD_S     300   // Default calibration age in seconds after which it is redone
+
+// Channel selection with frequency synthesizer calibration cache
+struct msp430_calibration_s
+{
+    uint8_t  channel;         // Channel number (CHANNR) to select
+    uint8_t  force;           // Calibrate even if a fresh calibration of the channel is cached
+    uint16_t period_s;        // Calibration age in seconds after which it is redone (0: unchanged)
+    uint8_t  fscal3;          // Returned: calibration in use (FSCAL3)
+    uint8_t  fscal2;          // Returned: calibration in use (FSCAL2)
+    uint8_t  fscal1;          // Returned: calibration in use (FSCAL1)
+    uint8_t  cached;          // Returned: 1 if restored from the cache, 0 if calibrated
+} __attribute__((packed));
+
+typedef struct msp430_calibration_s msp430_calibration_t;
+
+#define MSP430_HOP_MAX_CHANNELS MSP430_CAL_CACHE_SIZE // All channels hopped over keep their calibration
+#define MSP430_HOP_ENABLE    0x01 // Hop at each slot boundary else stay on the channel of the slot
+#define MSP430_HOP_SET_TABLE 0x02 // Load the number of channels, timing and channels table
+#define MSP430_HOP_SET_TIME  0x04 // Load the slot number and the time it started
+#define MSP430_HOP_QUERY     0x08 // Change nothing, just return the state
+
+// Frequency hopping timed by the MSP430. The channel of a slot is channels[slot % nb_channels].
+struct msp430_hop_s
+{
+    uint8_t  mode;            // MSP430_HOP_xxx flags (returned: MSP430_HOP_ENABLE if hopping)
+    uint8_t  nb_channels;     // Number of entries of the channels table
+    uint32_t dwell_us;        // Duration of a slot
+    uint32_t guard_us;        // A block is not started closer than this to the end of the slot...
+    uint32_t settle_us;       // ...it waits for this time after the next hop instead
+    uint32_t slot;            // Slot number (returned: current slot)
+    uint32_t slot_start_us;   // MSP430 time the slot started (returned: current slot)
+    uint8_t  channels[MSP430_HOP_MAX_CHANNELS]; // Channel (CHANNR) of each slot modulo the number of channels
+} __attribute__((packed));
+
+typedef struct msp430_hop_s msp430_hop_t;
+
+// Written by the MSP430 over the last bytes of the data of a block sent with the
+// MSP430_BLOCK_TYPE_HOP_BEACON command just before it is loaded in the Tx FIFO
+struct msp430_hop_stamp_s
+{
+    uint32_t slot;            // Slot number
+    uint32_t elapsed_us;      // Time since the start of the slot
+} __attribute__((packed));
+
+typedef struct msp430_hop_stamp_s msp430_hop_stamp_t;
+
+#define MSP430_SWEEP_MAX_STEPS  250   // Readings returned by one MSP430_BLOCK_TYPE_SWEEP command
+#define MSP430_SWEEP_MAX_US     2000  // Maximum settle plus dwell time per channel
+#define MSP430_SWEEP_CALIBRATE  0x01  // Calibrate all channels of the sweep even if their calibrations are fresh
+
+// RSSI sweep over consecutive channels (CHANNR). One RSSI status register reading is returned per
+// channel: the highest seen during the dwell time.
+struct msp430_sweep_s
+{
+    uint8_t  first_channel;   // First channel (CHANNR) swept
+    uint8_t  nb_steps;        // Number of channels swept (max MSP430_SWEEP_MAX_STEPS)
+    uint8_t  flags;           // MSP430_SWEEP_xxx flags
+    uint16_t settle_us;       // Time in Rx on each channel before the RSSI readings are valid
+    uint16_t dwell_us;        // Time the RSSI is read on each channel after settling
+} __attribute__((packed));
+
+typedef struct msp430_sweep_s msp430_sweep_t;
+
+#define MSP430_LATENCY_RESET 0x01 // Clear the statistics once returned
+
+// Interrupt latency statistics. The interrupts only latch the radio events and take timestamps.
+// The SPI and USB work is done in the main loop with interrupts enabled.
+struct msp430_latency_s
+{
+    uint8_t  flags;           // MSP430_LATENCY_xxx flags
+    uint16_t irq_max_us;      // Returned: longest delay from a timer interrupt request to its handler
+    uint32_t work_max_us;     // Returned: longest radio event or command handling in the main loop (ran with interrupts off before)
+    uint32_t event_max_us;    // Returned: longest delay from an event latched by an interrupt to its handling
+    uint32_t nb_probes;       // Returned: number of interrupt latency samples
+} __attribute__((packed));
+
+typedef struct msp430_latency_s msp430_latency_t;
+
+#define MSP430_FILTER_ADDRESS   0x01 // CC1101 address check with 0x00 and 0xFF broadcast. An address byte precedes each block sent.
+#define MSP430_FILTER_PAYLOAD   0x02 // Blocks received not matching the payload pattern are dropped by the MSP430
+#define MSP430_FILTER_QUERY     0x40 // Only return the filter in use and its counters
+#define MSP430_FILTER_RESET     0x80 // Clear the counters once returned
+#define MSP430_FILTER_MAX_BYTES 4    // Payload bytes compared at most
+
+// Reception filters. Packets that fail them are never read out of the radio (address) or never
+// sent over USB (payload). The initialization removes them.
+struct msp430_filter_s
+{
+    uint8_t  flags;           // MSP430_FILTER_xxx flags (returned: filters in use)
+    uint8_t  address;         // ADDR: address accepted on reception besides broadcast
+    uint8_t  tx_address;      // Address byte sent before each block
+    uint8_t  offset;          // Offset in the block of the first payload byte compared
+    uint8_t  length;          // Number of payload bytes compared
+    uint8_t  value[MSP430_FILTER_MAX_BYTES]; // Expected payload bytes...
+    uint8_t  mask[MSP430_FILTER_MAX_BYTES];  // ...on the bits set here
+    uint16_t nb_address_drops; // Returned: packets discarded by the address check
+    uint16_t nb_payload_drops; // Returned: blocks dropped by the payload filter
+} __attribute__((packed));
+
+typedef struct msp430_filter_s msp430_filter_t;
+
+#define MSP430_FIFO_STATS_RESET 0x01 // Clear the counters once returned
+
+// FIFO errors recovered by the MSP430. On a Rx FIFO overflow the FIFO is flushed and the reception
+// restarted without telling the host. On a Tx FIFO underflow the FIFO is flushed, the block is
+// acknowledged as failed and the radio goes back to reception if the turnaround is enabled.
+struct msp430_fifo_stats_s
+{
+    uint8_t  flags;            // MSP430_FIFO_STATS_xxx flags
+    uint16_t nb_rx_overflows;  // Returned: Rx FIFO overflows
+    uint16_t nb_tx_underflows; // Returned: Tx FIFO underflows
+    uint16_t recovery_max_us;  // Returned: longest time from the end of packet to the radio ready again
+} __attribute__((packed));
+
+typedef struct msp430_fifo_stats_s msp430_fifo_stats_t;
+
+#define MSP430_TRACE_RESET      0x01 // Clear the counters once returned
+#define MSP430_TRACE_MAX_EVENTS 32   // Events returned at most in one block
+
+#define MSP430_TRACE_COMMAND    1    // Block received from the host. Arg: block type
+#define MSP430_TRACE_TX_START   2    // STX strobe. Arg: packet length
+#define MSP430_TRACE_RX_START   3    // Reception armed. Arg: block size
+#define MSP430_TRACE_SYNC       4    // Sync word sent or detected
+#define MSP430_TRACE_FIFO_THR   5    // FIFO threshold crossed: Tx FIFO refilled or Rx FIFO unloaded
+#define MSP430_TRACE_TX_END     6    // End of packet sent. Arg: TXBYTES (0 if good)
+#define MSP430_TRACE_RX_END     7    // End of packet received and kept. Arg: LQI byte (CRC OK in bit 7)
+#define MSP430_TRACE_RX_DROP    8    // End of packet received and dropped. Arg: MSP430_TRACE_DROP_xxx
+#define MSP430_TRACE_USB_SENT   9    // Block sent to the host. Arg: block type
+
+#define MSP430_TRACE_DROP_ADDRESS  0 // Address check of the radio
+#define MSP430_TRACE_DROP_PAYLOAD  1 // Payload filter
+#define MSP430_TRACE_DROP_OVERFLOW 2 // Rx FIFO overflow
+
+// One event of the trace ring
+struct msp430_trace_event_s
+{
+    uint32_t time_us;         // MSP430 time of the event
+    uint8_t  event;           // MSP430_TRACE_xxx event
+    uint8_t  arg;             // Event dependent argument
+} __attribute__((packed));
+
+typedef struct msp430_trace_event_s msp430_trace_event_t;
+
+// Trace counters. The reply carries up to MSP430_TRACE_MAX_EVENTS of the oldest events of the
+// ring after this header. They are removed from the ring.
+struct msp430_trace_s
+{
+    uint8_t  flags;            // MSP430_TRACE_xxx flags
+    uint8_t  nb_events;        // Returned: number of events following
+    uint8_t  nb_left;          // Returned: number of events left in the ring
+    uint16_t nb_lost;          // Returned: events overwritten before they were read
+    uint16_t nb_tx;            // Returned: packets sent
+    uint16_t nb_rx;            // Returned: packets received with a good CRC
+    uint16_t nb_crc_errors;    // Returned: packets received with a bad CRC
+    uint16_t nb_rx_overflows;  // Returned: Rx FIFO overflows (not reset here)
+    uint16_t nb_tx_underflows; // Returned: Tx FIFO underflows (not reset here)
+} __attribute__((packed));
+
+typedef struct msp430_trace_s msp430_trace_t;
+
+#define MSP430_PROFILE_RESET    0x01 // Clear the statistics once returned
+#define MSP430_PROFILE_ENABLED  0x80 // Returned: firmware built with the profiling (make PROFILE=1)
+#define MSP430_PROFILE_BINS     8    // Histogram bins: below 128 cycles then doubling. The last one is open.
+
+// Code sites timed by the profiling
+typedef enum msp430_profile_site_e
+{
+    MSP430_PROFILE_PORT1_ISR = 0, // GDO0 and GDO2 interrupt
+    MSP430_PROFILE_USB_ISR,       // USB interrupt
+    MSP430_PROFILE_TX_SETUP,      // First Tx FIFO burst (transmit_setup)
+    MSP430_PROFILE_TX_REFILL,     // Tx FIFO refill (transmit_more)
+    MSP430_PROFILE_RX_UNLOAD,     // Rx FIFO unload (receive_more)
+    MSP430_PROFILE_RX_END,        // Rest of the packet read at the end (receive_end)
+    MSP430_PROFILE_NB_SITES
+} msp430_profile_site_t;
+
+// Duration statistics of a site in MCLK cycles
+struct msp430_profile_stats_s
+{
+    uint32_t count;           // Number of runs
+    uint32_t total_cycles;    // Sum of the durations
+    uint16_t min_cycles;      // Shortest run
+    uint16_t max_cycles;      // Longest run
+    uint16_t histogram[MSP430_PROFILE_BINS]; // Runs per duration range
+} __attribute__((packed));
+
+typedef struct msp430_profile_stats_s msp430_profile_stats_t;
+
+// Cycle profiling of the interrupts and FIFO transfers
+struct msp430_profile_s
+{
+    uint8_t  flags;           // MSP430_PROFILE_xxx flags
+    uint8_t  mclk_mhz;        // Returned: MCLK frequency in MHz
+    msp430_profile_stats_t sites[MSP430_PROFILE_NB_SITES]; // Returned: statistics of each site
+} __attribute__((packed));
+
+typedef struct msp430_profile_s msp430_profile_t;
+
+#define MSP430_REG_PROFILES         16   // Register profiles kept by the MSP430
+#define MSP430_REG_PROFILE_POWER    0x01 // Profile sets the Tx power (FREND0 and PATABLE) else keeps it
+#define MSP430_REG_PROFILE_RECAL    0x02 // Returned: the frequency changed and the channel was calibrated again
+#define MSP430_REG_PROFILE_INVALID  0x80 // Returned: no profile loaded under this index
+
+// Register profile loaded with MSP430_BLOCK_TYPE_LOAD_PROFILE. The MSP430 computes the registers of
+// the radio parameters as an initialization would and keeps those that follow the parameters.
+struct msp430_reg_profile_s
+{
+    uint8_t  index;           // Profile index below MSP430_REG_PROFILES
+    uint8_t  flags;           // MSP430_REG_PROFILE_POWER flag
+    msp430_radio_parms_t radio_parms; // Radio parameters of the profile
+} __attribute__((packed));
+
+typedef struct msp430_reg_profile_s msp430_reg_profile_t;
+
+// Profile selection with MSP430_BLOCK_TYPE_SELECT_PROFILE. Only the registers that differ from those
+// in use are written. The radio must be idle.
+struct msp430_reg_select_s
+{
+    uint8_t  index;           // Profile index
+    uint8_t  flags;           // Returned: MSP430_REG_PROFILE_RECAL and MSP430_REG_PROFILE_INVALID flags
+    uint8_t  nb_writes;       // Returned: number of registers written (the PATABLE counts for one)
+    uint16_t select_us;       // Returned: time taken on the MSP430 in microseconds
+} __attribute__((packed));
+
+typedef struct msp430_reg_select_s msp430_reg_select_t;
+
+#endif // _MSP430_INTERFACE_H_
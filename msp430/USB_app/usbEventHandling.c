@@ -58,7 +58,7 @@
 #endif
 
 //These variables are only example, they are not needed for stack
-extern volatile uint8_t bCDCDataReceived_event;    //data received event
+extern volatile uint8_t bCDCDataReceived_event[CDC_NUM_INTERFACES]; //data received event per interface
 
 /*
  * If this function gets executed, it's a sign that the output of the USB PLL has failed.
@@ -188,7 +188,7 @@ uint8_t USBCDC_handleDataReceived (uint8_t intfNum)
 {
     //TO DO: You can place your code here
 
-    bCDCDataReceived_event = TRUE;
+    bCDCDataReceived_event[intfNum] = TRUE;
 
     return (TRUE);                              //return FALSE to go asleep after interrupt (in the case the CPU slept before
                                                 //interrupt)
@@ -42,6 +42,7 @@
 #include <string.h>
 
 #include <USB_API/USB_CDC_API/UsbCdc.h>
+#include "profile.h"
 /*----------------------------------------------------------------------------+
 | External Variables                                                          |
 +----------------------------------------------------------------------------*/
@@ -76,6 +77,7 @@ __interrupt void iUsbInterruptHandler(void)
 void __attribute__ ((interrupt(USB_UBM_VECTOR))) iUsbInterruptHandler(void)
 #endif 
 {
+    PROFILE_START(profile_start);
     uint8_t bWakeUp = FALSE;
     //Check if the setup interrupt is pending.
     //We need to check it before other interrupts,
@@ -172,7 +174,9 @@ void __attribute__ ((interrupt(USB_UBM_VECTOR))) iUsbInterruptHandler(void)
     case USBVECINT_INPUT_ENDPOINT3:
       break;
     case USBVECINT_INPUT_ENDPOINT4:
-      break;
+      //send saved bytes from buffer...
+      bWakeUp = CdcToHostFromBuffer(CDC1_INTFNUM);
+            break;
     case USBVECINT_INPUT_ENDPOINT5:
       break;
     case USBVECINT_INPUT_ENDPOINT6:
@@ -199,7 +203,20 @@ void __attribute__ ((interrupt(USB_UBM_VECTOR))) iUsbInterruptHandler(void)
     case USBVECINT_OUTPUT_ENDPOINT3:
       break;
     case USBVECINT_OUTPUT_ENDPOINT4:
-      break;
+      //call callback function if no receive operation is underway
+      if (!CdcIsReceiveInProgress(CDC1_INTFNUM) && USBCDC_bytesInUSBBuffer(CDC1_INTFNUM))
+      {
+          if (wUsbEventMask & kUSB_dataReceivedEvent)
+          {
+              bWakeUp = USBCDC_handleDataReceived(CDC1_INTFNUM);
+          }
+      }
+      else
+      {
+          //complete receive opereation - copy data to user buffer
+          bWakeUp = CdcToBufferFromHost(CDC1_INTFNUM);
+      }
+            break;
     case USBVECINT_OUTPUT_ENDPOINT5:
       break;
     case USBVECINT_OUTPUT_ENDPOINT6:
@@ -214,6 +231,8 @@ void __attribute__ ((interrupt(USB_UBM_VECTOR))) iUsbInterruptHandler(void)
          __bic_SR_register_on_exit(LPM3_bits);   // Exit LPM0-3
          __no_operation();                       // Required for debugger
     }
+
+    PROFILE_END(MSP430_PROFILE_USB_ISR, profile_start);
 }
 
 /*----------------------------------------------------------------------------+
@@ -47,9 +47,9 @@ uint8_t const abromDeviceDescriptor[SIZEOF_DEVICE_DESCRIPTOR] = {
     SIZEOF_DEVICE_DESCRIPTOR,               // Length of this descriptor
     DESC_TYPE_DEVICE,                       // Type code of this descriptor
     0x00, 0x02,                             // Release of USB spec
-    0x02,                                   // Device's base class code
-    0x00,                                   // Device's sub class code
-    0x00,                                   // Device's protocol type code
+    0xEF,                                   // Device's base class code: miscellaneous (composite with IADs)
+    0x02,                                   // Device's sub class code: common class
+    0x01,                                   // Device's protocol type code: interface association descriptor
     EP0_PACKET_SIZE,                        // End point 0's packet size
     USB_VID&0xFF, USB_VID>>8,               // Vendor ID for device, TI=0x0451
                                             // You can order your own VID at www.usb.org
@@ -85,6 +85,15 @@ const struct abromConfigurationDescriptorGroup abromConfigurationDescriptorGroup
     {
         /* start CDC[0] */
         {
+            //INTERFACE ASSOCIATION DESCRIPTOR (8 bytes)
+            0x08,                              // bLength: IAD size
+            0x0B,                              // bDescriptorType: Interface Association
+            CDC0_COMM_INTERFACE,               // bFirstInterface
+            0x02,                              // bInterfaceCount: comm and data interfaces
+            0x02,                              // bFunctionClass: Communication Interface Class
+            0x02,                              // bFunctionSubClass: Abstract Control Model
+            0x01,                              // bFunctionProtocol: Common AT commands
+            INTF_STRING_INDEX + 0,             // iFunction
 
             //INTERFACE DESCRIPTOR (9 bytes)
             0x09,                              // bLength: Interface Descriptor size
@@ -158,10 +167,98 @@ const struct abromConfigurationDescriptorGroup abromConfigurationDescriptorGroup
             EP_DESC_ATTR_TYPE_BULK,                // bmAttributes: Bulk
             0x40, 0x00,                         // wMaxPacketSize, 64 bytes
             0xFF                                // bInterval: ignored for bulk transfer
-        }
+        },
 
         /* end CDC[0]*/
 
+        /* start CDC[1] */
+        {
+            //INTERFACE ASSOCIATION DESCRIPTOR (8 bytes)
+            0x08,                              // bLength: IAD size
+            0x0B,                              // bDescriptorType: Interface Association
+            CDC1_COMM_INTERFACE,               // bFirstInterface
+            0x02,                              // bInterfaceCount: comm and data interfaces
+            0x02,                              // bFunctionClass: Communication Interface Class
+            0x02,                              // bFunctionSubClass: Abstract Control Model
+            0x01,                              // bFunctionProtocol: Common AT commands
+            INTF_STRING_INDEX + 1,             // iFunction
+
+            //INTERFACE DESCRIPTOR (9 bytes)
+            0x09,                              // bLength: Interface Descriptor size
+            DESC_TYPE_INTERFACE,               // bDescriptorType: Interface
+            CDC1_COMM_INTERFACE,               // bInterfaceNumber
+            0x00,                              // bAlternateSetting: Alternate setting
+            0x01,                              // bNumEndpoints: Three endpoints used
+            0x02,                              // bInterfaceClass: Communication Interface Class
+            0x02,                              // bInterfaceSubClass: Abstract Control Model
+            0x01,                              // bInterfaceProtocol: Common AT commands
+            INTF_STRING_INDEX + 1,             // iInterface:
+
+            //Header Functional Descriptor
+            0x05,                                // bLength: Endpoint Descriptor size
+            0x24,                                // bDescriptorType: CS_INTERFACE
+            0x00,                                // bDescriptorSubtype: Header Func Desc
+            0x10,                                // bcdCDC: spec release number
+            0x01,
+
+            //Call Managment Functional Descriptor
+            0x05,                                // bFunctionLength
+            0x24,                                // bDescriptorType: CS_INTERFACE
+            0x01,                                // bDescriptorSubtype: Call Management Func Desc
+            0x00,                                // bmCapabilities: D0+D1
+            CDC1_DATA_INTERFACE,                // bDataInterface: 0
+
+            //ACM Functional Descriptor
+            0x04,                                // bFunctionLength 
+            0x24,                                // bDescriptorType: CS_INTERFACE
+            0x02,                                // bDescriptorSubtype: Abstract Control Management desc
+            0x02,                                // bmCapabilities
+
+            // Union Functional Descriptor
+            0x05,                               // Size, in bytes
+            0x24,                               // bDescriptorType: CS_INTERFACE
+            0x06,                                // bDescriptorSubtype: Union Functional Desc
+            CDC1_COMM_INTERFACE,                // bMasterInterface -- the controlling intf for the union
+            CDC1_DATA_INTERFACE,                // bSlaveInterface -- the controlled intf for the union
+
+            //EndPoint Descriptor for Interrupt endpoint
+            SIZEOF_ENDPOINT_DESCRIPTOR,         // bLength: Endpoint Descriptor size
+            DESC_TYPE_ENDPOINT,                 // bDescriptorType: Endpoint
+            CDC1_INTEP_ADDR,                    // bEndpointAddress: (IN3)
+            EP_DESC_ATTR_TYPE_INT,                // bmAttributes: Interrupt
+            0x40, 0x00,                         // wMaxPacketSize, 64 bytes
+            0xFF,                                // bInterval
+
+            //DATA INTERFACE DESCRIPTOR (9 bytes)
+            0x09,                                // bLength: Interface Descriptor size
+            DESC_TYPE_INTERFACE,                // bDescriptorType: Interface
+            CDC1_DATA_INTERFACE,                // bInterfaceNumber
+            0x00,                               // bAlternateSetting: Alternate setting
+            0x02,                               // bNumEndpoints: Three endpoints used
+            0x0A,                               // bInterfaceClass: Data Interface Class
+            0x00,                               // bInterfaceSubClass:
+            0x00,                               // bInterfaceProtocol: No class specific protocol required
+            0x00,                                // iInterface:
+
+            //EndPoint Descriptor for Output endpoint
+            SIZEOF_ENDPOINT_DESCRIPTOR,         // bLength: Endpoint Descriptor size
+            DESC_TYPE_ENDPOINT,                    // bDescriptorType: Endpoint
+            CDC1_OUTEP_ADDR,                    // bEndpointAddress: (OUT4)
+            EP_DESC_ATTR_TYPE_BULK,                // bmAttributes: Bulk 
+            0x40, 0x00,                         // wMaxPacketSize, 64 bytes
+            0xFF,                                 // bInterval: ignored for Bulk transfer
+
+            //EndPoint Descriptor for Input endpoint
+            SIZEOF_ENDPOINT_DESCRIPTOR,         // bLength: Endpoint Descriptor size
+            DESC_TYPE_ENDPOINT,                    // bDescriptorType: Endpoint
+            CDC1_INEP_ADDR,                        // bEndpointAddress: (IN4)
+            EP_DESC_ATTR_TYPE_BULK,                // bmAttributes: Bulk
+            0x40, 0x00,                         // wMaxPacketSize, 64 bytes
+            0xFF                                // bInterval: ignored for bulk transfer
+        }
+
+        /* end CDC[1]*/
+
     }
     /******************************************************* end of CDC**************************************/
 
@@ -201,12 +298,18 @@ uint8_t const abromStringDescriptor[] = {
     'M',0x00,'S',0x00,'P',0x00,'4',0x00,'3',0x00,'0',0x00,
     ' ',0x00,'U',0x00,'S',0x00,'B',0x00,
 
-    // String index5, Interface String
-    38,        // Length of this string descriptor
+    // String index5, Interface String (control)
+    32,        // Length of this string descriptor
     3,        // bDescriptorType
-    'M',0x00,'S',0x00,'P',0x00,'4',0x00,'3',0x00,'0',0x00,
-    '-',0x00,'U',0x00,'S',0x00,'B',0x00,' ',0x00,'E',0x00,
-    'x',0x00,'a',0x00,'m',0x00,'p',0x00,'l',0x00,'e',0x00
+    'T',0x00,'N',0x00,'C',0x00,'1',0x00,'1',0x00,'0',0x00,
+    '1',0x00,' ',0x00,'C',0x00,'o',0x00,'n',0x00,'t',0x00,
+    'r',0x00,'o',0x00,'l',0x00,
+
+    // String index6, Interface String (data)
+    26,        // Length of this string descriptor
+    3,        // bDescriptorType
+    'T',0x00,'N',0x00,'C',0x00,'1',0x00,'1',0x00,'0',0x00,
+    '1',0x00,' ',0x00,'D',0x00,'a',0x00,'t',0x00,'a',0x00
 };
 
 /**** Populating the endpoint information handle here ****/
@@ -224,6 +327,18 @@ const struct tUsbHandle stUsbHandle[]=
         OEP2_Y_BUFFER_ADDRESS,
         IEP2_X_BUFFER_ADDRESS,
         IEP2_Y_BUFFER_ADDRESS
+    },
+    {
+        CDC1_INEP_ADDR, 
+        CDC1_OUTEP_ADDR,
+        3,
+        CDC_CLASS,
+        IEP3_X_BUFFER_ADDRESS,
+        IEP3_Y_BUFFER_ADDRESS,
+        OEP4_X_BUFFER_ADDRESS,
+        OEP4_Y_BUFFER_ADDRESS,
+        IEP4_X_BUFFER_ADDRESS,
+        IEP4_Y_BUFFER_ADDRESS
     }
 };
 //-------------DEVICE REQUEST LIST---------------------------------------------
@@ -259,6 +374,34 @@ const tDEVICE_REQUEST_COMPARE tUsbRequestList[] =
             0x00,0x00,                                 // No further data
             0xcf,&usbSetControlLineState,
     },
+    {
+        //---- CDC 1 Class Requests -----//
+            // GET LINE CODING
+            USB_REQ_TYPE_INPUT | USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+            USB_CDC_GET_LINE_CODING,
+            0x00,0x00,                                 // always zero
+            CDC1_COMM_INTERFACE,0x00,                 // CDC interface is 2
+            0x07,0x00,                                 // Size of Structure (data length)
+            0xff,&usbGetLineCoding,
+    },
+    {
+            // SET LINE CODING
+            USB_REQ_TYPE_OUTPUT | USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+            USB_CDC_SET_LINE_CODING,
+            0x00,0x00,                                 // always zero
+            CDC1_COMM_INTERFACE,0x00,                  // CDC interface is 2
+            0x07,0x00,                                 // Size of Structure (data length)
+            0xff,&usbSetLineCoding,
+    },
+    {
+            // SET CONTROL LINE STATE
+            USB_REQ_TYPE_OUTPUT | USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+            USB_CDC_SET_CONTROL_LINE_STATE,
+            0xff,0xff,                                 // Contains data
+            CDC1_COMM_INTERFACE,0x00,                 // CDC interface is 2
+            0x00,0x00,                                 // No further data
+            0xcf,&usbSetControlLineState,
+    },
 
     {
         //---- USB Standard Requests -----//
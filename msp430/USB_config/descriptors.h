@@ -74,8 +74,8 @@ extern "C"
  #define PHDC_ENDPOINTS_NUMBER               2  // bulk in, bulk out
 
 
-#define DESCRIPTOR_TOTAL_LENGTH            67            // wTotalLength, This is the sum of configuration descriptor length  + CDC descriptor length  + HID descriptor length
-#define USB_NUM_INTERFACES                  2    // Number of implemented interfaces.
+#define DESCRIPTOR_TOTAL_LENGTH            141           // wTotalLength, This is the sum of configuration descriptor length  + CDC descriptor length  + HID descriptor length
+#define USB_NUM_INTERFACES                  4    // Number of implemented interfaces.
 
 #define CDC0_COMM_INTERFACE                0              // Comm interface number of CDC0
 #define CDC0_DATA_INTERFACE                1              // Data interface number of CDC0
@@ -83,18 +83,25 @@ extern "C"
 #define CDC0_OUTEP_ADDR                    0x02           // Output Endpoint Address of CDC0
 #define CDC0_INEP_ADDR                     0x82           // Input Endpoint Address of CDC0
 
-#define CDC_NUM_INTERFACES                   1           //  Total Number of CDCs implemented. should set to 0 if there are no CDCs implemented.
+#define CDC1_COMM_INTERFACE                2              // Comm interface number of CDC1
+#define CDC1_DATA_INTERFACE                3              // Data interface number of CDC1
+#define CDC1_INTEP_ADDR                    0x83           // Interrupt Endpoint Address of CDC1
+#define CDC1_OUTEP_ADDR                    0x04           // Output Endpoint Address of CDC1
+#define CDC1_INEP_ADDR                     0x84           // Input Endpoint Address of CDC1
+
+#define CDC_NUM_INTERFACES                   2           //  Total Number of CDCs implemented. should set to 0 if there are no CDCs implemented.
 #define HID_NUM_INTERFACES                   0           //  Total Number of HIDs implemented. should set to 0 if there are no HIDs implemented.
 #define MSC_NUM_INTERFACES                   0           //  Total Number of MSCs implemented. should set to 0 if there are no MSCs implemented.
 #define PHDC_NUM_INTERFACES                  0           //  Total Number of PHDCs implemented. should set to 0 if there are no PHDCs implemented.
 // Interface numbers for the implemented CDSs and HIDs, This is to use in the Application(main.c) and in the interupt file(UsbIsr.c).
 #define CDC0_INTFNUM                0
+#define CDC1_INTFNUM                1
 #define MSC_MAX_LUN_NUMBER                   1           // Maximum number of LUNs supported
 
 #define PUTWORD(x)      ((x)&0xFF),((x)>>8)
 
-#define USB_OUTEP_INT_EN BIT0 | BIT2 
-#define USB_INEP_INT_EN BIT0 | BIT1 | BIT2 
+#define USB_OUTEP_INT_EN BIT0 | BIT2 | BIT4 
+#define USB_INEP_INT_EN BIT0 | BIT1 | BIT2 | BIT3 | BIT4 
 
 #define USB_USE_INTERNAL_3V3LDO TRUE
 
@@ -139,7 +146,7 @@ extern "C"
 // DESCRIPTOR CONSTANTS
 //***********************************************************************************************
 #define SIZEOF_DEVICE_DESCRIPTOR  0x12
-#define MAX_STRING_DESCRIPTOR_INDEX 5
+#define MAX_STRING_DESCRIPTOR_INDEX 6
 //#define SIZEOF_REPORT_DESCRIPTOR  36
 //#define USBHID_REPORT_LENGTH      64  // length of whole HID report (including Report ID)
 #define CONFIG_STRING_INDEX       4
@@ -169,6 +176,16 @@ struct abromConfigurationDescriptorGenric
 /************************************************CDC Descriptor**************************/
 struct abromConfigurationDescriptorCdc
 {
+// Interface Association Descriptor (8 bytes)
+    uint8_t blength_iad;                         // bLength: IAD size
+    uint8_t desc_type_iad;                       // bDescriptorType: interface association
+    uint8_t bfirstinterface_iad;                 // bFirstInterface: comm interface
+    uint8_t binterfacecount_iad;                 // bInterfaceCount: comm and data interfaces
+    uint8_t bfunctionclass_iad;                  // bFunctionClass: communication interface class
+    uint8_t bfunctionsubclass_iad;               // bFunctionSubClass: abstract control model
+    uint8_t bfunctionprotocol_iad;               // bFunctionProtocol: common at commands
+    uint8_t ifunction_iad;                       // iFunction
+
 // interface descriptor (9 bytes)
     uint8_t blength_intf;                          // blength: interface descriptor size
     uint8_t desc_type_interface;                  // bdescriptortype: interface
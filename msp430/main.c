@@ -59,24 +59,70 @@
 #include "hal.h"
 #include "util.h"
 #include "radio.h"
+#include "profile.h"
 #include "msp430_interface.h"
 #include "TI_CC_hardware_board.h"
 
 // Global flags set by events
-volatile uint8_t bCDCDataReceived_event = FALSE;  // Flag set by event handler to 
+volatile uint8_t bCDCDataReceived_event[CDC_NUM_INTERFACES] = {FALSE}; // Flags set by event handler to
                                                // indicate data has been 
                                                // received into USB buffer
+                                               // of each interface
 
-#define BUFFER_SIZE 262                // Command + USB size + size + data (size + block countdown + data + RSSI + LQI)
-                                       //       1 +        1 +    1         ------------------------- 256 +    1 +   1  + 1 
-uint8_t dataBuffer[BUFFER_SIZE];       // Current I/O buffer
+#define USB_CTRL_INTFNUM CDC0_INTFNUM  // Configuration and telemetry commands
+#define USB_DATA_INTFNUM CDC1_INTFNUM  // Blocks sent and received and their acks
+
+#define TIMER_IDEX (MCLK_MHZ/4 - 1)   // Timers count microseconds from SMCLK divided by 4 then by TIMER_IDEX + 1
+
+#define EVENT_GDO2      0x01           // FIFO threshold crossed
+#define EVENT_GDO0_SYNC 0x02           // Sync word sent or detected (GDO0 rising edge)
+#define EVENT_GDO0_END  0x04           // End of packet (GDO0 falling edge)
+#define EVENT_TX_TIMER  0x08           // Keyup or inter-block delay elapsed
+#define EVENT_HOP       0x10           // Low part of the hop time reached
+
+#define LATENCY_PROBE_US 4099          // Period of the interrupt latency probe. Drifts over the timer period.
+#define TRACE_RING_SIZE  128           // Events kept in the trace ring. Power of 2 up to 128.
+
+#define BUFFER_SIZE 270                // Command + USB size + size + data (size + block countdown + data + RSSI + LQI) + timestamps
+                                       //       1 +        1 +    1         ------------------------- 256 +    1 +   1  + 1 +          8
+uint8_t dataBuffer[BUFFER_SIZE];       // Current I/O buffer of the data interface
+uint8_t rxBuffer[BUFFER_SIZE];         // Reception buffer: a block can be received while the I/O buffer is in use
+uint8_t ctrlBuffer[BUFFER_SIZE];       // I/O buffer of the control interface: commands do not wait for the radio
 char    outString[65];                 // Holds outgoing strings to be sent
-static  uint8_t send_ack = 0;          // Set when an ack is to be sent
 static  uint8_t rtx_toggle = 0;        // 0: Rx - 1: Tx
-static  uint8_t dataIndex = 0;         // Current index in I/O buffer
-static  uint8_t *returnedDataBuffer;   // pointer to data buffer returned via USB
-
-uint8_t gdo0_r, gdo0_f, gdo2_r, gdo2_f;
+static  uint8_t * const usbBuffer[CDC_NUM_INTERFACES] = {ctrlBuffer, dataBuffer}; // I/O buffer of each interface
+static  uint8_t dataIndex[CDC_NUM_INTERFACES];   // Current index in the I/O buffer of each interface
+static  uint8_t *ackBlock[CDC_NUM_INTERFACES];   // Block to be sent back on each interface (0: none)
+
+static  uint32_t tx_keyup_delay = 0;   // Delay before the first block after reception in microseconds
+static  uint32_t tx_block_delay = 0;   // Minimum time between the end of a block and the next one in microseconds
+static  uint8_t  tx_keyup = 1;         // Set when the next block is the first after reception or initialization
+static  volatile uint8_t  tx_deferred = 0;      // Set when a block waits for the timer to start
+static  volatile uint8_t  tx_timer_running = 0; // Set while the transmission timer counts
+static  volatile uint32_t tx_timer_left = 0;    // Microseconds left after the current timer period
+static  volatile uint16_t timestamp_high = 0;   // Overflows of the timestamp timer
+static  volatile uint32_t timestamp_ticks = 0;  // Same as a 32 bit count (MSP430_TICK_US units)
+static  msp430_timestamps_t gdo0_timestamps;    // Timestamps of the last block sent or received
+static  msp430_turnaround_t rx_turnaround;      // Reception armed at the end of each transmission
+static  uint8_t  rx_armed = 0;         // Set while a reception is set up
+static  uint8_t  rx_requested = 0;     // Set when the host waits for the block being received
+static  uint8_t  rx_pending = 0;       // Set when a block received after a transmission waits for the host
+static  uint8_t  rx_block_size = 0;    // Block size of the reception set up or of the pending block
+static  uint32_t rx_armed_us = 0;      // Time the reception was last set up
+static  msp430_hop_t hop;              // Frequency hopping table and current slot
+static  uint32_t hop_next_us = 0;      // Time of the next hop
+static  uint8_t  hop_pending = 0;      // Set when a hop waits for the end of the block in flight
+static  uint8_t  tx_beacon = 0;        // Set when the block to send is stamped with the hop timing
+static  volatile uint8_t  events = 0;   // EVENT_xxx flags latched by the interrupts for the main loop
+static  volatile uint32_t event_us = 0; // Time the oldest pending event was latched
+static  volatile uint32_t gdo0_sync_us = 0; // Time of the last GDO0 rising edge
+static  volatile uint32_t gdo0_end_us = 0;  // Time of the last GDO0 falling edge
+static  msp430_latency_t latency;      // Interrupt latency statistics
+static  msp430_fifo_stats_t fifo_stats; // FIFO errors recovered
+static  msp430_trace_event_t trace_ring[TRACE_RING_SIZE]; // Last events for performance debugging
+static  uint8_t  trace_head = 0;       // Index of the next event written (modulo the ring size)
+static  uint8_t  trace_tail = 0;       // Index of the oldest event not read yet
+static  msp430_trace_t trace_stats;    // Trace counters
 
 // = Static functions declarations =================================================================
 
@@ -88,7 +134,30 @@ static void    set_red_led(uint8_t on);
 static void    set_green_led(uint8_t on);
 static void    toggle_red_led();
 static void    toggle_green_led();
-static uint8_t process_usb_block(uint16_t count, uint8_t *block);
+static void    init_tx_timer();
+static void    start_tx_timer(uint32_t delay_us);
+static void    next_tx_timer_period();
+static void    start_tx_block();
+static void    init_timestamp_timer();
+static uint32_t get_timestamp();
+static void    arm_rx(uint8_t block_size, uint8_t strobe);
+static void    disarm_rx();
+static uint8_t tx_in_progress();
+static void    restart_rx();
+static void    fifo_recovered();
+static void    set_hop(msp430_hop_t *hop_cmd);
+static void    hop_channel();
+static uint8_t process_usb_block(uint8_t intf_num, uint16_t count, uint8_t *block);
+static uint8_t process_usb_interface(uint8_t intf_num);
+static void    latch_event(uint8_t event, uint32_t timestamp);
+static void    trace(uint8_t event, uint8_t arg, uint32_t time_us);
+static void    get_trace(uint8_t *block);
+static void    process_events();
+static void    gdo2_event();
+static void    gdo0_sync_event();
+static void    gdo0_end_event();
+static void    rx_end_event();
+static void    hop_event();
 
 // = Static functions =============================================================================
 
@@ -116,169 +185,1107 @@ void init_left_button()
 }
 
 // ------------------------------------------------------------------------------------------------
-// Init GDOx lines
-void init_gdo()
+// Init GDOx lines
+void init_gdo()
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_GDO0_PxSEL &= ~TI_CC_GDO0_PIN; // Set GDO0 as GPIO
+    TI_CC_GDO2_PxSEL &= ~TI_CC_GDO2_PIN; // Set GDO2 as GPIO
+    TI_CC_GDO0_PxDIR &= ~TI_CC_GDO0_PIN; // Set GDO0 as input
+    TI_CC_GDO2_PxDIR &= ~TI_CC_GDO2_PIN; // Set GDO2 as input
+    TI_CC_GDO0_PxREN |=  TI_CC_GDO0_PIN; // Enable pull-up and pull-down
+    TI_CC_GDO0_PxOUT &= ~TI_CC_GDO0_PIN; // Pull-down
+    TI_CC_GDO2_PxREN |=  TI_CC_GDO2_PIN; // Enable pull-up and pull-down
+    TI_CC_GDO2_PxOUT &= ~TI_CC_GDO2_PIN; // Pull-down
+    TI_CC_GDO0_PxIE  &= ~TI_CC_GDO0_PIN; // Interrupt disabled
+    TI_CC_GDO2_PxIE  &= ~TI_CC_GDO2_PIN; // Interrupt disabled
+}
+
+// ------------------------------------------------------------------------------------------------
+// Init the CC1101 GDO0 (packet) interrupt
+void init_gdo0_int()
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_GDO0_PxIFG &= ~TI_CC_GDO0_PIN; // IFG cleared just in case
+    TI_CC_GDO0_PxIE  |=  TI_CC_GDO0_PIN; // Interrupt enabled
+    TI_CC_GDO0_PxIES &= ~TI_CC_GDO0_PIN; // Start with rising edge
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the red led on or off
+void set_red_led(uint8_t on)
+// ------------------------------------------------------------------------------------------------
+{
+    if (on)
+    {
+        TI_CC_RED_LED_PxOUT |= TI_CC_RED_LED;
+    }
+    else
+    {
+        TI_CC_RED_LED_PxOUT &= ~TI_CC_RED_LED;        
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the green led on or off
+void set_green_led(uint8_t on)
+// ------------------------------------------------------------------------------------------------
+{
+    if (on)
+    {
+        TI_CC_GREEN_LED_PxOUT |= TI_CC_GREEN_LED;
+    }
+    else
+    {
+        TI_CC_GREEN_LED_PxOUT &= ~TI_CC_GREEN_LED;        
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Toggle the red led
+void toggle_red_led()
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_RED_LED_PxOUT ^= TI_CC_RED_LED;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Toggle the red led
+void toggle_green_led()
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_GREEN_LED_PxOUT ^= TI_CC_GREEN_LED;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Init the transmission timer. Timer_A1 counts microseconds from SMCLK divided by MCLK_MHZ.
+// Timer_A0 is left to the USB API.
+void init_tx_timer()
+// ------------------------------------------------------------------------------------------------
+{
+    TA1EX0   = TIMER_IDEX;
+    TA1CTL   = TASSEL__SMCLK + ID__4 + MC__STOP + TACLR; // 20 MHz / 4 / 5 = 1 MHz
+    TA1CCTL0 = 0;
+    tx_timer_running = 0;
+    tx_deferred = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Load the next timer period of at most 65536 microseconds
+void next_tx_timer_period()
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t period = (tx_timer_left > 65536 ? 65536 : tx_timer_left);
+
+    TA1CCR0 = (uint16_t) (period - 1); // up mode counts CCR0 + 1 ticks
+    tx_timer_left -= period;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Start the transmission timer for the given time. A deferred block is started when it expires.
+void start_tx_timer(uint32_t delay_us)
+// ------------------------------------------------------------------------------------------------
+{
+    uint16_t gie = __get_SR_register() & GIE;
+
+    __disable_interrupt(); // the timer interrupt uses the same state
+    TA1CTL = TASSEL__SMCLK + ID__4 + MC__STOP + TACLR;
+
+    if (delay_us < 2) // not worth it
+    {
+        TA1CCTL0 = 0;
+        tx_timer_running = 0;
+        __bis_SR_register(gie);
+        return;
+    }
+
+    tx_timer_left = delay_us;
+    next_tx_timer_period();
+    tx_timer_running = 1;
+    TA1CCTL0 = CCIE;
+    TA1CTL = TASSEL__SMCLK + ID__4 + MC__UP + TACLR;
+    __bis_SR_register(gie);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Init the timestamp timer. Timer_A2 runs continuously at 1 MHz from SMCLK divided by MCLK_MHZ and its
+// overflows are counted to make 32 bit timestamps in microseconds. CCR2 probes the interrupt latency.
+void init_timestamp_timer()
+// ------------------------------------------------------------------------------------------------
+{
+    timestamp_high = 0;
+    memset(&latency, 0, sizeof(msp430_latency_t));
+    TA2EX0 = TIMER_IDEX;
+    TA2CTL = TASSEL__SMCLK + ID__4 + MC__CONTINUOUS + TACLR + TAIE;
+    TA2CCR2  = LATENCY_PROBE_US;
+    TA2CCTL2 = CCIE;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Current time in microseconds
+uint32_t get_timestamp()
+// ------------------------------------------------------------------------------------------------
+{
+    uint16_t gie = __get_SR_register() & GIE;
+    uint16_t low, high;
+
+    __disable_interrupt(); // overflow must not be serviced in between
+    low  = TA2R;
+    high = timestamp_high;
+
+    if ((TA2CTL & TAIFG) && (low < 0x8000)) // overflow not serviced yet
+    {
+        high++;
+    }
+
+    __bis_SR_register(gie);
+    return (((uint32_t) high) << 16) + low;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set up the reception of a block in the Rx buffer. Unless strobe is set the radio is going from
+// Tx to Rx by itself at the end of a transmission.
+void arm_rx(uint8_t block_size, uint8_t strobe)
+// ------------------------------------------------------------------------------------------------
+{
+    rtx_toggle = 0;
+    rx_block_size = block_size;
+    rxBuffer[2] = block_size;
+
+    if (strobe)
+    {
+        receive_setup(&rxBuffer[2]);
+    }
+    else
+    {
+        receive_rearm(&rxBuffer[2]);
+    }
+
+    init_gdo0_int();
+    TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
+    TI_CC_GDO2_PxIE  |=  TI_CC_GDO2_PIN; // Interrupt enabled
+    TI_CC_GDO2_PxIES &= ~TI_CC_GDO2_PIN; // Threshold on rising edge (lo->hi) - Rx FIFO filling
+
+    if (strobe)
+    {
+        check_calibration(timestamp_ticks); // redone from time to time as there is no automatic calibration
+        start_rx();
+    }
+
+    rx_armed = 1;
+    rx_armed_us = get_timestamp();
+    trace(MSP430_TRACE_RX_START, block_size, rx_armed_us);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Stop the reception set up if any and put the radio in IDLE. A block already received is kept.
+void disarm_rx()
+// ------------------------------------------------------------------------------------------------
+{
+    if (rx_armed)
+    {
+        TI_CC_GDO0_PxIE  &= ~TI_CC_GDO0_PIN; // Interrupt disabled
+        TI_CC_GDO2_PxIE  &= ~TI_CC_GDO2_PIN; // Interrupt disabled
+        TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
+        TI_CC_GDO0_PxIFG &= ~TI_CC_GDO0_PIN; // IFG cleared just in case
+        receive_cancel();
+        rx_armed = 0;
+        rx_requested = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// A block from the data interface is being sent or waits for the keyup, inter-block or hop timer
+uint8_t tx_in_progress()
+// ------------------------------------------------------------------------------------------------
+{
+    return tx_deferred || (rtx_toggle && (TI_CC_GDO0_PxIE & TI_CC_GDO0_PIN));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Receive again after a packet dropped by the filters. The block the host waits for if any is
+// still expected.
+void restart_rx()
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_GDO0_PxIE  &= ~TI_CC_GDO0_PIN; // Interrupt disabled
+    TI_CC_GDO2_PxIE  &= ~TI_CC_GDO2_PIN; // Interrupt disabled
+    TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
+    receive_cancel();
+    arm_rx(rx_block_size, 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Keep the longest time from the end of packet to the radio ready again after a FIFO error
+void fifo_recovered()
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t recovery_us = get_timestamp() - gdo0_end_us;
+
+    if (recovery_us > fifo_stats.recovery_max_us)
+    {
+        fifo_stats.recovery_max_us = (recovery_us > 0xFFFF ? 0xFFFF : recovery_us);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the frequency hopping table and timing from the host
+void set_hop(msp430_hop_t *hop_cmd)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t elapsed_us, nb_slots;
+
+    if (hop_cmd->mode & MSP430_HOP_QUERY)
+    {
+        memcpy(hop_cmd, &hop, sizeof(msp430_hop_t));
+        return;
+    }
+
+    disarm_rx();
+
+    if (hop_cmd->mode & MSP430_HOP_SET_TABLE)
+    {
+        hop.nb_channels = (hop_cmd->nb_channels > MSP430_HOP_MAX_CHANNELS ? MSP430_HOP_MAX_CHANNELS : hop_cmd->nb_channels);
+        hop.dwell_us    = hop_cmd->dwell_us;
+        hop.guard_us    = hop_cmd->guard_us;
+        hop.settle_us   = hop_cmd->settle_us;
+        memcpy(hop.channels, hop_cmd->channels, MSP430_HOP_MAX_CHANNELS);
+    }
+
+    if (hop_cmd->mode & MSP430_HOP_SET_TIME)
+    {
+        hop.slot          = hop_cmd->slot;
+        hop.slot_start_us = hop_cmd->slot_start_us;
+    }
+
+    if ((hop.nb_channels == 0) || (hop.dwell_us == 0))
+    {
+        hop.mode = 0;
+        TA2CCTL1 = 0;
+        memcpy(hop_cmd, &hop, sizeof(msp430_hop_t));
+        return;
+    }
+
+    hop.mode = hop_cmd->mode & MSP430_HOP_ENABLE;
+    elapsed_us = get_timestamp() - hop.slot_start_us;
+
+    if ((hop.mode & MSP430_HOP_ENABLE) && ((int32_t) elapsed_us >= 0)) // catch up with the slot in progress
+    {
+        nb_slots = elapsed_us / hop.dwell_us;
+        hop.slot += nb_slots;
+        hop.slot_start_us += nb_slots * hop.dwell_us;
+    }
+
+    hop_next_us = hop.slot_start_us + hop.dwell_us;
+    TA2CCR1  = (uint16_t) hop_next_us; // matches once per timer period: the high part is checked in the interrupt
+    TA2CCTL1 = ((hop.mode & MSP430_HOP_ENABLE) ? CCIE : 0);
+    hop_pending = 0;
+
+    set_channel(hop.channels[hop.slot % hop.nb_channels], timestamp_ticks);
+    memcpy(hop_cmd, &hop, sizeof(msp430_hop_t));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Go to the channel of the current slot. A block being sent or received is finished first. A
+// reception waiting for a sync word is moved to the new channel.
+void hop_channel()
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t channel = hop.channels[hop.slot % hop.nb_channels];
+    uint8_t requested;
+
+    if ((TI_CC_GDO0_PxIE & TI_CC_GDO0_PIN) && (rtx_toggle || (TI_CC_GDO0_PxIES & TI_CC_GDO0_PIN))) // block in flight
+    {
+        hop_pending = 1;
+        return;
+    }
+
+    hop_pending = 0;
+
+    if (rx_armed)
+    {
+        requested = rx_requested;
+        disarm_rx();
+        set_channel(channel, timestamp_ticks);
+        rx_requested = requested;
+        arm_rx(rx_block_size, 1);
+    }
+    else
+    {
+        set_channel(channel, timestamp_ticks);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Start the transmission of the block in the I/O buffer
+void start_tx_block()
+// ------------------------------------------------------------------------------------------------
+{
+    if (hop.mode & MSP430_HOP_ENABLE)
+    {
+        uint32_t left_us = hop_next_us - get_timestamp();
+
+        if (left_us < hop.guard_us) // the block would not fit before the next hop: start after it
+        {
+            tx_deferred = 1; // before the timer can expire
+            start_tx_timer(left_us + hop.settle_us);
+            return;
+        }
+    }
+
+    check_calibration(timestamp_ticks); // redone from time to time as there is no automatic calibration
+
+    if (tx_beacon && (dataBuffer[2] > sizeof(msp430_hop_stamp_t))) // stamp the hop timing at the end of the data
+    {
+        msp430_hop_stamp_t stamp;
+
+        stamp.slot = hop.slot;
+        stamp.elapsed_us = get_timestamp() - hop.slot_start_us;
+        memcpy(&dataBuffer[3 + dataBuffer[2] - sizeof(msp430_hop_stamp_t)], &stamp, sizeof(msp430_hop_stamp_t));
+    }
+
+    tx_beacon = 0;
+
+    if (transmit_setup(&dataBuffer[1])) // if bytes are left to be sent activate threshold interrupt 
+    {
+        TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
+        TI_CC_GDO2_PxIE  |=  TI_CC_GDO2_PIN; // Interrupt enabled
+        TI_CC_GDO2_PxIES |=  TI_CC_GDO2_PIN; // Threshold on falling edge (hi->lo) - Tx FIFO depletion
+    }
+    
+    init_gdo0_int();
+    set_red_led(0);
+
+    trace(MSP430_TRACE_TX_START, dataBuffer[1], get_timestamp());
+    start_tx();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Process an incoming USB block. The reply goes back on the interface the block came from.
+uint8_t process_usb_block(uint8_t intf_num, uint16_t count, uint8_t *pDataBuffer)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t byte_count = pDataBuffer[1];
+    uint8_t send_ack = 0;
+    uint8_t *returnedDataBuffer = pDataBuffer;
+    char str_byte[4];
+
+    if ((intf_num != USB_DATA_INTFNUM)
+        && ((pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TX) 
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_HOP_BEACON)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RX)))
+    {
+        // Blocks live in the data interface buffer and their acks come from the radio events
+        pDataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_ERROR;
+        pDataBuffer[1] = 0;
+        send_ack = 1;
+    }
+    else if (tx_in_progress()
+        && ((pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_INIT)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RX_CANCEL)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_MODEM)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_SELECT_PROFILE)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_REGISTERS)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_CALIBRATION)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_SWEEP)
+         || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_FILTER)))
+    {
+        // Commands that reconfigure or idle the radio would break the block being sent
+        pDataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_ERROR;
+        pDataBuffer[1] = 0;
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_ECHO_TEST)
+    {
+        strcpy(outString, "xxEcho Command - Byte count: ");
+        print_byte_decimal(byte_count, str_byte);
+        strcat(outString, str_byte);                        
+
+        // Count has the number of bytes received into dataBuffer
+        // Echo back to the host.
+        if (cdcSendDataInBackground((uint8_t *) outString, strlen(outString), intf_num, 1))
+        {
+            // Exit if something went wrong.
+            return 1;
+        }
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RADIO_STATUS)
+    {
+        get_radio_status(&pDataBuffer[2]);
+        pDataBuffer[1] = TI_CCxxx0_NUM_STATUS;
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_INIT)
+    {
+        msp430_init_status_t init_status;
+        uint32_t init_start_us = get_timestamp();
+
+        set_green_led(0);
+        set_red_led(0);
+        init_radio((msp430_radio_parms_t *) &pDataBuffer[2], &init_status);
+        init_calibration(init_status.flags & MSP430_INIT_REUSED, timestamp_ticks);
+        init_tx_timer();
+        tx_keyup = 1;
+        rx_turnaround.enable = 0; // init_radio sets TXOFF_MODE to IDLE
+        rx_armed = 0;
+        rx_requested = 0;
+        rx_pending = 0;
+        hop.mode = 0; // init_radio selects channel 0
+        hop_pending = 0;
+        tx_beacon = 0;
+        TA2CCTL1 = 0;
+        init_status.init_us = (uint16_t) (get_timestamp() - init_start_us);
+        memcpy(&pDataBuffer[2], &init_status, sizeof(msp430_init_status_t));
+        pDataBuffer[1] = sizeof(msp430_init_status_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_MODEM)
+    {
+        disarm_rx();
+        set_modem((msp430_modem_parms_t *) &pDataBuffer[2]);
+        pDataBuffer[1] = 0; // Just send back the command as an ACK
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_LOAD_PROFILE)
+    {
+        if (!load_reg_profile((msp430_reg_profile_t *) &pDataBuffer[2]))
+        {
+            pDataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_ERROR;
+        }
+
+        pDataBuffer[1] = 0; // Just send back the command as an ACK
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_SELECT_PROFILE)
+    {
+        msp430_reg_select_t *select = (msp430_reg_select_t *) &pDataBuffer[2];
+        uint32_t select_start_us = get_timestamp();
+
+        disarm_rx();
+        select_reg_profile(select, timestamp_ticks);
+        select->select_us = (uint16_t) (get_timestamp() - select_start_us);
+        pDataBuffer[1] = sizeof(msp430_reg_select_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TX_POWER)
+    {
+        set_tx_power(pDataBuffer[2]);
+        pDataBuffer[1] = 0; // Just send back the command as an ACK
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_AFC)
+    {
+        set_freq_offset((msp430_afc_t *) &pDataBuffer[2]);
+        pDataBuffer[1] = sizeof(msp430_afc_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_REGISTERS)
+    {
+        if (pDataBuffer[1] > 2*MSP430_REGISTERS_MAX_PAIRS)
+        {
+            pDataBuffer[1] = 2*MSP430_REGISTERS_MAX_PAIRS;
+        }
+
+        disarm_rx();
+        write_registers(&pDataBuffer[2], pDataBuffer[1]/2, timestamp_ticks);
+        pDataBuffer[1] &= 0xFE; // Send back the pairs with the values read back
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TX_TIMING)
+    {
+        tx_keyup_delay = ((msp430_tx_timing_t *) &pDataBuffer[2])->keyup_delay_us;
+        tx_block_delay = ((msp430_tx_timing_t *) &pDataBuffer[2])->block_delay_us;
+        pDataBuffer[1] = 0; // Just send back the command as an ACK
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TURNAROUND)
+    {
+        memcpy(&rx_turnaround, &pDataBuffer[2], sizeof(msp430_turnaround_t));
+        set_turnaround(rx_turnaround.enable);
+        pDataBuffer[1] = 0; // Just send back the command as an ACK
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_CALIBRATION)
+    {
+        disarm_rx();
+        set_calibration((msp430_calibration_t *) &pDataBuffer[2], timestamp_ticks);
+        pDataBuffer[1] = sizeof(msp430_calibration_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_HOP)
+    {
+        set_hop((msp430_hop_t *) &pDataBuffer[2]);
+        pDataBuffer[1] = sizeof(msp430_hop_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_SWEEP)
+    {
+        msp430_sweep_t sweep;
+
+        memcpy(&sweep, &pDataBuffer[2], sizeof(msp430_sweep_t));
+
+        if (sweep.nb_steps > MSP430_SWEEP_MAX_STEPS)
+        {
+            sweep.nb_steps = MSP430_SWEEP_MAX_STEPS;
+        }
+
+        if (sweep.first_channel + sweep.nb_steps > 256)
+        {
+            sweep.nb_steps = 256 - sweep.first_channel;
+        }
+
+        if (sweep.settle_us > MSP430_SWEEP_MAX_US)
+        {
+            sweep.settle_us = MSP430_SWEEP_MAX_US;
+        }
+
+        if (sweep.settle_us + sweep.dwell_us > MSP430_SWEEP_MAX_US)
+        {
+            sweep.dwell_us = MSP430_SWEEP_MAX_US - sweep.settle_us;
+        }
+
+        disarm_rx();
+        sweep_rssi(&sweep, &pDataBuffer[2], timestamp_ticks);
+        pDataBuffer[1] = sweep.nb_steps;
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TIME)
+    {
+        uint32_t timestamp = get_timestamp();
+
+        memcpy(&pDataBuffer[2], &timestamp, sizeof(uint32_t));
+        pDataBuffer[1] = sizeof(uint32_t);
+        send_ack = 1;
+    }
+    else if ((pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TX) || (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_HOP_BEACON))
+    {
+        disarm_rx(); // reception armed after the previous block
+        rtx_toggle = 1;
+        tx_beacon = (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_HOP_BEACON);
+
+        if (tx_keyup) // first block after reception: keyup delay from now
+        {
+            tx_keyup = 0;
+            start_tx_timer(tx_keyup_delay);
+        }
+
+        __disable_interrupt(); // the timer must not expire between the test and the deferral
+        tx_deferred = tx_timer_running; // keyup or inter-block delay not elapsed: the timer starts the block
+        __enable_interrupt();
+
+        if (!tx_deferred)
+        {
+            start_tx_block();
+        }
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RX)
+    {
+        tx_keyup = 1;
+        set_green_led(0);
+
+        if (rx_pending && (pDataBuffer[2] == rx_block_size)) // block received since the end of transmission
+        {
+            rx_pending = 0;
+            returnedDataBuffer = &rxBuffer[1];
+            send_ack = 1;
+        }
+        else if (rx_armed && (pDataBuffer[2] == rx_block_size)) // receiving since the end of transmission
+        {
+            rx_requested = 1;
+        }
+        else
+        {
+            disarm_rx();
+            rx_pending = 0;
+            rx_requested = 1;
+            arm_rx(pDataBuffer[2], 1);
+        }
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RX_CANCEL)
+    {
+        TI_CC_GDO0_PxIE  &= ~TI_CC_GDO0_PIN; // Interrupt disabled
+        TI_CC_GDO2_PxIE  &= ~TI_CC_GDO2_PIN; // Interrupt disabled
+        TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
+        TI_CC_GDO0_PxIFG &= ~TI_CC_GDO0_PIN; // IFG cleared just in case
+
+        receive_cancel();
+        tx_deferred = 0;
+        tx_keyup = 1;
+        rx_armed = 0;
+        rx_requested = 0;
+        rx_pending = 0;
+
+        pDataBuffer[1] = 0; // Just send back the command as an ACK
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_LATENCY)
+    {
+        uint8_t flags = pDataBuffer[2];
+
+        __disable_interrupt(); // the probe updates the statistics
+        memcpy(&pDataBuffer[2], &latency, sizeof(msp430_latency_t));
+
+        if (flags & MSP430_LATENCY_RESET)
+        {
+            memset(&latency, 0, sizeof(msp430_latency_t));
+        }
+
+        __enable_interrupt();
+        pDataBuffer[2] = flags;
+        pDataBuffer[1] = sizeof(msp430_latency_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_FIFO_STATS)
+    {
+        uint8_t flags = pDataBuffer[2];
+
+        memcpy(&pDataBuffer[2], &fifo_stats, sizeof(msp430_fifo_stats_t));
+
+        if (flags & MSP430_FIFO_STATS_RESET)
+        {
+            memset(&fifo_stats, 0, sizeof(msp430_fifo_stats_t));
+        }
+
+        pDataBuffer[2] = flags;
+        pDataBuffer[1] = sizeof(msp430_fifo_stats_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TRACE)
+    {
+        get_trace(pDataBuffer);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_PROFILE)
+    {
+        get_profile((msp430_profile_t *) &pDataBuffer[2], pDataBuffer[2]);
+        pDataBuffer[1] = sizeof(msp430_profile_t);
+        send_ack = 1;
+    }
+    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_FILTER)
+    {
+        if (!(pDataBuffer[2] & MSP430_FILTER_QUERY))
+        {
+            disarm_rx();
+        }
+
+        set_filter((msp430_filter_t *) &pDataBuffer[2]);
+        pDataBuffer[1] = sizeof(msp430_filter_t);
+        send_ack = 1;
+    }
+
+    if (send_ack)
+    {
+        ackBlock[intf_num] = returnedDataBuffer;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Receive the blocks of one USB interface and send back its pending ack
+uint8_t process_usb_interface(uint8_t intf_num)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  retVal = 0;
+    uint8_t  *pDataBuffer = usbBuffer[intf_num];
+    uint8_t  *returnedDataBuffer;
+    uint16_t count;
+    uint32_t start_us, elapsed_us;
+
+    // Exit LPM because of a data-receive event, and
+    // fetch the received data
+    if (bCDCDataReceived_event[intf_num])
+    {
+        // Clear flag early -- just in case execution breaks
+        // below because of an error
+        bCDCDataReceived_event[intf_num] = FALSE;
+
+        count = cdcReceiveDataInBuffer((uint8_t*) &pDataBuffer[dataIndex[intf_num]], BUFFER_SIZE, intf_num);
+
+        if (count >= 2)
+        {
+            if (dataIndex[intf_num] + count < pDataBuffer[1] + 2)
+            {
+                dataIndex[intf_num] += count;
+            }
+            else
+            {
+                start_us = get_timestamp();
+                trace(MSP430_TRACE_COMMAND, pDataBuffer[0], start_us);
+                retVal = process_usb_block(intf_num, count, pDataBuffer);
+                elapsed_us = get_timestamp() - start_us;
+                latency.work_max_us = (elapsed_us > latency.work_max_us ? elapsed_us : latency.work_max_us);
+                dataIndex[intf_num] = 0;
+
+                if (retVal)
+                {
+                    return retVal;
+                }
+            }
+        }
+    }
+
+    if (ackBlock[intf_num])
+    {
+        returnedDataBuffer = ackBlock[intf_num];
+
+        retVal = cdcSendDataInBackground((uint8_t *) returnedDataBuffer, returnedDataBuffer[1] + 2, intf_num, 1);
+        trace(MSP430_TRACE_USB_SENT, returnedDataBuffer[0], get_timestamp());
+        ackBlock[intf_num] = 0;
+    }
+
+    return retVal;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Record an event in the trace ring. The oldest event is overwritten when it is full. Only called
+// from the main loop with a time already taken.
+void trace(uint8_t event, uint8_t arg, uint32_t time_us)
 // ------------------------------------------------------------------------------------------------
 {
-    TI_CC_GDO0_PxSEL &= ~TI_CC_GDO0_PIN; // Set GDO0 as GPIO
-    TI_CC_GDO2_PxSEL &= ~TI_CC_GDO2_PIN; // Set GDO2 as GPIO
-    TI_CC_GDO0_PxDIR &= ~TI_CC_GDO0_PIN; // Set GDO0 as input
-    TI_CC_GDO2_PxDIR &= ~TI_CC_GDO2_PIN; // Set GDO2 as input
-    TI_CC_GDO0_PxREN |=  TI_CC_GDO0_PIN; // Enable pull-up and pull-down
-    TI_CC_GDO0_PxOUT &= ~TI_CC_GDO0_PIN; // Pull-down
-    TI_CC_GDO2_PxREN |=  TI_CC_GDO2_PIN; // Enable pull-up and pull-down
-    TI_CC_GDO2_PxOUT &= ~TI_CC_GDO2_PIN; // Pull-down
-    TI_CC_GDO0_PxIE  &= ~TI_CC_GDO0_PIN; // Interrupt disabled
-    TI_CC_GDO2_PxIE  &= ~TI_CC_GDO2_PIN; // Interrupt disabled
+    msp430_trace_event_t *entry = &trace_ring[trace_head & (TRACE_RING_SIZE-1)];
+
+    entry->time_us = time_us;
+    entry->event = event;
+    entry->arg = arg;
+    trace_head++;
+
+    if ((uint8_t) (trace_head - trace_tail) > TRACE_RING_SIZE)
+    {
+        trace_tail++;
+        trace_stats.nb_lost++;
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
-// Init the CC1101 GDO0 (packet) interrupt
-void init_gdo0_int()
+// Move the oldest events of the trace ring after the counters in the block to return to the host
+void get_trace(uint8_t *block)
 // ------------------------------------------------------------------------------------------------
 {
-    TI_CC_GDO0_PxIFG &= ~TI_CC_GDO0_PIN; // IFG cleared just in case
-    TI_CC_GDO0_PxIE  |=  TI_CC_GDO0_PIN; // Interrupt enabled
-    TI_CC_GDO0_PxIES &= ~TI_CC_GDO0_PIN; // Start with rising edge
+    msp430_trace_event_t *events = (msp430_trace_event_t *) &block[2 + sizeof(msp430_trace_t)];
+    uint8_t flags = block[2];
+    uint8_t nb_events = trace_head - trace_tail;
+    uint8_t i;
+
+    if (nb_events > MSP430_TRACE_MAX_EVENTS)
+    {
+        nb_events = MSP430_TRACE_MAX_EVENTS;
+    }
+
+    for (i=0; i < nb_events; i++, trace_tail++)
+    {
+        memcpy(&events[i], &trace_ring[trace_tail & (TRACE_RING_SIZE-1)], sizeof(msp430_trace_event_t));
+    }
+
+    trace_stats.flags = flags;
+    trace_stats.nb_events = nb_events;
+    trace_stats.nb_left = trace_head - trace_tail;
+    trace_stats.nb_rx_overflows = fifo_stats.nb_rx_overflows;
+    trace_stats.nb_tx_underflows = fifo_stats.nb_tx_underflows;
+    memcpy(&block[2], &trace_stats, sizeof(msp430_trace_t));
+
+    if (flags & MSP430_TRACE_RESET)
+    {
+        memset(&trace_stats, 0, sizeof(msp430_trace_t));
+    }
+
+    block[1] = sizeof(msp430_trace_t) + nb_events * sizeof(msp430_trace_event_t);
 }
 
 // ------------------------------------------------------------------------------------------------
-// Set the red led on or off
-void set_red_led(uint8_t on)
+// Latch events for the main loop. The time of the oldest pending event is kept.
+void latch_event(uint8_t event, uint32_t timestamp)
 // ------------------------------------------------------------------------------------------------
 {
-    if (on)
-    {
-        TI_CC_RED_LED_PxOUT |= TI_CC_RED_LED;
-    }
-    else
+    uint16_t gie = __get_SR_register() & GIE;
+
+    __disable_interrupt();
+
+    if (!events)
     {
-        TI_CC_RED_LED_PxOUT &= ~TI_CC_RED_LED;        
+        event_us = timestamp;
     }
+
+    events |= event;
+    __bis_SR_register(gie);
 }
 
 // ------------------------------------------------------------------------------------------------
-// Set the green led on or off
-void set_green_led(uint8_t on)
+// Handle the events latched by the interrupts since the last call. Interrupts are only disabled
+// to take the events. They are handled in the order of the P1IV priorities.
+void process_events()
 // ------------------------------------------------------------------------------------------------
 {
-    if (on)
+    uint8_t  pending;
+    uint32_t latched_us, start_us, elapsed_us;
+
+    __disable_interrupt();
+    pending = events;
+    latched_us = event_us;
+    events = 0;
+    __enable_interrupt();
+
+    if (!pending)
     {
-        TI_CC_GREEN_LED_PxOUT |= TI_CC_GREEN_LED;
+        return;
     }
-    else
+
+    start_us = get_timestamp();
+    elapsed_us = start_us - latched_us;
+    latency.event_max_us = (elapsed_us > latency.event_max_us ? elapsed_us : latency.event_max_us);
+
+    if (pending & EVENT_GDO2)
     {
-        TI_CC_GREEN_LED_PxOUT &= ~TI_CC_GREEN_LED;        
+        gdo2_event();
+    }
+
+    if (pending & EVENT_GDO0_SYNC)
+    {
+        gdo0_sync_event();
+    }
+
+    if (pending & EVENT_GDO0_END)
+    {
+        gdo0_end_event();
+    }
+
+    if ((pending & EVENT_TX_TIMER) && tx_deferred) // not cancelled since
+    {
+        tx_deferred = 0;
+        start_tx_block();
     }
+
+    if (pending & EVENT_HOP)
+    {
+        hop_event();
+    }
+
+    elapsed_us = get_timestamp() - start_us;
+    latency.work_max_us = (elapsed_us > latency.work_max_us ? elapsed_us : latency.work_max_us);
 }
 
 // ------------------------------------------------------------------------------------------------
-// Toggle the red led
-void toggle_red_led()
+// FIFO threshold crossed: refill the Tx FIFO or unload the Rx FIFO. The threshold signal is checked
+// again as there is no new edge if it is still crossed after the transfer.
+void gdo2_event()
 // ------------------------------------------------------------------------------------------------
 {
-    TI_CC_RED_LED_PxOUT ^= TI_CC_RED_LED;
+    if (!(TI_CC_GDO2_PxIE & TI_CC_GDO2_PIN)) // block ended or cancelled since
+    {
+        return;
+    }
+
+    trace(MSP430_TRACE_FIFO_THR, 0, get_timestamp());
+
+    if (rtx_toggle) // Tx-ing
+    {
+        if (!transmit_more()) // if no more bytes are left to be sent de-activate threshold interrupt
+        {
+            TI_CC_GDO2_PxIE &= ~TI_CC_GDO2_PIN;   // Interrupt disabled
+        }
+        else if (!(TI_CC_GDO2_PxIN & TI_CC_GDO2_PIN)) // still below threshold
+        {
+            latch_event(EVENT_GDO2, get_timestamp());
+        }
+    }
+    else // Rx-ing
+    {
+        receive_more();
+
+        if (TI_CC_GDO2_PxIN & TI_CC_GDO2_PIN) // still above threshold
+        {
+            latch_event(EVENT_GDO2, get_timestamp());
+        }
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
-// Toggle the red led
-void toggle_green_led()
+// GDO0 rising edge: sync word sent or detected
+void gdo0_sync_event()
 // ------------------------------------------------------------------------------------------------
 {
-    TI_CC_GREEN_LED_PxOUT ^= TI_CC_GREEN_LED;
+    if (!(TI_CC_GDO0_PxIE & TI_CC_GDO0_PIN)) // cancelled since
+    {
+        return;
+    }
+
+    if (rtx_toggle) // Tx-ing
+    {
+        toggle_red_led();
+    }
+    else // Rx-ing
+    {
+        toggle_green_led();
+    }
+
+    gdo0_timestamps.sync_us = gdo0_sync_us;
+    trace(MSP430_TRACE_SYNC, 0, gdo0_sync_us);
 }
 
 // ------------------------------------------------------------------------------------------------
-// Process an incoming USB block
-uint8_t process_usb_block(uint16_t count, uint8_t *pDataBuffer)
+// GDO0 falling edge: end of packet sent or received
+void gdo0_end_event()
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t byte_count = pDataBuffer[1];
-    char str_byte[4];
+    uint8_t status;
 
-    __disable_interrupt();
+    if (!(TI_CC_GDO0_PxIE & TI_CC_GDO0_PIN)) // cancelled since
+    {
+        return;
+    }
 
-    returnedDataBuffer = pDataBuffer;
+    gdo0_timestamps.end_us = gdo0_end_us;
 
-    if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_ECHO_TEST)
+    if (rtx_toggle) // Tx-ing
     {
-        strcpy(outString, "xxEcho Command - Byte count: ");
-        print_byte_decimal(byte_count, str_byte);
-        strcat(outString, str_byte);                        
+        toggle_red_led();
+        status = transmit_end();
+        trace(MSP430_TRACE_TX_END, status, gdo0_end_us);
 
-        // Count has the number of bytes received into dataBuffer
-        // Echo back to the host.
-        if (cdcSendDataInBackground((uint8_t *) outString, strlen(outString), CDC0_INTFNUM, 1))
+        if (status == 0) 
         {
-            // Exit if something went wrong.
-            return 1;
+            dataBuffer[0]  = (uint8_t) MSP430_BLOCK_TYPE_TX;   
+            trace_stats.nb_tx++;
+        }
+        else // TX FIFO UNDERFLOW or not empty => flushed and the host is told the block failed
+        {
+            dataBuffer[0]  = (uint8_t) MSP430_BLOCK_TYPE_TX_KO;
+            TI_CC_SPIStrobe(TI_CCxxx0_SIDLE); // in case it went on with bytes left. Ignored on underflow.
+            flush_tx_fifo();
+            fifo_stats.nb_tx_underflows++;
+        }
+
+        if (rx_turnaround.enable && !rx_pending) // radio goes to Rx by itself unless it was left IDLE by the flush
+        {
+            arm_rx(rx_turnaround.rx_block_size, (status != 0));
+        }
+        else
+        {
+            rx_armed_us = 0;
+
+            if (rx_turnaround.enable) // nowhere to receive a block: back to IDLE
+            {
+                TI_CC_SPIStrobe(TI_CCxxx0_SIDLE);
+            }
+        }
+
+        dataBuffer[1]  = MSP430_TX_ACK_SIZE;
+        dataBuffer[MSP430_TX_ACK_STATUS] = status;
+        memcpy(&dataBuffer[MSP430_TX_ACK_TIMESTAMPS], &gdo0_timestamps, sizeof(msp430_timestamps_t));
+        memcpy(&dataBuffer[MSP430_TX_ACK_RX_ARMED], &rx_armed_us, sizeof(uint32_t));
+        ackBlock[USB_DATA_INTFNUM] = dataBuffer;
+
+        if (!rx_armed)
+        {
+            TI_CC_GDO0_PxIE &= ~TI_CC_GDO0_PIN; // Interrupt disabled
+        }
+
+        start_tx_timer(tx_block_delay);       // spacing to the next block starts now
+
+        if (status != 0)
+        {
+            fifo_recovered();
         }
     }
-    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RADIO_STATUS)
+    else // Rx-ing
     {
-        get_radio_status(&pDataBuffer[2]);
-        pDataBuffer[1] = TI_CCxxx0_NUM_STATUS;
-        send_ack = 1;
+        rx_end_event();
     }
-    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_INIT)
+
+    if (hop_pending) // slot ended during the block
     {
-        set_green_led(0);
-        set_red_led(0);
-        reset_radio();
-        DELAY_US(5000);  // ~5ms delay 
-        init_radio((msp430_radio_parms_t *) &pDataBuffer[2]);
-        send_ack = 1;
+        hop_channel();
     }
-    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_TX)
+}
+
+// ------------------------------------------------------------------------------------------------
+// End of packet received. Packets dropped by the filters and Rx FIFO overflows do not go to the
+// host: the radio is set to receive again at once.
+void rx_end_event()
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t status;
+
+    if (!receive_complete()) // discarded by the radio address check
     {
-        rtx_toggle = 1;
-        
-        if (transmit_setup(&pDataBuffer[1])) // if bytes are left to be sent activate threshold interrupt 
-        {
-            TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
-            TI_CC_GDO2_PxIE  |=  TI_CC_GDO2_PIN; // Interrupt enabled
-            TI_CC_GDO2_PxIES |=  TI_CC_GDO2_PIN; // Threshold on falling edge (hi->lo) - Tx FIFO depletion
-        }
-        
-        init_gdo0_int();
-        set_red_led(0);
+        trace(MSP430_TRACE_RX_DROP, MSP430_TRACE_DROP_ADDRESS, gdo0_end_us);
+        restart_rx();
+        return;
+    }
+
+    toggle_green_led();
+    status = receive_end();
 
-        start_tx();
+    if (status != 0) // RX FIFO OVERFLOW => flushed and received again without the host
+    {
+        fifo_stats.nb_rx_overflows++;
+        trace(MSP430_TRACE_RX_DROP, MSP430_TRACE_DROP_OVERFLOW, gdo0_end_us);
+        restart_rx();
+        fifo_recovered();
+        return;
     }
-    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RX)
+
+    if (!receive_accept()) // not for us: never goes to USB
     {
-        rtx_toggle = 0;
-        set_green_led(0);
-        receive_setup(&pDataBuffer[2]);
-        init_gdo0_int();
-        TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
-        TI_CC_GDO2_PxIE  |=  TI_CC_GDO2_PIN; // Interrupt enabled
-        TI_CC_GDO2_PxIES &= ~TI_CC_GDO2_PIN; // Threshold on rising edge (lo->hi) - Rx FIFO filling
+        trace(MSP430_TRACE_RX_DROP, MSP430_TRACE_DROP_PAYLOAD, gdo0_end_us);
+        restart_rx();
+        return;
+    }
 
-        start_rx();
+    // frequency offset tracking on packets with good CRC (bit 7 of LQI byte)
+    freq_compensate(rxBuffer[rxBuffer[2] + 4] & 0x80);
+    trace(MSP430_TRACE_RX_END, rxBuffer[rxBuffer[2] + 4], gdo0_end_us);
+
+    if (rxBuffer[rxBuffer[2] + 4] & 0x80)
+    {
+        trace_stats.nb_rx++;
     }
-    else if (pDataBuffer[0] == (uint8_t) MSP430_BLOCK_TYPE_RX_CANCEL)
+    else
     {
-        TI_CC_GDO0_PxIE  &= ~TI_CC_GDO0_PIN; // Interrupt disabled
-        TI_CC_GDO2_PxIE  &= ~TI_CC_GDO2_PIN; // Interrupt disabled
-        TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // IFG cleared just in case
-        TI_CC_GDO0_PxIFG &= ~TI_CC_GDO0_PIN; // IFG cleared just in case
+        trace_stats.nb_crc_errors++;
+    }
 
-        receive_cancel();
+    // rxBuffer[1] is free (size of USB block to start Rx)
+    // so bump returned USB header by 1 byte
+    rxBuffer[1] = (uint8_t) MSP430_BLOCK_TYPE_RX;
+    rxBuffer[2] += 2; // + RSSI + LQI
+    memcpy(&rxBuffer[3 + rxBuffer[2]], &gdo0_timestamps, sizeof(msp430_timestamps_t));
+    rxBuffer[2] += sizeof(msp430_timestamps_t); // + timestamps
 
-        pDataBuffer[1] = 0; // Just send back the command as an ACK
-        send_ack = 1;
+    if (rx_requested)
+    {
+        ackBlock[USB_DATA_INTFNUM] = &rxBuffer[1];
+    }
+    else // received after a transmission: kept until the host asks for it
+    {
+        rx_pending = 1;
     }
 
-    __enable_interrupt();  // Enable interrupts globally
+    rx_requested = 0;
+    rx_armed = 0;
+    TI_CC_GDO0_PxIE &= ~TI_CC_GDO0_PIN;   // Interrupt disabled
+    TI_CC_GDO2_PxIE &= ~TI_CC_GDO2_PIN;   // Interrupt disabled
+}
 
-    return 0;
+// ------------------------------------------------------------------------------------------------
+// Hop time low part reached: go to the next slot if the high part matches too
+void hop_event()
+// ------------------------------------------------------------------------------------------------
+{
+    if ((hop.mode & MSP430_HOP_ENABLE) && ((int32_t) (get_timestamp() - hop_next_us) >= 0))
+    {
+        hop.slot++;
+        hop.slot_start_us = hop_next_us;
+        hop_next_us += hop.dwell_us;
+        TA2CCR1 = (uint16_t) hop_next_us;
+        hop_channel();
+    }
 }
 
 // = Interrupt handlers ===========================================================================
 
 // ------------------------------------------------------------------------------------------------
-// Port 1 interrupt service routine
+// Port 1 interrupt service routine. The radio events are latched for the main loop.
 // GDO2        on P1.4
 // GDO0        on P1.5
 #if defined(__TI_COMPILER_VERSION__) || (__IAR_SYSTEMS_ICC__)
@@ -291,7 +1298,8 @@ void __attribute__ ((interrupt(PORT1_VECTOR))) PORT1_ISR (void)
 #endif
 // ------------------------------------------------------------------------------------------------
 {
-    __disable_interrupt();
+    PROFILE_START(profile_start);
+    uint32_t timestamp = get_timestamp(); // first thing for GDO0 edges
 
     switch (__even_in_range(P1IV,16))
     {
@@ -306,113 +1314,20 @@ void __attribute__ ((interrupt(PORT1_VECTOR))) PORT1_ISR (void)
         case 8:  // P1.3
             break;
         case 10: // P1.4 : FIFO threshold interrupt
-            if (rtx_toggle) // Tx-ing
-            {
-                gdo2_f++;
-                
-                if (!transmit_more()) // if no more bytes are left to be sent de-activate threshold interrupt
-                {
-                    TI_CC_GDO2_PxIE &= ~TI_CC_GDO2_PIN;   // Interrupt disabled
-                }
-            }
-            else // Rx-ing
-            {
-                gdo2_r++;
-                receive_more();
-            }
-
+            latch_event(EVENT_GDO2, timestamp);
             TI_CC_GDO2_PxIFG &= ~TI_CC_GDO2_PIN; // Clear IFG
             break;
         case 12:  // P1.5 : Packet interrupt
-            if (rtx_toggle) // Tx-ing
+            if ((TI_CC_GDO0_PxIES & TI_CC_GDO0_PIN) == 0) // rising edge 
             {
-                toggle_red_led();
-
-                if ((TI_CC_GDO0_PxIES & TI_CC_GDO0_PIN) == 0) // rising edge 
-                {
-                    gdo0_r++;
-                    TI_CC_GDO0_PxIES |= TI_CC_GDO0_PIN;  // Enable falling edge (hi->lo)
-                }
-                else // falling edge = end of packet
-                {
-                    uint8_t status;
-
-                    gdo0_f++;
-                    status = transmit_end();
-
-                    if (status == 0) 
-                    {
-                        dataBuffer[0]  = (uint8_t) MSP430_BLOCK_TYPE_TX;   
-                    }
-                    else // TX FIFO UNDERFLOW or not empty => problem 
-                    {
-                        dataBuffer[0]  = (uint8_t) MSP430_BLOCK_TYPE_TX_KO;
-                        flush_tx_fifo();
-                    }
-
-                    dataBuffer[1]  = 9;
-                    dataBuffer[2]  = status;
-                    dataBuffer[3]  = gdo0_r;
-                    dataBuffer[4]  = gdo0_f;
-                    dataBuffer[5]  = gdo2_r;
-                    dataBuffer[6]  = gdo2_f;
-                    dataBuffer[7]  = TI_CC_GDO0_PxIN;
-                    dataBuffer[8]  = TI_CC_GDO0_PxIFG;
-                    dataBuffer[9]  = TI_CC_GDO0_PxIE;
-                    dataBuffer[10] = TI_CC_GDO0_PxIES;
-                    returnedDataBuffer = dataBuffer;
-                    send_ack = 1;
-                    TI_CC_GDO0_PxIE &= ~TI_CC_GDO0_PIN;   // Interrupt disabled
-                }
+                gdo0_sync_us = timestamp;
+                TI_CC_GDO0_PxIES |= TI_CC_GDO0_PIN;  // Enable falling edge (hi->lo)
+                latch_event(EVENT_GDO0_SYNC, timestamp);
             }
-            else // Rx-ing
+            else // falling edge = end of packet
             {
-                toggle_green_led();
-
-                if ((TI_CC_GDO0_PxIES & TI_CC_GDO0_PIN) == 0) // rising edge 
-                //if ((TI_CC_GDO0_PxIN & TI_CC_GDO0_PIN) != 0) // rising edge = start of packet
-                {
-                    gdo0_r++;
-                    TI_CC_GDO0_PxIES |= TI_CC_GDO0_PIN;  // Enable falling edge (hi->lo)
-                }
-                else // falling edge = end of packet
-                {
-                    uint8_t status;
-
-                    gdo0_f++;
-                    status = receive_end();
-
-                    if (status == 0) 
-                    {
-                        // dataBuffer[1] has 0x01 (size of USB block to start Rx)
-                        // so bump returned USB header by 1 byte
-                        dataBuffer[1] = (uint8_t) MSP430_BLOCK_TYPE_RX;
-                        dataBuffer[2] += 2; // + RSSI + LQI
-                        returnedDataBuffer = &dataBuffer[1];
-                        // frequency compensation
-                        //freq_compensate();
-                    }
-                    else // RX FIFO OVERFLOW or not empty => problem
-                    {
-                        dataBuffer[0]  = (uint8_t) MSP430_BLOCK_TYPE_RX_KO;
-                        dataBuffer[1]  = 9;
-                        dataBuffer[2]  = status;
-                        dataBuffer[3]  = gdo0_r;
-                        dataBuffer[4]  = gdo0_f;
-                        dataBuffer[5]  = gdo2_r;
-                        dataBuffer[6]  = gdo2_f;
-                        dataBuffer[7]  = TI_CC_GDO0_PxIN;
-                        dataBuffer[8]  = TI_CC_GDO0_PxIFG;
-                        dataBuffer[9]  = TI_CC_GDO0_PxIE;
-                        dataBuffer[10] = TI_CC_GDO0_PxIES;
-                        flush_rx_fifo();
-                        returnedDataBuffer = dataBuffer;
-                    }
-
-                    send_ack = 1;
-                    TI_CC_GDO0_PxIE &= ~TI_CC_GDO0_PIN;   // Interrupt disabled
-                    TI_CC_GDO2_PxIE &= ~TI_CC_GDO2_PIN;   // Interrupt disabled
-                }
+                gdo0_end_us = timestamp;
+                latch_event(EVENT_GDO0_END, timestamp);
             }
 
             TI_CC_GDO0_PxIFG &= ~TI_CC_GDO0_PIN; // Clear IFG
@@ -423,7 +1338,78 @@ void __attribute__ ((interrupt(PORT1_VECTOR))) PORT1_ISR (void)
             break;
     }
 
-    __enable_interrupt();  // Enable interrupts globally
+    if (events)
+    {
+        __bic_SR_register_on_exit(LPM0_bits); // Wake the main loop
+    }
+
+    PROFILE_END(MSP430_PROFILE_PORT1_ISR, profile_start);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Timer_A1 CCR0 interrupt service routine: end of a transmission timer period
+#if defined(__TI_COMPILER_VERSION__) || (__IAR_SYSTEMS_ICC__)
+#pragma vector = TIMER1_A0_VECTOR
+__interrupt void TIMER1_A0_ISR (void)
+#elif defined(__GNUC__) && (__MSP430__)
+void __attribute__ ((interrupt(TIMER1_A0_VECTOR))) TIMER1_A0_ISR (void)
+#else
+#error Compiler not found!
+#endif
+// ------------------------------------------------------------------------------------------------
+{
+    if (tx_timer_left) // long delay: more periods to go
+    {
+        next_tx_timer_period();
+    }
+    else
+    {
+        TA1CTL   = TASSEL__SMCLK + ID__4 + MC__STOP;
+        TA1CCTL0 = 0;
+        tx_timer_running = 0;
+
+        if (tx_deferred) // the block is started by the main loop
+        {
+            latch_event(EVENT_TX_TIMER, get_timestamp());
+            __bic_SR_register_on_exit(LPM0_bits); // Wake the main loop
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Timer_A2 CCR1, CCR2 and overflow interrupt service routine: hop time, latency probe and high part
+// of the timestamps
+#if defined(__TI_COMPILER_VERSION__) || (__IAR_SYSTEMS_ICC__)
+#pragma vector = TIMER2_A1_VECTOR
+__interrupt void TIMER2_A1_ISR (void)
+#elif defined(__GNUC__) && (__MSP430__)
+void __attribute__ ((interrupt(TIMER2_A1_VECTOR))) TIMER2_A1_ISR (void)
+#else
+#error Compiler not found!
+#endif
+// ------------------------------------------------------------------------------------------------
+{
+    uint16_t probe_us;
+
+    switch (__even_in_range(TA2IV,14))
+    {
+        case 2:  // CCR1: low part of the hop time
+            latch_event(EVENT_HOP, get_timestamp());
+            __bic_SR_register_on_exit(LPM0_bits); // Wake the main loop
+            break;
+        case 4:  // CCR2: interrupt latency probe
+            probe_us = TA2R - TA2CCR2;
+            TA2CCR2 += LATENCY_PROBE_US;
+            latency.irq_max_us = (probe_us > latency.irq_max_us ? probe_us : latency.irq_max_us);
+            latency.nb_probes++;
+            break;
+        case 14: // TAIFG: overflow
+            timestamp_high++;
+            timestamp_ticks++;
+            break;
+        default:
+            break;
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -487,29 +1473,27 @@ void main (void)
 #endif
 
     initPorts();           // Config GPIOS for low-power (output low)
-    initClocks(MCLK_MHZ * 1000000);   // Config clocks. MCLK=SMCLK=FLL=8MHz; ACLK=REFO=32kHz
+    initClocks(MCLK_MHZ * 1000000);   // Config clocks. MCLK=SMCLK=FLL=20MHz; ACLK=REFO=32kHz
     USB_setup(TRUE, TRUE); // Init USB & events; if a host is present, connect
 
     DELAY_US(5000);        // 5ms delay to compensate for time to startup between MSP430 and CC1100/2500 
     init_radio_spi();      // Initialize SPI comm with radio module
     init_leds();
     init_freq_offset();    // initialize frequency offset compensation
+    init_tx_timer();       // transmission keyup and inter-block timing
+    init_timestamp_timer(); // timestamps of the GDO0 edges
+    init_profile();         // cycle profiling if built in
 
     P1IE  = 0;
     P1IFG = 0;
     P2IE  = 0;
     P2IFG = 0;
 
-    gdo0_r = 0;
-    gdo0_f = 0;
-    gdo2_r = 0;
-    gdo2_f = 0;
-
     init_left_button();
     init_gdo();
     memset(dataBuffer, 0, BUFFER_SIZE);
-
-    //__bis_SR_register(LPM0_bits + GIE); // Enter LPM0 until awakened by an event handler
+    memset(rxBuffer, 0, BUFFER_SIZE);
+    memset(ctrlBuffer, 0, BUFFER_SIZE);
 
     __enable_interrupt();  // Enable interrupts globally
 
@@ -517,10 +1501,10 @@ void main (void)
     {
         //uint8_t ReceiveError = 0, SendError = 0;
         uint8_t  retVal = 0;
-        uint16_t count;
-        //uint8_t byte_command;
-        //uint8_t byte_count;
-        //char str_byte[4];
+        uint8_t  usb_pending = 0;
+        uint8_t  intf_num;
+
+        process_events(); // radio events latched by the interrupts
         
         // Check the USB state and directly main loop accordingly
         switch (USB_connectionState())
@@ -528,88 +1512,13 @@ void main (void)
             // This case is executed while your device is enumerated on the
             // USB host
             case ST_ENUM_ACTIVE:
-                // You will not want this in the general case
-                // Sleep if there are no bytes to process.
-                /*
-                __disable_interrupt();
-                if (!USBCDC_bytesInUSBBuffer(CDC0_INTFNUM)) {
-                
-                    // Enter LPM0 until awakened by an event handler
-                    __bis_SR_register(LPM0_bits + GIE);
-                }
-
-                __enable_interrupt();
-                */
-                // Exit LPM because of a data-receive event, and
-                // fetch the received data
-                if (bCDCDataReceived_event){
-                
-                    // Clear flag early -- just in case execution breaks
-                    // below because of an error
-                    bCDCDataReceived_event = FALSE;
-
-                    count = cdcReceiveDataInBuffer((uint8_t*) &dataBuffer[dataIndex], BUFFER_SIZE, CDC0_INTFNUM);
-
-                    if (count >= 2)
-                    {
-                        if (dataIndex + count < dataBuffer[1] + 2)
-                        {
-                            dataIndex += count;
-                        }
-                        else
-                        {
-                            retVal = process_usb_block(count, (uint8_t*) dataBuffer);
-                            dataIndex = 0;
-
-                            if (retVal)
-                            {
-                                break;
-                            }
-                        }
-                        /*
-                        byte_command = dataBuffer[0];
-                        byte_count = dataBuffer[1];
-
-                        strcpy(outString, "xxCommand: ");
-                        print_byte_decimal(byte_command, str_byte);
-                        strcat(outString, str_byte);
-                        strcat(outString, " - Byte count: ");
-                        print_byte_decimal(byte_count, str_byte);
-                        strcat(outString, str_byte);                        
-
-                        // Count has the number of bytes received into dataBuffer
-                        // Echo back to the host.
-                        if (cdcSendDataInBackground((uint8_t *) outString, strlen(outString), CDC0_INTFNUM, 1))
-                        {
-                            // Exit if something went wrong.
-                            SendError = 0x01;
-                            break;
-                        }
-                        */
-                    }
-                }
-
-                if (send_ack)
+                // Control and data interfaces are serviced in turn so that a command on the control
+                // interface never waits behind a block on the data interface
+                for (intf_num = 0; intf_num < CDC_NUM_INTERFACES; intf_num++)
                 {
-                    if (returnedDataBuffer[0] == 0) // it's a bug!
-                    {
-                        returnedDataBuffer[1]  = 9;
-                        returnedDataBuffer[2]  = rtx_toggle;
-                        returnedDataBuffer[3]  = gdo0_r;
-                        returnedDataBuffer[4]  = gdo0_f;
-                        returnedDataBuffer[5]  = gdo2_r;
-                        returnedDataBuffer[6]  = gdo2_f;
-                        returnedDataBuffer[7]  = TI_CC_GDO0_PxIN;
-                        returnedDataBuffer[8]  = TI_CC_GDO0_PxIFG;
-                        returnedDataBuffer[9]  = TI_CC_GDO0_PxIE;
-                        returnedDataBuffer[10] = TI_CC_GDO0_PxIES;
-                    }
-
-                    retVal = cdcSendDataInBackground((uint8_t *) returnedDataBuffer, returnedDataBuffer[1] + 2, CDC0_INTFNUM, 1);
-                    send_ack = 0;
+                    retVal |= process_usb_interface(intf_num);
                 }
 
-                //__bis_SR_register(LPM0_bits + GIE); // Enter LPM0 until awakened by an event handler
                 break; // ST_ENUM_ACTIVE
                 
             // These cases are executed while your device is disconnected from
@@ -619,7 +1528,7 @@ void main (void)
             case ST_PHYS_DISCONNECTED:
             case ST_ENUM_SUSPENDED:
             case ST_PHYS_CONNECTED_NOENUM_SUSP:
-                //__bis_SR_register(LPM3_bits + GIE);
+                // Not LPM3: the radio timers run from SMCLK
                 _NOP();
                 break;
 
@@ -637,6 +1546,26 @@ void main (void)
         {
             // TO DO: User can place code here to handle error
         }
+
+        // Sleep if there is nothing left to do. The check and LPM0 entry are atomic: an event latched
+        // in between keeps the CPU awake. Only the interrupts that latch events or receive USB data
+        // wake the CPU. SMCLK, the FLL and the timers keep running in LPM0 so the wake up takes a few
+        // cycles only.
+        __disable_interrupt();
+
+        for (intf_num = 0; intf_num < CDC_NUM_INTERFACES; intf_num++)
+        {
+            usb_pending |= bCDCDataReceived_event[intf_num]
+                || USBCDC_bytesInUSBBuffer(intf_num)
+                || (ackBlock[intf_num] && (USB_connectionState() == ST_ENUM_ACTIVE)); // ack is sent once enumerated
+        }
+
+        if (!events && !usb_pending)
+        {
+            __bis_SR_register(LPM0_bits + GIE); // Enter LPM0 until awakened by an event handler
+        }
+
+        __enable_interrupt();
     }  //while(1)
 }                               // main()
 
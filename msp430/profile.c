@@ -0,0 +1,84 @@
+/******************************************************************************/
+/* tnc1101  - Radio serial link using CC1101 module and MSP430                */
+/*                                                                            */
+/* Cycle profiling of the interrupts and FIFO transfers                       */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "profile.h"
+
+static msp430_profile_stats_t profile_sites[MSP430_PROFILE_NB_SITES]; // Statistics of each site
+
+// ------------------------------------------------------------------------------------------------
+// Clear the statistics and start Timer_A0 counting SMCLK cycles if the profiling is built in
+void init_profile()
+// ------------------------------------------------------------------------------------------------
+{
+    memset(profile_sites, 0, sizeof(profile_sites));
+#ifdef PROFILE
+    TA0CTL = TASSEL__SMCLK + ID__1 + MC__CONTINUOUS + TACLR;
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+// Add a run of a site. Called from the interrupts and the main loop: the sites of the interrupts
+// are only recorded by them.
+void profile_record(uint8_t site, uint16_t cycles)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_profile_stats_t *stats = &profile_sites[site];
+    uint16_t range = cycles >> 7;
+    uint8_t  bin = 0;
+
+    while (range && (bin < MSP430_PROFILE_BINS-1))
+    {
+        range >>= 1;
+        bin++;
+    }
+
+    if (!stats->count || (cycles < stats->min_cycles))
+    {
+        stats->min_cycles = cycles;
+    }
+
+    if (cycles > stats->max_cycles)
+    {
+        stats->max_cycles = cycles;
+    }
+
+    if (stats->histogram[bin] != 0xFFFF)
+    {
+        stats->histogram[bin]++;
+    }
+
+    stats->total_cycles += cycles;
+    stats->count++;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Copy the statistics and clear them if asked
+void get_profile(msp430_profile_t *profile, uint8_t flags)
+// ------------------------------------------------------------------------------------------------
+{
+    uint16_t gie = __get_SR_register() & GIE;
+
+    __disable_interrupt(); // the interrupts update their statistics
+    memcpy(profile->sites, profile_sites, sizeof(profile_sites));
+
+    if (flags & MSP430_PROFILE_RESET)
+    {
+        memset(profile_sites, 0, sizeof(profile_sites));
+    }
+
+    __bis_SR_register(gie);
+#ifdef PROFILE
+    profile->flags = flags | MSP430_PROFILE_ENABLED;
+#else
+    profile->flags = flags & ~MSP430_PROFILE_ENABLED;
+#endif
+    profile->mclk_mhz = MCLK_MHZ;
+}
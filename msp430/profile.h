@@ -0,0 +1,32 @@
+/******************************************************************************/
+/* tnc1101  - Radio serial link using CC1101 module and MSP430                */
+/*                                                                            */
+/* Cycle profiling of the interrupts and FIFO transfers                       */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+#include "msp430.h"
+#include "msp430_interface.h"
+
+// The sites are timed with Timer_A0 counting SMCLK = MCLK cycles. It wraps after 65536 cycles
+// (3.2 ms at 20 MHz). Without PROFILE defined (make PROFILE=1) nothing is added to the code.
+#ifdef PROFILE
+#define PROFILE_START(start)     uint16_t start = TA0R
+#define PROFILE_END(site, start) profile_record(site, TA0R - (start))
+#else
+#define PROFILE_START(start)
+#define PROFILE_END(site, start)
+#endif
+
+void    init_profile();
+void    profile_record(uint8_t site, uint16_t cycles);
+void    get_profile(msp430_profile_t *profile, uint8_t flags);
+
+#endif
@@ -8,12 +8,75 @@
 /******************************************************************************/
 
 #include "radio.h"
+#include "profile.h"
 #include "TI_CC_CC1100-CC2500.h"
 
 static uint8_t bytes_remaining;
 static uint8_t bytes_processed;
 static uint8_t *pDataBlock;
-static signed char frequency_offset_accumulator;
+static uint8_t tx_fifo_refill = TX_FIFO_REFILL(RTX_THR_NORM);
+static uint8_t rx_fifo_unload = RX_FIFO_UNLOAD(RTX_THR_NORM);
+static int16_t  frequency_offset_accumulator; // Frequency offset in 1/16 of FSCTRL0 steps
+static int8_t   frequency_offset_written;     // Frequency offset last written to FSCTRL0
+static uint8_t  frequency_offset_tracking;    // Track the offset of received packets
+static int8_t   frequency_offset_estimate;    // Last FREQEST reading
+static uint16_t frequency_offset_updates;     // Number of estimates taken into account
+static msp430_filter_t filter;                // Reception filters in use and their counters
+static uint8_t  rx_address_pending;           // Address byte still to be read out of the Rx FIFO
+static uint32_t radio_config_hash;            // Hash of the radio parameters of the active configuration
+static uint8_t  radio_config_valid;           // The radio holds the configuration of radio_config_hash
+static uint8_t  radio_shadow[MSP430_REGISTERS_MAX_ADDR+1]; // Registers in use. Exact for those of the profiles.
+static uint8_t  patable_row;                  // PATABLE row in use
+
+// Frequency synthesizer calibration of a channel
+typedef struct fscal_entry_s
+{
+    uint8_t  valid;
+    uint8_t  channel;
+    uint8_t  fscal3;
+    uint8_t  fscal2;
+    uint8_t  fscal1;
+    uint32_t cal_tick;        // Time of the calibration in MSP430_TICK_US units
+} fscal_entry_t;
+
+static fscal_entry_t fscal_cache[MSP430_CAL_CACHE_SIZE];
+static fscal_entry_t *fscal_current;          // Calibration of the channel in use
+static uint32_t      fscal_period;            // Calibration age after which it is redone in ticks
+
+// Register profile: values of the registers that follow the radio parameters
+typedef struct reg_profile_s
+{
+    uint8_t  valid;
+    uint8_t  flags;           // MSP430_REG_PROFILE_POWER flag
+    uint8_t  patable_freq_i;  // PATABLE row
+    uint8_t  values[RADIO_PROFILE_NB_REGS]; // Values in the order of profile_registers
+} reg_profile_t;
+
+static reg_profile_t reg_profiles[MSP430_REG_PROFILES];
+
+static uint8_t  sweep_fscal[MSP430_SWEEP_MAX_STEPS][3]; // FSCAL3..1 of each channel of the last sweep
+static uint8_t  sweep_first_channel;          // First channel of the calibrated sweep
+static uint8_t  sweep_nb_steps;               // Number of channels of the calibrated sweep (0: none)
+static uint32_t sweep_cal_tick;               // Time of the sweep calibration in MSP430_TICK_US units
+
+// Reset values of the configuration registers IOCFG2..TEST0. Those not set by init_radio are
+// written back as is with the others in a single burst.
+static const uint8_t radio_defaults[MSP430_REGISTERS_MAX_ADDR+1] = {
+    0x29, 0x2E, 0x3F, 0x07, 0xD3, 0x91, 0xFF, 0x04,  // IOCFG2..PKTCTRL1
+    0x45, 0x00, 0x00, 0x0F, 0x00, 0x1E, 0xC4, 0xEC,  // PKTCTRL0..FREQ0
+    0x8C, 0x22, 0x02, 0x22, 0xF8, 0x47, 0x07, 0x30,  // MDMCFG4..MCSM1
+    0x04, 0x36, 0x6C, 0x03, 0x40, 0x91, 0x87, 0x6B,  // MCSM0..WOREVT0
+    0xF8, 0x56, 0x10, 0xA9, 0x0A, 0x20, 0x0D, 0x41,  // WORCTRL..RCCTRL1
+    0x00, 0x59, 0x7F, 0x3F, 0x88, 0x31, 0x0B};       // RCCTRL0..TEST0
+
+// Registers set by a profile. Those that follow the traffic (GDO2, packet length, channel,
+// calibration, frequency offset, address filter, turnaround) or that do not depend on the radio
+// parameters (AGC, loop gains, test settings, possibly tuned) are left as they are.
+static const uint8_t profile_registers[RADIO_PROFILE_NB_REGS] = {
+    TI_CCxxx0_FIFOTHR, TI_CCxxx0_SYNC1,   TI_CCxxx0_SYNC0,   TI_CCxxx0_PKTCTRL0,
+    TI_CCxxx0_FSCTRL1, TI_CCxxx0_FREQ2,   TI_CCxxx0_FREQ1,   TI_CCxxx0_FREQ0,
+    TI_CCxxx0_MDMCFG4, TI_CCxxx0_MDMCFG3, TI_CCxxx0_MDMCFG2, TI_CCxxx0_MDMCFG1,
+    TI_CCxxx0_MDMCFG0, TI_CCxxx0_DEVIATN, TI_CCxxx0_FREND0};
 
 static const uint8_t patable[5][8] = {
     {0x12, 0x0d, 0x1c, 0x34, 0x51, 0x85, 0xcb, 0xc2},  // 315 MHz FM
@@ -22,6 +85,18 @@ static const uint8_t patable[5][8] = {
     {0x03, 0x0e, 0x1e, 0x27, 0x8e, 0xcd, 0xc7, 0xc0},  // 915 MHz FM
     {0x00, 0x0e, 0x1d, 0x34, 0x3c, 0x40, 0x60, 0xc6}}; // All     ASK
 
+// = Static functions declarations ================================================================
+
+static uint8_t wait_idle(uint16_t max_loops);
+static uint32_t hash_parms(uint8_t *parms, uint8_t size);
+static uint8_t fifo_threshold(uint8_t fifo_thr);
+static void    write_config(uint8_t addr, uint8_t value);
+static void    build_image(msp430_radio_parms_t *radio_parms, uint8_t *radio_image);
+static void    forget_calibrations();
+static uint8_t frequency_register(uint8_t addr, uint8_t changed);
+static void    calibrate(fscal_entry_t *entry, uint32_t now);
+static uint8_t select_channel(uint8_t channel, uint8_t force, uint32_t now);
+
 // ------------------------------------------------------------------------------------------------
 // Initialize SPI radio interface
 void init_radio_spi()
@@ -32,11 +107,54 @@ void init_radio_spi()
 }
 
 // ------------------------------------------------------------------------------------------------
-// Reset the radio chip
-void reset_radio()
+// Reset the radio chip and wait until it is ready in IDLE state. Returns 1 if ready else 0
+uint8_t reset_radio()
 // ------------------------------------------------------------------------------------------------
 {
+    radio_config_valid = 0;
     TI_CC_SPIStrobe(TI_CCxxx0_SRES);
+    return wait_idle(RADIO_RESET_LOOPS); // status reads fail until the crystal oscillator runs
+}
+
+// ------------------------------------------------------------------------------------------------
+// Poll the radio state until IDLE within the given number of reads. Returns 1 if IDLE else 0
+uint8_t wait_idle(uint16_t max_loops)
+// ------------------------------------------------------------------------------------------------
+{
+    uint16_t wait_loops = 0;
+
+    while (((TI_CC_SPIReadStatus(TI_CCxxx0_MARCSTATE) & 0x1F) != 0x01) && (wait_loops < max_loops))
+    {
+        wait_loops++;
+    }
+
+    return ((TI_CC_SPIReadStatus(TI_CCxxx0_MARCSTATE) & 0x1F) == 0x01);
+}
+
+// ------------------------------------------------------------------------------------------------
+// FNV-1a hash of the radio parameters
+uint32_t hash_parms(uint8_t *parms, uint8_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t hash = 2166136261UL;
+    uint8_t  i;
+
+    for (i=0; i < size; i++)
+    {
+        hash ^= parms[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write a configuration register and keep its value in the shadow
+void write_config(uint8_t addr, uint8_t value)
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_SPIWriteReg(addr, value);
+    radio_shadow[addr] = value;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -45,37 +163,292 @@ void init_freq_offset()
 // ------------------------------------------------------------------------------------------------
 {
     frequency_offset_accumulator = 0; 
+    frequency_offset_written = 0;
+    frequency_offset_tracking = 0;
+    frequency_offset_estimate = 0;
+    frequency_offset_updates = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set frequency offset tracking mode and optionally load an offset. Returns the current state.
+void set_freq_offset(msp430_afc_t *afc)
+// ------------------------------------------------------------------------------------------------
+{
+    frequency_offset_tracking = afc->mode & MSP430_AFC_TRACK;
+
+    if (afc->mode & MSP430_AFC_LOAD)
+    {
+        frequency_offset_accumulator = afc->freq_offset * 16;
+    }
+
+    afc->freq_offset   = (frequency_offset_accumulator + (frequency_offset_accumulator < 0 ? -8 : 8)) / 16;
+    afc->last_estimate = frequency_offset_estimate;
+    afc->nb_updates    = frequency_offset_updates;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write the tracked frequency offset to FSCTRL0 if it has changed. Radio is expected to be idle.
+void apply_freq_offset()
+// ------------------------------------------------------------------------------------------------
+{
+    int8_t freq_offset = (frequency_offset_accumulator + (frequency_offset_accumulator < 0 ? -8 : 8)) / 16;
+
+    if (freq_offset != frequency_offset_written)
+    {
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCTRL0, (uint8_t) freq_offset);
+        frequency_offset_written = freq_offset;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Calibrate the frequency synthesizer for the current channel and keep the result. Radio goes IDLE.
+void calibrate(fscal_entry_t *entry, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    uint16_t wait_loops = 0;
+
+    TI_CC_SPIStrobe(TI_CCxxx0_SIDLE);
+    TI_CC_SPIStrobe(TI_CCxxx0_SCAL);
+
+    // About 720 us. Goes back to IDLE when done.
+    while (((TI_CC_SPIReadStatus(TI_CCxxx0_MARCSTATE) & 0x1F) != 0x01) && (wait_loops < 2000))
+    {
+        wait_loops++;
+    }
+
+    entry->fscal3   = TI_CC_SPIReadReg(TI_CCxxx0_FSCAL3);
+    entry->fscal2   = TI_CC_SPIReadReg(TI_CCxxx0_FSCAL2);
+    entry->fscal1   = TI_CC_SPIReadReg(TI_CCxxx0_FSCAL1);
+    entry->cal_tick = now;
+    entry->valid    = 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select a channel. Its calibration is restored from the cache if fresh enough else it is
+// calibrated. Radio must be idle. Returns 1 if the calibration was restored else 0
+uint8_t select_channel(uint8_t channel, uint8_t force, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    fscal_entry_t *entry = 0;
+    fscal_entry_t *victim = 0; // free or oldest entry
+    uint8_t       i;
+
+    for (i=0; i < MSP430_CAL_CACHE_SIZE; i++)
+    {
+        if (fscal_cache[i].valid && (fscal_cache[i].channel == channel))
+        {
+            entry = &fscal_cache[i];
+            break;
+        }
+
+        if (!victim || !fscal_cache[i].valid || (victim->valid && (now - fscal_cache[i].cal_tick > now - victim->cal_tick)))
+        {
+            victim = &fscal_cache[i];
+        }
+    }
+
+    if (!entry)
+    {
+        entry = victim;
+        entry->valid = 0;
+        entry->channel = channel;
+    }
+
+    TI_CC_SPIWriteReg(TI_CCxxx0_CHANNR, channel);
+    fscal_current = entry;
+
+    if (!force && entry->valid && (now - entry->cal_tick < fscal_period))
+    {
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL3, entry->fscal3);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL2, entry->fscal2);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL1, entry->fscal1);
+        return 1;
+    }
+
+    calibrate(entry, now);
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Whether the change of a register moves the channel frequencies (base frequency, IF or channel
+// spacing in MDMCFG1 bits 1:0 and MDMCFG0) so that their calibrations no longer hold
+uint8_t frequency_register(uint8_t addr, uint8_t changed)
+// ------------------------------------------------------------------------------------------------
+{
+    return (changed
+        && ((addr == TI_CCxxx0_FSCTRL1)
+         || ((addr >= TI_CCxxx0_FREQ2) && (addr <= TI_CCxxx0_FREQ0))
+         || (addr == TI_CCxxx0_MDMCFG0)
+         || ((addr == TI_CCxxx0_MDMCFG1) && (changed & 0x03))));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Forget the calibrations of all channels and of the sweep
+void forget_calibrations()
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t i;
+
+    for (i=0; i < MSP430_CAL_CACHE_SIZE; i++)
+    {
+        fscal_cache[i].valid = 0;
+    }
+
+    sweep_nb_steps = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select channel 0 that init_radio selects. All calibrations are forgotten and channel 0 is
+// calibrated unless they are kept because the configuration is unchanged. Radio must be idle.
+void init_calibration(uint8_t keep, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!keep)
+    {
+        forget_calibrations();
+    }
+
+    fscal_period = ((uint32_t) MSP430_CAL_PERIOD_S * 15625) / 1024; // seconds to 65.536 ms ticks
+    select_channel(0, !keep, now);
 }
 
 // ------------------------------------------------------------------------------------------------
-// Set up radio
-void init_radio(msp430_radio_parms_t *radio_parms)
+// Select a channel and the calibration period. Returns the calibration in use. Radio must be idle.
+void set_calibration(msp430_calibration_t *cal, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    if (cal->period_s)
+    {
+        fscal_period = ((uint32_t) cal->period_s * 15625) / 1024; // seconds to 65.536 ms ticks
+    }
+
+    cal->cached = select_channel(cal->channel, cal->force, now);
+    cal->fscal3 = fscal_current->fscal3;
+    cal->fscal2 = fscal_current->fscal2;
+    cal->fscal1 = fscal_current->fscal1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select a channel with its cached calibration if fresh enough. Radio must be idle.
+// Returns 1 if the calibration was restored else 0
+uint8_t set_channel(uint8_t channel, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    return select_channel(channel, 0, now);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Calibrate the channel in use again if its calibration is too old. Radio must be idle.
+void check_calibration(uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    if (fscal_current && (now - fscal_current->cal_tick >= fscal_period))
+    {
+        calibrate(fscal_current, now);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Read the RSSI over consecutive channels. The channels are calibrated once and their calibrations
+// kept for the next sweeps over the same channels so that each step is just a channel change and
+// a short reception. The highest reading on each channel is returned in rssi. Radio must be idle
+// and is left idle on the channel in use before the sweep.
+void sweep_rssi(msp430_sweep_t *sweep, uint8_t *rssi, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    fscal_entry_t entry;
+    uint16_t      start;
+    int8_t        reading, highest;
+    uint8_t       i;
+
+    if ((sweep->flags & MSP430_SWEEP_CALIBRATE)
+        || (sweep->first_channel != sweep_first_channel)
+        || (sweep->nb_steps != sweep_nb_steps)
+        || (now - sweep_cal_tick >= fscal_period))
+    {
+        for (i=0; i < sweep->nb_steps; i++)
+        {
+            TI_CC_SPIWriteReg(TI_CCxxx0_CHANNR, sweep->first_channel + i);
+            calibrate(&entry, now);
+            sweep_fscal[i][0] = entry.fscal3;
+            sweep_fscal[i][1] = entry.fscal2;
+            sweep_fscal[i][2] = entry.fscal1;
+        }
+
+        sweep_first_channel = sweep->first_channel;
+        sweep_nb_steps = sweep->nb_steps;
+        sweep_cal_tick = now;
+    }
+
+    for (i=0; i < sweep->nb_steps; i++)
+    {
+        TI_CC_SPIWriteReg(TI_CCxxx0_CHANNR, sweep->first_channel + i);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL3, sweep_fscal[i][0]);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL2, sweep_fscal[i][1]);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL1, sweep_fscal[i][2]);
+        TI_CC_SPIStrobe(TI_CCxxx0_SRX);
+
+        start = TA2R; // Timer_A2 counts microseconds
+        highest = -128;
+
+        while ((uint16_t) (TA2R - start) < sweep->settle_us);
+
+        do
+        {
+            reading = (int8_t) TI_CC_SPIReadStatus(TI_CCxxx0_RSSI);
+
+            if (reading > highest)
+            {
+                highest = reading;
+            }
+        } while ((uint16_t) (TA2R - start) < sweep->settle_us + sweep->dwell_us);
+
+        TI_CC_SPIStrobe(TI_CCxxx0_SIDLE);
+        rssi[i] = (uint8_t) highest;
+    }
+
+    TI_CC_SPIStrobe(TI_CCxxx0_SFRX); // A packet may have started during the sweep
+
+    if (fscal_current)
+    {
+        TI_CC_SPIWriteReg(TI_CCxxx0_CHANNR, fscal_current->channel);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL3, fscal_current->fscal3);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL2, fscal_current->fscal2);
+        TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL1, fscal_current->fscal1);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compute the configuration registers of the radio parameters
+void build_image(msp430_radio_parms_t *radio_parms, uint8_t *radio_image)
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t reg_word;
 
-    // Write register settings
+    memcpy(radio_image, radio_defaults, MSP430_REGISTERS_MAX_ADDR+1);
+
+    // Register settings
 
     // IOCFG2 = 0x00: Set in Rx mode (0x02 for Tx mode)
     // o 0x00: Asserts when RX FIFO is filled at or above the RX FIFO threshold. 
     //         De-asserts when RX FIFO is drained below the same threshold.
     // o 0x02: Asserts when the TX FIFO is filled at or above the TX FIFO threshold.
     //         De-asserts when the TX FIFO is below the same threshold.
-    TI_CC_SPIWriteReg(TI_CCxxx0_IOCFG2,   0x00); // GDO2 output pin config.
+    radio_image[TI_CCxxx0_IOCFG2]   = 0x00; // GDO2 output pin config.
 
     // IOCFG0 = 0x06: Asserts when sync word has been sent / received, and de-asserts at the
     // end of the packet. In RX, the pin will de-assert when the optional address
     // check fails or the RX FIFO overflows. In TX the pin will de-assert if the TX
     // FIFO underflows:    
-    TI_CC_SPIWriteReg(TI_CCxxx0_IOCFG0,   0x06); // GDO0 output pin config.
+    radio_image[TI_CCxxx0_IOCFG0]   = 0x06; // GDO0 output pin config.
 
-    // FIFO_THR = 14 (defined in RTX_THR_NORM in radio.h): 
-    // o 5 bytes in TX FIFO (55 available spaces)
-    // o 60 bytes in the RX FIFO
-    TI_CC_SPIWriteReg(TI_CCxxx0_FIFOTHR,  RTX_THR_NORM); // FIFO threshold.
+    // FIFO_THR: chosen by the host for the data rate (RTX_THR_NORM = 14 at low rates): 
+    // o 61 - 4*FIFO_THR bytes in TX FIFO (5 bytes with 14)
+    // o 4*(FIFO_THR + 1) bytes in the RX FIFO (60 bytes with 14)
+    radio_image[TI_CCxxx0_FIFOTHR] = (radio_parms->fifo_thr > RTX_THR_NORM ? RTX_THR_NORM : radio_parms->fifo_thr); // FIFO threshold.
 
     // PKTLEN: packet length up to 255 bytes. 
-    TI_CC_SPIWriteReg(TI_CCxxx0_PKTLEN, radio_parms->packet_length); // Packet length.
+    radio_image[TI_CCxxx0_PKTLEN] = radio_parms->packet_length; // Packet length.
 
     // PKTCTRL0: Packet automation control #0
     // . bit  7:   unused
@@ -85,7 +458,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // . bit  2:   1  -> CRC enabled
     // . bits 1:0: xx -> Packet length mode. Taken from radio config.
     reg_word = ((radio_parms->fec_whitening & 0x02)<<5) + 0x04 + (uint8_t) (radio_parms->packet_config & 0x03);
-    TI_CC_SPIWriteReg(TI_CCxxx0_PKTCTRL0, reg_word); // Packet automation control.
+    radio_image[TI_CCxxx0_PKTCTRL0] = reg_word; // Packet automation control.
 
     // PKTCTRL1: Packet automation control #1
     // . bits 7:5: 000 -> Preamble quality estimator threshold
@@ -93,19 +466,25 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // . bit  3:   0   -> Automatic flush of Rx FIFO disabled (too many side constraints see doc)
     // . bit  2:   1   -> Append two status bytes to the payload (RSSI and LQI + CRC OK)
     // . bits 1:0: 00  -> No address check of received packets
-    TI_CC_SPIWriteReg(TI_CCxxx0_PKTCTRL1, 0x04); // Packet automation control.
+    // .             Set by the filter command for the address check (11: 0x00 and 0xFF broadcast)
+    radio_image[TI_CCxxx0_PKTCTRL1] = 0x04; // Packet automation control.
+
+    radio_image[TI_CCxxx0_ADDR]     = 0x00; // Device address for packet filtration (unused, see just above).
 
-    TI_CC_SPIWriteReg(TI_CCxxx0_ADDR,     0x00); // Device address for packet filtration (unused, see just above).
-    TI_CC_SPIWriteReg(TI_CCxxx0_CHANNR,   0x00); // Channel number (unused, use direct frequency programming).
+    // SYNC1..0: sync word. Stations of different networks on the same frequency use different
+    // sync words so that the traffic of the others is not even detected.
+    radio_image[TI_CCxxx0_SYNC1]    = radio_parms->sync1; // Sync word, high byte
+    radio_image[TI_CCxxx0_SYNC0]    = radio_parms->sync0; // Sync word, low byte
+    radio_image[TI_CCxxx0_CHANNR]   = 0x00; // Channel number (unused, use direct frequency programming).
 
     // FSCTRL0: Frequency offset added to the base frequency before being used by the
     // frequency synthesizer. (2s-complement). Multiplied by Fxtal/2^14
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCTRL0,  0x00); // Freq synthesizer control.
+    radio_image[TI_CCxxx0_FSCTRL0]  = 0x00; // Freq synthesizer control.
 
     // FSCTRL1: The desired IF frequency to employ in RX. Subtracted from FS base frequency
     // in RX and controls the digital complex mixer in the demodulator. Multiplied by Fxtal/2^10
     // Here 0.3046875 MHz (lowest point below 310 kHz)
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCTRL1, (radio_parms->if_word & 0x1F)); // Freq synthesizer control.
+    radio_image[TI_CCxxx0_FSCTRL1] = (radio_parms->if_word & 0x1F); // Freq synthesizer control.
 
     // FREQ2..0: Base frequency for the frequency sythesizer
     // Fo = (Fxosc / 2^16) * FREQ[23..0]
@@ -113,9 +492,9 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // FREQ1 is FREQ[15..8]
     // FREQ0 is FREQ[7..0]
     // Fxtal = 26 MHz and FREQ = 0x10A762 => Fo = 432.99981689453125 MHz
-    TI_CC_SPIWriteReg(TI_CCxxx0_FREQ2,    ((radio_parms->freq_word>>16) & 0xFF)); // Freq control word, high byte
-    TI_CC_SPIWriteReg(TI_CCxxx0_FREQ1,    ((radio_parms->freq_word>>8)  & 0xFF)); // Freq control word, mid byte.
-    TI_CC_SPIWriteReg(TI_CCxxx0_FREQ0,    (radio_parms->freq_word & 0xFF));       // Freq control word, low byte.
+    radio_image[TI_CCxxx0_FREQ2]    = ((radio_parms->freq_word>>16) & 0xFF); // Freq control word, high byte
+    radio_image[TI_CCxxx0_FREQ1]    = ((radio_parms->freq_word>>8)  & 0xFF); // Freq control word, mid byte.
+    radio_image[TI_CCxxx0_FREQ0]    = (radio_parms->freq_word & 0xFF);       // Freq control word, low byte.
 
     // MDMCFG4 Modem configuration - bandwidth and data rate exponent
     // High nibble: Sets the decimation ratio for the delta-sigma ADC input stream hence the channel bandwidth
@@ -126,12 +505,12 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // Low nibble:
     // . bits 3:0: 13 -> DRATE_E: data rate base 2 exponent => here 13 (multiply by 8192)
     reg_word = (radio_parms->chanbw_e<<6) + (radio_parms->chanbw_m<<4) + radio_parms->drate_e;
-    TI_CC_SPIWriteReg(TI_CCxxx0_MDMCFG4,  reg_word); // Modem configuration.
+    radio_image[TI_CCxxx0_MDMCFG4]  = reg_word; // Modem configuration.
 
     // MDMCFG3 Modem configuration: DRATE_M data rate mantissa as per formula:
     //    Rate = (256 + DRATE_M).2^DRATE_E.Fxosc / 2^28 
     // Here DRATE_M = 59, DRATE_E = 13 => Rate = 250 kBaud
-    TI_CC_SPIWriteReg(TI_CCxxx0_MDMCFG3,  radio_parms->drate_m); // Modem configuration.
+    radio_image[TI_CCxxx0_MDMCFG3]  = radio_parms->drate_m; // Modem configuration.
 
     // MDMCFG2 Modem configuration: DC block, modulation, Manchester, sync word
     // o bit 7:    0   -> Enable DC blocking (1: disable)
@@ -139,7 +518,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // o bit 3:    0   -> Manchester disabled (1: enable)
     // o bits 2:0: 011 -> Sync word qualifier (30/32 by default). Taken from radio config.
     reg_word = (radio_parms->mod_word<<4) + radio_parms->sync_word;
-    TI_CC_SPIWriteReg(TI_CCxxx0_MDMCFG2,  reg_word); // Modem configuration.
+    radio_image[TI_CCxxx0_MDMCFG2]  = reg_word; // Modem configuration.
 
     // MDMCFG1 Modem configuration: FEC, Preamble, exponent for channel spacing
     // o bit 7:    x   -> FEC. Taken from radio config.
@@ -147,12 +526,12 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // o bits 3:2: unused
     // o bits 1:0: CHANSPC_E: exponent of channel spacing (here: 2)
     reg_word = ((radio_parms->fec_whitening&0x01)<<7) + (((uint8_t) radio_parms->preamble_word)<<4) + (radio_parms->chanspc_e);
-    TI_CC_SPIWriteReg(TI_CCxxx0_MDMCFG1,  reg_word); // Modem configuration.
+    radio_image[TI_CCxxx0_MDMCFG1]  = reg_word; // Modem configuration.
 
     // MODCFG0 Modem configuration: CHANSPC_M: mantissa of channel spacing following this formula:
     //    Df = (Fxosc / 2^18) * (256 + CHANSPC_M) * 2^CHANSPC_E
     //    Here: (26 /  ) * 2016 = 0.199951171875 MHz (200 kHz)
-    TI_CC_SPIWriteReg(TI_CCxxx0_MDMCFG0,  radio_parms->chanspc_m); // Modem configuration.
+    radio_image[TI_CCxxx0_MDMCFG0]  = radio_parms->chanspc_m; // Modem configuration.
 
     // DEVIATN: Modem deviation
     // o bit 7:    0   -> not used
@@ -171,10 +550,10 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   OOK      : No effect
     //    
     reg_word = (radio_parms->deviat_e<<4) + (radio_parms->deviat_m);
-    TI_CC_SPIWriteReg(TI_CCxxx0_DEVIATN,  reg_word); // Modem dev (when FSK mod en)
+    radio_image[TI_CCxxx0_DEVIATN]  = reg_word; // Modem dev (when FSK mod en)
 
     // MCSM2: Main Radio State Machine. See documentation.
-    TI_CC_SPIWriteReg(TI_CCxxx0_MCSM2 ,   0x00); //MainRadio Cntrl State Machine
+    radio_image[TI_CCxxx0_MCSM2]    = 0x00; //MainRadio Cntrl State Machine
 
     // MCSM1: Main Radio State Machine. 
     // o bits 7:6: not used
@@ -193,7 +572,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   1 (01): FSTXON
     //   2 (10): TX (stay)
     //   3 (11): RX 
-    TI_CC_SPIWriteReg(TI_CCxxx0_MCSM1 ,   0x30); //MainRadio Cntrl State Machine
+    radio_image[TI_CCxxx0_MCSM1]    = 0x30; //MainRadio Cntrl State Machine
 
     // MCSM0: Main Radio State Machine.
     // o bits 7:6: not used
@@ -210,7 +589,8 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   3 (11): 256: Approx. 597 – 620 μs
     // o bit 1: PIN_CTRL_EN:   Enables the pin radio control option
     // o bit 0: XOSC_FORCE_ON: Force the XOSC to stay on in the SLEEP state.
-    TI_CC_SPIWriteReg(TI_CCxxx0_MCSM0 ,   0x18); //MainRadio Cntrl State Machine
+    // Calibration is done once per channel and restored from cache (see select_channel)
+    radio_image[TI_CCxxx0_MCSM0]    = 0x08; //MainRadio Cntrl State Machine
 
     // FOCCFG: Frequency Offset Compensation Configuration.
     // o bits 7:6: not used
@@ -229,7 +609,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   1 (01): ±BW CHAN /8
     //   2 (10): ±BW CHAN /4
     //   3 (11): ±BW CHAN /2
-    TI_CC_SPIWriteReg(TI_CCxxx0_FOCCFG,   0x1F); // Freq Offset Compens. Config
+    radio_image[TI_CCxxx0_FOCCFG]   = 0x1F; // Freq Offset Compens. Config
 
     // BSCFG:Bit Synchronization Configuration
     // o bits 7:6: BS_PRE_KI: Clock recovery loop integral gain before sync word
@@ -253,7 +633,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   1 (01): ±3.125 % data rate offset
     //   2 (10): ±6.25 % data rate offset
     //   3 (11): ±12.5 % data rate offset
-    TI_CC_SPIWriteReg(TI_CCxxx0_BSCFG,    0x1C); //  Bit synchronization config.
+    radio_image[TI_CCxxx0_BSCFG]    = 0x1C; //  Bit synchronization config.
 
     // AGCCTRL2: AGC Control
     // o bits 7:6: MAX_DVGA_GAIN. Allowable DVGA settings
@@ -279,7 +659,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   5 (101): 38 dB
     //   6 (110): 40 dB
     //   7 (111): 42 dB
-    TI_CC_SPIWriteReg(TI_CCxxx0_AGCCTRL2, 0xC7); // AGC control.
+    radio_image[TI_CCxxx0_AGCCTRL2] = 0xC7; // AGC control.
 
     // AGCCTRL1: AGC Control
     // o bit 7: not used
@@ -294,7 +674,7 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     // o bits 3:0: CARRIER_SENSE_ABS_THR: Sets the absolute RSSI threshold for asserting carrier sense. 
     //   The 2-complement signed threshold is programmed in steps of 1 dB and is relative to the MAGN_TARGET setting.
     //   0 is at MAGN_TARGET setting.
-    TI_CC_SPIWriteReg(TI_CCxxx0_AGCCTRL1, 0x00); // AGC control.
+    radio_image[TI_CCxxx0_AGCCTRL1] = 0x00; // AGC control.
 
     // AGCCTRL0: AGC Control
     // o bits 7:6: HYST_LEVEL: Sets the level of hysteresis on the magnitude deviation
@@ -321,14 +701,14 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   1 (01):       16: 8 dB
     //   2 (10):       32: 12 dB
     //   3 (11):       64: 16 dB  
-    TI_CC_SPIWriteReg(TI_CCxxx0_AGCCTRL0, 0xB2); // AGC control.
+    radio_image[TI_CCxxx0_AGCCTRL0] = 0xB2; // AGC control.
 
     // FREND1: Front End RX Configuration
     // o bits 7:6: LNA_CURRENT: Adjusts front-end LNA PTAT current output
     // o bits 5:4: LNA2MIX_CURRENT: Adjusts front-end PTAT outputs
     // o bits 3:2: LODIV_BUF_CURRENT_RX: Adjusts current in RX LO buffer (LO input to mixer)
     // o bits 1:0: MIX_CURRENT: Adjusts current in mixer
-    TI_CC_SPIWriteReg(TI_CCxxx0_FREND1,   0xB6); // Front end RX configuration.
+    radio_image[TI_CCxxx0_FREND1]   = 0xB6; // Front end RX configuration.
 
     // FREND0: Front End TX Configuration
     // o bits 7:6: not used
@@ -341,43 +721,297 @@ void init_radio(msp430_radio_parms_t *radio_parms)
     //   The PATABLE settings from index ‘0’ to the PA_POWER value are used for ASK TX shaping, 
     //   and for power ramp-up/ramp-down at the start/end of transmission in all TX modulation formats.
     reg_word = 0x10 + (radio_parms->patable_power_i & 0x07);
-    TI_CC_SPIWriteReg(TI_CCxxx0_FREND0, reg_word); // Front end RX configuration. 0dBm.
+    radio_image[TI_CCxxx0_FREND0] = reg_word; // Front end RX configuration. 0dBm.
 
     // FSCAL3: Frequency Synthesizer Calibration
     // o bits 7:6: The value to write in this field before calibration is given by the SmartRF
     //   Studio software.
     // o bits 5:4: CHP_CURR_CAL_EN: Disable charge pump calibration stage when 0.
     // o bits 3:0: FSCAL3: Frequency synthesizer calibration result register.
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL3,   0xEA); // Frequency synthesizer cal.
+    radio_image[TI_CCxxx0_FSCAL3]   = 0xEA; // Frequency synthesizer cal.
 
     // FSCAL2: Frequency Synthesizer Calibration
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL2,   0x0A); // Frequency synthesizer cal.
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL1,   0x00); // Frequency synthesizer cal.
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCAL0,   0x11); // Frequency synthesizer cal.
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSTEST,   0x59); // Frequency synthesizer cal.
+    radio_image[TI_CCxxx0_FSCAL2]   = 0x0A; // Frequency synthesizer cal.
+    radio_image[TI_CCxxx0_FSCAL1]   = 0x00; // Frequency synthesizer cal.
+    radio_image[TI_CCxxx0_FSCAL0]   = 0x11; // Frequency synthesizer cal.
+    radio_image[TI_CCxxx0_FSTEST]   = 0x59; // Frequency synthesizer cal.
 
     // TEST2: Various test settings. The value to write in this field is given by the SmartRF Studio software.
-    TI_CC_SPIWriteReg(TI_CCxxx0_TEST2,    0x88); // Various test settings.
+    radio_image[TI_CCxxx0_TEST2]    = 0x88; // Various test settings.
 
     // TEST1: Various test settings. The value to write in this field is given by the SmartRF Studio software.
-    TI_CC_SPIWriteReg(TI_CCxxx0_TEST1,    0x31); // Various test settings.
+    radio_image[TI_CCxxx0_TEST1]    = 0x31; // Various test settings.
 
     // TEST0: Various test settings. The value to write in this field is given by the SmartRF Studio software.
-    TI_CC_SPIWriteReg(TI_CCxxx0_TEST0,    0x09); // Various test settings.
+    radio_image[TI_CCxxx0_TEST0]    = 0x09; // Various test settings.
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set up radio. The configuration registers are computed in an image written in a single burst.
+// With the parameters of the active configuration the radio is not reset but only brought back
+// to IDLE with its FIFOs flushed. The image is rewritten over any change made since.
+void init_radio(msp430_radio_parms_t *radio_parms, msp430_init_status_t *status)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  radio_image[MSP430_REGISTERS_MAX_ADDR+1];
+    uint32_t hash = hash_parms((uint8_t *) radio_parms, sizeof(msp430_radio_parms_t));
+
+    status->flags = 0;
+
+    if (radio_config_valid && (hash == radio_config_hash))
+    {
+        TI_CC_SPIStrobe(TI_CCxxx0_SIDLE);
+
+        if (wait_idle(RADIO_IDLE_LOOPS))
+        {
+            flush_rx_fifo();
+            flush_tx_fifo();
+            status->flags |= MSP430_INIT_REUSED;
+        }
+    }
+
+    if (!(status->flags & MSP430_INIT_REUSED))
+    {
+        reset_radio(); // also when the radio does not go IDLE
+    }
+
+    build_image(radio_parms, radio_image);
+    fifo_threshold(radio_image[TI_CCxxx0_FIFOTHR]);
+    memset(&filter, 0, sizeof(msp430_filter_t)); // no filter until the filter command
+    frequency_offset_written = 0;                // tracked offset is applied at next Rx or Tx
 
-    // Write the PATABLE
-    TI_CC_SPIWriteBurstReg(TI_CCxxx0_PATABLE, patable[radio_parms->patable_freq_i], 8);
+    // Write the registers then the PATABLE
+    TI_CC_SPIWriteBurstReg(TI_CCxxx0_IOCFG2, (char *) radio_image, MSP430_REGISTERS_MAX_ADDR+1);
+    TI_CC_SPIWriteBurstReg(TI_CCxxx0_PATABLE, (char *) patable[radio_parms->patable_freq_i], 8);
+    memcpy(radio_shadow, radio_image, MSP430_REGISTERS_MAX_ADDR+1);
+    patable_row = radio_parms->patable_freq_i;
 
+    radio_config_hash = hash;
+    radio_config_valid = 1;
+    status->marcstate = TI_CC_SPIReadStatus(TI_CCxxx0_MARCSTATE) & 0x1F;
+
+    if (status->marcstate == 0x01)
+    {
+        status->flags |= MSP430_INIT_READY;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Change the modem settings: data rate, deviation, channel bandwidth, modulation, FEC and whitening.
+// Other settings of the registers involved are kept. Radio is expected to be idle.
+void set_modem(msp430_modem_parms_t *modem_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t reg_word;
+
+    // MDMCFG4: channel bandwidth and data rate exponent
+    reg_word = (modem_parms->chanbw_e<<6) + (modem_parms->chanbw_m<<4) + modem_parms->drate_e;
+    write_config(TI_CCxxx0_MDMCFG4,  reg_word);
+
+    // MDMCFG3: data rate mantissa
+    write_config(TI_CCxxx0_MDMCFG3,  modem_parms->drate_m);
+
+    // MDMCFG2: modulation word in bits 6:4. DC blocking, Manchester and sync word are kept.
+    reg_word = (TI_CC_SPIReadReg(TI_CCxxx0_MDMCFG2) & 0x8F) + ((modem_parms->mod_word & 0x07)<<4);
+    write_config(TI_CCxxx0_MDMCFG2,  reg_word);
+
+    // MDMCFG1: FEC in bit 7. Preamble and channel spacing exponent are kept.
+    reg_word = (TI_CC_SPIReadReg(TI_CCxxx0_MDMCFG1) & 0x7F) + ((modem_parms->fec_whitening & 0x01)<<7);
+    write_config(TI_CCxxx0_MDMCFG1,  reg_word);
+
+    // DEVIATN: deviation exponent and mantissa
+    reg_word = (modem_parms->deviat_e<<4) + (modem_parms->deviat_m);
+    write_config(TI_CCxxx0_DEVIATN,  reg_word);
+
+    // PKTCTRL0: whitening in bit 6. Other packet settings are kept.
+    reg_word = (TI_CC_SPIReadReg(TI_CCxxx0_PKTCTRL0) & 0xBF) + ((modem_parms->fec_whitening & 0x02)<<5);
+    write_config(TI_CCxxx0_PKTCTRL0, reg_word);
+
+    set_fifo_threshold(modem_parms->fifo_thr);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Keep a register profile computed from radio parameters under its index. Returns 1 if the index
+// is valid else 0
+uint8_t load_reg_profile(msp430_reg_profile_t *reg_profile)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t       radio_image[MSP430_REGISTERS_MAX_ADDR+1];
+    reg_profile_t *profile;
+    uint8_t       i;
+
+    if ((reg_profile->index >= MSP430_REG_PROFILES) || (reg_profile->radio_parms.patable_freq_i >= 5))
+    {
+        return 0;
+    }
+
+    profile = &reg_profiles[reg_profile->index];
+    build_image(&reg_profile->radio_parms, radio_image);
+
+    for (i=0; i < RADIO_PROFILE_NB_REGS; i++)
+    {
+        profile->values[i] = radio_image[profile_registers[i]];
+    }
+
+    profile->flags = reg_profile->flags & MSP430_REG_PROFILE_POWER;
+    profile->patable_freq_i = reg_profile->radio_parms.patable_freq_i;
+    profile->valid = 1;
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Apply a register profile writing only the registers that differ from those in use. The Tx power
+// is kept unless the profile sets it. When the frequency changes the calibrations are forgotten and
+// the channel in use is calibrated again. Radio must be idle.
+void select_reg_profile(msp430_reg_select_t *select, uint32_t now)
+// ------------------------------------------------------------------------------------------------
+{
+    reg_profile_t *profile;
+    uint8_t       addr, changed, i;
+    uint8_t       freq_changed = 0;
+
+    select->flags = 0;
+    select->nb_writes = 0;
+
+    if ((select->index >= MSP430_REG_PROFILES) || !reg_profiles[select->index].valid)
+    {
+        select->flags = MSP430_REG_PROFILE_INVALID;
+        return;
+    }
+
+    profile = &reg_profiles[select->index];
+
+    for (i=0; i < RADIO_PROFILE_NB_REGS; i++)
+    {
+        addr = profile_registers[i];
+        changed = profile->values[i] ^ radio_shadow[addr];
+
+        if (!changed || ((addr == TI_CCxxx0_FREND0) && !(profile->flags & MSP430_REG_PROFILE_POWER)))
+        {
+            continue;
+        }
+
+        freq_changed |= frequency_register(addr, changed);
+        write_config(addr, profile->values[i]);
+        select->nb_writes++;
+    }
+
+    fifo_threshold(radio_shadow[TI_CCxxx0_FIFOTHR] & 0x0F);
+
+    if ((profile->flags & MSP430_REG_PROFILE_POWER) && (profile->patable_freq_i != patable_row))
+    {
+        TI_CC_SPIWriteBurstReg(TI_CCxxx0_PATABLE, (char *) patable[profile->patable_freq_i], 8);
+        patable_row = profile->patable_freq_i;
+        select->nb_writes++;
+    }
+
+    if (freq_changed)
+    {
+        radio_config_valid = 0; // the next initialization calibrates again
+        forget_calibrations();
+        select_channel(fscal_current ? fscal_current->channel : 0, 1, now);
+        select->flags |= MSP430_REG_PROFILE_RECAL;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the Rx and Tx FIFO threshold. At high data rates a lower threshold leaves more bytes in the
+// Tx FIFO and more room in the Rx FIFO when the threshold interrupt fires so that its latency
+// does not make them underflow or overflow. The bytes refilled or unloaded follow.
+void set_fifo_threshold(uint8_t fifo_thr)
+// ------------------------------------------------------------------------------------------------
+{
+    fifo_thr = fifo_threshold(fifo_thr);
+    write_config(TI_CCxxx0_FIFOTHR, (TI_CC_SPIReadReg(TI_CCxxx0_FIFOTHR) & 0xF0) + fifo_thr);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Limit the FIFO threshold to the highest used and set the bytes refilled or unloaded that follow
+uint8_t fifo_threshold(uint8_t fifo_thr)
+// ------------------------------------------------------------------------------------------------
+{
+    if (fifo_thr > RTX_THR_NORM)
+    {
+        fifo_thr = RTX_THR_NORM;
+    }
+
+    tx_fifo_refill = TX_FIFO_REFILL(fifo_thr);
+    rx_fifo_unload = RX_FIFO_UNLOAD(fifo_thr);
+    return fifo_thr;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select the PATABLE entry used for the next transmissions. Takes effect at the next Tx strobe.
+void set_tx_power(uint8_t patable_power_i)
+// ------------------------------------------------------------------------------------------------
+{
+    write_config(TI_CCxxx0_FREND0, 0x10 + (patable_power_i & 0x07)); // LODIV_BUF_CURRENT_TX kept at default
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select the state after a packet is sent (MCSM1 TXOFF_MODE): Rx if enabled else IDLE.
+// CCA_MODE and RXOFF_MODE are kept as set by init_radio.
+void set_turnaround(uint8_t enable)
+// ------------------------------------------------------------------------------------------------
+{
+    TI_CC_SPIWriteReg(TI_CCxxx0_MCSM1, 0x30 + (enable ? 0x03 : 0x00));
 }
 
 // ------------------------------------------------------------------------------------------------
-// Compensate for frequency offset by accumulating the frequency offset read from TI_CCxxx0_FREQEST
-// register and writing the resulting value to CCxxx0_FSCTRL0
-void freq_compensate()
+// Write configuration registers given as (address, value) pairs and replace each value by the one
+// read back. Addresses beyond the configuration registers are skipped. Radio is expected to be idle.
+// When the frequencies change the calibrations no longer hold: they are forgotten, the channel in
+// use is calibrated again and the next initialization resets.
+void write_registers(uint8_t *pairs, uint8_t nb_pairs, uint32_t now)
 // ------------------------------------------------------------------------------------------------
 {
-    frequency_offset_accumulator += (signed char) TI_CC_SPIReadStatus(TI_CCxxx0_FREQEST);
-    TI_CC_SPIWriteReg(TI_CCxxx0_FSCTRL0, (uint8_t) frequency_offset_accumulator);
+    uint8_t i, freq_changed = 0;
+
+    for (i=0; i < nb_pairs; i++, pairs += 2)
+    {
+        if (pairs[0] <= MSP430_REGISTERS_MAX_ADDR)
+        {
+            TI_CC_SPIWriteReg(pairs[0], pairs[1]);
+            pairs[1] = TI_CC_SPIReadReg(pairs[0]);
+
+            freq_changed |= frequency_register(pairs[0], pairs[1] ^ radio_shadow[pairs[0]]);
+            radio_shadow[pairs[0]] = pairs[1];
+        }
+    }
+
+    if (freq_changed)
+    {
+        radio_config_valid = 0; // the next initialization calibrates again
+        forget_calibrations();
+        select_channel(fscal_current ? fscal_current->channel : 0, 1, now);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Track the frequency offset after a packet is received. FREQEST is the offset left after the
+// current FSCTRL0 compensation. A quarter of it is added to the accumulated offset so that noisy
+// estimates are smoothed over a few packets (first order loop). Packets with a bad CRC are ignored.
+// The result goes to FSCTRL0 between packets (see apply_freq_offset).
+void freq_compensate(uint8_t crc_ok)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!frequency_offset_tracking || !crc_ok)
+    {
+        return;
+    }
+
+    frequency_offset_estimate = (int8_t) TI_CC_SPIReadStatus(TI_CCxxx0_FREQEST);
+    frequency_offset_accumulator += frequency_offset_estimate * 4; // gain 1/4 in 1/16 steps
+    frequency_offset_updates++;
+
+    if (frequency_offset_accumulator > 127*16)
+    {
+        frequency_offset_accumulator = 127*16;
+    }
+    else if (frequency_offset_accumulator < -128*16)
+    {
+        frequency_offset_accumulator = -128*16;
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -397,6 +1031,37 @@ void get_radio_status(uint8_t *status_regs)
     }
 }
 
+// ------------------------------------------------------------------------------------------------
+// Set the reception filters unless it is a query. The filters in use and their counters are
+// returned. Radio is expected to be idle.
+void set_filter(msp430_filter_t *filter_cmd)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t flags = filter_cmd->flags;
+
+    if (!(flags & MSP430_FILTER_QUERY))
+    {
+        filter.flags      = flags & (MSP430_FILTER_ADDRESS | MSP430_FILTER_PAYLOAD);
+        filter.address    = filter_cmd->address;
+        filter.tx_address = filter_cmd->tx_address;
+        filter.offset     = filter_cmd->offset;
+        filter.length     = (filter_cmd->length > MSP430_FILTER_MAX_BYTES ? MSP430_FILTER_MAX_BYTES : filter_cmd->length);
+        memcpy(filter.value, filter_cmd->value, MSP430_FILTER_MAX_BYTES);
+        memcpy(filter.mask, filter_cmd->mask, MSP430_FILTER_MAX_BYTES);
+
+        TI_CC_SPIWriteReg(TI_CCxxx0_ADDR, filter.address);
+        TI_CC_SPIWriteReg(TI_CCxxx0_PKTCTRL1, 0x04 + (filter.flags & MSP430_FILTER_ADDRESS ? 0x03 : 0x00));
+    }
+
+    memcpy(filter_cmd, &filter, sizeof(msp430_filter_t));
+
+    if (flags & MSP430_FILTER_RESET)
+    {
+        filter.nb_address_drops = 0;
+        filter.nb_payload_drops = 0;
+    }
+}
+
 // ------------------------------------------------------------------------------------------------
 // Setup for sending a block of data up to 255 bytes (packet for CC1101)
 // byte 0  : data block size
@@ -406,17 +1071,28 @@ void get_radio_status(uint8_t *status_regs)
 uint8_t transmit_setup(uint8_t *dataBlock)
 // ------------------------------------------------------------------------------------------------
 {
+    uint8_t address_size = (filter.flags & MSP430_FILTER_ADDRESS ? 1 : 0);
+    PROFILE_START(profile_start);
+
     bytes_remaining = dataBlock[0]; // initial count
     pDataBlock = &dataBlock[1];     // block of data to send
     //pDataBlock = xDataBlock;
 
-    TI_CC_SPIWriteReg(TI_CCxxx0_PKTLEN, bytes_remaining); // Packet length.
+    TI_CC_SPIWriteReg(TI_CCxxx0_PKTLEN, bytes_remaining + address_size); // Packet length.
     TI_CC_SPIWriteReg(TI_CCxxx0_IOCFG2, 0x02); // GDO2 output pin config TX mode
 
-    bytes_processed = (bytes_remaining > TI_CCxxx0_FIFO_SIZE-1 ? TI_CCxxx0_FIFO_SIZE-1 : bytes_remaining);
+    apply_freq_offset();
+
+    if (address_size) // checked by the receivers before anything goes to their Rx FIFO
+    {
+        TI_CC_SPIWriteReg(TI_CCxxx0_TXFIFO, filter.tx_address);
+    }
+
+    bytes_processed = (bytes_remaining > TI_CCxxx0_FIFO_SIZE-1-address_size ? TI_CCxxx0_FIFO_SIZE-1-address_size : bytes_remaining);
     TI_CC_SPIWriteBurstReg(TI_CCxxx0_TXFIFO, pDataBlock, bytes_processed);
     bytes_remaining -= bytes_processed;
 
+    PROFILE_END(MSP430_PROFILE_TX_SETUP, profile_start);
     return bytes_remaining;
 }
 
@@ -427,15 +1103,17 @@ uint8_t transmit_more()
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t bytes_to_send;
+    PROFILE_START(profile_start);
 
     if (bytes_remaining)
     {
-        bytes_to_send = (bytes_remaining < TX_FIFO_REFILL ? bytes_remaining : TX_FIFO_REFILL);
+        bytes_to_send = (bytes_remaining < tx_fifo_refill ? bytes_remaining : tx_fifo_refill);
         TI_CC_SPIWriteBurstReg(TI_CCxxx0_TXFIFO, &pDataBlock[bytes_processed], bytes_to_send);
         bytes_remaining -= bytes_to_send;
         bytes_processed += bytes_to_send;
     }
 
+    PROFILE_END(MSP430_PROFILE_TX_REFILL, profile_start);
     return bytes_remaining;
 }
 
@@ -465,11 +1143,22 @@ uint8_t transmit_end()
 void receive_setup(uint8_t *dataBlock)
 // ------------------------------------------------------------------------------------------------
 {
-    bytes_remaining = dataBlock[0] + 2; // + RSSI + LQI
+    flush_rx_fifo();                  // Flush anything that may be left in the Rx FIFO
+    receive_rearm(dataBlock);
+    apply_freq_offset();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set up for reception while the radio goes from Tx to Rx by itself (TXOFF_MODE = RX). The Rx
+// FIFO cannot be flushed in Rx and was left empty by the last reception anyway.
+void receive_rearm(uint8_t *dataBlock)
+// ------------------------------------------------------------------------------------------------
+{
+    rx_address_pending = (filter.flags & MSP430_FILTER_ADDRESS ? 1 : 0);
+    bytes_remaining = dataBlock[0] + 2 + rx_address_pending; // + RSSI + LQI (+ address)
     bytes_processed = 0;
     pDataBlock = &dataBlock[1];
-    flush_rx_fifo();                  // Flush anything that may be left in the Rx FIFO
-    TI_CC_SPIWriteReg(TI_CCxxx0_PKTLEN, dataBlock[0]);
+    TI_CC_SPIWriteReg(TI_CCxxx0_PKTLEN, dataBlock[0] + rx_address_pending);
     TI_CC_SPIWriteReg(TI_CCxxx0_IOCFG2, 0x00); // GDO2 output pin config RX mode
 }
 
@@ -479,9 +1168,39 @@ void receive_setup(uint8_t *dataBlock)
 void receive_more()
 // ------------------------------------------------------------------------------------------------
 {
-    TI_CC_SPIReadBurstReg(TI_CCxxx0_RXFIFO, &pDataBlock[bytes_processed], RX_FIFO_UNLOAD);
-    bytes_remaining -= RX_FIFO_UNLOAD;
-    bytes_processed += RX_FIFO_UNLOAD;
+    uint8_t bytes_to_read = rx_fifo_unload;
+    PROFILE_START(profile_start);
+
+    if (rx_address_pending) // address byte is not part of the block
+    {
+        TI_CC_SPIReadReg(TI_CCxxx0_RXFIFO);
+        rx_address_pending = 0;
+        bytes_remaining--;
+        bytes_to_read--;
+    }
+
+    TI_CC_SPIReadBurstReg(TI_CCxxx0_RXFIFO, &pDataBlock[bytes_processed], bytes_to_read);
+    bytes_remaining -= bytes_to_read;
+    bytes_processed += bytes_to_read;
+
+    PROFILE_END(MSP430_PROFILE_RX_UNLOAD, profile_start);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Called at end of packet condition on GDO0 before receive_end. Returns 0 if the rest of the packet
+// is not in the Rx FIFO: the radio discarded it after the address check.
+uint8_t receive_complete()
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t rx_bytes = TI_CC_SPIReadStatus(TI_CCxxx0_RXBYTES);
+
+    if ((rx_bytes & 0x80) || ((rx_bytes & 0x7F) >= bytes_remaining)) // overflow is reported by receive_end
+    {
+        return 1;
+    }
+
+    filter.nb_address_drops++;
+    return 0;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -492,6 +1211,14 @@ uint8_t receive_end()
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t status;
+    PROFILE_START(profile_start);
+
+    if (rx_address_pending) // short block: address byte is still there
+    {
+        TI_CC_SPIReadReg(TI_CCxxx0_RXFIFO);
+        rx_address_pending = 0;
+        bytes_remaining--;
+    }
 
     TI_CC_SPIReadBurstReg(TI_CCxxx0_RXFIFO, &pDataBlock[bytes_processed], bytes_remaining);
     bytes_remaining = 0;
@@ -499,9 +1226,35 @@ uint8_t receive_end()
 
     status = TI_CC_SPIReadStatus(TI_CCxxx0_RXBYTES);
 
+    PROFILE_END(MSP430_PROFILE_RX_END, profile_start);
     return (status & 0x80)>>7;
 }
 
+// ------------------------------------------------------------------------------------------------
+// Called after receive_end on a good block. Returns 0 if the block does not match the payload
+// filter: it is dropped and the radio is set to receive again.
+uint8_t receive_accept()
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t i;
+
+    if (!(filter.flags & MSP430_FILTER_PAYLOAD))
+    {
+        return 1;
+    }
+
+    for (i=0; i < filter.length; i++)
+    {
+        if ((pDataBlock[filter.offset + i] ^ filter.value[i]) & filter.mask[i])
+        {
+            filter.nb_payload_drops++;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Cancel a started Rx session. Mainly used to handle timeout conditions.
 void receive_cancel()
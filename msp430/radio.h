@@ -16,32 +16,50 @@
 #include "TI_CC_CC1100-CC2500.h"
 #include "msp430_interface.h"
 
-#define TX_FIFO_REFILL 60 // With the default FIFO thresholds selected this is the number of bytes to refill the Tx FIFO
-#define RX_FIFO_UNLOAD 59 // With the default FIFO thresholds selected this is the number of bytes to unload from the Rx FIFO
-#define RTX_THR_NORM   14 // Tx FIFO: 5 - Rx FIFO: 60
-//#define TX_FIFO_REFILL 56 // With the default FIFO thresholds selected this is the number of bytes to refill the Tx FIFO
-//#define RX_FIFO_UNLOAD 55 // With the default FIFO thresholds selected this is the number of bytes to unload from the Rx FIFO
-//#define RTX_THR_NORM   13 // Tx FIFO: 9 - Rx FIFO: 56
+#define RTX_THR_NORM   14 // Tx FIFO: 5 - Rx FIFO: 60. Highest FIFO threshold used.
+#define TX_FIFO_REFILL(thr) (4*(thr) + 4) // Bytes to refill the Tx FIFO with when it gets below the threshold
+#define RX_FIFO_UNLOAD(thr) (4*(thr) + 3) // Bytes to unload from the Rx FIFO when it gets to the threshold. One is left.
 #define RX_THR_START   0  // Rx FIFO: 4 This is to make sure counter byte has been received
 
 #define RADIO_BUFSIZE  (TI_CCxxx0_PACKET_SIZE+2)
+#define RADIO_RESET_LOOPS 10000 // Status reads while waiting for the crystal oscillator after a reset
+#define RADIO_IDLE_LOOPS  2000  // Status reads while waiting for IDLE from Rx or Tx
+#define RADIO_PROFILE_NB_REGS 15 // Registers set by a register profile
 
 void    init_radio_spi();
-void    reset_radio();
-void    init_radio(msp430_radio_parms_t *radio_parms);
+uint8_t reset_radio();
+void    init_radio(msp430_radio_parms_t *radio_parms, msp430_init_status_t *status);
+void    set_modem(msp430_modem_parms_t *modem_parms);
+uint8_t load_reg_profile(msp430_reg_profile_t *reg_profile);
+void    select_reg_profile(msp430_reg_select_t *select, uint32_t now);
+void    set_fifo_threshold(uint8_t fifo_thr);
+void    set_tx_power(uint8_t patable_power_i);
+void    set_turnaround(uint8_t enable);
+void    init_calibration(uint8_t keep, uint32_t now);
+void    set_calibration(msp430_calibration_t *cal, uint32_t now);
+void    check_calibration(uint32_t now);
+uint8_t set_channel(uint8_t channel, uint32_t now);
+void    sweep_rssi(msp430_sweep_t *sweep, uint8_t *rssi, uint32_t now);
+void    write_registers(uint8_t *pairs, uint8_t nb_pairs, uint32_t now);
 void    init_freq_offset();
+void    set_freq_offset(msp430_afc_t *afc);
+void    apply_freq_offset();
 void    get_radio_status(uint8_t *status_regs);
+void    set_filter(msp430_filter_t *filter_cmd);
 uint8_t transmit_setup(uint8_t *dataBlock);
 uint8_t transmit_more();
 void    start_tx();
 uint8_t transmit_end();
 void    receive_setup(uint8_t *dataBlock);
+void    receive_rearm(uint8_t *dataBlock);
 void    receive_more();
+uint8_t receive_complete();
 uint8_t receive_end();
+uint8_t receive_accept();
 void    receive_cancel();
 void    start_rx();
 void    flush_rx_fifo();
 void    flush_tx_fifo();
-void    freq_compensate();
+void    freq_compensate(uint8_t crc_ok);
 
 #endif // _RADIO_H_
\ No newline at end of file
@@ -0,0 +1,197 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Automatic frequency control and persistence of the learned offset          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "afc.h"
+#include "radio.h"
+#include "util.h"
+
+static int8_t   afc_saved_offset; // Offset last saved or loaded
+static uint64_t afc_last_poll;    // Time of the last poll in microseconds
+
+// === Static functions declarations ==============================================================
+
+static int afc_read_entries(char *filename, uint32_t *freqs, int *offsets);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Read the offsets file. Each line has a frequency in Hz and the offset in FSCTRL0 steps.
+// Returns the number of entries read
+int afc_read_entries(char *filename, uint32_t *freqs, int *offsets)
+// ------------------------------------------------------------------------------------------------
+{
+    FILE *afc_file = fopen(filename, "r");
+    int  nb_entries = 0;
+
+    if (!afc_file)
+    {
+        return 0;
+    }
+
+    while ((nb_entries < AFC_MAX_ENTRIES) && (fscanf(afc_file, "%u %d", &freqs[nb_entries], &offsets[nb_entries]) == 2))
+    {
+        nb_entries++;
+    }
+
+    fclose(afc_file);
+    return nb_entries;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Offset in ppm of the given frequency corresponding to an offset in FSCTRL0 steps
+float afc_offset_ppm(int8_t freq_offset, uint32_t freq_hz)
+// ------------------------------------------------------------------------------------------------
+{
+    return (freq_offset * ((F_XTAL_MHZ * 1e6) / (1<<14)) / freq_hz) * 1e6;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the offset saved for the frequency. Returns 1 if found else 0
+int afc_load(char *filename, uint32_t freq_hz, int8_t *freq_offset)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t freqs[AFC_MAX_ENTRIES];
+    int      offsets[AFC_MAX_ENTRIES];
+    int      i, nb_entries = afc_read_entries(filename, freqs, offsets);
+
+    for (i=0; i < nb_entries; i++)
+    {
+        if (freqs[i] == freq_hz)
+        {
+            *freq_offset = (int8_t) offsets[i];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Save the offset for the frequency keeping the other frequencies. The file is replaced at once.
+// Returns 0 if successful else -1
+int afc_save(char *filename, uint32_t freq_hz, int8_t freq_offset)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t freqs[AFC_MAX_ENTRIES];
+    int      offsets[AFC_MAX_ENTRIES];
+    char     tmp_filename[1024];
+    FILE     *afc_file;
+    int      i, nb_entries = afc_read_entries(filename, freqs, offsets);
+
+    for (i=0; (i < nb_entries) && (freqs[i] != freq_hz); i++);
+
+    if (i == nb_entries)
+    {
+        if (nb_entries == AFC_MAX_ENTRIES) // drop the oldest and append so the file stays oldest first
+        {
+            memmove(freqs, &freqs[1], (AFC_MAX_ENTRIES - 1) * sizeof(uint32_t));
+            memmove(offsets, &offsets[1], (AFC_MAX_ENTRIES - 1) * sizeof(int));
+            i = AFC_MAX_ENTRIES - 1;
+        }
+        else
+        {
+            nb_entries++;
+        }
+    }
+
+    freqs[i] = freq_hz;
+    offsets[i] = freq_offset;
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    afc_file = fopen(tmp_filename, "w");
+
+    if (!afc_file)
+    {
+        return -1;
+    }
+
+    for (i=0; i < nb_entries; i++)
+    {
+        fprintf(afc_file, "%u %d\n", freqs[i], offsets[i]);
+    }
+
+    fclose(afc_file);
+    return rename(tmp_filename, filename);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Start frequency offset tracking from the offset saved for the frequency if any. Radio must be
+// initialized and idle. Returns 0 if successful else -1
+int afc_start(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_afc_t afc;
+
+    if (!arguments->afc)
+    {
+        return 0;
+    }
+
+    afc.mode = MSP430_AFC_TRACK;
+    afc.freq_offset = 0;
+
+    if (afc_load(arguments->afc_filename, arguments->freq_hz, &afc.freq_offset))
+    {
+        afc.mode |= MSP430_AFC_LOAD;
+        verbprintf(1, "AFC: starting from %d steps (%.2f ppm)\n",
+            afc.freq_offset,
+            afc_offset_ppm(afc.freq_offset, arguments->freq_hz));
+    }
+
+    afc_saved_offset = afc.freq_offset;
+    afc_last_poll = now_us();
+
+    return radio_afc(serial_parms, &afc);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the tracked offset from time to time and save it when it has changed. Radio must be idle.
+void afc_poll(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_afc_t afc;
+    uint64_t     timestamp = now_us();
+
+    if (!arguments->afc || (timestamp - afc_last_poll < AFC_SAVE_PERIOD))
+    {
+        return;
+    }
+
+    afc_last_poll = timestamp;
+    afc.mode = MSP430_AFC_TRACK;
+
+    if (radio_afc(serial_parms, &afc) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "AFC: cannot get state" ANSI_COLOR_RESET "\n");
+        return;
+    }
+
+    verbprintft(2, "AFC: offset %d steps (%.2f ppm) last estimate %d after %d updates\n",
+        afc.freq_offset,
+        afc_offset_ppm(afc.freq_offset, arguments->freq_hz),
+        afc.last_estimate,
+        afc.nb_updates);
+
+    if (afc.freq_offset != afc_saved_offset)
+    {
+        if (afc_save(arguments->afc_filename, arguments->freq_hz, afc.freq_offset) < 0)
+        {
+            verbprintft(1, ANSI_COLOR_RED "AFC: cannot save offset to %s" ANSI_COLOR_RESET "\n", arguments->afc_filename);
+        }
+        else
+        {
+            afc_saved_offset = afc.freq_offset;
+        }
+    }
+}
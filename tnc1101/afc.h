@@ -0,0 +1,27 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Automatic frequency control and persistence of the learned offset          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _AFC_H_
+#define _AFC_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "serial.h"
+
+#define AFC_MAX_ENTRIES   64        // Maximum number of frequencies in the offsets file
+#define AFC_SAVE_PERIOD   60000000  // Minimum time between two saves in microseconds
+
+int      afc_load(char *filename, uint32_t freq_hz, int8_t *freq_offset);
+int      afc_save(char *filename, uint32_t freq_hz, int8_t freq_offset);
+int      afc_start(serial_t *serial_parms, arguments_t *arguments);
+void     afc_poll(serial_t *serial_parms, arguments_t *arguments);
+float    afc_offset_ppm(int8_t freq_offset, uint32_t freq_hz);
+
+#endif // _AFC_H_
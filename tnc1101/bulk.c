@@ -38,10 +38,6 @@ int bulk_transmit(FILE *fp,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     memset(buffer, 0, (1<<16));
     i = 0;
@@ -56,7 +52,6 @@ int bulk_transmit(FILE *fp,
             buffer,
             arguments->packet_length,
             nbytes,
-            arguments->block_delay,
             block_time);
 
         if (bytes_left)
@@ -90,10 +85,6 @@ int bulk_receive(FILE *fp,
         fprintf(stderr, "Begin: cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     block_time = (((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2)) + arguments->block_delay;
 
@@ -117,22 +108,11 @@ int bulk_receive(FILE *fp,
             {
                 verbprintf(1, "Cancel reception failed\n");
 
-                if (!init_radio(serial_parms, radio_parms, arguments))
-                {
-                    fprintf(stderr, "End: cannot initialize radio (1).\n");
-                }
-                else
-                {
-                    usleep(100000);
-                }
-
-                if (!init_radio(serial_parms, radio_parms, arguments))
-                {
-                    fprintf(stderr, "End: cannot initialize radio (2).\n");
-                }
-                else
+                // The first acknowledgement read may be a late one of the cancel
+                if (!init_radio(serial_parms, radio_parms, arguments)
+                    && !init_radio(serial_parms, radio_parms, arguments))
                 {
-                    usleep(100000);
+                    fprintf(stderr, "End: cannot initialize radio.\n");
                 }
             }
 
@@ -0,0 +1,256 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Synchronization of the MSP430 timestamps with the host monotonic clock     */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include "main.h"
+#include "clocksync.h"
+#include "radio.h"
+#include "util.h"
+
+#define CLOCKSYNC_MAX_ERROR 100000 // A sample this far in microseconds from the fit means the MSP430 was reset
+
+static clocksync_sample_t clocksync_samples[CLOCKSYNC_HISTORY]; // Ring of the last updates
+static int      clocksync_nb_samples; // Number of valid samples in the ring
+static int      clocksync_index = CLOCKSYNC_HISTORY - 1; // Index of the most recent sample
+static uint64_t clocksync_last_poll;  // Host time of the last update in microseconds
+static double   clocksync_mean_mcu;   // Mean MSP430 time of the samples relative to the most recent one
+static double   clocksync_mean_host;  // Mean host time of the samples relative to the most recent one
+static double   clocksync_slope = 1.0; // Host microseconds per MSP430 microsecond
+
+// === Static functions declarations ==============================================================
+
+static int      clocksync_exchange(serial_t *serial_parms, clocksync_sample_t *sample);
+static uint64_t clocksync_unwrap(uint32_t mcu_us);
+static void     clocksync_fit();
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Get the MSP430 time once and note the host time at the middle of the exchange.
+// Returns 0 if successful else -1
+int clocksync_exchange(serial_t *serial_parms, clocksync_sample_t *sample)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t mcu_us;
+    uint64_t start_us, end_us;
+
+    start_us = monotonic_us();
+
+    if (radio_get_time(serial_parms, &mcu_us) < 0)
+    {
+        return -1;
+    }
+
+    end_us = monotonic_us();
+
+    sample->mcu_us  = clocksync_unwrap(mcu_us);
+    sample->rtt_us  = end_us - start_us;
+    sample->host_us = start_us + sample->rtt_us / 2;
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Extend a 32 bit MSP430 time to 64 bits. The current MSP430 time is predicted from the host
+// clock so that the timestamps of recent blocks are unwrapped correctly however long ago the
+// last update was made.
+uint64_t clocksync_unwrap(uint32_t mcu_us)
+// ------------------------------------------------------------------------------------------------
+{
+    clocksync_sample_t *last;
+    uint64_t           predicted_us;
+
+    if (clocksync_nb_samples == 0)
+    {
+        return mcu_us;
+    }
+
+    last = &clocksync_samples[clocksync_index];
+    predicted_us = last->mcu_us + (int64_t) ((monotonic_us() - last->host_us) / clocksync_slope);
+
+    return predicted_us + (int32_t) (mcu_us - (uint32_t) predicted_us);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Least squares fit of the host time against the MSP430 time over the samples in the ring. Times
+// are taken relative to the most recent sample to keep the precision of doubles.
+void clocksync_fit()
+// ------------------------------------------------------------------------------------------------
+{
+    clocksync_sample_t *last = &clocksync_samples[clocksync_index];
+    double sum_mcu = 0.0, sum_host = 0.0, sum_xy = 0.0, sum_xx = 0.0;
+    double x, y;
+    int    i;
+
+    for (i=0; i < clocksync_nb_samples; i++)
+    {
+        sum_mcu  += (int64_t) (clocksync_samples[i].mcu_us - last->mcu_us);
+        sum_host += (int64_t) (clocksync_samples[i].host_us - last->host_us);
+    }
+
+    clocksync_mean_mcu  = sum_mcu / clocksync_nb_samples;
+    clocksync_mean_host = sum_host / clocksync_nb_samples;
+
+    for (i=0; i < clocksync_nb_samples; i++)
+    {
+        x = (int64_t) (clocksync_samples[i].mcu_us - last->mcu_us) - clocksync_mean_mcu;
+        y = (int64_t) (clocksync_samples[i].host_us - last->host_us) - clocksync_mean_host;
+        sum_xy += x * y;
+        sum_xx += x * x;
+    }
+
+    // one second between the oldest and newest samples at least before trusting the skew
+    if ((clocksync_nb_samples > 1) && (sum_xx > 1e12 / clocksync_nb_samples))
+    {
+        clocksync_slope = sum_xy / sum_xx;
+    }
+    else
+    {
+        clocksync_slope = 1.0;
+    }
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Forget all samples
+void clocksync_init()
+// ------------------------------------------------------------------------------------------------
+{
+    clocksync_nb_samples = 0;
+    clocksync_index = CLOCKSYNC_HISTORY - 1;
+    clocksync_last_poll = 0;
+    clocksync_mean_mcu = 0.0;
+    clocksync_mean_host = 0.0;
+    clocksync_slope = 1.0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compare the clocks a few times and add the exchange with the shortest round trip to the fit.
+// Radio must be idle. Returns 0 if successful else -1
+int clocksync_update(serial_t *serial_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    clocksync_sample_t sample, best;
+    int i;
+
+    best.rtt_us = UINT32_MAX;
+    clocksync_last_poll = monotonic_us();
+
+    for (i=0; i < CLOCKSYNC_EXCHANGES; i++)
+    {
+        if ((clocksync_exchange(serial_parms, &sample) == 0) && (sample.rtt_us < best.rtt_us))
+        {
+            best = sample;
+        }
+    }
+
+    if (best.rtt_us > CLOCKSYNC_MAX_RTT)
+    {
+        verbprintft(1, ANSI_COLOR_RED "CLOCKSYNC: no usable exchange with the MSP430" ANSI_COLOR_RESET "\n");
+        return -1;
+    }
+
+    if (clocksync_nb_samples > 0)
+    {
+        int64_t error_us = best.host_us - clocksync_host_us((uint32_t) best.mcu_us);
+
+        if ((error_us > CLOCKSYNC_MAX_ERROR) || (error_us < -CLOCKSYNC_MAX_ERROR))
+        {
+            verbprintft(1, "CLOCKSYNC: MSP430 clock jumped by %lld us. Restarting\n", (long long) error_us);
+            clocksync_init();
+            best.mcu_us = (uint32_t) best.mcu_us;
+            clocksync_last_poll = best.host_us;
+        }
+    }
+
+    clocksync_index = (clocksync_index + 1) % CLOCKSYNC_HISTORY;
+    clocksync_samples[clocksync_index] = best;
+
+    if (clocksync_nb_samples < CLOCKSYNC_HISTORY)
+    {
+        clocksync_nb_samples++;
+    }
+
+    clocksync_fit();
+    clocksync_print(3);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Update the clock comparison from time to time. Radio must be idle.
+void clocksync_poll(serial_t *serial_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    if (monotonic_us() - clocksync_last_poll < CLOCKSYNC_PERIOD)
+    {
+        return;
+    }
+
+    clocksync_update(serial_parms);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if MSP430 times can be converted to host times else 0
+int clocksync_synced()
+// ------------------------------------------------------------------------------------------------
+{
+    return (clocksync_nb_samples > 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Convert a MSP430 time to the host monotonic clock in microseconds. Returns 0 if not synced.
+uint64_t clocksync_host_us(uint32_t mcu_us)
+// ------------------------------------------------------------------------------------------------
+{
+    clocksync_sample_t *last = &clocksync_samples[clocksync_index];
+    double x;
+
+    if (clocksync_nb_samples == 0)
+    {
+        return 0;
+    }
+
+    x = (int64_t) (clocksync_unwrap(mcu_us) - last->mcu_us) - clocksync_mean_mcu;
+    return last->host_us + (int64_t) (clocksync_mean_host + clocksync_slope * x);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Convert a host monotonic time in microseconds to the MSP430 clock. Returns 0 if not synced.
+uint32_t clocksync_mcu_us(uint64_t host_us)
+// ------------------------------------------------------------------------------------------------
+{
+    clocksync_sample_t *last = &clocksync_samples[clocksync_index];
+    double y;
+
+    if (clocksync_nb_samples == 0)
+    {
+        return 0;
+    }
+
+    y = (int64_t) (host_us - last->host_us) - clocksync_mean_host;
+    return (uint32_t) (last->mcu_us + (int64_t) (clocksync_mean_mcu + y / clocksync_slope));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print the state of the clock comparison
+void clocksync_print(int verb_level)
+// ------------------------------------------------------------------------------------------------
+{
+    if (clocksync_nb_samples == 0)
+    {
+        verbprintf(verb_level, "CLOCKSYNC: not synced\n");
+        return;
+    }
+
+    verbprintft(verb_level, "CLOCKSYNC: %d samples, round trip %u us, MSP430 clock skew %.1f ppm\n",
+        clocksync_nb_samples,
+        clocksync_samples[clocksync_index].rtt_us,
+        (1.0 / clocksync_slope - 1.0) * 1e6);
+}
@@ -0,0 +1,38 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Synchronization of the MSP430 timestamps with the host monotonic clock     */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _CLOCKSYNC_H_
+#define _CLOCKSYNC_H_
+
+#include <stdint.h>
+
+#include "serial.h"
+
+#define CLOCKSYNC_EXCHANGES   8         // Time requests per update. The one with the shortest round trip is kept.
+#define CLOCKSYNC_HISTORY     16        // Number of updates the offset and skew are fitted on
+#define CLOCKSYNC_PERIOD      10000000  // Minimum time between two updates in microseconds
+#define CLOCKSYNC_MAX_RTT     5000      // Samples with a longer round trip in microseconds are discarded
+
+// One clock comparison
+typedef struct clocksync_sample_s
+{
+    uint64_t mcu_us;  // MSP430 time unwrapped to 64 bits
+    uint64_t host_us; // Host monotonic time at the middle of the exchange
+    uint32_t rtt_us;  // Round trip time of the exchange
+} clocksync_sample_t;
+
+void     clocksync_init();
+int      clocksync_update(serial_t *serial_parms);
+void     clocksync_poll(serial_t *serial_parms);
+int      clocksync_synced();
+uint64_t clocksync_host_us(uint32_t mcu_us);
+uint32_t clocksync_mcu_us(uint64_t host_us);
+void     clocksync_print(int verb_level);
+
+#endif // _CLOCKSYNC_H_
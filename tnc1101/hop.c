@@ -0,0 +1,511 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Frequency hopping: hop sequence, beacon synchronization and blacklisting   */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "hop.h"
+#include "radio.h"
+#include "clocksync.h"
+#include "util.h"
+
+static uint8_t      hop_nb_channels;      // Number of channels hopped over (0: not hopping)
+static uint8_t      hop_master;           // This station times the hops and sends the beacons
+static uint8_t      hop_sequence[MSP430_HOP_MAX_CHANNELS]; // Channel of each slot before blacklisting
+static uint16_t     hop_blacklist;        // Channels skipped (bit n for channel n)
+static uint8_t      hop_table_changed;    // Blacklist changed since the table was sent to the MSP430
+static msp430_hop_t hop_state;            // Table and slot timing as last returned by the MSP430
+static uint8_t      hop_synced;           // Slot timing known: always for the master
+static uint32_t     hop_next_beacon_slot; // Master: slot of the next beacon
+static uint64_t     hop_last_beacon;      // Host time of the last beacon sent or received
+static uint8_t      hop_park_index;       // Follower: index in the sequence of the channel listened to
+static uint64_t     hop_park_since;       // Follower: host time it started to listen to this channel
+static uint32_t     hop_sync_delay_us;    // From the MSP430 stamp of a beacon to its sync word on air
+static uint32_t     hop_block_time;       // Acknowledgement timeout of a beacon
+static uint32_t     hop_beacons;          // Beacons sent or received
+static uint32_t     hop_resyncs;          // Slot timing corrections of a follower
+static hop_channel_stats_t hop_stats[MSP430_HOP_MAX_CHANNELS];
+
+// === Static functions declarations ==============================================================
+
+static void     hop_make_sequence(uint32_t seed, uint8_t nb_channels);
+static void     hop_make_table(msp430_hop_t *hop);
+static uint32_t hop_slot_at(uint32_t mcu_us);
+static void     hop_observe(uint8_t crc_ok);
+static void     hop_blacklist_expire();
+static int      hop_send_beacon(serial_t *serial_parms, arguments_t *arguments);
+static int      hop_park(serial_t *serial_parms);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Shuffle the channels with a xorshift generator seeded by the seed all stations share
+void hop_make_sequence(uint32_t seed, uint8_t nb_channels)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t x = (seed ? seed : 0x12345678);
+    uint8_t  i, j, channel;
+
+    for (i=0; i < nb_channels; i++)
+    {
+        hop_sequence[i] = i;
+    }
+
+    for (i=nb_channels-1; i > 0; i--)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        j = x % (i+1);
+        channel = hop_sequence[i];
+        hop_sequence[i] = hop_sequence[j];
+        hop_sequence[j] = channel;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Make the MSP430 table from the sequence. The slots of a blacklisted channel go to the next
+// channel of the sequence that is not blacklisted so that all stations agree given the blacklist.
+void hop_make_table(msp430_hop_t *hop)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t i, j;
+
+    hop->nb_channels = hop_nb_channels;
+
+    for (i=0; i < hop_nb_channels; i++)
+    {
+        for (j=0; (j < hop_nb_channels-1) && (hop_blacklist & (1<<hop_sequence[(i+j) % hop_nb_channels])); j++);
+
+        hop->channels[i] = hop_sequence[(i+j) % hop_nb_channels];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Slot in progress at the given MSP430 time according to the last state returned by the MSP430
+uint32_t hop_slot_at(uint32_t mcu_us)
+// ------------------------------------------------------------------------------------------------
+{
+    int32_t elapsed_us = mcu_us - hop_state.slot_start_us;
+
+    if (elapsed_us >= 0)
+    {
+        return hop_state.slot + elapsed_us / hop_state.dwell_us;
+    }
+    else
+    {
+        return hop_state.slot - ((-elapsed_us - 1) / hop_state.dwell_us + 1);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Account for a packet received on the channel of its sync word. The master blacklists channels
+// with too many errors keeping half of the channels at least.
+void hop_observe(uint8_t crc_ok)
+// ------------------------------------------------------------------------------------------------
+{
+    hop_channel_stats_t *stats;
+    uint32_t slot;
+    uint8_t  channel, i, nb_blacklisted = 0;
+
+    if (!hop_nb_channels)
+    {
+        return;
+    }
+
+    slot = ((hop_state.mode & MSP430_HOP_ENABLE) ? hop_slot_at(radio_timing.rx_sync_mcu_us) : hop_state.slot);
+    channel = hop_state.channels[slot % hop_nb_channels];
+    stats = &hop_stats[channel];
+
+    if (crc_ok)
+    {
+        stats->ok += 1.0;
+        stats->total_ok++;
+    }
+    else
+    {
+        stats->ko += 1.0;
+        stats->total_ko++;
+    }
+
+    if (stats->ok + stats->ko > HOP_STATS_WINDOW)
+    {
+        stats->ok /= 2.0;
+        stats->ko /= 2.0;
+    }
+
+    if (!hop_master || stats->blacklist_end || (stats->ok + stats->ko < HOP_BLACKLIST_MIN) || (stats->ko <= HOP_BLACKLIST_PER * (stats->ok + stats->ko)))
+    {
+        return;
+    }
+
+    for (i=0; i < hop_nb_channels; i++)
+    {
+        nb_blacklisted += ((hop_blacklist >> i) & 1);
+    }
+
+    if (2 * (nb_blacklisted + 1) > hop_nb_channels)
+    {
+        return;
+    }
+
+    verbprintft(1, "HOP: channel %d blacklisted (PER %.2f)\n", channel, stats->ko / (stats->ok + stats->ko));
+    stats->blacklist_end = monotonic_us() + HOP_BLACKLIST_TIME;
+    hop_blacklist |= (1<<channel);
+    hop_table_changed = 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Give blacklisted channels another chance after some time with fresh statistics
+void hop_blacklist_expire()
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t timestamp = monotonic_us();
+    uint8_t  channel;
+
+    for (channel=0; channel < hop_nb_channels; channel++)
+    {
+        if (hop_stats[channel].blacklist_end && (timestamp >= hop_stats[channel].blacklist_end))
+        {
+            verbprintft(1, "HOP: channel %d back in use\n", channel);
+            hop_stats[channel].blacklist_end = 0;
+            hop_stats[channel].ok = 0.0;
+            hop_stats[channel].ko = 0.0;
+            hop_blacklist &= ~(1<<channel);
+            hop_table_changed = 1;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send a beacon at full power. Sends the table to the MSP430 first if the blacklist changed.
+// Radio must be idle. Returns 0 if successful else -1
+int hop_send_beacon(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    hop_beacon_t beacon;
+
+    if (hop_table_changed)
+    {
+        hop_make_table(&hop_state);
+        hop_state.mode = MSP430_HOP_ENABLE | MSP430_HOP_SET_TABLE;
+
+        if (radio_set_hop(serial_parms, &hop_state) < 0)
+        {
+            return -1;
+        }
+
+        hop_table_changed = 0;
+    }
+
+    beacon.magic       = HOP_BEACON_MAGIC;
+    beacon.nb_channels = hop_nb_channels;
+    beacon.seed        = arguments->hop_seed;
+    beacon.dwell_ms    = arguments->hop_dwell;
+    beacon.blacklist   = hop_blacklist;
+    memset(&beacon.stamp, 0, sizeof(msp430_hop_stamp_t));
+
+    if ((radio_set_tx_power(serial_parms, arguments->power_index) < 0) ||
+        (radio_send_hop_beacon(serial_parms, (uint8_t *) &beacon, arguments->packet_length, sizeof(hop_beacon_t), hop_block_time) < 0))
+    {
+        return -1;
+    }
+
+    hop_beacons++;
+    hop_last_beacon = monotonic_us();
+    verbprintft(3, "HOP: beacon sent, blacklist %04X\n", hop_blacklist);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Follower: stop hopping and listen to the channel of the sequence at the park index until a
+// beacon is received. Radio must be idle. Returns 0 if successful else -1
+int hop_park(serial_t *serial_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    hop_make_table(&hop_state);
+    hop_state.mode = MSP430_HOP_SET_TABLE | MSP430_HOP_SET_TIME;
+    hop_state.slot = hop_park_index;
+    hop_state.slot_start_us = 0;
+    hop_synced = 0;
+    hop_park_since = monotonic_us();
+
+    if (radio_set_hop(serial_parms, &hop_state) < 0)
+    {
+        return -1;
+    }
+
+    verbprintft(2, "HOP: waiting for a beacon on channel %d\n", hop_state.channels[hop_park_index]);
+    return 0;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Start frequency hopping if requested. The master starts hopping at once. A follower waits for
+// a beacon of the master. Radio must be idle. Returns 0 if successful else -1
+int hop_start(serial_t *serial_parms, msp430_radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    float    byte_us, raw_byte_us;
+    uint32_t airtime_us, mcu_us;
+    uint8_t  i;
+
+    hop_nb_channels = 0;
+
+    if (!arguments->hop_channels)
+    {
+        return 0;
+    }
+
+    // preamble and sync word are not coded
+    byte_us = radio_get_byte_time(radio_parms);
+    raw_byte_us = ((radio_parms->fec_whitening & 0x01) ? byte_us / 2.0 : byte_us);
+    hop_sync_delay_us = HOP_TX_START_US + (uint32_t) (raw_byte_us * (nb_preamble_bytes[arguments->preamble] + 4));
+    airtime_us = hop_sync_delay_us + (uint32_t) (byte_us * (arguments->packet_length + 2));
+    hop_block_time = airtime_us + arguments->block_delay;
+
+    memset(&hop_state, 0, sizeof(msp430_hop_t));
+    hop_state.dwell_us  = arguments->hop_dwell * 1000;
+    hop_state.guard_us  = airtime_us + HOP_SETTLE_US;
+    hop_state.settle_us = HOP_SETTLE_US;
+
+    if (hop_state.dwell_us < 2 * hop_state.guard_us + HOP_SETTLE_US)
+    {
+        verbprintf(1, "HOP: %d ms dwell time too short for blocks of %d us. Not hopping\n", arguments->hop_dwell, airtime_us);
+        return -1;
+    }
+
+    hop_nb_channels = arguments->hop_channels;
+    hop_master = arguments->hop_master;
+    hop_blacklist = 0;
+    hop_table_changed = 0;
+    hop_beacons = 0;
+    hop_resyncs = 0;
+    memset(hop_stats, 0, sizeof(hop_stats));
+    hop_make_sequence(arguments->hop_seed, hop_nb_channels);
+
+    verbprintf(1, "HOP: sequence:");
+
+    for (i=0; i < hop_nb_channels; i++)
+    {
+        verbprintf(1, " %d", hop_sequence[i]);
+    }
+
+    verbprintf(1, "\n");
+
+    if (!hop_master)
+    {
+        hop_park_index = 0;
+        return hop_park(serial_parms);
+    }
+
+    if (radio_get_time(serial_parms, &mcu_us) < 0)
+    {
+        hop_nb_channels = 0;
+        return -1;
+    }
+
+    hop_make_table(&hop_state);
+    hop_state.mode = MSP430_HOP_ENABLE | MSP430_HOP_SET_TABLE | MSP430_HOP_SET_TIME;
+    hop_state.slot = 0;
+    hop_state.slot_start_us = mcu_us;
+
+    if (radio_set_hop(serial_parms, &hop_state) < 0)
+    {
+        hop_nb_channels = 0;
+        return -1;
+    }
+
+    hop_synced = 1;
+    hop_next_beacon_slot = hop_state.slot;
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Take a packet received into account. A follower synchronizes its hops on the master beacons.
+// Radio must be idle. Returns 1 if the packet is a beacon (not to be delivered) else 0
+int hop_receive(serial_t *serial_parms, uint8_t *packet, int size, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    hop_beacon_t beacon;
+    msp430_hop_t hop;
+    uint32_t     slot_start_us, predicted_us;
+    int32_t      error_us;
+
+    hop_observe(1);
+
+    if ((size != sizeof(hop_beacon_t)) || (packet[0] != HOP_BEACON_MAGIC))
+    {
+        return 0;
+    }
+
+    memcpy(&beacon, packet, sizeof(hop_beacon_t));
+
+    if (!hop_nb_channels || hop_master ||
+        (beacon.nb_channels != hop_nb_channels) || (beacon.seed != arguments->hop_seed) || (beacon.dwell_ms != arguments->hop_dwell))
+    {
+        verbprintft(2, "HOP: beacon of another hop set ignored\n");
+        return 1;
+    }
+
+    hop_beacons++;
+    hop_last_beacon = monotonic_us();
+    slot_start_us = radio_timing.rx_sync_mcu_us - hop_sync_delay_us - beacon.stamp.elapsed_us;
+
+    if (hop_synced && (beacon.blacklist == hop_blacklist))
+    {
+        predicted_us = hop_state.slot_start_us + (beacon.stamp.slot - hop_state.slot) * hop_state.dwell_us;
+        error_us = slot_start_us - predicted_us;
+        verbprintft(3, "HOP: beacon in slot %u, timing error %d us\n", beacon.stamp.slot, error_us);
+
+        if ((error_us < HOP_RESYNC_US) && (error_us > -HOP_RESYNC_US))
+        {
+            return 1;
+        }
+
+        hop_resyncs++;
+    }
+
+    hop_blacklist = beacon.blacklist;
+    memcpy(&hop, &hop_state, sizeof(msp430_hop_t));
+    hop_make_table(&hop);
+    hop.mode = MSP430_HOP_ENABLE | MSP430_HOP_SET_TABLE | MSP430_HOP_SET_TIME;
+    hop.slot = beacon.stamp.slot;
+    hop.slot_start_us = slot_start_us;
+
+    if (radio_set_hop(serial_parms, &hop) < 0)
+    {
+        verbprintft(1, "HOP: cannot follow the beacon\n");
+        return 1;
+    }
+
+    if (!hop_synced)
+    {
+        verbprintft(1, "HOP: synchronized on slot %u, blacklist %04X\n", hop.slot, hop_blacklist);
+    }
+
+    memcpy(&hop_state, &hop, sizeof(msp430_hop_t));
+    hop_synced = 1;
+
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Take a packet received in error into account
+void hop_receive_error()
+// ------------------------------------------------------------------------------------------------
+{
+    hop_observe(0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Master: send a beacon at the start of every beacon period slot. Follower: go back to acquisition
+// when the beacons are lost and listen to the next channel of the sequence when nothing is heard.
+// Reception must be on. It is turned on again after use. Returns 0 if successful else -1
+int hop_poll(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t timestamp = monotonic_us();
+    uint64_t period_us = (uint64_t) arguments->hop_beacon * hop_state.dwell_us;
+    uint32_t slot;
+    int      status;
+
+    if (!hop_nb_channels)
+    {
+        return 0;
+    }
+
+    if (hop_master)
+    {
+        hop_blacklist_expire();
+
+        if (!clocksync_synced())
+        {
+            return 0;
+        }
+
+        slot = hop_slot_at(clocksync_mcu_us(timestamp));
+
+        if ((int32_t) (slot - hop_next_beacon_slot) < 0)
+        {
+            return 0;
+        }
+
+        hop_next_beacon_slot = (slot / arguments->hop_beacon + 1) * arguments->hop_beacon;
+
+        if (radio_cancel_rx(serial_parms) < 0)
+        {
+            return -1;
+        }
+
+        status = hop_send_beacon(serial_parms, arguments);
+    }
+    else
+    {
+        if (hop_synced && (timestamp - hop_last_beacon > HOP_LOST_BEACONS * period_us))
+        {
+            verbprintft(1, "HOP: beacons lost\n");
+            hop_park_index = 0;
+        }
+        else if (!hop_synced && (timestamp - hop_park_since > hop_nb_channels * period_us + hop_state.dwell_us))
+        {
+            // the master sends no beacon on this channel (blacklisted or beacon period sharing a factor
+            // with the number of channels)
+            hop_park_index = (hop_park_index + 1) % hop_nb_channels;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (radio_cancel_rx(serial_parms) < 0)
+        {
+            return -1;
+        }
+
+        status = hop_park(serial_parms);
+    }
+
+    radio_turn_on_rx(serial_parms, arguments->packet_length);
+    return status;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print the hop state and the packets received on each channel
+void hop_print_stats(int verb_level)
+// ------------------------------------------------------------------------------------------------
+{
+    hop_channel_stats_t *stats;
+    uint8_t channel;
+
+    if (!hop_nb_channels)
+    {
+        return;
+    }
+
+    verbprintf(verb_level, "HOP: %s, %s, %u beacons, %u timing corrections, blacklist %04X\n",
+        (hop_master ? "master" : "follower"),
+        (hop_synced ? "synchronized" : "waiting for a beacon"),
+        hop_beacons,
+        hop_resyncs,
+        hop_blacklist);
+
+    for (channel=0; channel < hop_nb_channels; channel++)
+    {
+        stats = &hop_stats[channel];
+        verbprintf(verb_level, "HOP: channel %2d: %u OK %u errors, recent PER %.3f%s\n",
+            channel,
+            stats->total_ok,
+            stats->total_ko,
+            (stats->ok + stats->ko > 0.0 ? stats->ko / (stats->ok + stats->ko) : 0.0),
+            (stats->blacklist_end ? " blacklisted" : ""));
+    }
+}
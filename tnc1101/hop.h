@@ -0,0 +1,56 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Frequency hopping: hop sequence, beacon synchronization and blacklisting   */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _HOP_H_
+#define _HOP_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "serial.h"
+#include "msp430_interface.h"
+
+#define HOP_BEACON_MAGIC      0xA9      // First byte of a hop beacon
+#define HOP_SETTLE_US         2000      // Blocks start this long after a hop so that all stations have hopped
+#define HOP_TX_START_US       250       // From the stamp of a beacon by the MSP430 to the start of its preamble
+#define HOP_RESYNC_US         200       // Slot timing error of a follower corrected at once on a beacon
+#define HOP_LOST_BEACONS      8         // Beacons missed in a row before a follower goes back to acquisition
+#define HOP_STATS_WINDOW      64        // Packets per channel after which the older ones count for half
+#define HOP_BLACKLIST_MIN     16        // Packets on a channel before it can be blacklisted
+#define HOP_BLACKLIST_PER     0.3       // Packet error rate above which a channel is blacklisted
+#define HOP_BLACKLIST_TIME    60000000  // Time a channel stays blacklisted in microseconds
+
+// Beacon sent by the master. The MSP430 stamps its slot timing over the last bytes.
+typedef struct hop_beacon_s
+{
+    uint8_t  magic;           // HOP_BEACON_MAGIC
+    uint8_t  nb_channels;     // Number of channels hopped over
+    uint32_t seed;            // Seed of the hop sequence
+    uint16_t dwell_ms;        // Time spent on each channel
+    uint16_t blacklist;       // Channels skipped (bit n for channel n)
+    msp430_hop_stamp_t stamp; // Slot and time into the slot just before transmission
+} __attribute__((packed)) hop_beacon_t;
+
+// Packets received on a channel
+typedef struct hop_channel_stats_s
+{
+    float    ok;              // Packets received with a good CRC (decayed count)
+    float    ko;              // Packets in error (decayed count)
+    uint32_t total_ok;        // Packets received with a good CRC since start
+    uint32_t total_ko;        // Packets in error since start
+    uint64_t blacklist_end;   // Time the channel comes back in microseconds (0: not blacklisted)
+} hop_channel_stats_t;
+
+int      hop_start(serial_t *serial_parms, msp430_radio_parms_t *radio_parms, arguments_t *arguments);
+int      hop_receive(serial_t *serial_parms, uint8_t *packet, int size, arguments_t *arguments);
+void     hop_receive_error();
+int      hop_poll(serial_t *serial_parms, arguments_t *arguments);
+void     hop_print_stats(int verb_level);
+
+#endif // _HOP_H_
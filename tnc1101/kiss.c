@@ -8,21 +8,76 @@
 /******************************************************************************/
 
 #include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include "kiss.h"
 #include "radio.h"
+#include "txqueue.h"
+#include "linkadapt.h"
+#include "afc.h"
+#include "tuner.h"
+#include "clocksync.h"
+#include "hop.h"
 #include "util.h"
 
+#define KISS_CLASSIFY_BYTES      80  // Number of unescaped bytes examined to classify a frame
+#define KISS_INTERACTIVE_MAXSIZE 128 // Data frames up to this size are interactive
+#define KISS_TXQ_BURST_BLOCKS    4   // Radio blocks in one transmission burst from the queues
+
 static uint32_t tnc_tx_keyup_delay; // Tx keyup delay in microseconds
 static float    kiss_persistence;   // Persistence parameter
 static uint32_t kiss_slot_time;     // Slot time in microseconds
 static uint32_t kiss_tx_tail;       // Tx tail in microseconds (obsolete)
 
+// Adaptive frame aggregation state for one direction of the TNC. The time window given by
+// the user is an upper bound: data is held only while more of it is likely to arrive.
+typedef struct kiss_aggregator_s
+{
+    uint64_t first_us;      // Arrival time of the oldest pending byte (0: nothing pending)
+    uint64_t last_us;       // Arrival time of the most recent chunk of data
+    uint32_t gap_us;        // Smoothed inter-arrival gap in microseconds
+    uint32_t max_window_us; // Maximum time pending data can be held (0: no concatenation)
+    uint32_t gap_limit_us;  // Saturation value of the inter-arrival gap estimate
+    uint32_t coalesce_us;   // Minimum quiet time after a complete frame before sending
+} kiss_aggregator_t;
+
+// Incremental KISS frame delimiter scanner. Only the bytes appended since the last call are
+// examined so the cost does not depend on the amount of data already buffered.
+typedef struct kiss_scanner_s
+{
+    int scan_index;  // Next byte to examine in the buffer
+    int frame_start; // Index of the opening FEND of the frame being received
+    int frame_len;   // Number of bytes of the frame being received so far
+} kiss_scanner_t;
+
+// Data received from the AX.25 serial side that does not form a complete frame yet
+typedef struct kiss_input_s
+{
+    uint8_t        buffer[1<<16];
+    int            count;   // Number of bytes in the buffer
+    uint8_t        pending; // The frame found by the scanner waits behind a held frame of its class
+    kiss_scanner_t scanner;
+    uint8_t        held[NUM_TXQ_CLASS][TXQ_CLASS_BUFSIZE]; // Frame of each class refused by its full queue
+    int            held_size[NUM_TXQ_CLASS];               // Size of the held frame (0: none)
+} kiss_input_t;
+
 // === Static functions declarations ==============================================================
 
 static uint8_t *kiss_tok(uint8_t *block, uint8_t *end);
 static uint8_t kiss_command(uint8_t *block);
+static void    kiss_agg_init(kiss_aggregator_t *agg, uint32_t max_window_us, uint32_t gap_limit_us, uint32_t coalesce_us);
+static void    kiss_agg_arrival(kiss_aggregator_t *agg, uint64_t timestamp);
+static uint8_t kiss_agg_ready(kiss_aggregator_t *agg, int count, uint8_t complete, uint8_t channel_busy, uint64_t timestamp);
+static void    kiss_agg_flush(kiss_aggregator_t *agg, int remaining);
+static uint8_t kiss_agg_active(kiss_aggregator_t *agg, uint64_t timestamp);
+static uint8_t kiss_scan(kiss_scanner_t *scanner, uint8_t *buffer, int count);
+static void    kiss_scan_next(kiss_scanner_t *scanner);
+static void    kiss_scan_consume(kiss_scanner_t *scanner, int consumed);
+static txq_class_t kiss_classify(uint8_t *frame, int size, uint8_t slip);
+static uint8_t kiss_queue_frames(kiss_input_t *input, txq_t *txq, uint8_t slip);
+static void    kiss_read_ax25(serial_t *serial_parms_ax25, kiss_input_t *input, txq_t *txq, kiss_aggregator_t *tx_agg, uint8_t slip);
+static uint8_t *kiss_prepare_packet(uint8_t *buffer, uint32_t *size, uint8_t *profile, uint8_t *source, uint8_t *power_index);
 
 // === Static functions ===========================================================================
 
@@ -100,8 +155,368 @@ uint8_t kiss_command(uint8_t *block)
     return 1;
 }
 
+// ------------------------------------------------------------------------------------------------
+// Initialize an aggregator. The smoothed gap starts at its saturation value so that the very first
+// frame is considered isolated and is sent without waiting.
+void kiss_agg_init(kiss_aggregator_t *agg, uint32_t max_window_us, uint32_t gap_limit_us, uint32_t coalesce_us)
+// ------------------------------------------------------------------------------------------------
+{
+    agg->coalesce_us   = coalesce_us;
+    agg->first_us      = 0;
+    agg->last_us       = 0;
+    agg->max_window_us = max_window_us;
+    agg->gap_limit_us  = (gap_limit_us > max_window_us ? gap_limit_us : max_window_us);
+    agg->gap_us        = agg->gap_limit_us;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Account for a chunk of data arriving at the given time. Updates the inter-arrival gap estimate
+// with an exponentially weighted moving average (1/4 weight on the new sample).
+void kiss_agg_arrival(kiss_aggregator_t *agg, uint64_t timestamp)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t gap;
+
+    if (agg->last_us)
+    {
+        gap = timestamp - agg->last_us;
+
+        if (gap > agg->gap_limit_us) // saturate so that long idle periods do not dominate
+        {
+            gap = agg->gap_limit_us;
+        }
+
+        agg->gap_us = (3 * agg->gap_us + (uint32_t) gap) / 4;
+    }
+
+    if (!agg->first_us)
+    {
+        agg->first_us = timestamp;
+    }
+
+    agg->last_us = timestamp;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decide if pending data should be sent now
+// count        is the number of bytes pending
+// complete     is set when the pending data ends on a frame boundary
+// channel_busy is set when the opposite direction is active (half-duplex)
+// Returns 1 if the data should be sent now
+uint8_t kiss_agg_ready(kiss_aggregator_t *agg, int count, uint8_t complete, uint8_t channel_busy, uint64_t timestamp)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t waited, idle;
+
+    if (count <= 0)
+    {
+        return 0;
+    }
+
+    if (agg->max_window_us == 0) // no concatenation
+    {
+        return 1;
+    }
+
+    waited = timestamp - agg->first_us;
+
+    if (waited >= agg->max_window_us) // latency bound reached whatever the conditions
+    {
+        return 1;
+    }
+
+    if (channel_busy || !complete)
+    {
+        return 0;
+    }
+
+    idle = timestamp - agg->last_us;
+
+    if (idle < agg->coalesce_us) // leave a chance to a frame following immediately
+    {
+        return 0;
+    }
+
+    // Next arrival is not expected before the latency bound: nothing to gain by waiting
+    if (agg->last_us + agg->gap_us >= agg->first_us + agg->max_window_us)
+    {
+        return 1;
+    }
+
+    // Burst has stopped: nothing came in for twice the usual gap
+    if (idle > 2 * (uint64_t) agg->gap_us)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Pending data has been sent. If some bytes remain they are accounted from the last arrival.
+void kiss_agg_flush(kiss_aggregator_t *agg, int remaining)
+// ------------------------------------------------------------------------------------------------
+{
+    agg->first_us = (remaining > 0 ? agg->last_us : 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tells if data is still flowing in this direction i.e. the last arrival is within the usual gap
+uint8_t kiss_agg_active(kiss_aggregator_t *agg, uint64_t timestamp)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!agg->last_us)
+    {
+        return 0;
+    }
+
+    return (timestamp - agg->last_us) < 2 * (uint64_t) agg->gap_us;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Look for the next closing frame delimiter in the bytes appended to the buffer since the last call.
+// A FEND following at least one byte of data closes a frame, any other FEND is an opening or
+// filling delimiter.
+// Returns 1 when a frame is complete. It spans from frame_start to scan_index (excluded).
+uint8_t kiss_scan(kiss_scanner_t *scanner, uint8_t *buffer, int count)
+// ------------------------------------------------------------------------------------------------
+{
+    for (; scanner->scan_index < count; scanner->scan_index++)
+    {
+        if (buffer[scanner->scan_index] == KISS_FEND)
+        {
+            if (scanner->frame_len) // closing delimiter
+            {
+                scanner->scan_index++;
+                return 1;
+            }
+
+            scanner->frame_start = scanner->scan_index;
+        }
+        else
+        {
+            scanner->frame_len++;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Move past a complete frame. Its closing FEND may also open the next frame.
+void kiss_scan_next(kiss_scanner_t *scanner)
+// ------------------------------------------------------------------------------------------------
+{
+    scanner->frame_start = scanner->scan_index - 1;
+    scanner->frame_len = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Account for bytes removed at the head of the buffer. A partial frame carries over.
+void kiss_scan_consume(kiss_scanner_t *scanner, int consumed)
+// ------------------------------------------------------------------------------------------------
+{
+    scanner->scan_index -= consumed;
+    scanner->frame_start -= consumed;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Find the transmission class of a complete frame
+// o With a non zero KISS port the port number minus one gives the class
+// o AX.25 supervisory frames and unnumbered frames other than UI (SABM, DISC, UA, DM...) are
+//   link control frames
+// o AX.25 segments (PID 0x08) are pieces of a large frame and are bulk
+// o Other data frames are interactive or bulk depending on their size
+// SLIP frames are not interpreted and are classified by size only
+txq_class_t kiss_classify(uint8_t *frame, int size, uint8_t slip)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t header[KISS_CLASSIFY_BYTES];
+    uint8_t kiss_port, control, fesc = 0;
+    int     i, header_len = 0, address_end;
+
+    for (i=0; (i < size) && (header_len < KISS_CLASSIFY_BYTES); i++) // unescape the head of the frame
+    {
+        if (frame[i] == KISS_FEND)
+        {
+            continue;
+        }
+        else if (frame[i] == KISS_FESC)
+        {
+            fesc = 1;
+        }
+        else if (fesc)
+        {
+            header[header_len++] = (frame[i] == KISS_TFEND ? KISS_FEND : KISS_FESC);
+            fesc = 0;
+        }
+        else
+        {
+            header[header_len++] = frame[i];
+        }
+    }
+
+    if (!slip && header_len)
+    {
+        kiss_port = (header[0] & 0xF0)>>4;
+
+        if (kiss_port)
+        {
+            return (kiss_port - 1 < NUM_TXQ_CLASS ? kiss_port - 1 : NUM_TXQ_CLASS - 1);
+        }
+
+        // Address field follows the KISS type byte. Addresses are 7 bytes long and the last one
+        // has the extension bit set.
+        for (address_end = 7; address_end < header_len; address_end += 7)
+        {
+            if (header[address_end] & 0x01)
+            {
+                break;
+            }
+        }
+
+        if (address_end + 1 < header_len)
+        {
+            control = header[address_end + 1];
+
+            if ((control & 0x03) == 0x01) // S frame
+            {
+                return TXQ_CLASS_CONTROL;
+            }
+
+            if (((control & 0x03) == 0x03) && ((control & 0xEF) != 0x03)) // U frame other than UI
+            {
+                return TXQ_CLASS_CONTROL;
+            }
+
+            if ((address_end + 2 < header_len) && (header[address_end + 2] == 0x08)) // segment
+            {
+                return TXQ_CLASS_BULK;
+            }
+        }
+    }
+
+    return (size <= KISS_INTERACTIVE_MAXSIZE ? TXQ_CLASS_INTERACTIVE : TXQ_CLASS_BULK);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Interpret commands and queue the complete frames found in the input buffer according to their
+// class. A frame that does not fit in its queue is held aside so that the frames of other classes
+// behind it are still queued. A frame of a class that already has a held frame is left in the
+// input buffer for the next call to keep the order of the frames within the class.
+// Returns 0 if a frame is left waiting in the input buffer
+uint8_t kiss_queue_frames(kiss_input_t *input, txq_t *txq, uint8_t slip)
+// ------------------------------------------------------------------------------------------------
+{
+    kiss_scanner_t *scanner = &input->scanner;
+    txq_class_t txq_class;
+    uint8_t *frame;
+    int frame_size, i;
+
+    for (i=0; i<NUM_TXQ_CLASS; i++) // present the held frames again first
+    {
+        if (input->held_size[i] && (txq_enqueue(txq, i, input->held[i], input->held_size[i]) >= 0))
+        {
+            verbprintft(4, "KISS receive AX.25: %d bytes %s frame released\n", input->held_size[i], txq_class_names[i]);
+            input->held_size[i] = 0;
+        }
+    }
+
+    while (input->pending || kiss_scan(scanner, input->buffer, input->count))
+    {
+        frame = &input->buffer[scanner->frame_start];
+        frame_size = scanner->scan_index - scanner->frame_start;
+
+        if (input->pending || slip || (frame[0] != KISS_FEND) || !kiss_command(frame))
+        {
+            txq_class = kiss_classify(frame, frame_size, slip);
+
+            if (input->held_size[txq_class])
+            {
+                input->pending = 1;
+                break;
+            }
+
+            if (txq_enqueue(txq, txq_class, frame, frame_size) < 0)
+            {
+                memcpy(input->held[txq_class], frame, frame_size);
+                input->held_size[txq_class] = frame_size;
+                verbprintft(4, "KISS receive AX.25: %d bytes %s frame held\n", frame_size, txq_class_names[txq_class]);
+            }
+            else
+            {
+                verbprintft(4, "KISS receive AX.25: %d bytes %s frame\n", frame_size, txq_class_names[txq_class]);
+            }
+
+            input->pending = 0;
+        }
+
+        kiss_scan_next(scanner);
+    }
+
+    if (scanner->frame_start > 0) // keep only the frame being received or waiting
+    {
+        input->count -= scanner->frame_start;
+        memmove(input->buffer, &input->buffer[scanner->frame_start], input->count);
+        kiss_scan_consume(scanner, scanner->frame_start);
+    }
+
+    return !input->pending;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Read the AX.25 serial side and queue complete frames. Reading stops when the queues are filled
+// up because the radio does not keep up. The kernel buffers then fill up in turn and the AX.25
+// stack backs off.
+void kiss_read_ax25(serial_t *serial_parms_ax25, kiss_input_t *input, txq_t *txq, kiss_aggregator_t *tx_agg, uint8_t slip)
+// ------------------------------------------------------------------------------------------------
+{
+    static const int bufsize = (1<<16);
+    int byte_count;
+
+    if (!kiss_queue_frames(input, txq, slip) || txq_backpressure(txq))
+    {
+        return;
+    }
+
+    if (input->count == bufsize) // no frame delimiter in the whole buffer: garbage
+    {
+        verbprintft(1, ANSI_COLOR_RED "KISS receive AX.25: no frame found in %d bytes. Discarding..." ANSI_COLOR_RESET "\n", input->count);
+        input->count = 0;
+        memset(&input->scanner, 0, sizeof(kiss_scanner_t));
+    }
+
+    byte_count = read_serial(serial_parms_ax25, &input->buffer[input->count], bufsize - input->count);
+
+    if (byte_count > 0) // something received on AX.25 serial
+    {
+        input->count += byte_count;  // Accumulate Tx
+        kiss_agg_arrival(tx_agg, now_us());
+        kiss_queue_frames(input, txq, slip);
+    }
+}
+
 // === Public functions ===========================================================================
 
+// ------------------------------------------------------------------------------------------------
+// Choose the link profile and the transmission power for the frames stored after the room left
+// for the link report at the start of the buffer then put the report in front of the frames.
+// Returns the start of the packet and updates its size.
+uint8_t *kiss_prepare_packet(uint8_t *buffer, uint32_t *size, uint8_t *profile, uint8_t *source, uint8_t *power_index)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  report[LINKADAPT_REPORT_MAX_SIZE];
+    uint8_t  *frames = &buffer[LINKADAPT_REPORT_MAX_SIZE];
+    uint32_t report_size;
+
+    *profile = linkadapt_select(frames, *size, source, power_index);
+    report_size = linkadapt_report(report, frames, *size, *power_index);
+    memcpy(frames - report_size, report, report_size);
+    *size += report_size;
+
+    return frames - report_size;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Initialize the common parameters to defaults
 void kiss_init(arguments_t *arguments)
@@ -111,6 +526,7 @@ void kiss_init(arguments_t *arguments)
     kiss_persistence = 0.25;                          // 0.25 persistence parameter
     kiss_slot_time = 100000;                          // 100ms slot time
     kiss_tx_tail = 0;                                 // obsolete
+    linkadapt_init(arguments);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -189,35 +605,57 @@ void kiss_run(serial_t *serial_parms_ax25,
 // ------------------------------------------------------------------------------------------------
 {
     static const size_t bufsize = (1<<16);
-    uint8_t  rx_buffer[1<<16], tx_buffer[1<<16];
-    uint8_t  rtx_tristate; // 0: no Rx/Tx operation, 1:Rx, 2:Tx
-    uint8_t  rx_trigger, tx_trigger, force_mode;
-    int      rx_count, tx_count, byte_count, nbytes;
-    uint32_t timeout_value, bytes_left, block_time, block_delay;
+    static txq_t        txq;
+    static kiss_input_t tx_input;
+    uint8_t  rx_buffer[1<<16], burst_buffer[1<<16], urgent_buffer[1<<16];
+    int      byte_count, nbytes;
+    uint32_t bytes_left, block_time, block_delay, burst_max, burst_size, urgent_size, stream_block_time;
     uint64_t timestamp;
-    struct timeval tp;
+    uint8_t  profile, urgent_profile, source[7], burst_power, urgent_power;
+    uint8_t  *burst_packet, *urgent_packet;
+    kiss_aggregator_t rx_agg, tx_agg;
+    radio_tx_stream_t tx_stream;
+    linkadapt_announce_t announce;
 
     memset(rx_buffer, 0, bufsize);
-    memset(tx_buffer, 0, bufsize);
-
-    force_mode   = 0;
-    rtx_tristate = 0;
-    rx_trigger   = 0;
-    tx_trigger   = 0;
-    rx_count     = 0;
-    tx_count     = 0;
+    memset(&tx_input, 0, sizeof(kiss_input_t));
+    txq_init(&txq);
 
     block_time  = (((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2)) + arguments->block_delay;
     block_delay = arguments->block_delay;
+    burst_max   = (arguments->packet_length - RADIO_PACKET_HEADER_SIZE) * KISS_TXQ_BURST_BLOCKS;
+
+    if (arguments->link_adapt || arguments->tx_power_control) // room for the link report
+    {
+        burst_max -= LINKADAPT_REPORT_MAX_SIZE;
+    }
+
+    // A peer sends the blocks of a burst about one block time apart: this sizes the radio gap estimate.
+    // Radio packets are delivered at once so the radio aggregator is only used to track activity.
+    kiss_agg_init(&rx_agg, 0, 2 * block_time, 0);
+    kiss_agg_init(&tx_agg, arguments->tnc_serial_window, 2 * arguments->tnc_serial_window, arguments->tnc_coalesce_delay);
 
     if (!init_radio(serial_parms_usb, radio_parms, arguments))
     {
         verbprintft(1, ANSI_COLOR_RED "KISS run: cannot initialize radio. Aborting..." ANSI_COLOR_RESET "\n");
         return;
     }
-    else
+
+    if (tuner_apply_profile(serial_parms_usb, arguments) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "KISS run: cannot apply register profile" ANSI_COLOR_RESET "\n");
+    }
+
+    linkadapt_load_profiles(serial_parms_usb, radio_parms);
+
+    if (afc_start(serial_parms_usb, arguments) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "KISS run: cannot start AFC" ANSI_COLOR_RESET "\n");
+    }
+
+    if (hop_start(serial_parms_usb, radio_parms, arguments) < 0)
     {
-        usleep(100000);
+        verbprintft(1, ANSI_COLOR_RED "KISS run: cannot start frequency hopping" ANSI_COLOR_RESET "\n");
     }
 
     radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // init for packet to receive
@@ -229,84 +667,73 @@ void kiss_run(serial_t *serial_parms_ax25,
         // Rx on CC1101 via USB
 
         byte_count = radio_receive_packet_nb(serial_parms_usb,
-            &rx_buffer[rx_count],
+            rx_buffer,
             arguments->packet_length,
             1000,
             block_time);
 
-        if (byte_count > 0) // Something received on radio
+        if ((byte_count > 0) && hop_receive(serial_parms_usb, rx_buffer, byte_count, arguments)) // Hop beacon: not delivered
         {
-            rx_count += byte_count;  // Accumulate Rx
-
-            gettimeofday(&tp, NULL);
-            timestamp = tp.tv_sec * 1000000ULL + tp.tv_usec;
-            timeout_value = arguments->tnc_radio_window;
-            force_mode = (timeout_value == 0);
+            radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // re-arm
+            byte_count = 0;
+        }
 
-            if (rtx_tristate == 2) // Tx to Rx transition
-            {
-                tx_trigger = 1; // Push Tx
-            }
-            else
-            {
-                tx_trigger = 0;
-            }
+        if ((byte_count > 0) && linkadapt_parse_announce(rx_buffer, byte_count, &announce)) // Peer switches modem for the next packet
+        {
+            byte_count = linkadapt_receive(serial_parms_usb, rx_buffer, &announce, arguments);
+        }
 
-            rtx_tristate = 1;
+        if (byte_count > 0) // Something received on radio with good CRC: deliver it at once on AX.25 serial
+        {
+            kiss_agg_arrival(&rx_agg, now_us());
+            byte_count = linkadapt_strip_report(rx_buffer, byte_count, radio_rssi_dbm);
+            linkadapt_observe(rx_buffer, byte_count, radio_rssi_dbm);
+            afc_poll(serial_parms_usb, arguments); // radio is idle after a packet
+            clocksync_poll(serial_parms_usb);
+            radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // re-arm
+
+            verbprintft(2, ANSI_COLOR_YELLOW "KISS send AX.25: received %d bytes from radio" ANSI_COLOR_RESET "\n", byte_count);
+            nbytes = write_serial_queued(serial_parms_ax25, rx_buffer, byte_count);
+            verbprintft(2, ANSI_COLOR_YELLOW "KISS send AX.25: queued %d bytes on AX.25 serial" ANSI_COLOR_RESET "\n", nbytes);
+            kiss_agg_flush(&rx_agg, 0);
         }
         else if (byte_count < 0) // Error
         {
             verbprintft(1, ANSI_COLOR_RED "KISS receive USB: error in packet" ANSI_COLOR_RESET "\n");
+            hop_receive_error();
             radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // init for new packet to receive
-            rtx_tristate = 0;
         }
 
-        // Rx on AX.25 serial link
-
-        byte_count = read_serial(serial_parms_ax25, &tx_buffer[tx_count], bufsize - tx_count);
+        flush_serial(serial_parms_ax25); // resume partial writes
 
-        if (byte_count > 0) // something received on AX.25 serial
-        {
-            tx_count += byte_count;  // Accumulate Tx
+        // Rx on AX.25 serial link
 
-            gettimeofday(&tp, NULL);
-            timestamp = tp.tv_sec * 1000000ULL + tp.tv_usec;
-            timeout_value = arguments->tnc_serial_window;
-            force_mode = (timeout_value == 0);
+        kiss_read_ax25(serial_parms_ax25, &tx_input, &txq, &tx_agg, arguments->slip);
 
-            if (rtx_tristate == 1) // Rx to Tx transition
-            {
-                rx_trigger = 1;
-            }
-            else
-            {
-                rx_trigger = 0;
-            }
+        timestamp = now_us();
 
-            rtx_tristate = 2;
+        // Hop beacons and hop synchronization while the peer is not sending
+        if (!kiss_agg_active(&rx_agg, timestamp) && (hop_poll(serial_parms_usb, arguments) < 0))
+        {
+            verbprintft(1, ANSI_COLOR_RED "KISS run: frequency hopping error" ANSI_COLOR_RESET "\n");
         }
 
-        // Send bytes received from CC1101 radio link via USB on AX.25 serial
+        // Send queued frames to CC1101 via USB for on air transmission
+        // Hold while the peer is still sending (half-duplex)
 
-        if ((rx_count > 0) && ((rx_trigger) || (force_mode))) // Send bytes received on air to serial
+        if (kiss_agg_ready(&tx_agg, txq.bytes, (txq.bytes > 0), kiss_agg_active(&rx_agg, timestamp), timestamp))
         {
-            verbprintft(2, ANSI_COLOR_YELLOW "KISS send AX.25: received %d bytes from radio" ANSI_COLOR_RESET "\n", rx_count);
-            nbytes = write_serial(serial_parms_ax25, rx_buffer, rx_count);
-            verbprintft(2, ANSI_COLOR_YELLOW "KISS send AX.25: sent %d bytes on AX.25 serial" ANSI_COLOR_RESET "\n", nbytes);
-            memset(rx_buffer, 0, (1<<12)); // DEBUG
-            rx_count = 0;
-            rx_trigger = 0;
-            force_mode = 0;
-            rtx_tristate = 0;
+            // Control frames first then fair share between interactive and bulk frames. A burst is
+            // limited to a few blocks so that a new interactive frame does not wait long. New control
+            // frames do not wait for the end of the burst.
+            burst_size = txq_dequeue_burst(&txq, &burst_buffer[LINKADAPT_REPORT_MAX_SIZE], burst_max);
 
-            radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // init for new packet to receive
-        }
+            print_block(4, &burst_buffer[LINKADAPT_REPORT_MAX_SIZE], burst_size); // debug
 
-        // Send bytes received on AX.25 serial to CC1101 via USB for on air transmission
-
-        if ((tx_count > 0) && ((tx_trigger) || (force_mode)))
-        {
-            print_block(4, tx_buffer, tx_count); // debug
+            verbprintft(3, "KISS send USB: %u bytes after %u us (gap %u us)\n", 
+                burst_size, 
+                (uint32_t) (timestamp - tx_agg.first_us), 
+                tx_agg.gap_us);
 
             nbytes = radio_cancel_rx(serial_parms_usb);
 
@@ -316,55 +743,113 @@ void kiss_run(serial_t *serial_parms_ax25,
                 return;
             }
 
-            if (arguments->slip || !kiss_command(tx_buffer))
+            verbprintft(2, ANSI_COLOR_YELLOW "KISS send USB: %d bytes to send to radio" ANSI_COLOR_RESET "\n", burst_size);
+
+            // Keyup and inter-block delays are timed by the MSP430
+            if (radio_set_tx_timing(serial_parms_usb, tnc_tx_keyup_delay, block_delay) < 0)
             {
-                verbprintft(2, ANSI_COLOR_YELLOW "KISS send USB: %d bytes to send to radio" ANSI_COLOR_RESET "\n", tx_count);
+                verbprintft(1, ANSI_COLOR_RED "KISS send USB: cannot set Tx timing. Aborting..." ANSI_COLOR_RESET "\n");
+                return;
+            }
 
-                if (tnc_tx_keyup_delay)
-                {
-                    usleep(tnc_tx_keyup_delay);
-                }
+            burst_packet = kiss_prepare_packet(burst_buffer, &burst_size, &profile, source, &burst_power);
+
+            if (radio_set_tx_power(serial_parms_usb, burst_power) < 0)
+            {
+                verbprintft(1, ANSI_COLOR_RED "KISS send USB: cannot set Tx power. Aborting..." ANSI_COLOR_RESET "\n");
+                return;
+            }
 
-                bytes_left = radio_send_packet(serial_parms_usb,
-                    tx_buffer,
-                    arguments->packet_length,
-                    tx_count,
-                    block_delay,
-                    block_time);
+            stream_block_time = block_time;
 
-                if (bytes_left)
+            if (profile) // Faster profile for all destinations: announce it and switch the modem
+            {
+                if (linkadapt_start(serial_parms_usb, profile, source, tnc_tx_keyup_delay, block_delay, arguments) < 0)
                 {
-                    verbprintft(1, ANSI_COLOR_RED "KISS send USB: error in packet transmission. Aborting..." ANSI_COLOR_RESET "\n");
+                    verbprintft(1, ANSI_COLOR_RED "KISS send USB: error in profile switch. Aborting..." ANSI_COLOR_RESET "\n");
                     return;
                 }
+
+                stream_block_time = linkadapt_block_time(profile);
             }
 
-            memset(tx_buffer, 0, (1<<12)); // DEBUG
-            tx_count = 0;
-            tx_trigger = 0;
-            force_mode = 0;
-            rtx_tristate = 0;
+            radio_stream_start(&tx_stream, burst_packet, arguments->packet_length, burst_size);
 
-            radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // init for new packet to receive
-        }
+            while (tx_stream.size > 0)
+            {
+                if (radio_stream_send_block(serial_parms_usb, &tx_stream, arguments->packet_length, stream_block_time) < 0)
+                {
+                    verbprintft(1, ANSI_COLOR_RED "KISS send USB: error in packet transmission. Aborting..." ANSI_COLOR_RESET "\n");
+                    return;
+                }
 
-        // Time window processing
+                if (tx_stream.size == 0)
+                {
+                    break;
+                }
 
-        if (rtx_tristate && !force_mode)
-        {
-            gettimeofday(&tp, NULL);
+                // Between two blocks take in new frames and let control frames through at once.
+                // The receiving end reassembles the interleaved packets by stream.
+                kiss_read_ax25(serial_parms_ax25, &tx_input, &txq, &tx_agg, arguments->slip);
+                urgent_size = txq_dequeue_priority(&txq, &urgent_buffer[LINKADAPT_REPORT_MAX_SIZE], burst_max);
 
-            if ((tp.tv_sec * 1000000ULL + tp.tv_usec) > timestamp + timeout_value)
-            {
-                force_mode = 1;
-            }
-            else
-            {
-                if (rtx_tristate == 1) // Rx going on
+                if (urgent_size)
                 {
-                    radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // init for new packet to receive
+                    verbprintft(2, ANSI_COLOR_YELLOW "KISS send USB: %d bytes of control frames interleaved" ANSI_COLOR_RESET "\n", urgent_size);
+
+                    if (profile) // the rest of the burst follows the control frames at the base profile
+                    {
+                        if (linkadapt_stop(serial_parms_usb, profile, 1, block_delay, arguments) < 0)
+                        {
+                            verbprintft(1, ANSI_COLOR_RED "KISS send USB: error in profile switch. Aborting..." ANSI_COLOR_RESET "\n");
+                            return;
+                        }
+
+                        profile = 0;
+                        stream_block_time = block_time;
+                    }
+
+                    // Control frames go at the base profile with the power their destinations need
+                    urgent_packet = kiss_prepare_packet(urgent_buffer, &urgent_size, &urgent_profile, source, &urgent_power);
+
+                    if (radio_set_tx_power(serial_parms_usb, urgent_power) < 0)
+                    {
+                        verbprintft(1, ANSI_COLOR_RED "KISS send USB: cannot set Tx power. Aborting..." ANSI_COLOR_RESET "\n");
+                        return;
+                    }
+
+                    bytes_left = radio_send_packet(serial_parms_usb,
+                        urgent_packet,
+                        arguments->packet_length,
+                        urgent_size,
+                        block_time);
+
+                    if (bytes_left || (radio_set_tx_power(serial_parms_usb, burst_power) < 0))
+                    {
+                        verbprintft(1, ANSI_COLOR_RED "KISS send USB: error in packet transmission. Aborting..." ANSI_COLOR_RESET "\n");
+                        return;
+                    }
                 }
             }
+
+            if (profile && (linkadapt_stop(serial_parms_usb, profile, 0, block_delay, arguments) < 0))
+            {
+                verbprintft(1, ANSI_COLOR_RED "KISS send USB: error in profile switch. Aborting..." ANSI_COLOR_RESET "\n");
+                return;
+            }
+
+            txq_print_stats(&txq, 4);
+            linkadapt_print_peers(4);
+            radio_print_blind_time(4);
+            hop_print_stats(4);
+            verbprintf(4, "KISS: AX.25 output: %d bytes pending, %d bytes dropped\n", 
+                serial_parms_ax25->out_count,
+                serial_parms_ax25->out_drops);
+            kiss_agg_flush(&tx_agg, txq.bytes);
+
+            afc_poll(serial_parms_usb, arguments); // radio is idle after a transmission
+            clocksync_poll(serial_parms_usb);
+            radio_turn_on_rx(serial_parms_usb, arguments->packet_length); // init for new packet to receive
         }
 
         usleep(10);
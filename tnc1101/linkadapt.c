@@ -0,0 +1,1035 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Link adaptation of data rate, modulation and FEC per peer                  */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "linkadapt.h"
+#include "kiss.h"
+#include "radio.h"
+#include "util.h"
+
+// Combinations in increasing order of throughput. Sensitivities are the CC1101 figures at 433 MHz
+// for 1% packet error rate, interpolated between the data sheet rates. FEC gains about 3 dB.
+static const linkadapt_profile_t linkadapt_ladder[] = {
+    {RATE_1200,   RADIO_MOD_FSK2, 0, -112.0},
+    {RATE_2400,   RADIO_MOD_FSK2, 0, -110.0},
+    {RATE_4800,   RADIO_MOD_FSK2, 0, -108.0},
+    {RATE_9600,   RADIO_MOD_FSK2, 0, -106.0},
+    {RATE_19200,  RADIO_MOD_FSK2, 0, -105.0},
+    {RATE_38400,  RADIO_MOD_GFSK, 0, -104.0},
+    {RATE_76800,  RADIO_MOD_GFSK, 0, -101.0},
+    {RATE_115200, RADIO_MOD_GFSK, 0,  -99.0},
+    {RATE_250K,   RADIO_MOD_GFSK, 1,  -98.0},
+    {RATE_250K,   RADIO_MOD_GFSK, 0,  -95.0},
+    {RATE_500K,   RADIO_MOD_MSK,  0,  -86.0}
+};
+
+typedef struct linkadapt_s
+{
+    uint8_t              enabled;                              // Adapt own transmissions
+    uint8_t              power_control;                        // Adapt own transmission power
+    uint8_t              max_power_index;                      // Power index given by the options
+    float                power_margin_db;                      // Margin kept over the sensitivity
+    float                target_per;                           // Target packet error rate
+    float                required_margin_db;                   // Margin over sensitivity for the target
+    uint8_t              nb_profiles;                          // Number of usable profiles
+    linkadapt_profile_t  profiles[LINKADAPT_MAX_PROFILES];     // Profile 0 is the base profile
+    msp430_modem_parms_t modem_parms[LINKADAPT_MAX_PROFILES];  // Modem settings of each profile
+    uint32_t             block_times[LINKADAPT_MAX_PROFILES];  // Block time of each profile in microseconds
+    uint8_t              profiles_loaded;                      // Profiles loaded in the MSP430 as register profiles
+    linkadapt_peer_t     peers[LINKADAPT_MAX_PEERS];
+    uint8_t              local[LINKADAPT_MAX_LOCAL][7];        // Own addresses
+    uint8_t              nb_local;                             // Number of own addresses known
+} linkadapt_t;
+
+static linkadapt_t linkadapt;
+
+// === Static functions declarations ==============================================================
+
+static float    linkadapt_throughput(rate_t rate, uint8_t fec);
+static uint8_t  linkadapt_same_address(uint8_t *address_a, uint8_t *address_b);
+static int      linkadapt_frame_header(uint8_t *buffer, uint32_t size, uint32_t *index, uint8_t *header);
+static linkadapt_peer_t *linkadapt_find_peer(uint8_t *callsign, uint8_t create);
+static void     linkadapt_update_rssi(linkadapt_peer_t *peer, float rssi_dbm);
+static void     linkadapt_update_offset(linkadapt_peer_t *peer, uint8_t success);
+static uint8_t  linkadapt_is_local(uint8_t *callsign);
+static void     linkadapt_add_local(uint8_t *callsign);
+static uint8_t  linkadapt_peer_path_loss(linkadapt_peer_t *peer, float *path_loss_db);
+static uint8_t  linkadapt_peer_power(linkadapt_peer_t *peer);
+static uint8_t  linkadapt_peer_profile(linkadapt_peer_t *peer, uint8_t power_index);
+static float    linkadapt_block_error_rate(float margin_db);
+static float    linkadapt_gaussian();
+static float    linkadapt_rician_db(float k_factor);
+static int      linkadapt_switch(serial_t *serial_parms, int profile, msp430_modem_parms_t *modem_parms);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Useful bit rate of a rate and FEC combination
+float linkadapt_throughput(rate_t rate, uint8_t fec)
+// ------------------------------------------------------------------------------------------------
+{
+    return ((float) rate_values[rate]) / (fec ? 2.0 : 1.0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compare AX.25 addresses: callsign and SSID
+uint8_t linkadapt_same_address(uint8_t *address_a, uint8_t *address_b)
+// ------------------------------------------------------------------------------------------------
+{
+    return (memcmp(address_a, address_b, 6) == 0) && ((address_a[6] & 0x1E) == (address_b[6] & 0x1E));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Unescape the head of the next KISS frame in the buffer starting at index. Index is moved past
+// the frame. Returns the number of header bytes or -1 when there are no more frames.
+int linkadapt_frame_header(uint8_t *buffer, uint32_t size, uint32_t *index, uint8_t *header)
+// ------------------------------------------------------------------------------------------------
+{
+    int     header_len = 0;
+    uint8_t byte, fesc = 0;
+
+    while ((*index < size) && (buffer[*index] == KISS_FEND))
+    {
+        (*index)++;
+    }
+
+    if (*index >= size)
+    {
+        return -1;
+    }
+
+    while ((*index < size) && (buffer[*index] != KISS_FEND))
+    {
+        byte = buffer[(*index)++];
+
+        if (header_len == LINKADAPT_HEADER_SIZE)
+        {
+            continue;
+        }
+        else if (byte == KISS_FESC)
+        {
+            fesc = 1;
+        }
+        else if (fesc)
+        {
+            header[header_len++] = (byte == KISS_TFEND ? KISS_FEND : KISS_FESC);
+            fesc = 0;
+        }
+        else
+        {
+            header[header_len++] = byte;
+        }
+    }
+
+    return header_len;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Find the peer with the given address. If create is set and the peer is unknown the least
+// recently heard peer is replaced. Returns 0 if the peer is not found.
+linkadapt_peer_t *linkadapt_find_peer(uint8_t *callsign, uint8_t create)
+// ------------------------------------------------------------------------------------------------
+{
+    linkadapt_peer_t *oldest = &linkadapt.peers[0];
+    int i;
+
+    for (i=0; i < LINKADAPT_MAX_PEERS; i++)
+    {
+        if (linkadapt.peers[i].valid && linkadapt_same_address(linkadapt.peers[i].callsign, callsign))
+        {
+            return &linkadapt.peers[i];
+        }
+
+        if (!linkadapt.peers[i].valid || (oldest->valid && (linkadapt.peers[i].last_us < oldest->last_us)))
+        {
+            oldest = &linkadapt.peers[i];
+        }
+    }
+
+    if (!create)
+    {
+        return 0;
+    }
+
+    memset(oldest, 0, sizeof(linkadapt_peer_t));
+    memcpy(oldest->callsign, callsign, 7);
+    oldest->valid = 1;
+
+    return oldest;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Take a new RSSI measurement of the peer into account
+void linkadapt_update_rssi(linkadapt_peer_t *peer, float rssi_dbm)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!peer->has_rssi)
+    {
+        peer->rssi_dbm = rssi_dbm;
+        peer->has_rssi = 1;
+    }
+    else
+    {
+        peer->rssi_dbm += LINKADAPT_RSSI_ALPHA * (rssi_dbm - peer->rssi_dbm);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Outer loop: a failure raises the margin by one step and a success lowers it by a fraction of
+// the step so that the failure rate settles at the target
+void linkadapt_update_offset(linkadapt_peer_t *peer, uint8_t success)
+// ------------------------------------------------------------------------------------------------
+{
+    if (success)
+    {
+        peer->successes++;
+        peer->offset_db -= LINKADAPT_OFFSET_STEP * linkadapt.target_per / (1.0 - linkadapt.target_per);
+    }
+    else
+    {
+        peer->failures++;
+        peer->offset_db += LINKADAPT_OFFSET_STEP;
+    }
+
+    if (peer->offset_db > LINKADAPT_OFFSET_MAX)
+    {
+        peer->offset_db = LINKADAPT_OFFSET_MAX;
+    }
+    else if (peer->offset_db < -LINKADAPT_OFFSET_MAX)
+    {
+        peer->offset_db = -LINKADAPT_OFFSET_MAX;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tell if the address is one of our own
+uint8_t linkadapt_is_local(uint8_t *callsign)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i < linkadapt.nb_local; i++)
+    {
+        if (linkadapt_same_address(linkadapt.local[i], callsign))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Learn an own address from the source of a transmitted frame
+void linkadapt_add_local(uint8_t *callsign)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!linkadapt_is_local(callsign) && (linkadapt.nb_local < LINKADAPT_MAX_LOCAL))
+    {
+        memcpy(linkadapt.local[linkadapt.nb_local++], callsign, 7);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Path loss towards the peer. The one reported by the peer is preferred over the one measured in
+// the other direction. Returns 0 if unknown.
+uint8_t linkadapt_peer_path_loss(linkadapt_peer_t *peer, float *path_loss_db)
+// ------------------------------------------------------------------------------------------------
+{
+    if (peer->report_us && (now_us() - peer->report_us < LINKADAPT_REPORT_TIMEOUT))
+    {
+        *path_loss_db = peer->reported_path_loss_db;
+        return 1;
+    }
+    else if (peer->has_path_loss)
+    {
+        *path_loss_db = peer->path_loss_db;
+        return 1;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Lowest power index giving the peer the required margin over the sensitivity of the fastest
+// profile. Power is reduced only when the fastest profile is already reachable.
+uint8_t linkadapt_peer_power(linkadapt_peer_t *peer)
+// ------------------------------------------------------------------------------------------------
+{
+    float path_loss_db, target_dbm;
+    int   i;
+
+    if (!linkadapt.power_control || !linkadapt_peer_path_loss(peer, &path_loss_db))
+    {
+        return linkadapt.max_power_index;
+    }
+
+    target_dbm = linkadapt.profiles[linkadapt.enabled ? linkadapt.nb_profiles - 1 : 0].sensitivity_dbm
+        + peer->offset_db + linkadapt.required_margin_db + linkadapt.power_margin_db;
+
+    for (i=0; i < linkadapt.max_power_index; i++)
+    {
+        if (power_values[i] - path_loss_db >= target_dbm)
+        {
+            return i;
+        }
+    }
+
+    return linkadapt.max_power_index;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Fastest profile whose margin over sensitivity meets the target for this peer when transmitting
+// with the given power index. Without path loss estimate the RSSI of the peer is used.
+uint8_t linkadapt_peer_profile(linkadapt_peer_t *peer, uint8_t power_index)
+// ------------------------------------------------------------------------------------------------
+{
+    float rssi_dbm, path_loss_db;
+    int   i;
+
+    if (linkadapt_peer_path_loss(peer, &path_loss_db))
+    {
+        rssi_dbm = power_values[power_index] - path_loss_db;
+    }
+    else
+    {
+        rssi_dbm = peer->rssi_dbm;
+    }
+
+    for (i = linkadapt.nb_profiles - 1; i > 0; i--)
+    {
+        if (rssi_dbm - linkadapt.profiles[i].sensitivity_dbm - peer->offset_db >= linkadapt.required_margin_db)
+        {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Block error rate model: 1% at sensitivity and one decade per dB of margin
+float linkadapt_block_error_rate(float margin_db)
+// ------------------------------------------------------------------------------------------------
+{
+    float error_rate = 0.01 * pow(10.0, -margin_db);
+
+    return (error_rate > 1.0 ? 1.0 : error_rate);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Normal random variable (Box-Muller)
+float linkadapt_gaussian()
+// ------------------------------------------------------------------------------------------------
+{
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Power gain in dB of a Rician fading channel with unit mean power
+float linkadapt_rician_db(float k_factor)
+// ------------------------------------------------------------------------------------------------
+{
+    float los     = sqrt(k_factor / (k_factor + 1.0));
+    float scatter = sqrt(1.0 / (2.0 * (k_factor + 1.0)));
+    float i       = los + scatter * linkadapt_gaussian();
+    float q       = scatter * linkadapt_gaussian();
+
+    return 10.0 * log10(i*i + q*q + 1e-12);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Switch the modem to a profile. A profile loaded in the MSP430 is just selected else the modem
+// settings are sent. Returns 0 if successful else -1
+int linkadapt_switch(serial_t *serial_parms, int profile, msp430_modem_parms_t *modem_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_reg_select_t select;
+
+    if ((profile >= 0) && linkadapt.profiles_loaded)
+    {
+        return radio_select_profile(serial_parms, profile, &select);
+    }
+
+    return (radio_set_modem(serial_parms, modem_parms) == 2 ? 0 : -1);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Build the profile ladder from the base settings up to the maximum rate
+void linkadapt_init(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    linkadapt_profile_t *base = &linkadapt.profiles[0];
+    float base_throughput = linkadapt_throughput(arguments->rate, arguments->fec);
+    int   i, nb_ladder = sizeof(linkadapt_ladder) / sizeof(linkadapt_profile_t);
+
+    memset(&linkadapt, 0, sizeof(linkadapt_t));
+    linkadapt.enabled = arguments->link_adapt;
+    linkadapt.power_control = arguments->tx_power_control;
+    linkadapt.max_power_index = arguments->power_index;
+    linkadapt.power_margin_db = arguments->tx_power_margin;
+    linkadapt.target_per = arguments->link_adapt_per;
+    linkadapt.required_margin_db = log10(0.01 / arguments->link_adapt_per);
+
+    // Base profile is the one given by the options. Its sensitivity is the one of the fastest
+    // ladder entry not faster than it.
+    base->rate = arguments->rate;
+    base->modulation = arguments->modulation;
+    base->fec = arguments->fec;
+    base->sensitivity_dbm = linkadapt_ladder[0].sensitivity_dbm;
+
+    for (i=0; i < nb_ladder; i++)
+    {
+        if (linkadapt_throughput(linkadapt_ladder[i].rate, linkadapt_ladder[i].fec) <= base_throughput)
+        {
+            base->sensitivity_dbm = linkadapt_ladder[i].sensitivity_dbm - (base->fec && !linkadapt_ladder[i].fec ? 3.0 : 0.0);
+        }
+    }
+
+    linkadapt.nb_profiles = 1;
+    linkadapt.profiles_loaded = 0;
+
+    for (i=0; (i < nb_ladder) && (linkadapt.nb_profiles < LINKADAPT_MAX_PROFILES); i++)
+    {
+        if ((linkadapt_throughput(linkadapt_ladder[i].rate, linkadapt_ladder[i].fec) > base_throughput)
+         && (linkadapt_ladder[i].rate <= arguments->link_adapt_max_rate))
+        {
+            linkadapt.profiles[linkadapt.nb_profiles++] = linkadapt_ladder[i];
+        }
+    }
+
+    for (i=0; i < linkadapt.nb_profiles; i++)
+    {
+        init_modem_parms(&linkadapt.modem_parms[i],
+            arguments,
+            linkadapt.profiles[i].rate,
+            linkadapt.profiles[i].modulation,
+            linkadapt.profiles[i].fec);
+        linkadapt.block_times[i] = ((uint32_t) radio_get_modem_byte_time(&linkadapt.modem_parms[i])) * (arguments->packet_length + 2)
+            + arguments->block_delay;
+        verbprintf(2, "LINKADAPT: profile %d: %d Baud %s FEC %s sensitivity %.1f dBm\n",
+            i,
+            rate_values[linkadapt.profiles[i].rate],
+            modulation_names[linkadapt.profiles[i].modulation],
+            (linkadapt.profiles[i].fec ? "on" : "off"),
+            linkadapt.profiles[i].sensitivity_dbm);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Load the profiles in the MSP430 as register profiles over the radio parameters in use so that
+// switching is a single selection. The Tx power is left to the power control.
+void linkadapt_load_profiles(serial_t *serial_parms, msp430_radio_parms_t *radio_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    if (!linkadapt.enabled || (linkadapt.nb_profiles < 2) || (linkadapt.nb_profiles > MSP430_REG_PROFILES))
+    {
+        return;
+    }
+
+    for (i=0; i < linkadapt.nb_profiles; i++)
+    {
+        if (radio_load_profile(serial_parms, i, radio_parms, &linkadapt.modem_parms[i], 0) < 0)
+        {
+            verbprintft(1, "LINKADAPT: cannot load profile %d in the MSP430\n", i);
+            return;
+        }
+    }
+
+    linkadapt.profiles_loaded = 1;
+    verbprintft(2, "LINKADAPT: %d profiles loaded in the MSP430\n", linkadapt.nb_profiles);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Record the RSSI of a packet received at the base profile against the sources of its frames
+void linkadapt_observe(uint8_t *packet, uint32_t size, float rssi_dbm)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  header[LINKADAPT_HEADER_SIZE];
+    uint32_t index = 0;
+    int      header_len;
+    linkadapt_peer_t *peer;
+
+    while ((header_len = linkadapt_frame_header(packet, size, &index, header)) >= 0)
+    {
+        if ((header_len == LINKADAPT_HEADER_SIZE) && ((header[0] & 0x0F) == 0)) // data frame
+        {
+            peer = linkadapt_find_peer(&header[8], 1);
+            linkadapt_update_rssi(peer, rssi_dbm);
+            peer->last_us = now_us();
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Choose the profile and the power index for a burst of KISS frames. All destinations must be
+// reached so this is the slowest profile and the highest power of the destinations. Unknown
+// destinations get the base profile and the power given by the options.
+// The source address of the first frame is copied to source.
+uint8_t linkadapt_select(uint8_t *burst, uint32_t size, uint8_t *source, uint8_t *power_index)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  header[LINKADAPT_HEADER_SIZE];
+    uint32_t index = 0;
+    uint8_t  profile = LINKADAPT_MAX_PROFILES, peer_profile, peer_power, unknown = 0;
+    int      header_len, nb_peers = 0, i;
+    linkadapt_peer_t *peer, *peers[LINKADAPT_MAX_PEERS];
+
+    *power_index = linkadapt.max_power_index;
+
+    if (!linkadapt.enabled && !linkadapt.power_control)
+    {
+        return 0;
+    }
+
+    while ((header_len = linkadapt_frame_header(burst, size, &index, header)) >= 0)
+    {
+        if ((header_len != LINKADAPT_HEADER_SIZE) || ((header[0] & 0x0F) != 0))
+        {
+            return 0;
+        }
+
+        if (profile == LINKADAPT_MAX_PROFILES)
+        {
+            memcpy(source, &header[8], 7);
+            profile = 0;
+        }
+
+        linkadapt_add_local(&header[8]);
+        peer = linkadapt_find_peer(&header[1], 0);
+
+        if (!peer)
+        {
+            unknown = 1;
+            continue;
+        }
+
+        for (i=0; (i < nb_peers) && (peers[i] != peer); i++);
+
+        if (i == nb_peers)
+        {
+            peers[nb_peers++] = peer;
+        }
+    }
+
+    if (unknown || (nb_peers == 0))
+    {
+        return 0;
+    }
+
+    *power_index = 0;
+
+    for (i=0; i < nb_peers; i++)
+    {
+        peer_power = linkadapt_peer_power(peers[i]);
+
+        if (peer_power > *power_index)
+        {
+            *power_index = peer_power;
+        }
+    }
+
+    if (!linkadapt.enabled || (linkadapt.nb_profiles < 2))
+    {
+        return 0;
+    }
+
+    profile = LINKADAPT_MAX_PROFILES;
+
+    for (i=0; i < nb_peers; i++)
+    {
+        peer_profile = linkadapt_peer_profile(peers[i], *power_index);
+
+        if (peer_profile < profile)
+        {
+            profile = peer_profile;
+        }
+    }
+
+    return profile;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Build the link report that heads a burst: magic byte, transmission power in dBm, source address
+// then for each destination heard its address and the path loss measured from it in dB.
+// Returns the size of the report (0 if there is no report to send)
+uint32_t linkadapt_report(uint8_t *report, uint8_t *burst, uint32_t size, uint8_t power_index)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  header[LINKADAPT_HEADER_SIZE];
+    uint32_t index = 0, report_size = 10;
+    uint8_t  nb_entries = 0, has_source = 0;
+    int      header_len, i;
+    linkadapt_peer_t *peer;
+
+    if (!linkadapt.enabled && !linkadapt.power_control)
+    {
+        return 0;
+    }
+
+    while ((header_len = linkadapt_frame_header(burst, size, &index, header)) >= 0)
+    {
+        if ((header_len != LINKADAPT_HEADER_SIZE) || ((header[0] & 0x0F) != 0))
+        {
+            continue;
+        }
+
+        if (!has_source)
+        {
+            memcpy(&report[2], &header[8], 7);
+            has_source = 1;
+        }
+
+        peer = linkadapt_find_peer(&header[1], 0);
+
+        if (!peer || !peer->has_path_loss || (nb_entries == LINKADAPT_REPORT_ENTRIES))
+        {
+            continue;
+        }
+
+        for (i=0; (i < nb_entries) && !linkadapt_same_address(&report[10 + 8*i], peer->callsign); i++);
+
+        if (i == nb_entries)
+        {
+            memcpy(&report[report_size], peer->callsign, 7);
+            report[report_size + 7] = (peer->path_loss_db < 0.0 ? 0 : (peer->path_loss_db > 255.0 ? 255 : (uint8_t) (peer->path_loss_db + 0.5)));
+            report_size += 8;
+            nb_entries++;
+        }
+    }
+
+    if (!has_source)
+    {
+        return 0;
+    }
+
+    report[0] = LINKADAPT_REPORT_MAGIC;
+    report[1] = (uint8_t) ((int8_t) power_values[power_index]);
+    report[9] = nb_entries;
+
+    return report_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Process and remove the link report heading a received packet. The path loss from the sender is
+// measured with its transmission power and the path loss it reports towards us is recorded.
+// Returns the size of the packet left (0 if the report is invalid)
+uint32_t linkadapt_strip_report(uint8_t *packet, uint32_t size, float rssi_dbm)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t report_size;
+    float    path_loss_db;
+    int      i;
+    linkadapt_peer_t *peer;
+
+    if ((size == 0) || (packet[0] != LINKADAPT_REPORT_MAGIC))
+    {
+        return size;
+    }
+
+    if ((size < 10) || (packet[9] > LINKADAPT_REPORT_ENTRIES))
+    {
+        return 0;
+    }
+
+    report_size = 10 + 8*packet[9];
+
+    if (size < report_size)
+    {
+        return 0;
+    }
+
+    peer = linkadapt_find_peer(&packet[2], 1);
+    path_loss_db = ((int8_t) packet[1]) - rssi_dbm;
+
+    if (!peer->has_path_loss)
+    {
+        peer->path_loss_db = path_loss_db;
+        peer->has_path_loss = 1;
+    }
+    else
+    {
+        peer->path_loss_db += LINKADAPT_PATH_LOSS_ALPHA * (path_loss_db - peer->path_loss_db);
+    }
+
+    peer->last_us = now_us();
+
+    for (i=0; i < packet[9]; i++)
+    {
+        if (linkadapt_is_local(&packet[10 + 8*i]))
+        {
+            peer->reported_path_loss_db = packet[10 + 8*i + 7];
+            peer->report_us = peer->last_us;
+        }
+    }
+
+    memmove(packet, &packet[report_size], size - report_size);
+    return size - report_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Recognize an announcement packet. Returns 1 if it is one.
+uint8_t linkadapt_parse_announce(uint8_t *packet, uint32_t size, linkadapt_announce_t *announce)
+// ------------------------------------------------------------------------------------------------
+{
+    if ((size != LINKADAPT_ANNOUNCE_SIZE) || (packet[0] != LINKADAPT_MAGIC))
+    {
+        return 0;
+    }
+
+    if ((packet[1] ^ packet[2] ^ packet[3] ^ 0xFF) != packet[4])
+    {
+        return 0;
+    }
+
+    if ((packet[1] >= NUM_RATE) || (packet[2] >= RADIO_NUM_MOD) || (packet[3] > 1))
+    {
+        return 0;
+    }
+
+    announce->rate = (rate_t) packet[1];
+    announce->modulation = (radio_modulation_t) packet[2];
+    announce->fec = packet[3];
+    memcpy(announce->callsign, &packet[5], 7);
+
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Prepare a burst with the given profile. The profile is announced at the base profile then the
+// modem is switched for the burst that the caller sends one block at a time. The MSP430 holds the
+// first block of the burst for the time the peer needs to switch its modem.
+// keyup_delay_us  is the keyup delay before the first block after reception
+// block_delay_us  is the minimum time between blocks
+// Returns 0 if successful else -1
+int linkadapt_start(serial_t *serial_parms,
+    uint8_t     profile,
+    uint8_t     *source,
+    uint32_t    keyup_delay_us,
+    uint32_t    block_delay_us,
+    arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t announce[LINKADAPT_ANNOUNCE_SIZE];
+
+    announce[0] = LINKADAPT_MAGIC;
+    announce[1] = (uint8_t) linkadapt.profiles[profile].rate;
+    announce[2] = (uint8_t) linkadapt.profiles[profile].modulation;
+    announce[3] = linkadapt.profiles[profile].fec;
+    announce[4] = announce[1] ^ announce[2] ^ announce[3] ^ 0xFF;
+    memcpy(&announce[5], source, 7);
+
+    verbprintft(2, "LINKADAPT: send at %d Baud %s FEC %s\n",
+        rate_values[linkadapt.profiles[profile].rate],
+        modulation_names[linkadapt.profiles[profile].modulation],
+        (linkadapt.profiles[profile].fec ? "on" : "off"));
+
+    // The delay after the announcement block is the switch time of the peer
+    if (radio_set_tx_timing(serial_parms, keyup_delay_us, LINKADAPT_SWITCH_DELAY + arguments->tnc_switchover_delay) < 0)
+    {
+        return -1;
+    }
+
+    if (radio_send_packet(serial_parms, announce, arguments->packet_length, LINKADAPT_ANNOUNCE_SIZE,
+        linkadapt.block_times[0]))
+    {
+        return -1;
+    }
+
+    if (radio_set_tx_timing(serial_parms, keyup_delay_us, block_delay_us) < 0)
+    {
+        return -1;
+    }
+
+    if (linkadapt_switch(serial_parms, profile, &linkadapt.modem_parms[profile]) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "LINKADAPT: cannot switch modem" ANSI_COLOR_RESET "\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return to the base profile after a burst. When the burst is interrupted the peer waits for the
+// next block at the burst profile for one block time before it switches back: the MSP430 then
+// holds the next block sent at the base profile for this time.
+// Returns 0 if successful else -1
+int linkadapt_stop(serial_t *serial_parms,
+    uint8_t     profile,
+    uint8_t     interrupted,
+    uint32_t    block_delay_us,
+    arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    if (linkadapt_switch(serial_parms, 0, &linkadapt.modem_parms[0]) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "LINKADAPT: cannot switch modem back" ANSI_COLOR_RESET "\n");
+        return -1;
+    }
+
+    if (interrupted)
+    {
+        if (radio_set_tx_timing(serial_parms,
+            linkadapt.block_times[profile] + LINKADAPT_SWITCH_DELAY + arguments->tnc_switchover_delay,
+            block_delay_us) < 0)
+        {
+            return -1;
+        }
+
+        if (radio_cancel_rx(serial_parms) < 0) // next block is timed from its arrival as after reception
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Block time of a profile in microseconds
+uint32_t linkadapt_block_time(uint8_t profile)
+// ------------------------------------------------------------------------------------------------
+{
+    return linkadapt.block_times[profile];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Receive the packet following an announcement with the announced modem settings then return to
+// the base profile. The outcome drives the margin used to transmit to the same peer.
+// The radio is left idle when a packet is received and in Rx otherwise like in
+// radio_receive_packet_nb. Returns the packet size or 0 if nothing was received.
+int linkadapt_receive(serial_t *serial_parms,
+    uint8_t              *packet,
+    linkadapt_announce_t *announce,
+    arguments_t          *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_modem_parms_t modem_parms;
+    uint32_t block_time, size;
+    linkadapt_peer_t *peer;
+    int profile;
+
+    init_modem_parms(&modem_parms, arguments, announce->rate, announce->modulation, announce->fec);
+
+    for (profile = linkadapt.nb_profiles - 1; profile >= 0; profile--) // -1 if the peer uses another
+    {
+        if ((linkadapt.profiles[profile].rate == announce->rate)
+         && (linkadapt.profiles[profile].modulation == announce->modulation)
+         && (linkadapt.profiles[profile].fec == announce->fec))
+        {
+            break;
+        }
+    }
+
+    block_time = ((uint32_t) radio_get_modem_byte_time(&modem_parms)) * (arguments->packet_length + 2) + arguments->block_delay;
+
+    verbprintft(2, "LINKADAPT: receive at %d Baud %s FEC %s\n",
+        rate_values[announce->rate],
+        modulation_names[announce->modulation],
+        (announce->fec ? "on" : "off"));
+
+    if (linkadapt_switch(serial_parms, profile, &modem_parms) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "LINKADAPT: cannot switch modem" ANSI_COLOR_RESET "\n");
+        radio_turn_on_rx(serial_parms, arguments->packet_length);
+        return 0;
+    }
+
+    radio_turn_on_rx(serial_parms, arguments->packet_length);
+
+    size = radio_receive_packet(serial_parms,
+        packet,
+        arguments->packet_length,
+        2*LINKADAPT_SWITCH_DELAY + arguments->tnc_switchover_delay + linkadapt.block_times[0] + block_time,
+        block_time);
+
+    if (size == 0)
+    {
+        radio_cancel_rx(serial_parms);
+    }
+
+    linkadapt_switch(serial_parms, 0, &linkadapt.modem_parms[0]);
+
+    peer = linkadapt_find_peer(announce->callsign, 1);
+    peer->last_us = now_us();
+
+    if ((size > 0) || !radio_rx_streams_pending()) // an interrupted burst continues at the base profile
+    {
+        linkadapt_update_offset(peer, (size > 0));
+    }
+
+    if (size == 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "LINKADAPT: announced packet not received or interrupted" ANSI_COLOR_RESET "\n");
+        radio_turn_on_rx(serial_parms, arguments->packet_length);
+    }
+
+    return size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print the link quality of the known peers
+void linkadapt_print_peers(int verb_level)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t profile, power_index;
+    int     i, j;
+
+    for (i=0; i < LINKADAPT_MAX_PEERS; i++)
+    {
+        if (!linkadapt.peers[i].valid)
+        {
+            continue;
+        }
+
+        power_index = linkadapt_peer_power(&linkadapt.peers[i]);
+        profile = linkadapt_peer_profile(&linkadapt.peers[i], power_index);
+        verbprintf(verb_level, "LINKADAPT: ");
+
+        for (j=0; j < 6; j++)
+        {
+            verbprintf(verb_level, "%c", (linkadapt.peers[i].callsign[j] >> 1) & 0x7F);
+        }
+
+        verbprintf(verb_level, "-%d: RSSI %.1f dBm path loss %.1f/%.1f dB offset %.2f dB ok %d ko %d -> %d Baud %s FEC %s %d dBm\n",
+            (linkadapt.peers[i].callsign[6] >> 1) & 0x0F,
+            linkadapt.peers[i].rssi_dbm,
+            linkadapt.peers[i].path_loss_db,
+            linkadapt.peers[i].reported_path_loss_db,
+            linkadapt.peers[i].offset_db,
+            linkadapt.peers[i].successes,
+            linkadapt.peers[i].failures,
+            rate_values[linkadapt.profiles[profile].rate],
+            modulation_names[linkadapt.profiles[profile].modulation],
+            (linkadapt.profiles[profile].fec ? "on" : "off"),
+            power_values[power_index]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Simulate the adaptation on peers at increasing distances and compare with the base profile.
+// The channel has a log-distance path loss, a lognormal shadowing per peer and a Rician fading
+// per packet. Each step the peer is heard once at the base profile then one burst is sent to it.
+void linkadapt_simulate(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    static const float distances_m[] = {50.0, 100.0, 200.0, 400.0, 700.0, 1000.0, 1500.0};
+    static const float path_loss_1m_db = 25.2; // free space at 433 MHz
+    static const float path_exponent = 2.7;
+    static const float shadowing_db = 4.0;
+    static const float k_factor = 10.0;
+    arguments_t      sim_arguments = *arguments;
+    linkadapt_peer_t *peer;
+    uint8_t  callsign[7] = {'P'<<1, 'E'<<1, 'E'<<1, 'R'<<1, ' '<<1, ' '<<1, 0x60};
+    uint8_t  profile, success, base_success;
+    uint32_t payload_bytes, nb_blocks, profile_uses[LINKADAPT_MAX_PROFILES];
+    uint32_t steps = 1000 * arguments->repetition, failures, base_failures, announce_bits;
+    float    mean_rssi_dbm, rssi_dbm, air_time, base_air_time, block_bits, main_profile_uses;
+    int      d, i, j, step, main_profile;
+
+    sim_arguments.link_adapt = 1;
+    sim_arguments.tx_power_control = 0;
+    linkadapt_init(&sim_arguments);
+    srand(1);
+
+    payload_bytes = (arguments->packet_length - RADIO_PACKET_HEADER_SIZE) * 4;
+    nb_blocks     = 4;
+    block_bits    = (arguments->packet_length + 2) * 8.0;
+    announce_bits = block_bits;
+
+    fprintf(stderr, "Link adaptation simulation: %d profiles, target PER %.3f, %d steps per peer\n",
+        linkadapt.nb_profiles, linkadapt.target_per, steps);
+    fprintf(stderr, "Dist (m)  RSSI (dBm)  Main profile              Adapt (b/s)  PER     Base (b/s)  PER\n");
+
+    for (d=0; d < sizeof(distances_m) / sizeof(float); d++)
+    {
+        memset(linkadapt.peers, 0, sizeof(linkadapt.peers));
+        memset(profile_uses, 0, sizeof(profile_uses));
+        callsign[5] = ('0' + d) << 1;
+        peer = linkadapt_find_peer(callsign, 1);
+        mean_rssi_dbm = power_values[arguments->power_index] - path_loss_1m_db
+            - 10.0 * path_exponent * log10(distances_m[d]) + shadowing_db * linkadapt_gaussian();
+        air_time = 0.0;
+        base_air_time = 0.0;
+        failures = 0;
+        base_failures = 0;
+
+        for (step=0; step < steps; step++)
+        {
+            linkadapt_update_rssi(peer, mean_rssi_dbm + linkadapt_rician_db(k_factor));
+            peer->last_us = step + 1;
+            profile = linkadapt_peer_profile(peer, linkadapt.max_power_index);
+            profile_uses[profile]++;
+
+            rssi_dbm = mean_rssi_dbm + linkadapt_rician_db(k_factor);
+            success = 1;
+            base_success = 1;
+
+            for (j=0; j < nb_blocks; j++)
+            {
+                if (rand() < RAND_MAX * linkadapt_block_error_rate(rssi_dbm - linkadapt.profiles[profile].sensitivity_dbm))
+                {
+                    success = 0;
+                }
+
+                if (rand() < RAND_MAX * linkadapt_block_error_rate(rssi_dbm - linkadapt.profiles[0].sensitivity_dbm))
+                {
+                    base_success = 0;
+                }
+            }
+
+            if (profile)
+            {
+                air_time += announce_bits / linkadapt_throughput(linkadapt.profiles[0].rate, linkadapt.profiles[0].fec)
+                    + LINKADAPT_SWITCH_DELAY / 1e6;
+                linkadapt_update_offset(peer, success);
+            }
+
+            air_time += nb_blocks * block_bits / linkadapt_throughput(linkadapt.profiles[profile].rate, linkadapt.profiles[profile].fec);
+            base_air_time += nb_blocks * block_bits / linkadapt_throughput(linkadapt.profiles[0].rate, linkadapt.profiles[0].fec);
+            failures += !success;
+            base_failures += !base_success;
+        }
+
+        main_profile = 0;
+        main_profile_uses = 0;
+
+        for (i=0; i < linkadapt.nb_profiles; i++)
+        {
+            if (profile_uses[i] > main_profile_uses)
+            {
+                main_profile = i;
+                main_profile_uses = profile_uses[i];
+            }
+        }
+
+        fprintf(stderr, "%8.0f  %10.1f  %6d Baud %-5s FEC %-3s  %11.0f  %.4f  %10.0f  %.4f\n",
+            distances_m[d],
+            mean_rssi_dbm,
+            rate_values[linkadapt.profiles[main_profile].rate],
+            modulation_names[linkadapt.profiles[main_profile].modulation],
+            (linkadapt.profiles[main_profile].fec ? "on" : "off"),
+            ((float) (steps - failures)) * payload_bytes * 8.0 / air_time,
+            ((float) failures) / steps,
+            ((float) (steps - base_failures)) * payload_bytes * 8.0 / base_air_time,
+            ((float) base_failures) / steps);
+    }
+}
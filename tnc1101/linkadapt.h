@@ -0,0 +1,98 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Link adaptation of data rate, modulation and FEC per peer                  */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _LINKADAPT_H_
+#define _LINKADAPT_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "serial.h"
+#include "msp430_interface.h"
+
+#define LINKADAPT_MAX_PROFILES  16    // Maximum number of rate, modulation and FEC combinations
+#define LINKADAPT_MAX_PEERS     16    // Number of peers whose link quality is tracked
+#define LINKADAPT_HEADER_SIZE   15    // KISS type byte followed by destination and source addresses
+#define LINKADAPT_MAGIC         0xA5  // First byte of an announcement packet. KISS packets start with FEND.
+#define LINKADAPT_ANNOUNCE_SIZE 12    // Magic, rate, modulation, FEC, check and source address
+#define LINKADAPT_RSSI_ALPHA    0.125 // Smoothing factor of the peer RSSI average
+#define LINKADAPT_OFFSET_STEP   1.0   // Margin offset increase in dB after a failed packet
+#define LINKADAPT_OFFSET_MAX    20.0  // Margin offset limit in dB
+#define LINKADAPT_SWITCH_DELAY  2000  // Time in microseconds given to the peer to switch its modem
+#define LINKADAPT_REPORT_MAGIC  0xA6  // First byte of a packet starting with a link report
+#define LINKADAPT_REPORT_ENTRIES 4    // Maximum number of peers in a link report
+#define LINKADAPT_REPORT_MAX_SIZE (10 + 8*LINKADAPT_REPORT_ENTRIES) // Header and entries
+#define LINKADAPT_REPORT_TIMEOUT 60000000 // Reports older than this in microseconds are not used
+#define LINKADAPT_PATH_LOSS_ALPHA 0.25 // Smoothing factor of the peer path loss average
+#define LINKADAPT_MAX_LOCAL     4     // Number of own addresses learned from transmitted frames
+
+typedef struct linkadapt_profile_s
+{
+    rate_t             rate;            // Data rate
+    radio_modulation_t modulation;      // Modulation scheme
+    uint8_t            fec;             // FEC on (1) or off (0)
+    float              sensitivity_dbm; // Level giving 1% packet error rate
+} linkadapt_profile_t;
+
+typedef struct linkadapt_peer_s
+{
+    uint8_t  callsign[7]; // AX.25 address of the peer
+    uint8_t  valid;       // Slot in use
+    uint8_t  has_rssi;    // RSSI has been measured
+    float    rssi_dbm;    // Smoothed RSSI of the packets received from the peer
+    float    offset_db;   // Outer loop offset added to the required margin
+    uint8_t  has_path_loss;        // Path loss has been measured
+    float    path_loss_db;         // Smoothed path loss from the peer measured on its packets
+    float    reported_path_loss_db; // Path loss towards the peer reported by the peer
+    uint64_t report_us;            // Time of the last report of the peer (0: none)
+    uint32_t successes;   // Adapted packets received from the peer
+    uint32_t failures;    // Adapted packets announced by the peer and not received
+    uint64_t last_us;     // Time the peer was last heard
+} linkadapt_peer_t;
+
+typedef struct linkadapt_announce_s
+{
+    rate_t             rate;        // Data rate of the packet that follows
+    radio_modulation_t modulation;  // Modulation scheme of the packet that follows
+    uint8_t            fec;         // FEC of the packet that follows
+    uint8_t            callsign[7]; // AX.25 address of the sender
+} linkadapt_announce_t;
+
+void     linkadapt_init(arguments_t *arguments);
+void     linkadapt_load_profiles(serial_t *serial_parms, msp430_radio_parms_t *radio_parms);
+void     linkadapt_observe(uint8_t *packet, uint32_t size, float rssi_dbm);
+uint8_t  linkadapt_select(uint8_t *burst, uint32_t size, uint8_t *source, uint8_t *power_index);
+uint32_t linkadapt_report(uint8_t *report, uint8_t *burst, uint32_t size, uint8_t power_index);
+uint32_t linkadapt_strip_report(uint8_t *packet, uint32_t size, float rssi_dbm);
+uint8_t  linkadapt_parse_announce(uint8_t *packet, uint32_t size, linkadapt_announce_t *announce);
+
+int      linkadapt_start(serial_t *serial_parms,
+            uint8_t     profile,
+            uint8_t     *source,
+            uint32_t    keyup_delay_us,
+            uint32_t    block_delay_us,
+            arguments_t *arguments);
+
+int      linkadapt_stop(serial_t *serial_parms,
+            uint8_t     profile,
+            uint8_t     interrupted,
+            uint32_t    block_delay_us,
+            arguments_t *arguments);
+
+uint32_t linkadapt_block_time(uint8_t profile);
+
+int      linkadapt_receive(serial_t *serial_parms,
+            uint8_t              *packet,
+            linkadapt_announce_t *announce,
+            arguments_t          *arguments);
+
+void     linkadapt_print_peers(int verb_level);
+void     linkadapt_simulate(arguments_t *arguments);
+
+#endif // _LINKADAPT_H_
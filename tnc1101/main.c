@@ -12,15 +12,20 @@
 #include <argp.h>
 #include <string.h>
 #include <signal.h>
+#include <ctype.h>
 
 #include "main.h"
 #include "util.h"
 #include "serial.h"
 #include "radio.h"
+#include "linkadapt.h"
+#include "tuner.h"
+#include "sweep.h"
+#include "trace.h"
 #include "msp430_interface.h"
 
 arguments_t          arguments;
-serial_t             serial_parms_usb, serial_parms_ax25;
+serial_t             serial_parms_usb, serial_parms_usb_data, serial_parms_ax25;
 msp430_radio_parms_t radio_parms;
 
 char *tnc_mode_names[] = {
@@ -37,7 +42,13 @@ char *tnc_mode_names[] = {
     "Radio block echo test starting with Rx",
     "Radio packet transmission test",
     "Radio packet reception test",
-    "Radio packet reception test in non-blocking mode"
+    "Radio packet reception test in non-blocking mode",
+    "Link adaptation simulation",
+    "Modem register tuning",
+    "Modem register tuning responder",
+    "Modem register tuning simulation",
+    "Spectrum sweep",
+    "MSP430 event trace"
 };
 
 char *modulation_names[] = {
@@ -121,13 +132,39 @@ static struct argp_option options[] = {
     {"repetition",  'n', "REPETITION", 0, "Repetiton factor wherever appropriate, see long Help (-H) option (default : 1 single)"},
     {"radio-status",  's', 0, 0, "Print radio status and exit"},
     {"tnc-usb-device",  'U', "USB_SERIAL_DEVICE", 0, "Hardware TNC USB device, (default : /dev/ttyACM2"},
+    {"tnc-usb-data-device",  327, "USB_SERIAL_DEVICE", 0, "Hardware TNC USB device of the data interface, (default : USB device number + 1 e.g. /dev/ttyACM3"},
     {"tnc-serial-device",  'D', "SERIAL_DEVICE", 0, "TNC Serial device, (default : /var/ax25/axp2)"},
     {"tnc-serial-speed",  'B', "SERIAL_SPEED", 0, "TNC Serial speed in Bauds (default : 9600)"},
-    {"tnc-serial-window",  300, "TX_WINDOW_US", 0, "TNC time window in microseconds for concatenating serial frames. 0: no concatenation (default: 40ms))"},
-    {"tnc-radio-window",  301, "RX_WINDOW_US", 0, "TNC time window in microseconds for concatenating radio frames. 0: no concatenation (default: 0))"},
+    {"tnc-serial-window",  300, "TX_WINDOW_US", 0, "TNC maximum time in microseconds serial frames are held for concatenation. Frames go earlier when no more data is expected. 0: no concatenation (default: 40ms))"},
+    {"tnc-radio-window",  301, "RX_WINDOW_US", 0, "OBSOLETE: radio frames are delivered as soon as they are received"},
     {"tnc-keyup-delay",  302, "KEYUP_DELAY_US", 0, "TNC keyup delay in microseconds (default: 10ms)."},
     {"tnc-keydown-delay",  303, "KEYDOWN_DELAY_US", 0, "FUTUR USE: TNC keydown delay in microseconds (default: 0 inactive)"},
     {"tnc-switchover-delay",  304, "SWITCHOVER_DELAY_US", 0, "FUTUR USE: TNC switchover delay in microseconds (default: 0 inactive)"},
+    {"tnc-turnaround",  315, 0, 0, "Radio goes to reception by itself at the end of each block sent. Shortens the time replies are missed (default: off)"},
+    {"cal-period",  316, "SECONDS", 0, "Age of the frequency synthesizer calibration of a channel after which it is redone (default: 300)"},
+    {"hop",  317, "NB_CHANNELS", 0, "Hop over this number of channels (2 to 16) in KISS and SLIP modes (default: off)"},
+    {"hop-master",  318, 0, 0, "This station times the hops and sends the beacons the others synchronize on (default: off)"},
+    {"hop-dwell",  319, "DWELL_MS", 0, "Time spent on each channel in milliseconds (default: 500)"},
+    {"hop-spacing",  320, "SPACING_HZ", 0, "Channel spacing in Hz (default: 200000)"},
+    {"hop-seed",  321, "SEED", 0, "Seed of the hop sequence. Same for all stations (default: 1)"},
+    {"hop-beacon",  322, "NB_SLOTS", 0, "Number of slots between two beacons of the master (default: 1)"},
+    {"sweep-start",  323, "FREQUENCY_HZ", 0, "Lowest frequency of the spectrum sweep in Hz (default: 433050000)"},
+    {"sweep-stop",  324, "FREQUENCY_HZ", 0, "Highest frequency of the spectrum sweep in Hz (default: 434790000)"},
+    {"sweep-step",  325, "STEP_HZ", 0, "Frequency step of the spectrum sweep in Hz, 25.4 kHz minimum (default: 25000)"},
+    {"sweep-dwell",  326, "DWELL_US", 0, "Time the RSSI is read on each frequency of the spectrum sweep in microseconds (default: 200)"},
+    {"sync-word",  328, "SYNC_WORD", 0, "Sync word of the network in hex. Packets with another sync word are not even detected (default: D391)"},
+    {"address",  329, "ADDRESS", 0, "Address of the network 1 to 254. The radio drops the packets to other addresses except broadcast 0 and 255 before they are read. Fixed packet length up to 254 bytes only (default: off)"},
+    {"tx-address",  330, "ADDRESS", 0, "Address sent before each block 0 to 255. 0 or 255 to broadcast (default: network address)"},
+    {"rx-filter",  331, "OFFSET:VALUE[:MASK]", 0, "Drop blocks received whose bytes from OFFSET in the block do not match VALUE (hex, up to 4 bytes) on the bits set in MASK (hex, default: all) before they go to USB (default: off)"},
+    {"tnc-coalesce-delay",  305, "COALESCE_US", 0, "TNC quiet time in microseconds after a complete serial frame before it is sent (default: 200us)"},
+    {"link-adapt",  306, "MAX_RATE_INDEX", 0, "Adapt rate, modulation and FEC to each peer using rates up to this rate index. See long help (-H) option (default: off)"},
+    {"link-adapt-per",  307, "TARGET_PER", 0, "Target packet error rate of link adaptation (default: 0.01)"},
+    {"tx-power-margin",  308, "MARGIN_DB", 0, "Lower the Tx power for each peer down to this margin over sensitivity using the path loss peers report. Power index (-d) is the maximum (default: off)"},
+    {"afc",  309, 0, 0, "Track the frequency offset of received packets and keep it for the next start (default: off)"},
+    {"afc-file",  311, "FILE_NAME", 0, "File where learned frequency offsets are kept per frequency (default: $HOME/.tnc1101_afc)"},
+    {"tune-profile",  312, "PROFILE_NAME", 0, "Modem register profile saved by tuning (-t 15) or written after initialization in KISS mode (default: none, tuning uses rate and modulation e.g. 9600-2-FSK)"},
+    {"tune-blocks",  313, "NB_BLOCKS", 0, "Number of test blocks per tuning measurement (default: 100)"},
+    {"tune-file",  314, "FILE_NAME", 0, "File where modem register profiles are kept (default: $HOME/.tnc1101_profiles)"},
     {"bulk-file",  310, "FILE_NAME", 0, "File name to send or receive with bulk transmission (default: '-' stdin or stdout"},
     {0}
 };
@@ -135,6 +172,9 @@ static struct argp_option options[] = {
 // === Static functions declarations ==============================================================
 
 static void delete_args(arguments_t *arguments);
+static char *default_data_device(char *usbacm_device);
+static int  parse_hex_bytes(char *hex, uint8_t *bytes, int max_bytes);
+static int  parse_rx_filter(char *arg, msp430_filter_t *filter);
 
 static void file_bulk_transmit(serial_t *serial_parms, 
     msp430_radio_parms_t *radio_parms, 
@@ -151,6 +191,7 @@ static void file_bulk_receive(serial_t *serial_parms,
 static void terminate(const int signal_) {
 // ------------------------------------------------------------------------------------------------
     printf("PICC: Terminating with signal %d\n", signal_);
+    close_serial(&serial_parms_usb_data);
     close_serial(&serial_parms_usb);
     close_serial(&serial_parms_ax25);
     delete_args(&arguments);
@@ -197,9 +238,121 @@ static void print_long_help()
 
     fprintf(stderr, "\nRepetition factor option -n values\n");    
     fprintf(stderr, "- for test transmissions (-t option) this is the repetition of the same test packet\n");
+    fprintf(stderr, "- for the spectrum sweep this is the number of hundreds of sweeps\n");
 
 }
 
+// ------------------------------------------------------------------------------------------------
+// Data interface device of the hardware TNC: the one following the control interface device.
+// The two CDC interfaces of the MSP430 enumerate in order e.g. /dev/ttyACM2 then /dev/ttyACM3
+static char *default_data_device(char *usbacm_device)
+// ------------------------------------------------------------------------------------------------
+{
+    int  len = strlen(usbacm_device);
+    int  i = len;
+    char *data_device = malloc(len + 12);
+
+    while ((i > 0) && isdigit(usbacm_device[i-1]))
+    {
+        i--;
+    }
+
+    if (i == len) // no number to increment
+    {
+        snprintf(data_device, len + 12, "%s1", usbacm_device);
+    }
+    else
+    {
+        snprintf(data_device, len + 12, "%.*s%ld", i, usbacm_device, strtol(&usbacm_device[i], 0, 10) + 1);
+    }
+
+    return data_device;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Convert a string of hex digits to bytes. Returns the number of bytes or -1 if invalid
+static int parse_hex_bytes(char *hex, uint8_t *bytes, int max_bytes)
+// ------------------------------------------------------------------------------------------------
+{
+    int  len = strlen(hex);
+    int  i;
+    char byte_str[3] = {0, 0, 0};
+    char *end;
+
+    if ((len == 0) || (len % 2) || (len > 2*max_bytes))
+    {
+        return -1;
+    }
+
+    for (i=0; i < len/2; i++)
+    {
+        byte_str[0] = hex[2*i];
+        byte_str[1] = hex[2*i+1];
+        bytes[i] = strtoul(byte_str, &end, 16);
+
+        if (*end)
+        {
+            return -1;
+        }
+    }
+
+    return len/2;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Payload filter given as OFFSET:VALUE[:MASK]. Returns 0 if successful else -1
+static int parse_rx_filter(char *arg, msp430_filter_t *filter)
+// ------------------------------------------------------------------------------------------------
+{
+    char *value_str, *mask_str, *end;
+    long offset;
+    int  length, i;
+
+    value_str = strchr(arg, ':');
+
+    if (!value_str)
+    {
+        return -1;
+    }
+
+    offset = strtol(arg, &end, 10);
+
+    if ((end != value_str) || (offset < 0) || (offset > 255))
+    {
+        return -1;
+    }
+
+    *value_str++ = '\0';
+    mask_str = strchr(value_str, ':');
+
+    if (mask_str)
+    {
+        *mask_str++ = '\0';
+    }
+
+    length = parse_hex_bytes(value_str, filter->value, MSP430_FILTER_MAX_BYTES);
+
+    if (length < 0)
+    {
+        return -1;
+    }
+
+    for (i=0; i < MSP430_FILTER_MAX_BYTES; i++)
+    {
+        filter->mask[i] = 0xFF;
+    }
+
+    if (mask_str && (parse_hex_bytes(mask_str, filter->mask, MSP430_FILTER_MAX_BYTES) != length))
+    {
+        return -1;
+    }
+
+    filter->offset = offset;
+    filter->length = length;
+    filter->flags |= MSP430_FILTER_PAYLOAD;
+    return 0;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Init arguments
 static void init_args(arguments_t *arguments)
@@ -208,8 +361,12 @@ static void init_args(arguments_t *arguments)
     arguments->verbose_level = 0;
     arguments->print_long_help = 0;
     arguments->usbacm_device = 0;
+    arguments->usbacm_data_device = 0;
     arguments->serial_device = 0;
     arguments->bulk_filename = 0;
+    arguments->afc_filename = 0;
+    arguments->tune_profile = 0;
+    arguments->tune_filename = 0;
     arguments->serial_speed = B38400;
     arguments->serial_speed_n = 38400;
     arguments->print_radio_status = 0;
@@ -233,11 +390,34 @@ static void init_args(arguments_t *arguments)
     arguments->preamble = PREAMBLE_4;
     arguments->tnc_serial_window = 40000;
     arguments->tnc_radio_window = 0;
+    arguments->tnc_coalesce_delay = 200;
     arguments->tnc_keyup_delay = 4000;
     arguments->tnc_keydown_delay = 0;
     arguments->tnc_switchover_delay = 0;
+    arguments->tnc_turnaround = 0;
+    arguments->cal_period = MSP430_CAL_PERIOD_S;
+    arguments->hop_channels = 0;
+    arguments->hop_master = 0;
+    arguments->hop_dwell = 500;
+    arguments->hop_spacing = 200000;
+    arguments->hop_seed = 1;
+    arguments->hop_beacon = 1;
+    arguments->sweep_start = 433050000;
+    arguments->sweep_stop = 434790000;
+    arguments->sweep_step = 25000;
+    arguments->sweep_dwell = 200;
+    arguments->sync_word = 0xD391;
+    memset(&arguments->rx_filter, 0, sizeof(msp430_filter_t));
+    arguments->tx_address_set = 0;
     arguments->real_time = 0;
     arguments->slip = 0;
+    arguments->link_adapt = 0;
+    arguments->link_adapt_max_rate = RATE_500K;
+    arguments->link_adapt_per = 0.01;
+    arguments->tx_power_control = 0;
+    arguments->tx_power_margin = 10.0;
+    arguments->afc = 0;
+    arguments->tune_blocks = 100;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -253,10 +433,26 @@ void delete_args(arguments_t *arguments)
     {
         free(arguments->usbacm_device);
     }
+    if (arguments->usbacm_data_device)
+    {
+        free(arguments->usbacm_data_device);
+    }
     if (arguments->test_phrase)
     {
         free(arguments->test_phrase);
     }
+    if (arguments->afc_filename)
+    {
+        free(arguments->afc_filename);
+    }
+    if (arguments->tune_profile)
+    {
+        free(arguments->tune_profile);
+    }
+    if (arguments->tune_filename)
+    {
+        free(arguments->tune_filename);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -352,36 +548,97 @@ static void print_args(arguments_t *arguments)
     fprintf(stderr, "Preamble size .......: %d bytes\n", nb_preamble_bytes[arguments->preamble]);
     fprintf(stderr, "FEC .................: %s\n", (arguments->fec ? "on" : "off"));
     fprintf(stderr, "Whitening ...........: %s\n", (arguments->whitening ? "on" : "off"));
+    fprintf(stderr, "AFC .................: %s\n", (arguments->afc ? arguments->afc_filename : "off"));
+    fprintf(stderr, "Register profile ....: %s\n", (arguments->tune_profile ? arguments->tune_profile : "none"));
     fprintf(stderr, "TNC mode ............: %s\n", tnc_mode_names[arguments->tnc_mode]);
     fprintf(stderr, "--- test ---\n");
     fprintf(stderr, "Test phrase .........: %s\n", arguments->test_phrase);
     fprintf(stderr, "Test repetition .....: %d times\n", arguments->repetition);
     fprintf(stderr, "--- serial ---\n");
     fprintf(stderr, "Hardware TNC device .: %s\n", arguments->usbacm_device);
+    fprintf(stderr, "Hardware TNC data ...: %s\n", arguments->usbacm_data_device);
     fprintf(stderr, "TNC device ..........: %s\n", arguments->serial_device);
     fprintf(stderr, "TNC speed ...........: %d Baud\n", arguments->serial_speed_n);
 
     if (arguments->tnc_serial_window)
     {
-        fprintf(stderr, "TNC serial window ...: %.2f ms\n", arguments->tnc_serial_window / 1000.0);
+        fprintf(stderr, "TNC serial window ...: %.2f ms max\n", arguments->tnc_serial_window / 1000.0);
     }
     else
     {
         fprintf(stderr, "TNC serial window ...: none\n");   
     }
 
-    if (arguments->tnc_radio_window)
+    fprintf(stderr, "TNC coalesce delay ..: %.2f ms\n", arguments->tnc_coalesce_delay / 1000.0);
+
+    fprintf(stderr, "TNC keyup delay .....: %.2f ms\n", arguments->tnc_keyup_delay / 1000.0);
+    fprintf(stderr, "TNC keydown delay ...: %.2f ms\n", arguments->tnc_keydown_delay / 1000.0);
+    fprintf(stderr, "TNC switch delay ....: %.2f ms\n", arguments->tnc_switchover_delay / 1000.0);
+    fprintf(stderr, "TNC Tx/Rx turnaround : %s\n", (arguments->tnc_turnaround ? "automatic" : "by host"));
+    fprintf(stderr, "Calibration period ..: %d s\n", arguments->cal_period);
+
+    if (arguments->hop_channels)
     {
-        fprintf(stderr, "TNC radio window ....: %.2f ms\n", arguments->tnc_radio_window / 1000.0);
+        fprintf(stderr, "Frequency hopping ...: %d channels %.1f kHz apart, %d ms dwell, seed %u, %s\n",
+            arguments->hop_channels,
+            arguments->hop_spacing / 1000.0,
+            arguments->hop_dwell,
+            arguments->hop_seed,
+            (arguments->hop_master ? "master" : "follower"));
     }
     else
     {
-        fprintf(stderr, "TNC radio window ....: none\n");   
+        fprintf(stderr, "Frequency hopping ...: off\n");
+    }
+
+    fprintf(stderr, "Sync word ...........: %04X\n", arguments->sync_word);
+
+    if (arguments->rx_filter.flags & MSP430_FILTER_ADDRESS)
+    {
+        fprintf(stderr, "Address filter ......: %d (sending to %d)\n", arguments->rx_filter.address, arguments->rx_filter.tx_address);
+    }
+    else
+    {
+        fprintf(stderr, "Address filter ......: off\n");
+    }
+
+    if (arguments->rx_filter.flags & MSP430_FILTER_PAYLOAD)
+    {
+        fprintf(stderr, "Payload filter ......: %d bytes from offset %d\n", arguments->rx_filter.length, arguments->rx_filter.offset);
+    }
+    else
+    {
+        fprintf(stderr, "Payload filter ......: off\n");
+    }
+
+    if (arguments->tnc_mode == TNC_SWEEP)
+    {
+        fprintf(stderr, "Spectrum sweep ......: %.3f to %.3f MHz by %.1f kHz, %d us dwell\n",
+            arguments->sweep_start / 1e6,
+            arguments->sweep_stop / 1e6,
+            arguments->sweep_step / 1000.0,
+            arguments->sweep_dwell);
+    }
+
+    if (arguments->link_adapt)
+    {
+        fprintf(stderr, "Link adaptation .....: up to %d Baud\n", rate_values[arguments->link_adapt_max_rate]);
+        fprintf(stderr, "Link adapt. PER .....: %.3f\n", arguments->link_adapt_per);
+    }
+    else
+    {
+        fprintf(stderr, "Link adaptation .....: off\n");
+    }
+
+    if (arguments->tx_power_control)
+    {
+        fprintf(stderr, "Tx power margin .....: %.1f dB\n", arguments->tx_power_margin);
+    }
+    else
+    {
+        fprintf(stderr, "Tx power control ....: off\n");
     }
 
-    fprintf(stderr, "TNC keyup delay .....: %.2f ms\n", arguments->tnc_keyup_delay / 1000.0);
-    fprintf(stderr, "TNC keydown delay ...: %.2f ms\n", arguments->tnc_keydown_delay / 1000.0);
-    fprintf(stderr, "TNC switch delay ....: %.2f ms\n", arguments->tnc_switchover_delay / 1000.0);
     fprintf(stderr, "--- bulk transfer ---\n");
     fprintf(stderr, "Bulk filename .......: %s\n", arguments->bulk_filename);
 }
@@ -575,6 +832,10 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
         case 'U':
             arguments->usbacm_device = strdup(arg);
             break;
+        // USB device of the data interface
+        case 327:
+            arguments->usbacm_data_device = strdup(arg);
+            break;
         // Serial device
         case 'D':
             arguments->serial_device = strdup(arg);
@@ -619,6 +880,12 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
             if (*end)
                 argp_usage(state);
             break; 
+        // TNC serial frames coalescing delay
+        case 305:
+            arguments->tnc_coalesce_delay = strtol(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break; 
         // TNC keyup delay
         case 302:
             arguments->tnc_keyup_delay = strtol(arg, &end, 10);
@@ -637,6 +904,145 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
             if (*end)
                 argp_usage(state);
             break; 
+        // Automatic Tx to Rx turnaround
+        case 315:
+            arguments->tnc_turnaround = 1;
+            break;
+        // Frequency synthesizer calibration period
+        case 316:
+            arguments->cal_period = strtol(arg, &end, 10);
+            if (*end || !arguments->cal_period)
+                argp_usage(state);
+            break; 
+        // Frequency hopping number of channels
+        case 317:
+            arguments->hop_channels = strtol(arg, &end, 10);
+            if (*end || (arguments->hop_channels < 2) || (arguments->hop_channels > MSP430_HOP_MAX_CHANNELS))
+                argp_usage(state);
+            break; 
+        // Frequency hopping master
+        case 318:
+            arguments->hop_master = 1;
+            break;
+        // Frequency hopping dwell time
+        case 319:
+            arguments->hop_dwell = strtol(arg, &end, 10);
+            if (*end || (arguments->hop_dwell < 10))
+                argp_usage(state);
+            break; 
+        // Frequency hopping channel spacing
+        case 320:
+            arguments->hop_spacing = strtol(arg, &end, 10);
+            if (*end || !arguments->hop_spacing)
+                argp_usage(state);
+            break; 
+        // Frequency hopping sequence seed
+        case 321:
+            arguments->hop_seed = strtoul(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break; 
+        // Frequency hopping beacon period
+        case 322:
+            arguments->hop_beacon = strtol(arg, &end, 10);
+            if (*end || !arguments->hop_beacon)
+                argp_usage(state);
+            break; 
+        // Spectrum sweep lowest frequency
+        case 323:
+            arguments->sweep_start = strtoul(arg, &end, 10);
+            if (*end || !arguments->sweep_start)
+                argp_usage(state);
+            break; 
+        // Spectrum sweep highest frequency
+        case 324:
+            arguments->sweep_stop = strtoul(arg, &end, 10);
+            if (*end || !arguments->sweep_stop)
+                argp_usage(state);
+            break; 
+        // Spectrum sweep frequency step
+        case 325:
+            arguments->sweep_step = strtoul(arg, &end, 10);
+            if (*end || !arguments->sweep_step)
+                argp_usage(state);
+            break; 
+        // Spectrum sweep dwell time
+        case 326:
+            arguments->sweep_dwell = strtol(arg, &end, 10);
+            if (*end || (arguments->sweep_dwell > MSP430_SWEEP_MAX_US))
+                argp_usage(state);
+            break; 
+        // Sync word
+        case 328:
+            i32 = strtoul(arg, &end, 16);
+            if (*end || (i32 > 0xFFFF))
+                argp_usage(state);
+            else
+                arguments->sync_word = i32;
+            break; 
+        // Network address
+        case 329:
+            i32 = strtol(arg, &end, 10);
+            if (*end || (i32 < 1) || (i32 > 254))
+                argp_usage(state);
+            arguments->rx_filter.flags |= MSP430_FILTER_ADDRESS;
+            arguments->rx_filter.address = i32;
+            if (!arguments->tx_address_set)
+                arguments->rx_filter.tx_address = i32;
+            break; 
+        // Address sent before each block
+        case 330:
+            i32 = strtol(arg, &end, 10);
+            if (*end || (i32 > 255))
+                argp_usage(state);
+            arguments->rx_filter.tx_address = i32;
+            arguments->tx_address_set = 1;
+            break; 
+        // Payload filter
+        case 331:
+            if (parse_rx_filter(arg, &arguments->rx_filter) < 0)
+                argp_usage(state);
+            break; 
+        // Link adaptation maximum rate
+        case 306:
+            arguments->link_adapt = 1;
+            arguments->link_adapt_max_rate = get_rate(strtol(arg, &end, 10));
+            if (*end)
+                argp_usage(state);
+            break; 
+        // Link adaptation target packet error rate
+        case 307:
+            arguments->link_adapt_per = atof(arg);
+            if ((arguments->link_adapt_per <= 0.0) || (arguments->link_adapt_per >= 1.0))
+                argp_usage(state);
+            break; 
+        // Transmission power control margin
+        case 308:
+            arguments->tx_power_control = 1;
+            arguments->tx_power_margin = atof(arg);
+            break; 
+        // Automatic frequency control
+        case 309:
+            arguments->afc = 1;
+            break;
+        // Automatic frequency control offsets file
+        case 311:
+            arguments->afc_filename = strdup(arg);
+            break;
+        // Modem register profile name
+        case 312:
+            arguments->tune_profile = strdup(arg);
+            break;
+        // Number of test blocks per tuning measurement
+        case 313:
+            arguments->tune_blocks = strtol(arg, &end, 10);
+            if (*end || !arguments->tune_blocks)
+                argp_usage(state);
+            break; 
+        // Modem register profiles file
+        case 314:
+            arguments->tune_filename = strdup(arg);
+            break;
         // Bkulk filename
         case 310:
             arguments->bulk_filename = strdup(arg);
@@ -695,10 +1101,29 @@ int main (int argc, char **argv)
         return 0;
     }
     
+    if ((arguments.rx_filter.flags & MSP430_FILTER_ADDRESS) && (arguments.variable_length || (arguments.packet_length > 254)))
+    {
+        fprintf(stderr, "Address filtering needs a fixed packet length up to 254 bytes. Aborting...\n");
+        delete_args(&arguments);
+        return 1;
+    }
+
+    if ((arguments.rx_filter.flags & MSP430_FILTER_PAYLOAD) && (arguments.rx_filter.offset + arguments.rx_filter.length > arguments.packet_length))
+    {
+        fprintf(stderr, "Payload filter beyond the packet length. Aborting...\n");
+        delete_args(&arguments);
+        return 1;
+    }
+
     if (!arguments.usbacm_device)
     {
         arguments.usbacm_device = strdup("/dev/ttyACM2");
     }
+
+    if (!arguments.usbacm_data_device)
+    {
+        arguments.usbacm_data_device = default_data_device(arguments.usbacm_device);
+    }
     
     if (!arguments.serial_device)
     {
@@ -710,8 +1135,22 @@ int main (int argc, char **argv)
         arguments.bulk_filename = strdup("-");
     }
 
+    if (!arguments.afc_filename)
+    {
+        arguments.afc_filename = malloc(1024);
+        snprintf(arguments.afc_filename, 1024, "%s/.tnc1101_afc", (getenv("HOME") ? getenv("HOME") : "."));
+    }
+
+    if (!arguments.tune_filename)
+    {
+        arguments.tune_filename = malloc(1024);
+        snprintf(arguments.tune_filename, 1024, "%s/.tnc1101_profiles", (getenv("HOME") ? getenv("HOME") : "."));
+    }
+
     set_serial_parameters(&serial_parms_ax25, arguments.serial_device, get_serial_speed(arguments.serial_speed, &arguments.serial_speed_n));
     set_serial_parameters(&serial_parms_usb,  arguments.usbacm_device, get_serial_speed(115200, &arguments.usb_speed_n));
+    set_serial_parameters(&serial_parms_usb_data, arguments.usbacm_data_device, get_serial_speed(115200, &arguments.usb_speed_n));
+    radio_set_data_serial(&serial_parms_usb_data);
     init_radio_parms(&radio_parms, &arguments);
 
     if (arguments.verbose_level > 0)
@@ -742,9 +1181,7 @@ int main (int argc, char **argv)
     }
     else if (arguments.tnc_mode == TNC_RADIO_INIT)
     {
-        init_radio(&serial_parms_usb, &radio_parms, &arguments);
-
-        if (nbytes < 0)
+        if (!init_radio(&serial_parms_usb, &radio_parms, &arguments))
         {
             fprintf(stderr, "Error\n");
         }
@@ -785,7 +1222,32 @@ int main (int argc, char **argv)
     {
         file_bulk_receive(&serial_parms_usb, &radio_parms, &arguments);
     }
+    else if (arguments.tnc_mode == TNC_LINK_ADAPT_SIM) // Does not need any access to the radio
+    {
+        linkadapt_simulate(&arguments);
+    }
+    else if (arguments.tnc_mode == TNC_TUNE)
+    {
+        tuner_run(&serial_parms_usb, &radio_parms, &arguments);
+    }
+    else if (arguments.tnc_mode == TNC_TUNE_RESPONDER)
+    {
+        tuner_respond(&serial_parms_usb, &radio_parms, &arguments);
+    }
+    else if (arguments.tnc_mode == TNC_TUNE_SIM) // Does not need any access to the radio
+    {
+        tuner_simulate(&arguments);
+    }
+    else if (arguments.tnc_mode == TNC_SWEEP)
+    {
+        sweep_run(&serial_parms_usb, &radio_parms, &arguments);
+    }
+    else if (arguments.tnc_mode == TNC_TRACE) // Does not initialize the radio
+    {
+        trace_run(&serial_parms_usb, &arguments);
+    }
 
+    close_serial(&serial_parms_usb_data);
     close_serial(&serial_parms_usb);
     close_serial(&serial_parms_ax25);
     delete_args(&arguments);
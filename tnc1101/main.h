@@ -24,6 +24,12 @@ typedef enum tnc_mode_e {
     TNC_TEST_TX_PACKET,
     TNC_TEST_RX_PACKET,
     TNC_TEST_RX_PACKET_NON_BLOCKING,
+    TNC_LINK_ADAPT_SIM,
+    TNC_TUNE,
+    TNC_TUNE_RESPONDER,
+    TNC_TUNE_SIM,
+    TNC_SWEEP,
+    TNC_TRACE,
     NUM_TNC
 } tnc_mode_t;
 
@@ -87,6 +93,7 @@ typedef struct arguments_s {
     char               *bulk_filename;       // File name for bulk transfer
     // --- USB link TNC ---
     char               *usbacm_device;       // TNC USB ttyACMx device (real) 
+    char               *usbacm_data_device;  // TNC USB ttyACMx device of the data interface (blocks) 
     speed_t            usb_speed;            // TNC USB serial speed (physical, Baud)
     uint32_t           usb_speed_n;          // TNC USB serial speed as a number (physical)
     // --- serial link TNC ---
@@ -116,11 +123,37 @@ typedef struct arguments_s {
     preamble_t         preamble;             // Preamblescheme (number of preamble bytes)
     uint32_t           block_delay;         // Delay before sending packet on serial or radio in microseconds
     uint32_t           tnc_serial_window;    // Time window in microseconds for concatenating serial frames (0: no concatenation)
-    uint32_t           tnc_radio_window;     // Time window in microseconds for concatenating radio frames (0: no concatenation)
+    uint32_t           tnc_radio_window;     // Obsolete: radio frames are delivered as soon as they are received
+    uint32_t           tnc_coalesce_delay;   // Quiet time in microseconds after a complete serial frame before sending it
     uint32_t           tnc_keyup_delay;      // TNC keyup delay in microseconds
     uint32_t           tnc_keydown_delay;    // TNC keydown delay in microseconds
     uint32_t           tnc_switchover_delay; // TNC Rx/Tx switchover delay in microseconds
+    uint8_t            tnc_turnaround;       // Radio goes to Rx by itself at the end of each block sent
+    uint16_t           cal_period;           // Age in seconds after which a synthesizer calibration is redone
+    uint8_t            hop_channels;         // Number of channels hopped over (0: no hopping)
+    uint8_t            hop_master;           // This station times the hops and sends the beacons
+    uint16_t           hop_dwell;            // Time spent on each channel in milliseconds
+    uint32_t           hop_spacing;          // Channel spacing in Hz
+    uint32_t           hop_seed;             // Seed of the hop sequence shared by the stations
+    uint8_t            hop_beacon;           // Number of slots between two beacons of the master
+    uint32_t           sweep_start;          // Lowest frequency of the spectrum sweep in Hz
+    uint32_t           sweep_stop;           // Highest frequency of the spectrum sweep in Hz
+    uint32_t           sweep_step;           // Frequency step of the spectrum sweep in Hz
+    uint16_t           sweep_dwell;          // Time the RSSI is read on each frequency in microseconds
+    uint16_t           sync_word;            // Sync word of the network (SYNC1 and SYNC0)
+    msp430_filter_t    rx_filter;            // Address and payload filters set after initialization
+    uint8_t            tx_address_set;       // Address sent before each block given apart from the network address
     uint8_t            real_time;            // Engage so called "real time" scheduling
+    uint8_t            link_adapt;           // Adapt rate, modulation and FEC to each peer
+    rate_t             link_adapt_max_rate;  // Fastest rate used by link adaptation
+    float              link_adapt_per;       // Target packet error rate of link adaptation
+    uint8_t            tx_power_control;     // Adapt transmission power to each peer
+    float              tx_power_margin;      // Margin in dB kept over the sensitivity by power control
+    uint8_t            afc;                  // Track the frequency offset of received packets
+    char               *afc_filename;        // File where the learned frequency offsets are kept
+    char               *tune_profile;        // Name of the modem register profile to tune or to use
+    char               *tune_filename;       // File where the modem register profiles are kept
+    uint8_t            tune_blocks;          // Number of test blocks per tuning measurement
 } arguments_t;
 
 #endif
@@ -17,6 +17,7 @@
 #include "util.h"
 #include "radio.h"
 #include "serial.h"
+#include "clocksync.h"
 #include "msp430_interface.h"
 
 char *state_names[] = {
@@ -82,6 +83,31 @@ uint32_t blocks_sent;
 uint32_t blocks_received;
 uint32_t packets_sent;
 uint32_t packets_received;
+float    radio_rssi_dbm; // RSSI of the last block received
+uint8_t  radio_lqi;      // LQI of the last block received
+radio_timing_t radio_timing; // Timing of the last blocks sent and received
+
+#define RADIO_STREAM_TIMEOUT_BLOCKS 16 // Inter-block timeouts after which an incomplete packet is dropped
+
+// Reassembly of a packet. The blocks of other packets may come in between.
+typedef struct radio_rx_stream_s
+{
+    uint8_t  packet[RADIO_BUFSIZE];
+    uint32_t size;            // Number of bytes received so far
+    uint64_t last_us;         // Time of the last block received
+    uint8_t  in_use;          // A packet is being reassembled
+    uint8_t  stream_id;       // Stream number carried by all blocks of the packet
+    uint8_t  block_countdown; // Countdown expected for the next block
+} radio_rx_stream_t;
+
+static radio_rx_stream_t rx_streams[RADIO_NUM_STREAMS];
+static uint8_t           tx_stream_id;
+static uint8_t           tx_power_index; // PATABLE index currently selected in the radio
+static msp430_tx_timing_t tx_timing;     // Keyup and inter-block delays enforced by the MSP430
+static uint8_t           tx_timing_set;  // Delays above have been sent. The initialization keeps them.
+static uint8_t           rx_blind_pending; // Blind time of the last transmission is measured when Rx is turned on
+static uint32_t          tx_hop_wait_us;   // Longest time the MSP430 holds a block until the next hop
+static serial_t          *data_serial;     // Data interface of the MSP430: blocks and their acks (0: same as commands)
 
 // === Static functions declarations ==============================================================
 static uint32_t get_freq_word(arguments_t *arguments);
@@ -89,9 +115,27 @@ static uint8_t  get_mod_word(radio_modulation_t modulation_code);
 static radio_modulation_t get_mod_code(uint8_t mod_word);
 static uint8_t  get_if_word(arguments_t *arguments);
 static void     get_chanbw_words(float bw, msp430_radio_parms_t *radio_parms);
+static void     get_chanspc_words(uint32_t spacing_hz, msp430_radio_parms_t *radio_parms);
 static void     get_rate_words(arguments_t *arguments, msp430_radio_parms_t *radio_parms);
+static uint8_t  get_fifothr_word(float byte_time_us);
 static int      read_usb(serial_t *serial_parms, uint8_t *dataBuffer, int size, uint32_t timeout);
 static int      read_usb_nb(serial_t *serial_parms, uint8_t *dataBuffer, int size, uint32_t timeout);
+static serial_t *block_serial(serial_t *serial_parms);
+static int      reassemble_block(uint8_t *dataBlock, uint32_t size, uint8_t blockCountdown, uint8_t *packet, uint32_t timeout_us);
+static void     reassemble_drop(uint8_t *dataBlock, uint32_t size);
+static void     radio_tx_timestamps(uint8_t *ackBlock, int ackbytes, uint64_t write_us);
+static void     radio_blind_time(uint64_t rx_armed_us);
+static void     radio_rx_trailer(uint8_t block_size, uint8_t *rssi, uint8_t *crc_lqi, uint64_t read_us);
+static void     print_profile(msp430_profile_t *profile, msp430_latency_t *latency, arguments_t *arguments);
+static int      radio_send_typed_block(serial_t *serial_parms, 
+                    msp430_block_type_t block_type,
+                    uint8_t  *dataBlock,
+                    uint8_t  dataSize,
+                    uint8_t  blockCountdown, 
+                    uint8_t  blockSize,
+                    uint8_t  *ackBlock, 
+                    int      *ackBlockSize, 
+                    uint32_t timeout_us);
 /*
 static void     wait_for_state(spi_parms_t *spi_parms, ccxxx0_state_t state, uint32_t timeout);
 static void     print_received_packet(int verbose_min);
@@ -198,6 +242,29 @@ void get_chanbw_words(float bw, msp430_radio_parms_t *radio_parms)
     radio_parms->chanbw_m = 3;
 }
 
+// ------------------------------------------------------------------------------------------------
+// Calculate CHANSPC words closest to the given channel spacing. Assumes 26 MHz crystal.
+//   o CHANSPC = (Fxosc / 2^18) * (256 + CHANSPC_M) * 2^CHANSPC_E
+void get_chanspc_words(uint32_t spacing_hz, msp430_radio_parms_t *radio_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    double step = ((double) F_XTAL_MHZ * 1e6) / (1<<18);
+    double m;
+    uint8_t e_index;
+
+    for (e_index=0; e_index<3; e_index++)
+    {
+        if (spacing_hz < step * 511.5 * (1<<e_index))
+        {
+            break;
+        }
+    }
+
+    m = round(spacing_hz / (step * (1<<e_index))) - 256.0;
+    radio_parms->chanspc_e = e_index;
+    radio_parms->chanspc_m = (uint8_t) (m < 0.0 ? 0 : (m > 255.0 ? 255 : m));
+}
+
 // ------------------------------------------------------------------------------------------------
 // Calculate data rate, channel bandwidth and deviation words. Assumes 26 MHz crystal.
 //   o DRATE = (Fxosc / 2^28) * (256 + DRATE_M) * 2^DRATE_E
@@ -232,6 +299,19 @@ void get_rate_words(arguments_t *arguments, msp430_radio_parms_t *radio_parms)
     radio_parms->deviat_m &= 0x07; // it is 3 bits long
 }
 
+// ------------------------------------------------------------------------------------------------
+// Get the FIFO threshold word (FIFOTHR[3:0]) for the given byte time. The MSP430 moves chunks of
+// about 4*(thr+1) bytes leaving 60-4*thr bytes in the Tx FIFO or free in the Rx FIFO when it is
+// interrupted. This margin must last RADIO_FIFO_LATENCY_US. Slow rates keep the largest chunks.
+uint8_t get_fifothr_word(float byte_time_us)
+// ------------------------------------------------------------------------------------------------
+{
+    int margin_bytes = (int) ceilf(RADIO_FIFO_LATENCY_US / byte_time_us) + 1;
+    int thr = (60 - margin_bytes) / 4;
+
+    return (thr < 0 ? 0 : (thr > 14 ? 14 : thr));
+}
+
 // ------------------------------------------------------------------------------------------------
 // Read USB with timeout
 // Timeout is in 10's of microseconds
@@ -320,6 +400,14 @@ int read_usb_nb(serial_t *serial_parms, uint8_t *buffer, int size, uint32_t time
     }
 }
 
+// ------------------------------------------------------------------------------------------------
+// Serial device blocks go through: the data interface when it is set else the command one
+serial_t *block_serial(serial_t *serial_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    return (data_serial ? data_serial : serial_parms);
+}
+
 /*
 // ------------------------------------------------------------------------------------------------
 // Poll FSM state waiting for given state until timeout (approx ms)
@@ -379,6 +467,150 @@ void print_received_packet(int verbose_min)
 }
 */
 
+// ------------------------------------------------------------------------------------------------
+// Add a received block to the packet of its stream
+// dataBlock      is the block data starting with the stream identifier
+// size           is the size of the block data including the stream identifier
+// blockCountdown is the block countdown
+// packet         is the pointer to the reception area of a complete packet
+// timeout_us     is the inter-block timeout in microseconds
+// A packet is started only by a block flagged as first. When a block is missing the partial packet
+// is dropped and the next blocks of its stream are discarded up to the start of another packet.
+// Returns the size of the packet copied to the reception area when the block completes it, 0 when
+// more blocks are expected or -1 on sequence error
+int reassemble_block(uint8_t *dataBlock, uint32_t size, uint8_t blockCountdown, uint8_t *packet, uint32_t timeout_us)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_rx_stream_t *rx_stream = 0, *free_stream = 0;
+    uint64_t timestamp = now_us();
+    uint32_t packet_size;
+    uint8_t  stream_id;
+    int      i;
+
+    if (size < 1)
+    {
+        return -1;
+    }
+
+    if ((dataBlock[0] & RADIO_STREAM_FORMAT_MASK) != RADIO_STREAM_FORMAT)
+    {
+        verbprintft(1, "RADIO: unknown block format %02X. Dropping block\n", dataBlock[0]);
+        return -1;
+    }
+
+    stream_id = dataBlock[0] & RADIO_STREAM_ID_MASK;
+
+    for (i=0; i<RADIO_NUM_STREAMS; i++)
+    {
+        if (rx_streams[i].in_use && (timestamp - rx_streams[i].last_us > RADIO_STREAM_TIMEOUT_BLOCKS * (uint64_t) timeout_us))
+        {
+            verbprintft(1, "RADIO: stream %d timed out. Dropping %d bytes\n", rx_streams[i].stream_id, rx_streams[i].size);
+            rx_streams[i].in_use = 0;
+        }
+
+        if (rx_streams[i].in_use)
+        {
+            if (rx_streams[i].stream_id == stream_id)
+            {
+                rx_stream = &rx_streams[i];
+            }
+        }
+        else if (!free_stream)
+        {
+            free_stream = &rx_streams[i];
+        }
+    }
+
+    if (dataBlock[0] & RADIO_STREAM_FIRST) // first block of a new packet
+    {
+        if (rx_stream) // end of the previous packet lost
+        {
+            verbprintft(1, "RADIO: stream %d restarted. Dropping %d bytes\n", stream_id, rx_stream->size);
+        }
+        else
+        {
+            if (!free_stream) // replace the stream that has been idle for the longest time
+            {
+                free_stream = &rx_streams[0];
+
+                for (i=1; i<RADIO_NUM_STREAMS; i++)
+                {
+                    if (rx_streams[i].last_us < free_stream->last_us)
+                    {
+                        free_stream = &rx_streams[i];
+                    }
+                }
+
+                verbprintft(1, "RADIO: too many streams. Dropping stream %d\n", free_stream->stream_id);
+            }
+
+            rx_stream = free_stream;
+        }
+
+        rx_stream->in_use = 1;
+        rx_stream->stream_id = stream_id;
+        rx_stream->block_countdown = blockCountdown;
+        rx_stream->size = 0;
+    }
+    else if (!rx_stream) // start of the packet missed or packet already dropped: discard up to the next start
+    {
+        verbprintft(1, "RADIO: stream %d block %d without packet start. Dropping block\n", stream_id, blockCountdown);
+        return -1;
+    }
+
+    if (blockCountdown != rx_stream->block_countdown) // block lost in between: the packet cannot be completed
+    {
+        verbprintft(1, "RADIO: stream %d out of sequence. Dropping %d bytes\n", stream_id, rx_stream->size);
+        rx_stream->in_use = 0;
+        return -1;
+    }
+
+    if (rx_stream->size + size - 1 > RADIO_BUFSIZE)
+    {
+        rx_stream->in_use = 0;
+        return -1;
+    }
+
+    memcpy(&rx_stream->packet[rx_stream->size], &dataBlock[1], size - 1);
+    rx_stream->size += size - 1;
+    rx_stream->last_us = timestamp;
+
+    if (blockCountdown > 0)
+    {
+        rx_stream->block_countdown = blockCountdown - 1;
+        return 0;
+    }
+
+    packet_size = rx_stream->size;
+    memcpy(packet, rx_stream->packet, packet_size);
+    rx_stream->in_use = 0;
+
+    return packet_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Drop the partial packet of the stream of a block received with a CRC error. The next blocks of
+// the stream are discarded up to the start of another packet.
+void reassemble_drop(uint8_t *dataBlock, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    if ((size < 1) || ((dataBlock[0] & RADIO_STREAM_FORMAT_MASK) != RADIO_STREAM_FORMAT))
+    {
+        return;
+    }
+
+    for (i=0; i<RADIO_NUM_STREAMS; i++)
+    {
+        if (rx_streams[i].in_use && (rx_streams[i].stream_id == (dataBlock[0] & RADIO_STREAM_ID_MASK)))
+        {
+            verbprintft(1, "RADIO: stream %d block lost. Dropping %d bytes\n", rx_streams[i].stream_id, rx_streams[i].size);
+            rx_streams[i].in_use = 0;
+        }
+    }
+}
+
 // === Public functions ===========================================================================
 /*
 // ------------------------------------------------------------------------------------------------
@@ -463,6 +695,49 @@ float radio_get_rate(msp430_radio_parms_t *radio_parms)
     return ((float) (f_xtal) / (1<<28)) * (256 + radio_parms->drate_m) * (1<<radio_parms->drate_e);
 }
 
+// ------------------------------------------------------------------------------------------------
+// Get the actual channel filter bandwidth in Hz
+//   o CHANBW = Fxosc / (8(4+CHANBW_M) * 2^CHANBW_E)
+float radio_get_chanbw(msp430_radio_parms_t *radio_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    float f_xtal = F_XTAL_MHZ * 1e6;
+
+    return f_xtal / (8 * (4 + radio_parms->chanbw_m) * (1<<radio_parms->chanbw_e));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the actual channel spacing in Hz
+float radio_get_chanspc(msp430_radio_parms_t *radio_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    float f_xtal = F_XTAL_MHZ * 1e6;
+
+    return (f_xtal / (1<<18)) * (256 + radio_parms->chanspc_m) * (1<<radio_parms->chanspc_e);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the frequency of channel 0 and the channel spacing closest to the one given. Other radio
+// parameters are left unchanged.
+void radio_set_channel_plan(msp430_radio_parms_t *radio_parms, arguments_t *arguments, uint32_t base_hz, uint32_t spacing_hz)
+// ------------------------------------------------------------------------------------------------
+{
+    arguments_t plan_arguments = *arguments;
+
+    plan_arguments.freq_hz = base_hz;
+    radio_parms->freq_word = get_freq_word(&plan_arguments);
+    get_chanspc_words(spacing_hz, radio_parms);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the serial device of the MSP430 data interface. Blocks sent and received and their acks go
+// there while the other commands use the serial device each function is given (control interface).
+void radio_set_data_serial(serial_t *serial_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    data_serial = serial_parms;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Initialize MSP430-CC1101 radio parameters
 void init_radio_parms(msp430_radio_parms_t *radio_parms, arguments_t *arguments)
@@ -474,8 +749,16 @@ void init_radio_parms(msp430_radio_parms_t *radio_parms, arguments_t *arguments)
     radio_parms->freq_word       = get_freq_word(arguments);
     radio_parms->mod_word        = get_mod_word(arguments->modulation);
     radio_parms->sync_word       = SYNC_30_over_32;  // 30/32 sync word bits detected
-    radio_parms->chanspc_m       = 0;                // Do not use channel spacing for the moment defaulting to 0
-    radio_parms->chanspc_e       = 0;                // Do not use channel spacing for the moment defaulting to 0
+    radio_parms->sync1           = (arguments->sync_word >> 8) & 0xFF;
+    radio_parms->sync0           = arguments->sync_word & 0xFF;
+    radio_parms->chanspc_m       = 0;                // Channel spacing is only used for frequency hopping
+    radio_parms->chanspc_e       = 0;
+
+    if (arguments->hop_channels)
+    {
+        get_chanspc_words(arguments->hop_spacing, radio_parms);
+    }
+
     radio_parms->fec_whitening   = arguments->fec + 2*arguments->whitening;
     radio_parms->packet_length   = arguments->packet_length;  // Packet length
     radio_parms->preamble_word   = nb_preamble_bytes[(int) arguments->preamble]; // set number of preamble bytes
@@ -511,21 +794,66 @@ void init_radio_parms(msp430_radio_parms_t *radio_parms, arguments_t *arguments)
         radio_parms->patable_freq_i = 3;   
     }
 
+    radio_parms->fifo_thr = get_fifothr_word(radio_get_byte_time(radio_parms));
 }
 
 // ------------------------------------------------------------------------------------------------
-// Initialize the radio link interface
-int init_radio(serial_t *serial_parms, msp430_radio_parms_t *radio_parms, arguments_t *arguments)
+// Initialize modem parameters for the given data rate, modulation and FEC. Other settings like
+// the modulation index and whitening are taken from the arguments.
+void init_modem_parms(msp430_modem_parms_t *modem_parms, 
+        arguments_t        *arguments, 
+        rate_t             rate, 
+        radio_modulation_t modulation, 
+        uint8_t            fec)
+// ------------------------------------------------------------------------------------------------
+{
+    arguments_t          modem_arguments = *arguments;
+    msp430_radio_parms_t radio_parms;
+
+    modem_arguments.rate = rate;
+    modem_arguments.modulation = modulation;
+    get_rate_words(&modem_arguments, &radio_parms);
+
+    modem_parms->drate_e       = radio_parms.drate_e;
+    modem_parms->drate_m       = radio_parms.drate_m;
+    modem_parms->deviat_e      = radio_parms.deviat_e;
+    modem_parms->deviat_m      = radio_parms.deviat_m;
+    modem_parms->chanbw_e      = radio_parms.chanbw_e;
+    modem_parms->chanbw_m      = radio_parms.chanbw_m;
+    modem_parms->mod_word      = get_mod_word(modulation);
+    modem_parms->fec_whitening = fec + 2*arguments->whitening;
+    modem_parms->fifo_thr      = get_fifothr_word(radio_get_modem_byte_time(modem_parms));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the time to transmit or receive a byte in microseconds with the given modem parameters
+float radio_get_modem_byte_time(msp430_modem_parms_t *modem_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_radio_parms_t radio_parms;
+
+    radio_parms.drate_e       = modem_parms->drate_e;
+    radio_parms.drate_m       = modem_parms->drate_m;
+    radio_parms.mod_word      = modem_parms->mod_word;
+    radio_parms.fec_whitening = modem_parms->fec_whitening;
+
+    return radio_get_byte_time(&radio_parms);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Change modem settings without a full radio initialization. Radio must be idle.
+// Returns the number of bytes of the acknowledgement. It must be 2 to be valid.
+int radio_set_modem(serial_t *serial_parms, msp430_modem_parms_t *modem_parms)
 // ------------------------------------------------------------------------------------------------
 {
     int nbytes;
 
-    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_INIT;
-    dataBuffer[1] = sizeof(msp430_radio_parms_t);
-    memcpy(&dataBuffer[2], radio_parms, dataBuffer[1]);
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_MODEM;
+    dataBuffer[1] = sizeof(msp430_modem_parms_t);
+    memcpy(&dataBuffer[2], modem_parms, dataBuffer[1]);
 
     nbytes = write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
-    verbprintft(1, "RADIO: init: %d bytes written to USB\n", nbytes);
+    verbprintft(2, "RADIO: set modem: %d bytes written to USB\n", nbytes);
 
     nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
 
@@ -538,119 +866,883 @@ int init_radio(serial_t *serial_parms, msp430_radio_parms_t *radio_parms, argume
 }
 
 // ------------------------------------------------------------------------------------------------
-// Cancel reception state
-int radio_cancel_rx(serial_t *serial_parms)
+// Load a register profile in the MSP430 under the given index. Its modem settings replace those of
+// the radio parameters. The Tx power is kept when the profile is selected unless set_power is on.
+// Returns 0 if successful else -1
+int radio_load_profile(serial_t *serial_parms,
+            uint8_t              index,
+            msp430_radio_parms_t *radio_parms,
+            msp430_modem_parms_t *modem_parms,
+            uint8_t              set_power)
 // ------------------------------------------------------------------------------------------------
 {
+    msp430_reg_profile_t reg_profile;
     int nbytes;
 
-    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_RX_CANCEL;
-    dataBuffer[1] = 0;
+    reg_profile.index = index;
+    reg_profile.flags = (set_power ? MSP430_REG_PROFILE_POWER : 0);
+    reg_profile.radio_parms = *radio_parms;
 
-    nbytes = write_serial(serial_parms, dataBuffer, 2);
-    verbprintft(2, "RADIO: cancel Rx: %d bytes written to USB\n", nbytes);
+    if (modem_parms)
+    {
+        reg_profile.radio_parms.drate_e       = modem_parms->drate_e;
+        reg_profile.radio_parms.drate_m       = modem_parms->drate_m;
+        reg_profile.radio_parms.deviat_e      = modem_parms->deviat_e;
+        reg_profile.radio_parms.deviat_m      = modem_parms->deviat_m;
+        reg_profile.radio_parms.chanbw_e      = modem_parms->chanbw_e;
+        reg_profile.radio_parms.chanbw_m      = modem_parms->chanbw_m;
+        reg_profile.radio_parms.mod_word      = modem_parms->mod_word;
+        reg_profile.radio_parms.fec_whitening = modem_parms->fec_whitening;
+        reg_profile.radio_parms.fifo_thr      = modem_parms->fifo_thr;
+    }
 
-    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 100000);
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_LOAD_PROFILE;
+    dataBuffer[1] = sizeof(msp430_reg_profile_t);
+    memcpy(&dataBuffer[2], &reg_profile, dataBuffer[1]);
 
-    if (nbytes > 0)
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_LOAD_PROFILE))
     {
-        print_block(3, dataBuffer, nbytes);
+        return -1;
     }
 
-    return nbytes;
+    return 0;
 }
 
 // ------------------------------------------------------------------------------------------------
-// Print status registers to stderr
-void print_radio_status(serial_t *serial_parms, arguments_t *arguments)
+// Select a register profile loaded in the MSP430. Only the registers that differ from those in use
+// are written. The radio must be idle. Returns 0 if successful else -1
+int radio_select_profile(serial_t *serial_parms, uint8_t index, msp430_reg_select_t *select)
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t *regs;
     int nbytes;
 
-    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_RADIO_STATUS;
-    dataBuffer[1] = 0;
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_SELECT_PROFILE;
+    dataBuffer[1] = sizeof(msp430_reg_select_t);
+    memset(&dataBuffer[2], 0, sizeof(msp430_reg_select_t));
+    dataBuffer[2] = index;
 
-    fprintf(stderr, "Start...\n");
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
 
-    nbytes = write_serial(serial_parms, dataBuffer, 2);
-    verbprintft(1, "RADIO: status: %d bytes written to USB\n", nbytes);
+    if ((nbytes != 2 + sizeof(msp430_reg_select_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_SELECT_PROFILE))
+    {
+        return -1;
+    }
 
-    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+    memcpy(select, &dataBuffer[2], sizeof(msp430_reg_select_t));
+    verbprintft(3, "RADIO: select profile %d: %d registers written in %d us%s\n",
+        index, select->nb_writes, select->select_us, (select->flags & MSP430_REG_PROFILE_RECAL ? ", calibrated" : ""));
 
-    print_block(3, dataBuffer, nbytes);
+    return (select->flags & MSP430_REG_PROFILE_INVALID ? -1 : 0);
+}
 
-    if (nbytes >= 14)
-    {
-        regs = &dataBuffer[2];
+// ------------------------------------------------------------------------------------------------
+// Convert the timestamps of a Tx acknowledgement to the host clock and log the delays
+void radio_tx_timestamps(uint8_t *ackBlock, int ackbytes, uint64_t write_us)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_timestamps_t timestamps;
+    uint32_t            rx_armed_us;
 
-        fprintf(stderr, "Part number ...........: %d\n", regs[0]);
-        fprintf(stderr, "Version ...............: %d\n", regs[1]);
-        fprintf(stderr, "Freq offset estimate ..: %d\n", (signed char) regs[2]);
-        fprintf(stderr, "CRC OK ................: %d\n", ((regs[3] & 0x80)>>7));
-        fprintf(stderr, "LQI ...................: %d\n", regs[3] & 0x7F);
-        fprintf(stderr, "RSSI ..................: %.1f dBm\n", rssi_dbm(regs[4]));
-        fprintf(stderr, "Radio FSM state .......: %s\n", state_names[regs[5] & 0x1F]);
-        fprintf(stderr, "WOR time ..............: %d\n", ((regs[6] << 8) + regs[7]));
-        fprintf(stderr, "Carrier Sense .........: %d\n", ((regs[8] & 0x40)>>6));
-        fprintf(stderr, "Preamble Qual Reached .: %d\n", ((regs[8] & 0x20)>>5));
-        fprintf(stderr, "Clear channel .........: %d\n", ((regs[8] & 0x10)>>4));
-        fprintf(stderr, "Start of frame delim ..: %d\n", ((regs[8] & 0x08)>>3));
-        fprintf(stderr, "GDO2 ..................: %d\n", ((regs[8] & 0x04)>>2));
-        fprintf(stderr, "GDO0 ..................: %d\n", ((regs[8] & 0x01)));
-        fprintf(stderr, "VCO VC DAC ............: %d\n", regs[9]);
-        fprintf(stderr, "FIFO Tx underflow .....: %d\n", ((regs[10] & 0x80)>>7));
-        fprintf(stderr, "FIFO Tx bytes .........: %d\n", regs[10] & 0x7F);
-        fprintf(stderr, "FIFO Rx overflow ......: %d\n", ((regs[11] & 0x80)>>7));
-        fprintf(stderr, "FIFO Rx bytes .........: %d\n", regs[11] & 0x7F);
+    radio_timing.tx_write_us = write_us;
+    rx_blind_pending = 0;
+
+    if ((ackbytes < MSP430_TX_ACK_TIMESTAMPS + (int) sizeof(msp430_timestamps_t)) || !clocksync_synced())
+    {
+        radio_timing.tx_sync_us = 0;
+        radio_timing.tx_end_us = 0;
+        return;
     }
-    else
+
+    memcpy(&timestamps, &ackBlock[MSP430_TX_ACK_TIMESTAMPS], sizeof(msp430_timestamps_t));
+    radio_timing.tx_sync_us = clocksync_host_us(timestamps.sync_us);
+    radio_timing.tx_end_us  = clocksync_host_us(timestamps.end_us);
+
+    verbprintft(3, "RADIO: Tx timing: USB to sync word %lld us, airtime %d us\n",
+        (long long) (radio_timing.tx_sync_us - write_us),
+        timestamps.end_us - timestamps.sync_us);
+
+    if (radio_timing.rx_end_us && (radio_timing.rx_end_us < radio_timing.tx_sync_us))
     {
-        fprintf(stderr, "Error reading from %s\n", arguments->usbacm_device);
+        verbprintft(3, "RADIO: Tx timing: Rx to Tx turnaround %lld us\n",
+            (long long) (radio_timing.tx_sync_us - radio_timing.rx_end_us));
+        radio_timing.rx_end_us = 0; // only the first block after reception
     }
 
+    memcpy(&rx_armed_us, &ackBlock[MSP430_TX_ACK_RX_ARMED], sizeof(uint32_t));
+
+    if ((ackbytes >= MSP430_TX_ACK_RX_ARMED + (int) sizeof(uint32_t)) && rx_armed_us) // Rx armed by the MSP430
+    {
+        radio_blind_time(clocksync_host_us(rx_armed_us));
+    }
+    else // measured when the host turns Rx on
+    {
+        rx_blind_pending = 1;
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
-// Print actual radio link parameters once initialized
-//   o Operating frequency ..: Fo   = (Fxosc / 2^16) * FREQ[23..0]
-//   o Channel spacing ......: Df   = (Fxosc / 2^18) * (256 + CHANSPC_M) * 2^CHANSPC_E
-//   o Channel bandwidth ....: BW   = Fxosc / (8 * (4+CHANBW_M) * 2^CHANBW_E)
-//   o Data rate (Baud) .....: Rate = (Fxosc / 2^28) * (256 + DRATE_M) * 2^DRATE_E
-//   o Deviation ............: Df   = (Fxosc / 2^17) * (8 + DEVIATION_M) * 2^DEVIATION_E
+// Account for the time the receiver is deaf after a transmission until it is armed again
+void radio_blind_time(uint64_t rx_armed_us)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!radio_timing.tx_end_us || (rx_armed_us < radio_timing.tx_end_us))
+    {
+        return;
+    }
+
+    radio_timing.rx_blind_us = rx_armed_us - radio_timing.tx_end_us;
+    radio_timing.rx_blind_total_us += radio_timing.rx_blind_us;
+    radio_timing.rx_blind_count++;
+
+    if (radio_timing.rx_blind_us > radio_timing.rx_blind_max_us)
+    {
+        radio_timing.rx_blind_max_us = radio_timing.rx_blind_us;
+    }
+
+    verbprintft(3, "RADIO: Rx blind time after Tx %u us\n", radio_timing.rx_blind_us);
+}
 
-void print_radio_parms(msp430_radio_parms_t *radio_parms)
+// ------------------------------------------------------------------------------------------------
+// Get RSSI, CRC+LQI and the timestamps that follow the data of a received block in the I/O buffer
+// block_size     is the size of the block after the command and size bytes
+// read_us        is the host time at which the block was read from USB
+void radio_rx_trailer(uint8_t block_size, uint8_t *rssi, uint8_t *crc_lqi, uint64_t read_us)
 // ------------------------------------------------------------------------------------------------
 {
-    float f_xtal = F_XTAL_MHZ * 1e6;
+    uint8_t             *trailer = &dataBuffer[block_size + 2 - 2 - sizeof(msp430_timestamps_t)];
+    msp430_timestamps_t timestamps;
 
-    fprintf(stderr, "\n--- Actual radio channel parameters ---\n");
-    fprintf(stderr, "Operating frequency ....: %.3f MHz (W=%d)\n", 
-        ((f_xtal/1e6) / (1<<16))*radio_parms->freq_word, radio_parms->freq_word);
-    fprintf(stderr, "Intermediate frequency .: %.3f kHz (W=%d)\n", 
-        ((f_xtal/1e3) / (1<<10))*radio_parms->if_word, radio_parms->if_word);
-    fprintf(stderr, "Channel spacing ........: %.3f kHz (M=%d, E=%d)\n", 
-        ((f_xtal/1e3) / (1<<18))*(256+radio_parms->chanspc_m)*(1<<radio_parms->chanspc_e), radio_parms->chanspc_m, radio_parms->chanspc_e);
-    fprintf(stderr, "Channel bandwidth.......: %.3f kHz (M=%d, E=%d)\n",
-        (f_xtal/1e3) / (8*(4+radio_parms->chanbw_m)*(1<<radio_parms->chanbw_e)), radio_parms->chanbw_m, radio_parms->chanbw_e);
-    fprintf(stderr, "Data rate ..............: %.1f Baud (M=%d, E=%d)\n",
-        radio_get_rate(radio_parms), radio_parms->drate_m, radio_parms->drate_e);
-    fprintf(stderr, "Deviation ..............: %.3f kHz (M=%d, E=%d)\n",
-        ((f_xtal/1e3) / (1<<17)) * (8 + radio_parms->deviat_m) * (1<<radio_parms->deviat_e), radio_parms->deviat_m, radio_parms->deviat_e);
-    fprintf(stderr, "Modulation word ........: %d (%s)\n", 
-        radio_parms->mod_word, modulation_names[get_mod_code(radio_parms->mod_word)]);
-    fprintf(stderr, "FEC ....................: %s\n", (radio_parms->fec_whitening & 0x01 ? "on" : "off"));
-    fprintf(stderr, "Data whitening .........: %s\n", (radio_parms->fec_whitening & 0x02 ? "on" : "off"));
-    fprintf(stderr, "Packet length ..........: %d bytes\n",
-        radio_parms->packet_length);
-    fprintf(stderr, "Byte time ..............: %d us\n",
-        ((uint32_t) radio_get_byte_time(radio_parms)));
-    fprintf(stderr, "Packet time ............: %d us\n",
-        (uint32_t) (radio_parms->packet_length * radio_get_byte_time(radio_parms)));
+    *rssi    = trailer[0]; // RSSI follows data
+    *crc_lqi = trailer[1]; // then CRC+LQI combination byte
+    radio_rssi_dbm = rssi_dbm(*rssi);
+    get_crc_lqi(*crc_lqi, &radio_lqi);
+
+    radio_timing.rx_read_us = read_us;
+    memcpy(&timestamps, &trailer[2], sizeof(msp430_timestamps_t));
+    radio_timing.rx_sync_mcu_us = timestamps.sync_us;
+
+    if (!clocksync_synced())
+    {
+        return;
+    }
+
+    radio_timing.rx_sync_us = clocksync_host_us(timestamps.sync_us);
+    radio_timing.rx_end_us  = clocksync_host_us(timestamps.end_us);
+
+    verbprintft(3, "RADIO: Rx timing: airtime %d us, end of packet to host %lld us\n",
+        timestamps.end_us - timestamps.sync_us,
+        (long long) (read_us - radio_timing.rx_end_us));
 }
 
 // ------------------------------------------------------------------------------------------------
-// Send a radio block of maximum 255 bytes
+// Initialize the radio link interface. The MSP430 acknowledges once the radio is IDLE so that it
+// can be used right away. Returns the number of bytes of the acknowledgement or 0 if unsuccessful
+int init_radio(serial_t *serial_parms, msp430_radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_init_status_t init_status;
+    msp430_calibration_t cal;
+    uint64_t start_us = monotonic_us();
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_INIT;
+    dataBuffer[1] = sizeof(msp430_radio_parms_t);
+    memcpy(&dataBuffer[2], radio_parms, dataBuffer[1]);
+    tx_power_index = radio_parms->patable_power_i;
+
+    nbytes = write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    verbprintft(1, "RADIO: init: %d bytes written to USB\n", nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if (nbytes > 0)
+    {
+        print_block(3, dataBuffer, nbytes);
+    }
+
+    tx_hop_wait_us = 0; // hopping is stopped by the initialization. Tx timing is kept.
+
+    if ((nbytes != 2 + sizeof(msp430_init_status_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_INIT))
+    {
+        verbprintft(1, "RADIO: init: no acknowledgement\n");
+        return 0;
+    }
+
+    memcpy(&init_status, &dataBuffer[2], sizeof(msp430_init_status_t));
+
+    if (!(init_status.flags & MSP430_INIT_READY))
+    {
+        verbprintft(1, "RADIO: init: radio not ready (MARCSTATE %d)\n", init_status.marcstate);
+        return 0;
+    }
+
+    verbprintft(1, "RADIO: init: %s in %d us\n",
+        (init_status.flags & MSP430_INIT_REUSED ? "configuration unchanged, radio not reset," : "radio reset and configured"),
+        init_status.init_us);
+
+    if (radio_set_tx_timing(serial_parms, arguments->tnc_keyup_delay, arguments->block_delay) < 0)
+    {
+        verbprintft(1, "RADIO: init: cannot set Tx timing\n");
+    }
+
+    // The MSP430 clock runs on through the initialization
+    if (!clocksync_synced() && (clocksync_update(serial_parms) < 0))
+    {
+        verbprintft(1, "RADIO: init: cannot synchronize clocks\n");
+    }
+
+    cal.channel = 0;
+    cal.force = 0;
+    cal.period_s = arguments->cal_period;
+
+    // The initialization restores the default calibration period
+    if ((cal.period_s != MSP430_CAL_PERIOD_S) && (radio_calibrate(serial_parms, &cal) < 0))
+    {
+        verbprintft(1, "RADIO: init: cannot set calibration period\n");
+    }
+
+    if (arguments->tnc_turnaround && (radio_set_turnaround(serial_parms, 1, arguments->packet_length) < 0))
+    {
+        verbprintft(1, "RADIO: init: cannot set Tx/Rx turnaround\n");
+    }
+
+    if (arguments->rx_filter.flags)
+    {
+        msp430_filter_t filter = arguments->rx_filter;
+
+        if (radio_set_filter(serial_parms, &filter) < 0)
+        {
+            verbprintft(1, "RADIO: init: cannot set reception filters\n");
+        }
+    }
+
+    verbprintft(1, "RADIO: init: ready after %d us\n", (uint32_t) (monotonic_us() - start_us));
+
+    return nbytes;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the keyup delay before the first block sent after reception and the minimum time between
+// the end of a block and the start of the next one. The MSP430 times them. Nothing is sent to the
+// radio if they are unchanged. Returns 0 if successful else -1
+int radio_set_tx_timing(serial_t *serial_parms, uint32_t keyup_delay_us, uint32_t block_delay_us)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    if (tx_timing_set && (tx_timing.keyup_delay_us == keyup_delay_us) && (tx_timing.block_delay_us == block_delay_us))
+    {
+        return 0;
+    }
+
+    tx_timing.keyup_delay_us = keyup_delay_us;
+    tx_timing.block_delay_us = block_delay_us;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_TX_TIMING;
+    dataBuffer[1] = sizeof(msp430_tx_timing_t);
+    memcpy(&dataBuffer[2], &tx_timing, dataBuffer[1]);
+
+    nbytes = write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    verbprintft(2, "RADIO: Tx keyup %d us block delay %d us: %d bytes written to USB\n", keyup_delay_us, block_delay_us, nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+    tx_timing_set = (nbytes == 2);
+
+    return (tx_timing_set ? 0 : -1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the current MSP430 time in microseconds. Radio must be idle. Returns 0 if successful else -1
+int radio_get_time(serial_t *serial_parms, uint32_t *mcu_us)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_TIME;
+    dataBuffer[1] = 0;
+
+    write_serial(serial_parms, dataBuffer, 2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(uint32_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_TIME))
+    {
+        return -1;
+    }
+
+    memcpy(mcu_us, &dataBuffer[2], sizeof(uint32_t));
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select a channel. The MSP430 restores its frequency synthesizer calibration from its cache or
+// calibrates it. The calibration in use is returned in cal. Radio must be idle.
+// Returns 0 if successful else -1
+int radio_calibrate(serial_t *serial_parms, msp430_calibration_t *cal)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_CALIBRATION;
+    dataBuffer[1] = sizeof(msp430_calibration_t);
+    memcpy(&dataBuffer[2], cal, dataBuffer[1]);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(msp430_calibration_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_CALIBRATION))
+    {
+        return -1;
+    }
+
+    memcpy(cal, &dataBuffer[2], sizeof(msp430_calibration_t));
+    verbprintft(2, "RADIO: channel %d FSCAL3..1 %02X %02X %02X %s\n",
+        cal->channel,
+        cal->fscal3,
+        cal->fscal2,
+        cal->fscal1,
+        (cal->cached ? "from cache" : "calibrated"));
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the frequency hopping table and timing or just get the state (MSP430_HOP_QUERY). The state is
+// returned in hop. Returns 0 if successful else -1
+int radio_set_hop(serial_t *serial_parms, msp430_hop_t *hop)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_HOP;
+    dataBuffer[1] = sizeof(msp430_hop_t);
+    memcpy(&dataBuffer[2], hop, dataBuffer[1]);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(msp430_hop_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_HOP))
+    {
+        return -1;
+    }
+
+    memcpy(hop, &dataBuffer[2], sizeof(msp430_hop_t));
+    tx_hop_wait_us = ((hop->mode & MSP430_HOP_ENABLE) ? hop->guard_us + hop->settle_us : 0);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Read the RSSI over consecutive channels. The highest RSSI seen on each channel is returned in dBm
+// in rssi_dbm. Radio must be idle. Returns the number of channels swept if successful else -1
+int radio_sweep(serial_t *serial_parms, msp430_sweep_t *sweep, float *rssi_dbm_values)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes, i;
+    uint32_t timeout = sweep->nb_steps * (MSP430_SWEEP_MAX_US + 1000) / 10 + 10000; // calibration of all channels included
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_SWEEP;
+    dataBuffer[1] = sizeof(msp430_sweep_t);
+    memcpy(&dataBuffer[2], sweep, dataBuffer[1]);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, timeout);
+
+    if ((nbytes < 2) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_SWEEP) || (nbytes != dataBuffer[1] + 2))
+    {
+        return -1;
+    }
+
+    for (i=0; i < dataBuffer[1]; i++)
+    {
+        rssi_dbm_values[i] = rssi_dbm(dataBuffer[2+i]);
+    }
+
+    return dataBuffer[1];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the MSP430 interrupt latency statistics and optionally reset them. Returns 0 if successful
+// else -1
+int radio_get_latency(serial_t *serial_parms, msp430_latency_t *latency, uint8_t reset)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_LATENCY;
+    dataBuffer[1] = sizeof(msp430_latency_t);
+    memset(&dataBuffer[2], 0, sizeof(msp430_latency_t));
+    dataBuffer[2] = (reset ? MSP430_LATENCY_RESET : 0);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(msp430_latency_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_LATENCY))
+    {
+        return -1;
+    }
+
+    memcpy(latency, &dataBuffer[2], sizeof(msp430_latency_t));
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the counters of the FIFO errors the MSP430 recovered from by itself and optionally reset
+// them. Returns 0 if successful else -1
+int radio_get_fifo_stats(serial_t *serial_parms, msp430_fifo_stats_t *fifo_stats, uint8_t reset)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_FIFO_STATS;
+    dataBuffer[1] = sizeof(msp430_fifo_stats_t);
+    memset(&dataBuffer[2], 0, sizeof(msp430_fifo_stats_t));
+    dataBuffer[2] = (reset ? MSP430_FIFO_STATS_RESET : 0);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(msp430_fifo_stats_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_FIFO_STATS))
+    {
+        return -1;
+    }
+
+    memcpy(fifo_stats, &dataBuffer[2], sizeof(msp430_fifo_stats_t));
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the trace counters and the oldest events of the MSP430 trace ring. The events are removed
+// from the ring. Returns the number of events or -1 if unsuccessful
+int radio_get_trace(serial_t *serial_parms, msp430_trace_t *trace, msp430_trace_event_t *events, uint8_t reset)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_TRACE;
+    dataBuffer[1] = sizeof(msp430_trace_t);
+    memset(&dataBuffer[2], 0, sizeof(msp430_trace_t));
+    dataBuffer[2] = (reset ? MSP430_TRACE_RESET : 0);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes < 2 + sizeof(msp430_trace_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_TRACE))
+    {
+        return -1;
+    }
+
+    memcpy(trace, &dataBuffer[2], sizeof(msp430_trace_t));
+
+    if ((trace->nb_events > MSP430_TRACE_MAX_EVENTS) 
+        || (nbytes != 2 + sizeof(msp430_trace_t) + trace->nb_events * sizeof(msp430_trace_event_t)))
+    {
+        return -1;
+    }
+
+    memcpy(events, &dataBuffer[2 + sizeof(msp430_trace_t)], trace->nb_events * sizeof(msp430_trace_event_t));
+    return trace->nb_events;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the cycle profiling statistics of the MSP430 and optionally reset them. The
+// MSP430_PROFILE_ENABLED flag is returned if the firmware was built with the profiling. Returns 0
+// if successful else -1
+int radio_get_profile(serial_t *serial_parms, msp430_profile_t *profile, uint8_t reset)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_PROFILE;
+    dataBuffer[1] = sizeof(msp430_profile_t);
+    memset(&dataBuffer[2], 0, sizeof(msp430_profile_t));
+    dataBuffer[2] = (reset ? MSP430_PROFILE_RESET : 0);
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(msp430_profile_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_PROFILE))
+    {
+        return -1;
+    }
+
+    memcpy(profile, &dataBuffer[2], sizeof(msp430_profile_t));
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the address and payload filters of the MSP430 or only get their counters with the
+// MSP430_FILTER_QUERY flag. The filters in use and their counters are returned. Returns 0 if
+// successful else -1
+int radio_set_filter(serial_t *serial_parms, msp430_filter_t *filter)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_FILTER;
+    dataBuffer[1] = sizeof(msp430_filter_t);
+    memcpy(&dataBuffer[2], filter, sizeof(msp430_filter_t));
+
+    write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2 + sizeof(msp430_filter_t)) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_FILTER))
+    {
+        return -1;
+    }
+
+    memcpy(filter, &dataBuffer[2], sizeof(msp430_filter_t));
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Let the radio go to reception by itself at the end of each block sent with the given block size
+// expected. The block received is returned at the next Rx command. Returns 0 if successful else -1
+int radio_set_turnaround(serial_t *serial_parms, uint8_t enable, uint8_t rx_block_size)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_turnaround_t turnaround;
+    int nbytes;
+
+    turnaround.enable = enable;
+    turnaround.rx_block_size = rx_block_size;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_TURNAROUND;
+    dataBuffer[1] = sizeof(msp430_turnaround_t);
+    memcpy(&dataBuffer[2], &turnaround, dataBuffer[1]);
+
+    nbytes = write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    verbprintft(2, "RADIO: Tx/Rx turnaround %s: %d bytes written to USB\n", (enable ? "on" : "off"), nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    return (nbytes == 2 ? 0 : -1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print the receiver blind time statistics
+void radio_print_blind_time(int verb_level)
+// ------------------------------------------------------------------------------------------------
+{
+    if (radio_timing.rx_blind_count == 0)
+    {
+        return;
+    }
+
+    verbprintf(verb_level, "RADIO: Rx blind time after Tx: last %u us, average %.0f us, max %u us over %u transmissions\n",
+        radio_timing.rx_blind_us,
+        (float) radio_timing.rx_blind_total_us / radio_timing.rx_blind_count,
+        radio_timing.rx_blind_max_us,
+        radio_timing.rx_blind_count);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select the PATABLE power index for the next transmissions. Nothing is sent to the radio if the
+// index is already selected. Returns 0 if successful else -1
+int radio_set_tx_power(serial_t *serial_parms, uint8_t power_index)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    if (power_index == tx_power_index)
+    {
+        return 0;
+    }
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_TX_POWER;
+    dataBuffer[1] = 1;
+    dataBuffer[2] = power_index;
+
+    nbytes = write_serial(serial_parms, dataBuffer, 3);
+    verbprintft(2, "RADIO: Tx power %d dBm: %d bytes written to USB\n", power_values[power_index], nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if (nbytes != 2)
+    {
+        return -1;
+    }
+
+    tx_power_index = power_index;
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set the automatic frequency control mode and get its state back in the same structure.
+// Radio must be idle. Returns 0 if successful else -1
+int radio_afc(serial_t *serial_parms, msp430_afc_t *afc)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_AFC;
+    dataBuffer[1] = sizeof(msp430_afc_t);
+    memcpy(&dataBuffer[2], afc, dataBuffer[1]);
+
+    nbytes = write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    verbprintft(2, "RADIO: AFC: %d bytes written to USB\n", nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != sizeof(msp430_afc_t) + 2) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_AFC))
+    {
+        return -1;
+    }
+
+    memcpy(afc, &dataBuffer[2], sizeof(msp430_afc_t));
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write modem configuration registers given as (address, value) pairs. Values are replaced by the
+// ones read back. Radio must be idle. Returns 0 if successful else -1
+int radio_write_registers(serial_t *serial_parms, uint8_t *pairs, int nb_pairs)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    if (nb_pairs > MSP430_REGISTERS_MAX_PAIRS)
+    {
+        return -1;
+    }
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_REGISTERS;
+    dataBuffer[1] = 2*nb_pairs;
+    memcpy(&dataBuffer[2], pairs, dataBuffer[1]);
+
+    nbytes = write_serial(serial_parms, dataBuffer, dataBuffer[1]+2);
+    verbprintft(2, "RADIO: write %d registers: %d bytes written to USB\n", nb_pairs, nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    if ((nbytes != 2*nb_pairs + 2) || (dataBuffer[0] != (uint8_t) MSP430_BLOCK_TYPE_REGISTERS))
+    {
+        return -1;
+    }
+
+    memcpy(pairs, &dataBuffer[2], 2*nb_pairs);
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Cancel reception state
+int radio_cancel_rx(serial_t *serial_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_RX_CANCEL;
+    dataBuffer[1] = 0;
+
+    nbytes = write_serial(serial_parms, dataBuffer, 2);
+    verbprintft(2, "RADIO: cancel Rx: %d bytes written to USB\n", nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 100000);
+
+    if (nbytes > 0)
+    {
+        print_block(3, dataBuffer, nbytes);
+    }
+
+    return nbytes;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print the cycle profiling statistics of each site then the headroom left to the FIFO transfers
+// at the configured rate: from the FIFO threshold the Tx FIFO underflows and the Rx FIFO overflows
+// after the bytes left in the Tx FIFO or free in the Rx FIFO are sent or received. The longest
+// interrupt, event latency and transfer must fit in this time.
+void print_profile(msp430_profile_t *profile, msp430_latency_t *latency, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    static char *site_names[] = {
+        "PORT1 interrupt ......",
+        "USB interrupt ........",
+        "Tx FIFO first burst ..",
+        "Tx FIFO refill .......",
+        "Rx FIFO unload .......",
+        "Rx FIFO end of packet "
+    };
+    msp430_profile_stats_t *stats;
+    msp430_radio_parms_t   radio_parms;
+    float cycle_us = 1.0 / profile->mclk_mhz;
+    float byte_us, tx_deadline_us, rx_deadline_us, tx_work_us, rx_work_us;
+    int i, j;
+
+    for (i=0; i < MSP430_PROFILE_NB_SITES; i++)
+    {
+        stats = &profile->sites[i];
+
+        if (!stats->count)
+        {
+            fprintf(stderr, "%s: no run\n", site_names[i]);
+            continue;
+        }
+
+        fprintf(stderr, "%s: %d runs, min %.1f us, avg %.1f us, max %.1f us, histogram",
+            site_names[i],
+            stats->count,
+            stats->min_cycles * cycle_us,
+            ((float) stats->total_cycles / stats->count) * cycle_us,
+            stats->max_cycles * cycle_us);
+
+        for (j=0; j < MSP430_PROFILE_BINS; j++)
+        {
+            fprintf(stderr, " %d", stats->histogram[j]);
+        }
+
+        fprintf(stderr, "\n");
+    }
+
+    init_radio_parms(&radio_parms, arguments);
+    byte_us = radio_get_byte_time(&radio_parms);
+    tx_deadline_us = (61 - 4*radio_parms.fifo_thr) * byte_us;
+    rx_deadline_us = (60 - 4*radio_parms.fifo_thr) * byte_us;
+    tx_work_us = latency->event_max_us + (profile->sites[MSP430_PROFILE_PORT1_ISR].max_cycles 
+        + profile->sites[MSP430_PROFILE_USB_ISR].max_cycles 
+        + profile->sites[MSP430_PROFILE_TX_REFILL].max_cycles) * cycle_us;
+    rx_work_us = latency->event_max_us + (profile->sites[MSP430_PROFILE_PORT1_ISR].max_cycles 
+        + profile->sites[MSP430_PROFILE_USB_ISR].max_cycles 
+        + profile->sites[MSP430_PROFILE_RX_UNLOAD].max_cycles) * cycle_us;
+
+    fprintf(stderr, "Tx FIFO headroom .....: %.0f us of %.0f us at %d Baud (%s)\n",
+        tx_deadline_us - tx_work_us, tx_deadline_us, rate_values[arguments->rate],
+        (tx_work_us < tx_deadline_us ? "safe" : "UNSAFE"));
+    fprintf(stderr, "Rx FIFO headroom .....: %.0f us of %.0f us at %d Baud (%s)\n",
+        rx_deadline_us - rx_work_us, rx_deadline_us, rate_values[arguments->rate],
+        (rx_work_us < rx_deadline_us ? "safe" : "UNSAFE"));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print status registers to stderr
+void print_radio_status(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_latency_t    latency;
+    msp430_filter_t     filter;
+    msp430_fifo_stats_t fifo_stats;
+    msp430_profile_t    profile;
+    uint8_t *regs;
+    int nbytes;
+
+    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_RADIO_STATUS;
+    dataBuffer[1] = 0;
+
+    fprintf(stderr, "Start...\n");
+
+    nbytes = write_serial(serial_parms, dataBuffer, 2);
+    verbprintft(1, "RADIO: status: %d bytes written to USB\n", nbytes);
+
+    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 10000);
+
+    print_block(3, dataBuffer, nbytes);
+
+    if (nbytes >= 14)
+    {
+        regs = &dataBuffer[2];
+
+        fprintf(stderr, "Part number ...........: %d\n", regs[0]);
+        fprintf(stderr, "Version ...............: %d\n", regs[1]);
+        fprintf(stderr, "Freq offset estimate ..: %d\n", (signed char) regs[2]);
+        fprintf(stderr, "CRC OK ................: %d\n", ((regs[3] & 0x80)>>7));
+        fprintf(stderr, "LQI ...................: %d\n", regs[3] & 0x7F);
+        fprintf(stderr, "RSSI ..................: %.1f dBm\n", rssi_dbm(regs[4]));
+        fprintf(stderr, "Radio FSM state .......: %s\n", state_names[regs[5] & 0x1F]);
+        fprintf(stderr, "WOR time ..............: %d\n", ((regs[6] << 8) + regs[7]));
+        fprintf(stderr, "Carrier Sense .........: %d\n", ((regs[8] & 0x40)>>6));
+        fprintf(stderr, "Preamble Qual Reached .: %d\n", ((regs[8] & 0x20)>>5));
+        fprintf(stderr, "Clear channel .........: %d\n", ((regs[8] & 0x10)>>4));
+        fprintf(stderr, "Start of frame delim ..: %d\n", ((regs[8] & 0x08)>>3));
+        fprintf(stderr, "GDO2 ..................: %d\n", ((regs[8] & 0x04)>>2));
+        fprintf(stderr, "GDO0 ..................: %d\n", ((regs[8] & 0x01)));
+        fprintf(stderr, "VCO VC DAC ............: %d\n", regs[9]);
+        fprintf(stderr, "FIFO Tx underflow .....: %d\n", ((regs[10] & 0x80)>>7));
+        fprintf(stderr, "FIFO Tx bytes .........: %d\n", regs[10] & 0x7F);
+        fprintf(stderr, "FIFO Rx overflow ......: %d\n", ((regs[11] & 0x80)>>7));
+        fprintf(stderr, "FIFO Rx bytes .........: %d\n", regs[11] & 0x7F);
+
+        memset(&latency, 0, sizeof(msp430_latency_t));
+
+        if (radio_get_latency(serial_parms, &latency, 1) == 0) // since the last status
+        {
+            fprintf(stderr, "IRQ latency max .......: %d us (%d samples)\n", latency.irq_max_us, latency.nb_probes);
+            fprintf(stderr, "Main loop work max ....: %d us\n", latency.work_max_us);
+            fprintf(stderr, "Event latency max .....: %d us\n", latency.event_max_us);
+        }
+
+        if (radio_get_fifo_stats(serial_parms, &fifo_stats, 1) == 0) // since the last status
+        {
+            fprintf(stderr, "Rx FIFO overflows .....: %d\n", fifo_stats.nb_rx_overflows);
+            fprintf(stderr, "Tx FIFO underflows ....: %d\n", fifo_stats.nb_tx_underflows);
+            fprintf(stderr, "FIFO recovery max .....: %d us\n", fifo_stats.recovery_max_us);
+        }
+
+        if ((radio_get_profile(serial_parms, &profile, 1) == 0) && (profile.flags & MSP430_PROFILE_ENABLED))
+        {
+            print_profile(&profile, &latency, arguments);
+        }
+
+        filter.flags = MSP430_FILTER_QUERY | MSP430_FILTER_RESET;
+
+        if ((radio_set_filter(serial_parms, &filter) == 0) && filter.flags) // since the last status
+        {
+            fprintf(stderr, "Address filter drops ..: %d\n", filter.nb_address_drops);
+            fprintf(stderr, "Payload filter drops ..: %d\n", filter.nb_payload_drops);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error reading from %s\n", arguments->usbacm_device);
+    }
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print actual radio link parameters once initialized
+//   o Operating frequency ..: Fo   = (Fxosc / 2^16) * FREQ[23..0]
+//   o Channel spacing ......: Df   = (Fxosc / 2^18) * (256 + CHANSPC_M) * 2^CHANSPC_E
+//   o Channel bandwidth ....: BW   = Fxosc / (8 * (4+CHANBW_M) * 2^CHANBW_E)
+//   o Data rate (Baud) .....: Rate = (Fxosc / 2^28) * (256 + DRATE_M) * 2^DRATE_E
+//   o Deviation ............: Df   = (Fxosc / 2^17) * (8 + DEVIATION_M) * 2^DEVIATION_E
+
+void print_radio_parms(msp430_radio_parms_t *radio_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    float f_xtal = F_XTAL_MHZ * 1e6;
+
+    fprintf(stderr, "\n--- Actual radio channel parameters ---\n");
+    fprintf(stderr, "Operating frequency ....: %.3f MHz (W=%d)\n", 
+        ((f_xtal/1e6) / (1<<16))*radio_parms->freq_word, radio_parms->freq_word);
+    fprintf(stderr, "Intermediate frequency .: %.3f kHz (W=%d)\n", 
+        ((f_xtal/1e3) / (1<<10))*radio_parms->if_word, radio_parms->if_word);
+    fprintf(stderr, "Channel spacing ........: %.3f kHz (M=%d, E=%d)\n", 
+        ((f_xtal/1e3) / (1<<18))*(256+radio_parms->chanspc_m)*(1<<radio_parms->chanspc_e), radio_parms->chanspc_m, radio_parms->chanspc_e);
+    fprintf(stderr, "Channel bandwidth.......: %.3f kHz (M=%d, E=%d)\n",
+        (f_xtal/1e3) / (8*(4+radio_parms->chanbw_m)*(1<<radio_parms->chanbw_e)), radio_parms->chanbw_m, radio_parms->chanbw_e);
+    fprintf(stderr, "Data rate ..............: %.1f Baud (M=%d, E=%d)\n",
+        radio_get_rate(radio_parms), radio_parms->drate_m, radio_parms->drate_e);
+    fprintf(stderr, "Deviation ..............: %.3f kHz (M=%d, E=%d)\n",
+        ((f_xtal/1e3) / (1<<17)) * (8 + radio_parms->deviat_m) * (1<<radio_parms->deviat_e), radio_parms->deviat_m, radio_parms->deviat_e);
+    fprintf(stderr, "Modulation word ........: %d (%s)\n", 
+        radio_parms->mod_word, modulation_names[get_mod_code(radio_parms->mod_word)]);
+    fprintf(stderr, "FEC ....................: %s\n", (radio_parms->fec_whitening & 0x01 ? "on" : "off"));
+    fprintf(stderr, "Data whitening .........: %s\n", (radio_parms->fec_whitening & 0x02 ? "on" : "off"));
+    fprintf(stderr, "Packet length ..........: %d bytes\n",
+        radio_parms->packet_length);
+    fprintf(stderr, "Byte time ..............: %d us\n",
+        ((uint32_t) radio_get_byte_time(radio_parms)));
+    fprintf(stderr, "Packet time ............: %d us\n",
+        (uint32_t) (radio_parms->packet_length * radio_get_byte_time(radio_parms)));
+    fprintf(stderr, "FIFO threshold .........: %d (%d bytes margin)\n",
+        radio_parms->fifo_thr, 60 - 4*radio_parms->fifo_thr);
+    fprintf(stderr, "Sync word ..............: %02X%02X\n", radio_parms->sync1, radio_parms->sync0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send a radio block of maximum 255 bytes
 // dataBlock      is the start of the actual data block
 // dataSize       is the size of the useful data inside the block
 // blockCountdown is the block countdown provisoned for multi-block packets
@@ -670,10 +1762,35 @@ int radio_send_block(serial_t *serial_parms,
         uint32_t timeout_us)
 // ------------------------------------------------------------------------------------------------
 {
-    int nbytes, ackbytes;
+    return radio_send_typed_block(serial_parms,
+        MSP430_BLOCK_TYPE_TX,
+        dataBlock,
+        dataSize,
+        blockCountdown,
+        blockSize,
+        ackBlock,
+        ackBlockSize,
+        timeout_us);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send a radio block with the given Tx command (plain or hop beacon). See radio_send_block.
+int radio_send_typed_block(serial_t *serial_parms, 
+        msp430_block_type_t block_type,
+        uint8_t  *dataBlock, 
+        uint8_t  dataSize,
+        uint8_t  blockCountdown, 
+        uint8_t  blockSize,
+        uint8_t  *ackBlock, 
+        int      *ackBlockSize, 
+        uint32_t timeout_us)
+// ------------------------------------------------------------------------------------------------
+{
+    int      nbytes, ackbytes;
+    uint64_t write_us;
 
     memset(dataBuffer, 0, blockSize+2);
-    dataBuffer[0] = (uint8_t) MSP430_BLOCK_TYPE_TX;
+    dataBuffer[0] = (uint8_t) block_type;
     dataBuffer[1] = blockSize;
     dataBuffer[2] = dataSize;
     dataBuffer[3] = blockCountdown;
@@ -681,92 +1798,172 @@ int radio_send_block(serial_t *serial_parms,
 
     print_block(4, dataBuffer, blockSize+2);
 
-    nbytes = write_serial(serial_parms, dataBuffer, blockSize+2);
+    write_us = monotonic_us();
+    nbytes = write_serial(block_serial(serial_parms), dataBuffer, blockSize+2);
     verbprintft(2, "RADIO: send block: Block (%d,%d): %d bytes written to USB\n",
         dataBuffer[2],
         dataBuffer[3],
         nbytes);
 
-    ackbytes = read_usb(serial_parms, ackBlock, *ackBlockSize, timeout_us/10);
+    // the MSP430 may hold the block for the keyup or inter-block delay and until the next hop
+    ackbytes = read_usb(block_serial(serial_parms), ackBlock, *ackBlockSize, (timeout_us + tx_timing.keyup_delay_us + tx_timing.block_delay_us + tx_hop_wait_us)/10);
     *ackBlockSize = ackbytes;
 
+    if ((ackbytes > 0) && (ackBlock[0] == (uint8_t) MSP430_BLOCK_TYPE_TX))
+    {
+        radio_tx_timestamps(ackBlock, ackbytes, write_us);
+    }
+
     return nbytes;
 }
 
 // ------------------------------------------------------------------------------------------------
-// Transmission of a packet
-uint32_t radio_send_packet(serial_t *serial_parms,
+// Prepare the transmission of a packet one block at a time. Each packet gets a new stream identifier.
+// packet         is the pointer to the packet data. It must remain valid until the packet is sent.
+// dataBlockSize  is the size of the radio block
+// size           is the size of the packet
+void radio_stream_start(radio_tx_stream_t *stream,
         uint8_t  *packet,
-        uint8_t  blockSize,
+        uint8_t  dataBlockSize,
+        uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    stream->packet = packet;
+    stream->size = size;
+    stream->data_index = 0;
+    stream->block_countdown = (size ? (size - 1) / (dataBlockSize - RADIO_PACKET_HEADER_SIZE) : 0);
+    stream->stream_id = RADIO_STREAM_FORMAT | (tx_stream_id++ & RADIO_STREAM_ID_MASK);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Transmission of the next block of a packet
+// dataBlockSize    is the size of the radio block
+// block_timeout_us is the acknowledgement timeout in microseconds
+// Returns 0 if successful or -1 if the MSP430 did not acknowledge the block
+int radio_stream_send_block(serial_t *serial_parms,
+        radio_tx_stream_t *stream,
+        uint8_t  dataBlockSize,
+        uint32_t block_timeout_us)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  blockData[DATA_BUFFER_SIZE];
+    uint8_t  ackBuffer[DATA_BUFFER_SIZE];
+    int      data_length, nbytes, ackbytes;
+
+    data_length = (stream->size > dataBlockSize - RADIO_PACKET_HEADER_SIZE ? dataBlockSize - RADIO_PACKET_HEADER_SIZE : stream->size);
+    ackbytes = DATA_BUFFER_SIZE; 
+
+    memset(blockData, 0, dataBlockSize);
+    blockData[0] = stream->stream_id | (stream->data_index ? 0 : RADIO_STREAM_FIRST);
+    memcpy(&blockData[1], &stream->packet[stream->data_index], data_length);
+
+    nbytes = radio_send_block(serial_parms, 
+        blockData,
+        data_length + 2, // size takes countdown counter and stream identifier into account
+        stream->block_countdown,
+        dataBlockSize,
+        ackBuffer,
+        &ackbytes,
+        block_timeout_us);
+
+    verbprintft(2, "RADIO: send packet: Stream %d Block (%d,%d): data_index: %d - %d bytes sent %d bytes received from radio_send_block\n", 
+        stream->stream_id,
+        data_length + 2,
+        stream->block_countdown, 
+        stream->data_index,
+        nbytes, 
+        ackbytes); 
+    
+    if (ackbytes > 0)
+    {
+        if (ackBuffer[0] != MSP430_BLOCK_TYPE_TX)
+        {
+            verbprintft(1, "RADIO: send packet: Error returned via USB\n");
+            print_block(1, ackBuffer, ackbytes);
+            return -1;
+        }
+        else
+        {
+            print_block(3, ackBuffer, ackbytes);
+        }
+    }
+    else
+    {
+        verbprintft(1, "RADIO: send packet: No reply via USB\n");
+        return -1;
+    }
+
+    stream->data_index += data_length;
+    stream->size -= data_length;
+    stream->block_countdown--;
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Transmission of a single block packet stamped by the MSP430 with its hop timing over its last
+// bytes (msp430_hop_stamp_t). Returns 0 if successful or -1 if the MSP430 did not acknowledge it
+int radio_send_hop_beacon(serial_t *serial_parms,
+        uint8_t  *packet,
+        uint8_t  dataBlockSize,
         uint32_t size,
-        uint32_t block_delay_us,
         uint32_t block_timeout_us)
 // ------------------------------------------------------------------------------------------------
 {
-    int      data_length, data_index;
+    uint8_t  blockData[DATA_BUFFER_SIZE];
     uint8_t  ackBuffer[DATA_BUFFER_SIZE];
-    int      nbytes, ackbytes;
-    uint32_t block_countdown;
+    int      ackbytes = DATA_BUFFER_SIZE;
 
-    if (size == 0)
+    if (size > dataBlockSize - RADIO_PACKET_HEADER_SIZE)
     {
-        return 0;
+        return -1;
     }
 
-    block_countdown = (size - 1) / (blockSize - 2);
-    data_index = 0;
-
-    while (size > 0)
+    memset(blockData, 0, dataBlockSize);
+    blockData[0] = RADIO_STREAM_FORMAT | RADIO_STREAM_FIRST | (tx_stream_id++ & RADIO_STREAM_ID_MASK);
+    memcpy(&blockData[1], packet, size);
+
+    radio_send_typed_block(serial_parms,
+        MSP430_BLOCK_TYPE_HOP_BEACON,
+        blockData,
+        size + 2, // size takes countdown counter and stream identifier into account
+        0,
+        dataBlockSize,
+        ackBuffer,
+        &ackbytes,
+        block_timeout_us);
+
+    if ((ackbytes <= 0) || (ackBuffer[0] != MSP430_BLOCK_TYPE_TX))
     {
-        data_length = (size > blockSize - 2 ? blockSize - 2 : size);
-        ackbytes = DATA_BUFFER_SIZE; 
+        verbprintft(1, "RADIO: send hop beacon: no acknowledgement\n");
+        return -1;
+    }
 
-        nbytes = radio_send_block(serial_parms, 
-            &packet[data_index],
-            data_length + 1, // size takes countdown counter into account
-            block_countdown,
-            blockSize,
-            ackBuffer,
-            &ackbytes,
-            block_timeout_us);
-
-        verbprintft(2, "RADIO: send packet: Block (%d,%d): data_index: %d - %d bytes sent %d bytes received from radio_send_block\n", 
-            data_length + 1,
-            block_countdown, 
-            data_index,
-            nbytes, 
-            ackbytes); 
-        
-        if (ackbytes > 0)
-        {
-            if (ackBuffer[0] != MSP430_BLOCK_TYPE_TX)
-            {
-                verbprintft(1, "RADIO: send packet: Error returned via USB\n");
-                print_block(1, ackBuffer, ackbytes);
-                break;
-            }
-            else
-            {
-                print_block(3, ackBuffer, ackbytes);
-            }
-        }
-        else
-        {
-            verbprintft(1, "RADIO: send packet: No reply via USB\n");
-            break;
-        }
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Transmission of a packet
+uint32_t radio_send_packet(serial_t *serial_parms,
+        uint8_t  *packet,
+        uint8_t  blockSize,
+        uint32_t size,
+        uint32_t block_timeout_us)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_tx_stream_t stream;
 
-        data_index += data_length;
-        size -= data_length;
-        block_countdown--;
+    radio_stream_start(&stream, packet, blockSize, size);
 
-        if (block_delay_us && size) // inter-block delay
+    while (stream.size > 0)
+    {
+        if (radio_stream_send_block(serial_parms, &stream, blockSize, block_timeout_us) < 0)
         {
-            usleep(block_delay_us); // pause before sending the next block
+            break;
         }
     }
 
-    return size;
+    return stream.size;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -786,7 +1983,13 @@ int radio_turn_on_rx(serial_t *serial_parms,
     dataBuffer[1] = 1;
     dataBuffer[2] = dataBlockSize;
 
-    nbytes = write_serial(serial_parms, dataBuffer, 3);
+    if (rx_blind_pending) // receiver armed by this command: blind up to now at least
+    {
+        radio_blind_time(monotonic_us());
+        rx_blind_pending = 0;
+    }
+
+    nbytes = write_serial(block_serial(serial_parms), dataBuffer, 3);
     verbprintft(2, "RADIO: turn on Rx: %d bytes written to USB\n", nbytes);
 
     //nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, 100000);
@@ -827,10 +2030,10 @@ int radio_receive_block(serial_t *serial_parms,
     dataBuffer[1] = 1;
     dataBuffer[2] = dataBlockSize;
 
-    nbytes = write_serial(serial_parms, dataBuffer, 3);
+    nbytes = write_serial(block_serial(serial_parms), dataBuffer, 3);
     verbprintft(2, "RADIO: receive block: %d bytes written to USB\n", nbytes);
 
-    nbytes = read_usb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, timeout_us/10);
+    nbytes = read_usb(block_serial(serial_parms), dataBuffer, DATA_BUFFER_SIZE, timeout_us/10);
     verbprintft(2, "RADIO: receive block: %d bytes read from USB\n", nbytes);
 
     if (nbytes > 0)
@@ -850,10 +2053,9 @@ int radio_receive_block(serial_t *serial_parms,
             memcpy(dataBlock, &dataBuffer[4], data_size);
         }
 
-        if (nbytes >= 6)
+        if (nbytes >= 6 + sizeof(msp430_timestamps_t)) // RSSI, LQI and timestamps
         {
-            *rssi    = dataBuffer[block_size+2 - 2]; // byte before last byte is RSSI
-            *crc_lqi = dataBuffer[block_size+2 - 1]; // last byte is CRC+LQI combination byte
+            radio_rx_trailer(block_size, rssi, crc_lqi, monotonic_us());
         }
     }
 
@@ -883,7 +2085,7 @@ int radio_receive_block_nb(serial_t *serial_parms,
     uint8_t block_size;
     uint8_t data_size;
 
-    nbytes = read_usb_nb(serial_parms, dataBuffer, DATA_BUFFER_SIZE, timeout_us/10); // timeout=1 is non-blocking
+    nbytes = read_usb_nb(block_serial(serial_parms), dataBuffer, DATA_BUFFER_SIZE, timeout_us/10); // timeout=1 is non-blocking
 
     if (nbytes > 0)
     {
@@ -903,10 +2105,9 @@ int radio_receive_block_nb(serial_t *serial_parms,
             memcpy(dataBlock, &dataBuffer[4], data_size);
         }
 
-        if (nbytes >= 6)
+        if (nbytes >= 6 + sizeof(msp430_timestamps_t)) // RSSI, LQI and timestamps
         {
-            *rssi    = dataBuffer[block_size+2 - 2]; // byte before last byte is RSSI
-            *crc_lqi = dataBuffer[block_size+2 - 1]; // last byte is CRC+LQI combination byte
+            radio_rx_trailer(block_size, rssi, crc_lqi, monotonic_us());
         }
     }
 
@@ -914,7 +2115,8 @@ int radio_receive_block_nb(serial_t *serial_parms,
 }
 
 // ------------------------------------------------------------------------------------------------
-// Receive of a packet
+// Receive of a packet. Blocks of several packets may be interleaved. Reception stops as soon as
+// any of the packets is complete.
 // packet                 is the pointer to the reception area
 // blockSize              is the size of the radio block
 // init_timeout_us        is the timeout in microseconds for the first block
@@ -927,18 +2129,21 @@ uint32_t radio_receive_packet(serial_t *serial_parms,
     uint32_t inter_block_timeout_us)
 // ------------------------------------------------------------------------------------------------
 {
-    int      nbytes;
-    uint8_t  crc_lqi, crc, lqi, rssi, block_countdown, block_count = 0;
-    uint32_t packet_size = 0;
+    int      nbytes, packet_size;
+    uint8_t  blockData[DATA_BUFFER_SIZE];
+    uint8_t  crc_lqi, crc, lqi, rssi, block_countdown;
+    uint32_t block_size;
     uint32_t timeout = init_timeout_us;
 
     do
     {
+        block_size = 0;
+
         nbytes = radio_receive_block(serial_parms, 
-            &packet[packet_size],
+            blockData,
             blockSize,
             &block_countdown,
-            &packet_size,
+            &block_size,
             &rssi,
             &crc_lqi,
             timeout);
@@ -950,46 +2155,58 @@ uint32_t radio_receive_packet(serial_t *serial_parms,
             return 0;
         }
 
-        if (!block_count)
-        {
-            block_count = block_countdown + 1;
-            timeout = inter_block_timeout_us;
-        }
-
-        block_count--;
-
-        if (block_count != block_countdown)
-        {
-            verbprintft(1, "RADIO: block sequence error. Aborting packet\n");
-            packet[0] = '\0';
-            return 0;
-        }
-
+        timeout = inter_block_timeout_us;
         crc = get_crc_lqi(crc_lqi, &lqi);
 
         if (crc)
         {
-            verbprintft(2, "RADIO: Block countdown: %d Size so far: %d RSSI: %.1f dBm CRC OK\n",
+            verbprintft(2, "RADIO: Stream: %d Block countdown: %d Block size: %d RSSI: %.1f dBm CRC OK\n",
+                blockData[0],
                 block_countdown, 
-                packet_size, 
+                block_size, 
                 rssi_dbm(rssi));
         }
         else
         {
             verbprintft(1, "RADIO: CRC error, aborting packet\n");
+            reassemble_drop(blockData, block_size);
+            packet[0] = '\0';
+            return 0;
+        }
+
+        packet_size = reassemble_block(blockData, block_size, block_countdown, packet, inter_block_timeout_us);
+
+        if (packet_size < 0)
+        {
+            verbprintft(1, "RADIO: block sequence error. Aborting packet\n");
             packet[0] = '\0';
             return 0;
         }
 
-    } while (block_countdown > 0);
+    } while (packet_size == 0);
 
     return packet_size;
 }
 
 // ------------------------------------------------------------------------------------------------
-// Reception of a packet in non-blocking mode. Only the first block of a packet is non-blocking
-// other blocks of the packet are expected to follow immediately and therefore blocking reception
-// is used.
+// Number of packets partially received and waiting for their next blocks
+int radio_rx_streams_pending()
+// ------------------------------------------------------------------------------------------------
+{
+    int i, count = 0;
+
+    for (i=0; i<RADIO_NUM_STREAMS; i++)
+    {
+        count += rx_streams[i].in_use;
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reception of a packet in non-blocking mode. Only the first block is non-blocking. If it does not
+// complete a packet other blocks are expected to follow immediately and therefore blocking reception
+// is used until a packet is complete.
 // packet                 is the pointer to the reception area
 // blockSize              is the size of the radio block
 // init_timeout_us        is the timeout in microseconds for the first block
@@ -1002,16 +2219,16 @@ int radio_receive_packet_nb(serial_t *serial_parms,
     uint32_t inter_block_timeout_us)
 // ------------------------------------------------------------------------------------------------
 {
-    int      nbytes;
-    uint8_t  crc_lqi, crc, lqi, rssi, block_countdown, block_count = 0;
-    uint32_t packet_size = 0;
-    uint32_t rest_of_packet_size;
+    int      nbytes, packet_size = 0;
+    uint8_t  blockData[DATA_BUFFER_SIZE];
+    uint8_t  crc_lqi, crc, lqi, rssi, block_countdown;
+    uint32_t block_size = 0;
 
     // first non-blocking read
     nbytes = radio_receive_block_nb(serial_parms, 
-        &packet[packet_size],
+        blockData,
         &block_countdown,
-        &packet_size,
+        &block_size,
         &rssi,
         &crc_lqi,
         init_timeout_us);
@@ -1023,22 +2240,27 @@ int radio_receive_packet_nb(serial_t *serial_parms,
         if (!crc)
         {
             verbprintft(1, "RADIO: CRC error on first block. Aborting packet\n");
+            reassemble_drop(blockData, block_size);
+            return -1;
+        }
+
+        packet_size = reassemble_block(blockData, block_size, block_countdown, packet, inter_block_timeout_us);
+
+        if (packet_size < 0)
+        {
+            verbprintft(1, "RADIO: block sequence error. Aborting packet\n");
             return -1;
         }
 
-        if (block_countdown > 0) // there are more blocks to follow
+        if (packet_size == 0) // there are more blocks to follow
         {
-            rest_of_packet_size = radio_receive_packet(serial_parms,
-                &packet[packet_size],
+            packet_size = radio_receive_packet(serial_parms,
+                packet,
                 blockSize,
                 inter_block_timeout_us,
                 inter_block_timeout_us);
 
-            if (rest_of_packet_size > 0)
-            {
-                packet_size += rest_of_packet_size;
-            }
-            else
+            if (packet_size == 0)
             {
                 verbprintft(1, "RADIO: received incomplete packet. Aborting packet\n");
                 return -1;
@@ -1048,4 +2270,3 @@ int radio_receive_packet_nb(serial_t *serial_parms,
 
     return packet_size;
 }
-
@@ -14,6 +14,13 @@
 #include "serial.h"
 
 #define RADIO_BUFSIZE (1<<16)   // 256 max radio block size times a maximum of 256 radio blocs
+#define RADIO_PACKET_HEADER_SIZE 3 // Data count, block countdown and stream identifier of a packet block
+#define RADIO_NUM_STREAMS        4 // Number of packets that can be reassembled concurrently
+#define RADIO_STREAM_FORMAT   0xA0 // Upper 3 bits of the stream identifier byte: version of the block format
+#define RADIO_STREAM_FORMAT_MASK 0xE0 // Bits of the format in the stream identifier byte
+#define RADIO_STREAM_FIRST    0x10 // Stream identifier byte flag of the first block of a packet
+#define RADIO_STREAM_ID_MASK  0x0F // Lower nibble of the stream identifier byte: stream number
+#define RADIO_FIFO_LATENCY_US  500 // Longest time the MSP430 may take to serve a FIFO threshold interrupt
 
 typedef enum radio_int_scheme_e 
 {
@@ -31,6 +38,33 @@ typedef enum radio_mode_e
     NUM_RADIOMODE
 } radio_mode_t;
 
+// Transmission of a packet one block at a time. Blocks of several packets can be interleaved.
+typedef struct radio_tx_stream_s
+{
+    uint8_t  *packet;         // Packet data
+    uint32_t size;            // Number of bytes left to be sent
+    uint32_t data_index;      // Index of the next byte to be sent
+    uint8_t  block_countdown; // Countdown of the next block
+    uint8_t  stream_id;       // Identifier carried by all blocks of the packet
+} radio_tx_stream_t;
+
+// Timing of the last blocks sent and received on the host monotonic clock in microseconds.
+// Radio events come from the MSP430 timestamps. Values are 0 when unknown.
+typedef struct radio_timing_s
+{
+    uint64_t rx_sync_us;  // Sync word of the last block received
+    uint64_t rx_end_us;   // End of the last block received
+    uint64_t rx_read_us;  // Last block received read from USB
+    uint32_t rx_sync_mcu_us; // Sync word of the last block received on the MSP430 clock
+    uint64_t tx_write_us; // Last block sent written to USB
+    uint64_t tx_sync_us;  // Sync word of the last block sent
+    uint64_t tx_end_us;   // End of the last block sent
+    uint32_t rx_blind_us;       // Receiver blind time after the last transmission
+    uint32_t rx_blind_max_us;   // Longest blind time
+    uint64_t rx_blind_total_us; // Sum of the blind times
+    uint32_t rx_blind_count;    // Number of blind times measured
+} radio_timing_t;
+
 extern char     *modulation_names[];
 extern char     *state_names[];
 extern float    chanbw_limits[];
@@ -38,6 +72,9 @@ extern uint32_t packets_sent;
 extern uint32_t packets_received;
 extern uint32_t blocks_sent;
 extern uint32_t blocks_received;
+extern float    radio_rssi_dbm;
+extern uint8_t  radio_lqi;
+extern radio_timing_t radio_timing;
 
 /*
 void     init_radio_parms(radio_parms_t *radio_parms, arguments_t *arguments);
@@ -51,11 +88,43 @@ void     radio_turn_rx(spi_parms_t *spi_parms);
 
 float    radio_get_byte_time(msp430_radio_parms_t *radio_parms);
 float    radio_get_rate(msp430_radio_parms_t *radio_parms);
+float    radio_get_chanbw(msp430_radio_parms_t *radio_parms);
+float    radio_get_chanspc(msp430_radio_parms_t *radio_parms);
 void     print_radio_parms(msp430_radio_parms_t *radio_parms);
 
 void     init_radio_parms(msp430_radio_parms_t *radio_parms, arguments_t *arguments);
+void     radio_set_channel_plan(msp430_radio_parms_t *radio_parms, arguments_t *arguments, uint32_t base_hz, uint32_t spacing_hz);
+void     init_modem_parms(msp430_modem_parms_t *modem_parms, 
+            arguments_t        *arguments, 
+            rate_t             rate, 
+            radio_modulation_t modulation, 
+            uint8_t            fec);
+float    radio_get_modem_byte_time(msp430_modem_parms_t *modem_parms);
+void     radio_set_data_serial(serial_t *serial_parms);
+int      radio_set_modem(serial_t *serial_parms, msp430_modem_parms_t *modem_parms);
+int      radio_load_profile(serial_t *serial_parms,
+            uint8_t              index,
+            msp430_radio_parms_t *radio_parms,
+            msp430_modem_parms_t *modem_parms,
+            uint8_t              set_power);
+int      radio_select_profile(serial_t *serial_parms, uint8_t index, msp430_reg_select_t *select);
 int      init_radio(serial_t *serial_parms, msp430_radio_parms_t *radio_parms, arguments_t *arguments);
+int      radio_set_tx_power(serial_t *serial_parms, uint8_t power_index);
+int      radio_set_tx_timing(serial_t *serial_parms, uint32_t keyup_delay_us, uint32_t block_delay_us);
+int      radio_afc(serial_t *serial_parms, msp430_afc_t *afc);
+int      radio_write_registers(serial_t *serial_parms, uint8_t *pairs, int nb_pairs);
 int      radio_cancel_rx(serial_t *serial_parms);
+int      radio_get_time(serial_t *serial_parms, uint32_t *mcu_us);
+int      radio_calibrate(serial_t *serial_parms, msp430_calibration_t *cal);
+int      radio_set_turnaround(serial_t *serial_parms, uint8_t enable, uint8_t rx_block_size);
+int      radio_set_hop(serial_t *serial_parms, msp430_hop_t *hop);
+int      radio_sweep(serial_t *serial_parms, msp430_sweep_t *sweep, float *rssi_dbm_values);
+int      radio_get_latency(serial_t *serial_parms, msp430_latency_t *latency, uint8_t reset);
+int      radio_get_fifo_stats(serial_t *serial_parms, msp430_fifo_stats_t *fifo_stats, uint8_t reset);
+int      radio_get_trace(serial_t *serial_parms, msp430_trace_t *trace, msp430_trace_event_t *events, uint8_t reset);
+int      radio_get_profile(serial_t *serial_parms, msp430_profile_t *profile, uint8_t reset);
+int      radio_set_filter(serial_t *serial_parms, msp430_filter_t *filter);
+void     radio_print_blind_time(int verb_level);
 void     print_radio_status(serial_t *serial_parms, arguments_t *arguments);
 
 int      radio_send_block(serial_t *serial_parms, 
@@ -67,14 +136,30 @@ int      radio_send_block(serial_t *serial_parms,
             int      *ackBlockSize, 
             uint32_t timeout_us);
 
+int      radio_send_hop_beacon(serial_t *serial_parms,
+            uint8_t  *packet,
+            uint8_t  dataBlockSize,
+            uint32_t size,
+            uint32_t block_timeout_us);
+
 uint32_t radio_send_packet(serial_t *serial_parms,
             uint8_t  *packet,
             uint8_t  dataBlockSize,
             uint32_t size,
-            uint32_t block_delay_us,
+            uint32_t block_timeout_us);
+
+void     radio_stream_start(radio_tx_stream_t *stream,
+            uint8_t  *packet,
+            uint8_t  dataBlockSize,
+            uint32_t size);
+
+int      radio_stream_send_block(serial_t *serial_parms,
+            radio_tx_stream_t *stream,
+            uint8_t  dataBlockSize,
             uint32_t block_timeout_us);
 
 int      radio_turn_on_rx(serial_t *serial_parms, uint8_t  dataBlockSize);
+int      radio_rx_streams_pending();
 
 int      radio_receive_block(serial_t *serial_parms, 
             uint8_t  *dataBlock,
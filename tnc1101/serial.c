@@ -11,9 +11,11 @@
 #include <errno.h>      // Error number definitions
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "main.h"
 #include "serial.h"
+#include "util.h"
 
 // ------------------------------------------------------------------------------------------------
 // Get serial speed
@@ -113,6 +115,9 @@ void set_serial_parameters(serial_t *serial_parameters, char *serial_device, spe
 // ------------------------------------------------------------------------------------------------
 {
     serial_parameters->SERIAL_TNC = open(serial_device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    serial_parameters->out_index = 0;
+    serial_parameters->out_count = 0;
+    serial_parameters->out_drops = 0;
 
     if (serial_parameters->SERIAL_TNC < 0)
     {
@@ -159,11 +164,94 @@ void set_serial_parameters(serial_t *serial_parameters, char *serial_device, spe
 }
 
 // ------------------------------------------------------------------------------------------------
-// Write to serial interface
+// Write to serial interface. The device is non-blocking so the remainder of a short write is
+// written again when the device gets ready with a limited number of retries.
+// Returns the number of bytes written or the write error if nothing could be written
 int write_serial(serial_t *serial_parameters, char *msg, int msglen)
 // ------------------------------------------------------------------------------------------------
 {
-    return write(serial_parameters->SERIAL_TNC, msg, msglen);
+    int nbytes, written = 0, retries = 0;
+
+    while (written < msglen)
+    {
+        nbytes = write(serial_parameters->SERIAL_TNC, &msg[written], msglen - written);
+
+        if (nbytes < 0)
+        {
+            if (((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (retries++ < SERIAL_WRITE_RETRIES))
+            {
+                usleep(100);
+                continue;
+            }
+
+            return (written ? written : nbytes);
+        }
+
+        written += nbytes;
+    }
+
+    return written;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write to serial interface without waiting. Bytes that cannot be written at once are kept in the
+// output queue and written by the next calls to flush_serial. Order of bytes is preserved.
+// Returns the number of bytes accepted: msglen or 0 if the output queue is full
+int write_serial_queued(serial_t *serial_parameters, uint8_t *msg, int msglen)
+// ------------------------------------------------------------------------------------------------
+{
+    if (serial_parameters->out_count + msglen > SERIAL_OUTQ_SIZE)
+    {
+        serial_parameters->out_drops += msglen;
+        verbprintft(2, "SERIAL: output queue full, dropping %d bytes\n", msglen);
+        return 0;
+    }
+
+    if (serial_parameters->out_index + serial_parameters->out_count + msglen > SERIAL_OUTQ_SIZE)
+    {
+        memmove(serial_parameters->out_queue, 
+            &serial_parameters->out_queue[serial_parameters->out_index], 
+            serial_parameters->out_count);
+        serial_parameters->out_index = 0;
+    }
+
+    memcpy(&serial_parameters->out_queue[serial_parameters->out_index + serial_parameters->out_count], msg, msglen);
+    serial_parameters->out_count += msglen;
+
+    flush_serial(serial_parameters);
+
+    return msglen;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write as much of the output queue as the device accepts
+// Returns the number of bytes still waiting
+int flush_serial(serial_t *serial_parameters)
+// ------------------------------------------------------------------------------------------------
+{
+    int nbytes;
+
+    while (serial_parameters->out_count)
+    {
+        nbytes = write(serial_parameters->SERIAL_TNC, 
+            &serial_parameters->out_queue[serial_parameters->out_index], 
+            serial_parameters->out_count);
+
+        if (nbytes <= 0) // device not ready (or error): try again later
+        {
+            break;
+        }
+
+        serial_parameters->out_index += nbytes;
+        serial_parameters->out_count -= nbytes;
+    }
+
+    if (serial_parameters->out_count == 0)
+    {
+        serial_parameters->out_index = 0;
+    }
+
+    return serial_parameters->out_count;
 }
 
 // ------------------------------------------------------------------------------------------------
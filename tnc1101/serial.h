@@ -13,17 +13,26 @@
 #include <inttypes.h>
 #include <termios.h> 
 
+#define SERIAL_OUTQ_SIZE      (1<<16) // Size of the queue of bytes waiting to be written
+#define SERIAL_WRITE_RETRIES  100     // Number of 100us retries when the device is not ready
+
 typedef struct serial_s
 {
     int SERIAL_TNC;
     struct termios tty;
     struct termios tty_old;
+    uint8_t  out_queue[SERIAL_OUTQ_SIZE]; // Bytes waiting for the device to be ready
+    uint32_t out_index;                   // Index of the first byte waiting
+    uint32_t out_count;                   // Number of bytes waiting
+    uint32_t out_drops;                   // Number of bytes dropped because the queue was full
 } serial_t;
 
 speed_t get_serial_speed(uint32_t speed, uint32_t *speed_n);
 void set_serial_parameters(serial_t *serial_parameters, char *serial_device, speed_t serial_speed);
 int write_serial(serial_t *serial_parameters, char *msg, int msglen);
 int read_serial(serial_t *serial_parameters, char *buf, int buflen);
+int write_serial_queued(serial_t *serial_parameters, uint8_t *msg, int msglen);
+int flush_serial(serial_t *serial_parameters);
 void close_serial(serial_t *serial_parameters);
 
 #endif
\ No newline at end of file
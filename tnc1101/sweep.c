@@ -0,0 +1,265 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Spectrum sweep: channel occupancy statistics and quietest channel          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sweep.h"
+#include "radio.h"
+#include "util.h"
+
+// === Static functions declarations ==============================================================
+
+static int      sweep_level_index(float rssi_dbm);
+static float    sweep_level_dbm(int level_index);
+static float    sweep_percentile_dbm(sweep_channel_t *channel, float fraction);
+static float    sweep_occupancy(sweep_channel_t *channel, float threshold_dbm);
+static float    sweep_mean_dbm(sweep_channel_t *channel);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Histogram index of a reading
+int sweep_level_index(float rssi_dbm)
+// ------------------------------------------------------------------------------------------------
+{
+    int level_index = (int) lroundf(2.0 * rssi_dbm) + 276; // RSSI status register value + 128
+
+    return (level_index < 0 ? 0 : (level_index > SWEEP_NB_LEVELS - 1 ? SWEEP_NB_LEVELS - 1 : level_index));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reading of a histogram index
+float sweep_level_dbm(int level_index)
+// ------------------------------------------------------------------------------------------------
+{
+    return (level_index - 276) / 2.0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Level under which the given fraction of the readings on a channel are
+float sweep_percentile_dbm(sweep_channel_t *channel, float fraction)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t count = 0;
+    int      i;
+
+    for (i=0; i < SWEEP_NB_LEVELS; i++)
+    {
+        count += channel->levels[i];
+
+        if (count >= fraction * channel->nb_readings)
+        {
+            break;
+        }
+    }
+
+    return sweep_level_dbm(i < SWEEP_NB_LEVELS ? i : SWEEP_NB_LEVELS - 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Fraction of the readings on a channel above the threshold
+float sweep_occupancy(sweep_channel_t *channel, float threshold_dbm)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t count = 0;
+    int      i;
+
+    if (!channel->nb_readings)
+    {
+        return 0.0;
+    }
+
+    for (i = sweep_level_index(threshold_dbm) + 1; i < SWEEP_NB_LEVELS; i++)
+    {
+        count += channel->levels[i];
+    }
+
+    return ((float) count) / channel->nb_readings;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Mean power of the readings on a channel in dBm
+float sweep_mean_dbm(sweep_channel_t *channel)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!channel->nb_readings)
+    {
+        return -138.0;
+    }
+
+    return 10.0 * log10(channel->power_mw / channel->nb_readings);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Sweep the RSSI over the frequency range many times, print the occupancy of each frequency and
+// recommend the quietest channel as wide as the channel filter bandwidth of the configured rate
+int sweep_run(serial_t *serial_parms,
+            msp430_radio_parms_t *radio_parms,
+            arguments_t          *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_radio_parms_t sweep_parms = *radio_parms;
+    msp430_sweep_t       sweep;
+    sweep_channel_t      *channels;
+    float                readings[MSP430_SWEEP_MAX_STEPS];
+    float                spacing_hz, chanbw_hz, floor_dbm, threshold_dbm;
+    float                best_occupancy = 2.0, best_dbm = 0.0;
+    uint32_t             nb_sweeps = SWEEP_REPEAT * arguments->repetition;
+    uint32_t             sweep_i, best_hz;
+    uint64_t             start_us, sweep_us, total_us = 0, max_us = 0;
+    int                  nb_steps, window, best_i = -1, i, j;
+
+    if (arguments->sweep_stop <= arguments->sweep_start)
+    {
+        fprintf(stderr, "Sweep stop frequency must be above the start frequency. Aborting...\n");
+        return 1;
+    }
+
+    radio_set_channel_plan(&sweep_parms, arguments, arguments->sweep_start, arguments->sweep_step);
+    spacing_hz = radio_get_chanspc(&sweep_parms);
+    chanbw_hz = radio_get_chanbw(&sweep_parms);
+    nb_steps = (int) ((arguments->sweep_stop - arguments->sweep_start) / spacing_hz) + 1;
+
+    if (nb_steps > MSP430_SWEEP_MAX_STEPS)
+    {
+        fprintf(stderr, "Sweep limited to %d steps\n", MSP430_SWEEP_MAX_STEPS);
+        nb_steps = MSP430_SWEEP_MAX_STEPS;
+    }
+
+    sweep.first_channel = 0;
+    sweep.nb_steps = nb_steps;
+    sweep.flags = MSP430_SWEEP_CALIBRATE;
+    sweep.settle_us = SWEEP_SETTLE_US + (uint16_t) (SWEEP_AGC_SAMPLES * 1e6 / chanbw_hz);
+    sweep.dwell_us = arguments->sweep_dwell;
+
+    if (sweep.settle_us > MSP430_SWEEP_MAX_US)
+    {
+        sweep.settle_us = MSP430_SWEEP_MAX_US;
+    }
+
+    if (sweep.settle_us + sweep.dwell_us > MSP430_SWEEP_MAX_US)
+    {
+        sweep.dwell_us = MSP430_SWEEP_MAX_US - sweep.settle_us;
+    }
+
+    if (!init_radio(serial_parms, &sweep_parms, arguments))
+    {
+        fprintf(stderr, "Cannot initialize radio. Aborting...\n");
+        return 1;
+    }
+
+    channels = calloc(nb_steps, sizeof(sweep_channel_t));
+
+    for (i=0; i < nb_steps; i++)
+    {
+        channels[i].peak_dbm = -138.0;
+    }
+
+    verbprintf(0, "Sweeping %d frequencies %.1f kHz apart from %.3f MHz %d times (settle %d us, dwell %d us)\n",
+        nb_steps, spacing_hz / 1000.0, arguments->sweep_start / 1e6, nb_sweeps, sweep.settle_us, sweep.dwell_us);
+
+    for (sweep_i=0; sweep_i < nb_sweeps; sweep_i++)
+    {
+        start_us = monotonic_us();
+
+        if (radio_sweep(serial_parms, &sweep, readings) != nb_steps)
+        {
+            fprintf(stderr, "Sweep %d failed. Aborting...\n", sweep_i);
+            free(channels);
+            return 1;
+        }
+
+        sweep_us = monotonic_us() - start_us;
+        sweep.flags = 0; // calibrations are kept by the MSP430 for the next sweeps
+
+        if (sweep_i > 0) // first sweep includes the calibration of all frequencies
+        {
+            total_us += sweep_us;
+            max_us = (sweep_us > max_us ? sweep_us : max_us);
+        }
+
+        for (i=0; i < nb_steps; i++)
+        {
+            channels[i].levels[sweep_level_index(readings[i])]++;
+            channels[i].power_mw += pow(10.0, readings[i] / 10.0);
+            channels[i].nb_readings++;
+
+            if (readings[i] > channels[i].peak_dbm)
+            {
+                channels[i].peak_dbm = readings[i];
+            }
+        }
+
+        verbprintf(2, "Sweep %d done in %.1f ms\n", sweep_i, sweep_us / 1000.0);
+    }
+
+    if (nb_sweeps > 1)
+    {
+        verbprintf(0, "Sweep time: %.1f ms average, %.1f ms max\n",
+            total_us / 1000.0 / (nb_sweeps - 1), max_us / 1000.0);
+    }
+
+    // The noise floor is taken as the quietest frequency median
+    floor_dbm = 0.0;
+
+    for (i=0; i < nb_steps; i++)
+    {
+        float median_dbm = sweep_percentile_dbm(&channels[i], 0.5);
+        floor_dbm = (i == 0 || median_dbm < floor_dbm ? median_dbm : floor_dbm);
+    }
+
+    threshold_dbm = floor_dbm + SWEEP_OCCUPIED_DB;
+    verbprintf(0, "Noise floor %.1f dBm, occupied above %.1f dBm\n", floor_dbm, threshold_dbm);
+    verbprintf(0, "Frequency (MHz)  Mean (dBm)  Median (dBm)  Peak (dBm)  Occupancy (%%)\n");
+
+    for (i=0; i < nb_steps; i++)
+    {
+        verbprintf(0, "%15.4f  %10.1f  %12.1f  %10.1f  %13.1f\n",
+            (arguments->sweep_start + i * spacing_hz) / 1e6,
+            sweep_mean_dbm(&channels[i]),
+            sweep_percentile_dbm(&channels[i], 0.5),
+            channels[i].peak_dbm,
+            100.0 * sweep_occupancy(&channels[i], threshold_dbm));
+    }
+
+    // A channel spans the frequencies within the channel filter bandwidth. The busiest of them
+    // counts for the channel then the loudest.
+    window = (int) ceil(chanbw_hz / spacing_hz);
+    window = (window < 1 ? 1 : (window > nb_steps ? nb_steps : window));
+
+    for (i=0; i + window <= nb_steps; i++)
+    {
+        float occupancy = 0.0, mean_dbm = -138.0;
+
+        for (j=i; j < i + window; j++)
+        {
+            occupancy = fmaxf(occupancy, sweep_occupancy(&channels[j], threshold_dbm));
+            mean_dbm = fmaxf(mean_dbm, sweep_mean_dbm(&channels[j]));
+        }
+
+        if ((occupancy < best_occupancy) || ((occupancy == best_occupancy) && (mean_dbm < best_dbm)))
+        {
+            best_occupancy = occupancy;
+            best_dbm = mean_dbm;
+            best_i = i;
+        }
+    }
+
+    best_hz = arguments->sweep_start + (uint32_t) ((best_i + (window - 1) / 2.0) * spacing_hz);
+    verbprintf(0, "Quietest %.1f kHz wide channel: %.4f MHz (-f %u) occupancy %.1f%% mean %.1f dBm\n",
+        chanbw_hz / 1000.0, best_hz / 1e6, best_hz, 100.0 * best_occupancy, best_dbm);
+
+    free(channels);
+    return 0;
+}
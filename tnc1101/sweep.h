@@ -0,0 +1,38 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Spectrum sweep: channel occupancy statistics and quietest channel          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "serial.h"
+#include "msp430_interface.h"
+
+#define SWEEP_REPEAT         100    // Sweeps per repetition factor (-n)
+#define SWEEP_SETTLE_US      100    // Synthesizer settling from IDLE to Rx with the calibration restored
+#define SWEEP_AGC_SAMPLES    32     // RSSI is valid after about this many samples at the channel filter bandwidth
+#define SWEEP_OCCUPIED_DB    10.0   // A reading this far above the noise floor counts as occupied
+#define SWEEP_NB_LEVELS      256    // RSSI levels in 0.5 dB steps
+
+// Readings on one frequency over all sweeps
+typedef struct sweep_channel_s
+{
+    uint32_t levels[SWEEP_NB_LEVELS]; // Histogram of the readings indexed by the RSSI status register value + 128
+    double   power_mw;                // Sum of the readings in milliwatts
+    float    peak_dbm;                // Highest reading
+    uint32_t nb_readings;             // Number of readings
+} sweep_channel_t;
+
+int      sweep_run(serial_t *serial_parms,
+            msp430_radio_parms_t *radio_parms,
+            arguments_t          *arguments);
+
+#endif // _SWEEP_H_
@@ -35,10 +35,6 @@ int radio_transmit_test(serial_t *serial_parms,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     memset(dataBlock, 0, 255);
 
@@ -83,7 +79,7 @@ int radio_packet_transmit_test(serial_t *serial_parms,
     arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    uint32_t packets_sent, block_time, block_delay, bytes_left;
+    uint32_t packets_sent, block_time, bytes_left;
     uint8_t  dataBlock[1<<16];
 
     if (!init_radio(serial_parms, radio_parms, arguments))
@@ -91,16 +87,11 @@ int radio_packet_transmit_test(serial_t *serial_parms,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     memset(dataBlock, 0, 1<<16);
     strncpy(dataBlock, arguments->test_phrase, arguments->large_packet_length);
 
     block_time  = ((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2);
-    block_delay = arguments->block_delay;
 
     packets_sent = 0;
 
@@ -116,7 +107,6 @@ int radio_packet_transmit_test(serial_t *serial_parms,
             dataBlock,
             arguments->packet_length,
             arguments->large_packet_length,
-            block_delay,
             block_time);
 
         if (bytes_left)
@@ -149,10 +139,6 @@ int radio_receive_test(serial_t *serial_parms,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     memset(dataBlock, 0, 255);
     
@@ -219,10 +205,6 @@ int radio_packet_receive_test(serial_t *serial_parms,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     block_time = (((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2)) + arguments->block_delay;
 
@@ -271,10 +253,6 @@ int radio_packet_receive_nb_test(serial_t *serial_parms,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     block_time = (((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2)) + arguments->block_delay;
 
@@ -353,10 +331,6 @@ int radio_echo_test(serial_t *serial_parms,
         fprintf(stderr, "Cannot initialize radio. Aborting...\n");
         return 1;
     }
-    else
-    {
-        usleep(100000);
-    }
 
     memset(dataBlock, 0, 255);    
     block_time  = ((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2);    
@@ -386,13 +360,8 @@ int radio_echo_test(serial_t *serial_parms,
     {
         rtx_count = 0;
 
-        do // Rx-Tx transaction in whichever order
+        do // Rx-Tx transaction in whichever order. The MSP430 applies the keyup delay before Tx.
         {
-            if (arguments->tnc_keyup_delay)
-            {
-                usleep(arguments->tnc_keyup_delay);
-            }
-
             if (rtx_toggle) // Tx
             {
                 verbprintf(0, "Sending #%d\n", packets_sent);
@@ -0,0 +1,139 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* MSP430 event trace: drain of the trace ring and packet timelines           */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "radio.h"
+#include "util.h"
+
+static char *trace_drop_names[] = {
+    "address",
+    "payload",
+    "overflow"
+};
+
+// === Static functions declarations ==============================================================
+
+static void     trace_describe(msp430_trace_event_t *event, char *description, int size);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Readable description of an event
+void trace_describe(msp430_trace_event_t *event, char *description, int size)
+// ------------------------------------------------------------------------------------------------
+{
+    switch (event->event)
+    {
+        case MSP430_TRACE_COMMAND:
+            snprintf(description, size, "command %d received", event->arg);
+            break;
+        case MSP430_TRACE_TX_START:
+            snprintf(description, size, "Tx start (%d bytes)", event->arg);
+            break;
+        case MSP430_TRACE_RX_START:
+            snprintf(description, size, "Rx armed (%d bytes)", event->arg);
+            break;
+        case MSP430_TRACE_SYNC:
+            snprintf(description, size, "sync word");
+            break;
+        case MSP430_TRACE_FIFO_THR:
+            snprintf(description, size, "FIFO threshold");
+            break;
+        case MSP430_TRACE_TX_END:
+            snprintf(description, size, "Tx end (%s)", (event->arg ? "underflow" : "ok"));
+            break;
+        case MSP430_TRACE_RX_END:
+            snprintf(description, size, "Rx end (CRC %s, LQI %d)", (event->arg & 0x80 ? "ok" : "error"), event->arg & 0x7F);
+            break;
+        case MSP430_TRACE_RX_DROP:
+            snprintf(description, size, "Rx dropped (%s)",
+                (event->arg <= MSP430_TRACE_DROP_OVERFLOW ? trace_drop_names[event->arg] : "unknown"));
+            break;
+        case MSP430_TRACE_USB_SENT:
+            snprintf(description, size, "block %d sent to host", event->arg);
+            break;
+        default:
+            snprintf(description, size, "unknown event %d (%d)", event->event, event->arg);
+            break;
+    }
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Drain the MSP430 trace ring then print the counters and the events as timelines. A timeline
+// starts at each Tx start or Rx arming and the events are timed from there.
+int trace_run(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    msp430_trace_t       counters, next;
+    msp430_trace_event_t *events;
+    uint32_t             origin_us = 0;
+    char                 description[64];
+    int                  nb_events = 0, nb_read, i;
+
+    events = malloc(TRACE_MAX_DRAINED * sizeof(msp430_trace_event_t));
+    nb_read = radio_get_trace(serial_parms, &counters, events, 1); // counters since the last run
+
+    if (nb_read < 0)
+    {
+        fprintf(stderr, "Cannot read the MSP430 trace. Aborting...\n");
+        free(events);
+        return 1;
+    }
+
+    nb_events = nb_read;
+    next = counters;
+
+    while (next.nb_left && (nb_events + MSP430_TRACE_MAX_EVENTS <= TRACE_MAX_DRAINED))
+    {
+        nb_read = radio_get_trace(serial_parms, &next, &events[nb_events], 0);
+
+        if (nb_read <= 0)
+        {
+            break;
+        }
+
+        nb_events += nb_read;
+    }
+
+    verbprintf(0, "Packets sent .........: %d\n", counters.nb_tx);
+    verbprintf(0, "Packets received .....: %d\n", counters.nb_rx);
+    verbprintf(0, "CRC errors ...........: %d\n", counters.nb_crc_errors);
+    verbprintf(0, "Rx FIFO overflows ....: %d\n", counters.nb_rx_overflows);
+    verbprintf(0, "Tx FIFO underflows ...: %d\n", counters.nb_tx_underflows);
+    verbprintf(0, "Trace events lost ....: %d\n", counters.nb_lost);
+
+    for (i=0; i < nb_events; i++)
+    {
+        trace_describe(&events[i], description, sizeof(description));
+
+        if ((i == 0) || (events[i].event == MSP430_TRACE_TX_START) || (events[i].event == MSP430_TRACE_RX_START))
+        {
+            origin_us = events[i].time_us;
+            verbprintf(0, "\n%12.6f s   %s\n", origin_us / 1e6, description);
+        }
+        else
+        {
+            verbprintf(0, "%+12d us  %s\n", (int32_t) (events[i].time_us - origin_us), description);
+        }
+    }
+
+    if (next.nb_left)
+    {
+        verbprintf(0, "\n%d events left in the ring\n", next.nb_left);
+    }
+
+    free(events);
+    return 0;
+}
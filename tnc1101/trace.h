@@ -0,0 +1,23 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* MSP430 event trace: drain of the trace ring and packet timelines           */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "serial.h"
+#include "msp430_interface.h"
+
+#define TRACE_MAX_DRAINED    1024   // Events drained at most in one run
+
+int      trace_run(serial_t *serial_parms, arguments_t *arguments);
+
+#endif // _TRACE_H_
@@ -0,0 +1,743 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Modem register tuning against a peer and named register profiles          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "tuner.h"
+#include "radio.h"
+#include "util.h"
+
+typedef struct tuner_register_s
+{
+    char    *name;          // Register name in the CC1101 documentation
+    uint8_t address;        // Configuration register address
+    uint8_t default_value;  // Value written by the firmware at initialization
+} tuner_register_t;
+
+typedef struct tuner_field_s
+{
+    char    *name;          // Field name in the CC1101 documentation
+    uint8_t reg;            // Index of the register in the registers table
+    uint8_t shift;          // Position of the least significant bit
+    uint8_t width;          // Number of bits
+    float   sim_step_db;    // Simulated sensitivity loss per step away from the best value
+} tuner_field_t;
+
+typedef int (*tuner_measure_t)(void *context, uint8_t *values, uint8_t power_index, tuner_result_t *result);
+
+typedef struct tuner_radio_s
+{
+    serial_t             *serial_parms;
+    msp430_radio_parms_t *radio_parms;
+    arguments_t          *arguments;
+    uint8_t              seq;           // Sequence number of the last request
+    uint32_t             block_time;    // Air time of one block in microseconds
+} tuner_radio_t;
+
+typedef struct tuner_sim_s
+{
+    uint8_t  best[TUNER_NB_REGS];       // Hidden best register set of the simulated receiver
+    float    margin_db;                 // Link margin with the best register set at the initial power
+    uint8_t  power_index;               // Initial power index
+    uint32_t nb_blocks;                 // Blocks per measurement
+    uint32_t block_bits;                // Bits per block
+    uint32_t nb_measures;               // Number of measurements taken
+} tuner_sim_t;
+
+static tuner_register_t tuner_registers[TUNER_NB_REGS] = {
+    {"FOCCFG",   0x19, 0x1F},
+    {"BSCFG",    0x1A, 0x1C},
+    {"AGCCTRL2", 0x1B, 0xC7},
+    {"AGCCTRL1", 0x1C, 0x00},
+    {"AGCCTRL0", 0x1D, 0xB2},
+    {"FREND1",   0x21, 0xB6}
+};
+
+// Carrier sense thresholds and test registers are left out: they do not act on demodulation
+static tuner_field_t tuner_fields[] = {
+    {"FOC_BS_CS_GATE",        0, 5, 1, 1.0},
+    {"FOC_PRE_K",             0, 3, 2, 1.5},
+    {"FOC_POST_K",            0, 2, 1, 0.5},
+    {"FOC_LIMIT",             0, 0, 2, 1.0},
+    {"BS_PRE_KI",             1, 6, 2, 1.0},
+    {"BS_PRE_KP",             1, 4, 2, 1.0},
+    {"BS_POST_KI",            1, 3, 1, 0.5},
+    {"BS_POST_KP",            1, 2, 1, 0.5},
+    {"BS_LIMIT",              1, 0, 2, 0.8},
+    {"MAX_DVGA_GAIN",         2, 6, 2, 0.7},
+    {"MAX_LNA_GAIN",          2, 3, 3, 0.4},
+    {"MAGN_TARGET",           2, 0, 3, 0.6},
+    {"AGC_LNA_PRIORITY",      3, 6, 1, 0.3},
+    {"HYST_LEVEL",            4, 6, 2, 0.3},
+    {"WAIT_TIME",             4, 4, 2, 0.5},
+    {"AGC_FREEZE",            4, 2, 2, 0.8},
+    {"FILTER_LENGTH",         4, 0, 2, 0.6},
+    {"LNA_CURRENT",           5, 6, 2, 0.4},
+    {"LNA2MIX_CURRENT",       5, 4, 2, 0.2},
+    {"LODIV_BUF_CURRENT_RX",  5, 2, 2, 0.2},
+    {"MIX_CURRENT",           5, 0, 2, 0.2}
+};
+
+#define TUNER_NB_FIELDS (sizeof(tuner_fields) / sizeof(tuner_field_t))
+
+// === Static functions declarations ==============================================================
+
+static uint8_t  tuner_get_field(uint8_t *values, tuner_field_t *field);
+static void     tuner_set_field(uint8_t *values, tuner_field_t *field, uint8_t field_value);
+static float    tuner_cost(tuner_result_t *result);
+static void     tuner_print_registers(int verb_level, char *name, uint8_t *values);
+static int      tuner_read_profiles(char *filename, char names[][TUNER_NAME_SIZE], uint8_t values[][TUNER_NB_REGS]);
+static void     tuner_profile_name(char *name, arguments_t *arguments);
+static void     tuner_pattern(uint8_t seq, uint8_t index, uint8_t *pattern, int size);
+static uint32_t tuner_bit_errors(uint8_t *data, uint8_t *pattern, int size);
+static int      tuner_measure_radio(void *context, uint8_t *values, uint8_t power_index, tuner_result_t *result);
+static int      tuner_measure_sim(void *context, uint8_t *values, uint8_t power_index, tuner_result_t *result);
+static float    tuner_sim_loss_db(tuner_sim_t *sim, uint8_t *values);
+static float    tuner_sim_block_error_rate(float margin_db);
+static int      tuner_search(uint8_t *values, uint32_t nb_blocks, uint8_t power_index, tuner_measure_t measure, void *context, tuner_result_t *best);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Value of a field in a register set
+uint8_t tuner_get_field(uint8_t *values, tuner_field_t *field)
+// ------------------------------------------------------------------------------------------------
+{
+    return (values[field->reg] >> field->shift) & ((1<<field->width) - 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Change the value of a field in a register set
+void tuner_set_field(uint8_t *values, tuner_field_t *field, uint8_t field_value)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t mask = ((1<<field->width) - 1) << field->shift;
+
+    values[field->reg] = (values[field->reg] & ~mask) | ((field_value << field->shift) & mask);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Cost to minimize. PER comes first. BER separates register sets with the same PER.
+float tuner_cost(tuner_result_t *result)
+// ------------------------------------------------------------------------------------------------
+{
+    return result->per + result->ber;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print a register set
+void tuner_print_registers(int verb_level, char *name, uint8_t *values)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    verbprintf(verb_level, "%s:", name);
+
+    for (i=0; i < TUNER_NB_REGS; i++)
+    {
+        verbprintf(verb_level, " %s=0x%02X", tuner_registers[i].name, values[i]);
+    }
+
+    verbprintf(verb_level, "\n");
+}
+
+// ------------------------------------------------------------------------------------------------
+// Read the profiles file. Each line has a name followed by the registers values in hexadecimal in
+// the order of the registers table. Returns the number of profiles read
+int tuner_read_profiles(char *filename, char names[][TUNER_NAME_SIZE], uint8_t values[][TUNER_NB_REGS])
+// ------------------------------------------------------------------------------------------------
+{
+    FILE         *profiles_file = fopen(filename, "r");
+    unsigned int v[TUNER_NB_REGS];
+    int          i, nb_profiles = 0;
+
+    if (!profiles_file)
+    {
+        return 0;
+    }
+
+    while ((nb_profiles < TUNER_MAX_PROFILES) && (fscanf(profiles_file, "%31s %x %x %x %x %x %x",
+        names[nb_profiles], &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 1 + TUNER_NB_REGS))
+    {
+        for (i=0; i < TUNER_NB_REGS; i++)
+        {
+            values[nb_profiles][i] = (uint8_t) v[i];
+        }
+
+        nb_profiles++;
+    }
+
+    fclose(profiles_file);
+    return nb_profiles;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Profile name given in the options or made of the rate and modulation otherwise
+void tuner_profile_name(char *name, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    if (arguments->tune_profile)
+    {
+        snprintf(name, TUNER_NAME_SIZE, "%s", arguments->tune_profile);
+    }
+    else
+    {
+        snprintf(name, TUNER_NAME_SIZE, "%d-%s", rate_values[arguments->rate], modulation_names[arguments->modulation]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Pseudo random test pattern of a block. Both sides compute it from the sequence and block index.
+void tuner_pattern(uint8_t seq, uint8_t index, uint8_t *pattern, int size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t x = 0x9E3779B9 ^ (seq << 8) ^ index;
+    int      i;
+
+    for (i=0; i < size; i++)
+    {
+        x ^= x << 13; // xorshift32
+        x ^= x >> 17;
+        x ^= x << 5;
+        pattern[i] = x & 0xFF;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Number of bits that differ between the received data and the expected pattern
+uint32_t tuner_bit_errors(uint8_t *data, uint8_t *pattern, int size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t errors = 0;
+    uint8_t  diff;
+    int      i;
+
+    for (i=0; i < size; i++)
+    {
+        for (diff = data[i] ^ pattern[i]; diff; diff &= diff - 1)
+        {
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Measure PER and BER with a register set against the peer. The registers are written to the
+// radio then a test burst is requested from the responder at the given power and received with them.
+// Returns 0 if successful else -1
+int tuner_measure_radio(void *context, uint8_t *values, uint8_t power_index, tuner_result_t *result)
+// ------------------------------------------------------------------------------------------------
+{
+    tuner_radio_t *tuner = (tuner_radio_t *) context;
+    arguments_t   *arguments = tuner->arguments;
+    uint8_t  pairs[2*TUNER_NB_REGS], request[255], block[255], pattern[255], ack_block[32];
+    uint8_t  rssi, crc_lqi, lqi, countdown, nb_blocks = arguments->tune_blocks;
+    uint32_t size, received, headers, bit_errors, bits, timeout;
+    uint64_t deadline;
+    int      i, nbytes, ack_bytes, retry, pattern_size = arguments->packet_length - 2 - TUNER_HEADER_SIZE;
+
+    for (i=0; i < TUNER_NB_REGS; i++)
+    {
+        pairs[2*i]   = tuner_registers[i].address;
+        pairs[2*i+1] = values[i];
+    }
+
+    if (radio_write_registers(tuner->serial_parms, pairs, TUNER_NB_REGS) < 0)
+    {
+        verbprintft(1, ANSI_COLOR_RED "Tuner: cannot write registers" ANSI_COLOR_RESET "\n");
+        return -1;
+    }
+
+    timeout = 2 * (tuner->block_time + arguments->block_delay) + arguments->tnc_switchover_delay + TUNER_TURNAROUND_US;
+
+    for (retry=0; retry < TUNER_MAX_RETRIES; retry++)
+    {
+        tuner->seq++;
+        memset(request, 0, sizeof(request));
+        request[0] = TUNER_REQUEST_MAGIC;
+        request[1] = tuner->seq;
+        request[2] = nb_blocks;
+        request[3] = power_index;
+        ack_bytes = sizeof(ack_block);
+
+        radio_send_block(tuner->serial_parms, request, TUNER_REQUEST_SIZE + 1, 0, arguments->packet_length,
+            ack_block, &ack_bytes, tuner->block_time);
+
+        received = 0;
+        headers = 0;
+        bit_errors = 0;
+        bits = 0;
+        deadline = now_us() + timeout + nb_blocks * (tuner->block_time + arguments->block_delay);
+
+        while (now_us() < deadline)
+        {
+            size = 0;
+            nbytes = radio_receive_block(tuner->serial_parms, block, arguments->packet_length,
+                &countdown, &size, &rssi, &crc_lqi, timeout);
+
+            if (nbytes <= 4)
+            {
+                radio_cancel_rx(tuner->serial_parms);
+                continue;
+            }
+
+            if ((block[0] != TUNER_BLOCK_MAGIC) || (block[1] != tuner->seq) || (block[2] >= nb_blocks))
+            {
+                continue; // other traffic, stale burst or corrupted header
+            }
+
+            headers++;
+            tuner_pattern(tuner->seq, block[2], pattern, pattern_size);
+            bit_errors += tuner_bit_errors(&block[TUNER_HEADER_SIZE], pattern, pattern_size);
+            bits += 8 * pattern_size;
+            received += get_crc_lqi(crc_lqi, &lqi);
+
+            if (block[2] == nb_blocks - 1) // last block of the burst
+            {
+                break;
+            }
+        }
+
+        if (headers) // the responder got the request
+        {
+            result->per = 1.0 - ((float) received) / nb_blocks;
+            result->ber = ((float) bit_errors) / bits;
+            return 0;
+        }
+
+        verbprintft(2, "Tuner: no answer to request #%d\n", tuner->seq);
+    }
+
+    verbprintft(1, ANSI_COLOR_RED "Tuner: no answer from the responder" ANSI_COLOR_RESET "\n");
+    return -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Sensitivity loss of the simulated receiver with a register set. Each field loses a fixed amount
+// of dB per step away from its hidden best value.
+float tuner_sim_loss_db(tuner_sim_t *sim, uint8_t *values)
+// ------------------------------------------------------------------------------------------------
+{
+    float loss_db = 0.0;
+    int   f;
+
+    for (f=0; f < TUNER_NB_FIELDS; f++)
+    {
+        loss_db += tuner_fields[f].sim_step_db
+            * abs(tuner_get_field(values, &tuner_fields[f]) - tuner_get_field(sim->best, &tuner_fields[f]));
+    }
+
+    return loss_db;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Block error rate of the simulated receiver: 1% at 0 dB margin and a decade every 2 dB
+float tuner_sim_block_error_rate(float margin_db)
+// ------------------------------------------------------------------------------------------------
+{
+    float per = 0.01 * pow(10.0, -margin_db / 2.0);
+
+    return (per > 1.0 ? 1.0 : per);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Measure PER and BER with a register set on the simulated channel. Returns 0
+int tuner_measure_sim(void *context, uint8_t *values, uint8_t power_index, tuner_result_t *result)
+// ------------------------------------------------------------------------------------------------
+{
+    tuner_sim_t *sim = (tuner_sim_t *) context;
+    float    margin_db = sim->margin_db + power_values[power_index] - power_values[sim->power_index];
+    float    per = tuner_sim_block_error_rate(margin_db - tuner_sim_loss_db(sim, values));
+    float    bit_error_rate = 1.0 - pow(1.0 - per, 1.0 / sim->block_bits);
+    uint32_t i, failures = 0, bit_errors = 0;
+
+    for (i=0; i < sim->nb_blocks; i++)
+    {
+        if (rand() < RAND_MAX * per)
+        {
+            failures++;
+            bit_errors += 1 + (uint32_t) (2.0 * bit_error_rate * sim->block_bits * rand() / RAND_MAX);
+        }
+    }
+
+    sim->nb_measures++;
+    result->per = ((float) failures) / sim->nb_blocks;
+    result->ber = ((float) bit_errors) / (sim->nb_blocks * sim->block_bits);
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Coordinate descent over the register fields. Each field in turn takes all its values with the
+// others kept and the best one is retained. Passes are repeated until no field changes. The
+// retained set is measured again at each pass so that a lucky measurement does not stick. When its
+// PER gets too low to tell candidates apart the responder power is lowered one step unless this
+// step is too large.
+// A candidate must beat the retained set by at least one block. Returns 0 if successful else -1
+int tuner_search(uint8_t *values, uint32_t nb_blocks, uint8_t power_index, tuner_measure_t measure, void *context, tuner_result_t *best)
+// ------------------------------------------------------------------------------------------------
+{
+    tuner_result_t result;
+    uint8_t        candidate[TUNER_NB_REGS], current, lower_power = 1;
+    int            pass, f, v, improved = 1;
+
+    for (pass=0; improved && (pass < TUNER_MAX_PASSES); pass++)
+    {
+        improved = 0;
+
+        if (measure(context, values, power_index, best) < 0)
+        {
+            return -1;
+        }
+
+        while (lower_power && (best->per < TUNER_PER_LOW) && (power_index > 0))
+        {
+            if (measure(context, values, power_index - 1, &result) < 0)
+            {
+                return -1;
+            }
+
+            if (result.per > TUNER_PER_HIGH) // power step too large: stay at this power
+            {
+                lower_power = 0;
+            }
+            else
+            {
+                power_index--;
+                *best = result;
+            }
+        }
+
+        verbprintf(1, "Tuner: pass %d starts with PER %.4f BER %.2e at %d dBm\n",
+            pass + 1, best->per, best->ber, power_values[power_index]);
+
+        for (f=0; f < TUNER_NB_FIELDS; f++)
+        {
+            current = tuner_get_field(values, &tuner_fields[f]);
+
+            for (v=0; v < (1<<tuner_fields[f].width); v++)
+            {
+                if (v == current)
+                {
+                    continue;
+                }
+
+                memcpy(candidate, values, TUNER_NB_REGS);
+                tuner_set_field(candidate, &tuner_fields[f], v);
+
+                if (measure(context, candidate, power_index, &result) < 0)
+                {
+                    return -1;
+                }
+
+                verbprintf(2, "Tuner: %s=%d: PER %.4f BER %.2e\n", tuner_fields[f].name, v, result.per, result.ber);
+
+                if (tuner_cost(&result) < tuner_cost(best) - 1.0 / nb_blocks)
+                {
+                    verbprintf(1, "Tuner: %s %d -> %d: PER %.4f BER %.2e\n",
+                        tuner_fields[f].name, tuner_get_field(values, &tuner_fields[f]), v, result.per, result.ber);
+                    memcpy(values, candidate, TUNER_NB_REGS);
+                    *best = result;
+                    improved = 1;
+                }
+            }
+        }
+    }
+
+    tuner_print_registers(1, "Tuner: best", values);
+    return 0;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Register set written by the firmware at initialization
+void tuner_default_registers(uint8_t *values)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i < TUNER_NB_REGS; i++)
+    {
+        values[i] = tuner_registers[i].default_value;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the register set of a named profile. Returns 1 if found else 0
+int tuner_load_profile(char *filename, char *name, uint8_t *values)
+// ------------------------------------------------------------------------------------------------
+{
+    char    names[TUNER_MAX_PROFILES][TUNER_NAME_SIZE];
+    uint8_t profiles[TUNER_MAX_PROFILES][TUNER_NB_REGS];
+    int     i, nb_profiles = tuner_read_profiles(filename, names, profiles);
+
+    for (i=0; i < nb_profiles; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+        {
+            memcpy(values, profiles[i], TUNER_NB_REGS);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Save the register set under the profile name keeping the other profiles. The file is replaced at
+// once. Returns 0 if successful else -1
+int tuner_save_profile(char *filename, char *name, uint8_t *values)
+// ------------------------------------------------------------------------------------------------
+{
+    char    names[TUNER_MAX_PROFILES][TUNER_NAME_SIZE];
+    uint8_t profiles[TUNER_MAX_PROFILES][TUNER_NB_REGS];
+    char    tmp_filename[1024];
+    FILE    *profiles_file;
+    int     i, j, nb_profiles = tuner_read_profiles(filename, names, profiles);
+
+    for (i=0; (i < nb_profiles) && strcmp(names[i], name); i++);
+
+    if (i == nb_profiles)
+    {
+        if (nb_profiles == TUNER_MAX_PROFILES)
+        {
+            i = 0; // replace the oldest
+        }
+        else
+        {
+            nb_profiles++;
+        }
+    }
+
+    snprintf(names[i], TUNER_NAME_SIZE, "%s", name);
+    memcpy(profiles[i], values, TUNER_NB_REGS);
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    profiles_file = fopen(tmp_filename, "w");
+
+    if (!profiles_file)
+    {
+        return -1;
+    }
+
+    for (i=0; i < nb_profiles; i++)
+    {
+        fprintf(profiles_file, "%s", names[i]);
+
+        for (j=0; j < TUNER_NB_REGS; j++)
+        {
+            fprintf(profiles_file, " %02X", profiles[i][j]);
+        }
+
+        fprintf(profiles_file, "\n");
+    }
+
+    fclose(profiles_file);
+    return rename(tmp_filename, filename);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write the registers of the profile given in the options if any. Radio must be initialized and
+// idle. Returns 0 if successful else -1
+int tuner_apply_profile(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t values[TUNER_NB_REGS], pairs[2*TUNER_NB_REGS];
+    int     i;
+
+    if (!arguments->tune_profile)
+    {
+        return 0;
+    }
+
+    if (!tuner_load_profile(arguments->tune_filename, arguments->tune_profile, values))
+    {
+        verbprintft(1, ANSI_COLOR_RED "Tuner: no profile %s in %s" ANSI_COLOR_RESET "\n",
+            arguments->tune_profile, arguments->tune_filename);
+        return -1;
+    }
+
+    for (i=0; i < TUNER_NB_REGS; i++)
+    {
+        pairs[2*i]   = tuner_registers[i].address;
+        pairs[2*i+1] = values[i];
+    }
+
+    tuner_print_registers(1, arguments->tune_profile, values);
+    return radio_write_registers(serial_parms, pairs, TUNER_NB_REGS);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tune the receiver registers against a peer running the responder and save the best set under
+// the profile name. The search starts from the saved profile if any. Returns 0 if successful else 1
+int tuner_run(serial_t *serial_parms,
+            msp430_radio_parms_t *radio_parms,
+            arguments_t          *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    tuner_radio_t  tuner;
+    tuner_result_t best;
+    uint8_t        values[TUNER_NB_REGS];
+    char           name[TUNER_NAME_SIZE];
+
+    if (!init_radio(serial_parms, radio_parms, arguments))
+    {
+        fprintf(stderr, "Cannot initialize radio. Aborting...\n");
+        return 1;
+    }
+
+    tuner_profile_name(name, arguments);
+
+    if (!tuner_load_profile(arguments->tune_filename, name, values))
+    {
+        tuner_default_registers(values);
+    }
+
+    tuner.serial_parms = serial_parms;
+    tuner.radio_parms = radio_parms;
+    tuner.arguments = arguments;
+    tuner.seq = 0;
+    tuner.block_time = ((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2);
+
+    verbprintf(0, "Tuning profile %s with %d blocks per measurement\n", name, arguments->tune_blocks);
+    tuner_print_registers(1, "Tuner: start", values);
+
+    if (tuner_search(values, arguments->tune_blocks, arguments->power_index, tuner_measure_radio, &tuner, &best) < 0)
+    {
+        fprintf(stderr, "Tuning failed. Aborting...\n");
+        return 1;
+    }
+
+    if (tuner_save_profile(arguments->tune_filename, name, values) < 0)
+    {
+        fprintf(stderr, "Cannot save profile %s to %s\n", name, arguments->tune_filename);
+        return 1;
+    }
+
+    verbprintf(0, "Profile %s saved: PER %.4f BER %.2e\n", name, best.per, best.ber);
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Answer the test burst requests of the tuner running on the peer with the power it asks for, up
+// to the power index given in the options. Runs until interrupted.
+int tuner_respond(serial_t *serial_parms,
+            msp430_radio_parms_t *radio_parms,
+            arguments_t          *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  block[255], ack_block[32];
+    uint8_t  rssi, crc_lqi, lqi, countdown, seq, index, nb_blocks, power_index;
+    uint32_t size, block_time;
+    int      nbytes, ack_bytes, pattern_size = arguments->packet_length - 2 - TUNER_HEADER_SIZE;
+
+    if (!init_radio(serial_parms, radio_parms, arguments))
+    {
+        fprintf(stderr, "Cannot initialize radio. Aborting...\n");
+        return 1;
+    }
+
+    block_time = ((uint32_t) radio_get_byte_time(radio_parms)) * (arguments->packet_length + 2);
+    verbprintf(0, "Tuner responder: waiting for requests\n");
+
+    while (1)
+    {
+        size = 0;
+        nbytes = radio_receive_block(serial_parms, block, arguments->packet_length,
+            &countdown, &size, &rssi, &crc_lqi, 0);
+
+        if ((nbytes <= 4) || !get_crc_lqi(crc_lqi, &lqi) || (block[0] != TUNER_REQUEST_MAGIC))
+        {
+            continue;
+        }
+
+        seq = block[1];
+        nb_blocks = block[2];
+        power_index = (block[3] > arguments->power_index ? arguments->power_index : block[3]);
+        verbprintft(1, "Tuner responder: request #%d for %d blocks at %d dBm RSSI %.1f dBm\n",
+            seq, nb_blocks, power_values[power_index], radio_rssi_dbm);
+        radio_set_tx_power(serial_parms, power_index);
+        usleep(arguments->tnc_switchover_delay + TUNER_TURNAROUND_US);
+
+        for (index=0; index < nb_blocks; index++)
+        {
+            memset(block, 0, sizeof(block));
+            block[0] = TUNER_BLOCK_MAGIC;
+            block[1] = seq;
+            block[2] = index;
+            tuner_pattern(seq, index, &block[TUNER_HEADER_SIZE], pattern_size);
+            ack_bytes = sizeof(ack_block);
+
+            radio_send_block(serial_parms, block, arguments->packet_length - 1, 0, arguments->packet_length,
+                ack_block, &ack_bytes, block_time);
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tune against a simulated receiver whose sensitivity depends on the register fields. The hidden
+// best set depends on the rate and modulation. The link margin is set so that the default
+// registers give about 20% PER.
+void tuner_simulate(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    tuner_sim_t    sim;
+    tuner_result_t best;
+    uint8_t        defaults[TUNER_NB_REGS], values[TUNER_NB_REGS];
+    char           name[TUNER_NAME_SIZE];
+    int            f, nb_right = 0;
+
+    srand(arguments->rate * RADIO_NUM_MOD + arguments->modulation + 1);
+    tuner_default_registers(defaults);
+    memcpy(sim.best, defaults, TUNER_NB_REGS);
+
+    for (f=0; f < TUNER_NB_FIELDS; f++)
+    {
+        tuner_set_field(sim.best, &tuner_fields[f], rand() % (1<<tuner_fields[f].width));
+    }
+
+    sim.margin_db   = tuner_sim_loss_db(&sim, defaults) - 2.0 * log10(20.0);
+    sim.power_index = arguments->power_index;
+    sim.nb_blocks   = arguments->tune_blocks;
+    sim.block_bits  = 8 * (arguments->packet_length - 2 - TUNER_HEADER_SIZE);
+    sim.nb_measures = 0;
+
+    memcpy(values, defaults, TUNER_NB_REGS);
+    tuner_profile_name(name, arguments);
+
+    fprintf(stderr, "Modem register tuning simulation: profile %s, %d blocks per measurement\n", name, sim.nb_blocks);
+
+    tuner_search(values, sim.nb_blocks, sim.power_index, tuner_measure_sim, &sim, &best);
+
+    fprintf(stderr, "Field                  Default  Tuned  Best\n");
+
+    for (f=0; f < TUNER_NB_FIELDS; f++)
+    {
+        fprintf(stderr, "%-21s  %7d  %5d  %4d\n",
+            tuner_fields[f].name,
+            tuner_get_field(defaults, &tuner_fields[f]),
+            tuner_get_field(values, &tuner_fields[f]),
+            tuner_get_field(sim.best, &tuner_fields[f]));
+        nb_right += (tuner_get_field(values, &tuner_fields[f]) == tuner_get_field(sim.best, &tuner_fields[f]));
+    }
+
+    fprintf(stderr, "%d of %d fields at their best value after %d measurements\n", nb_right, (int) TUNER_NB_FIELDS, sim.nb_measures);
+    fprintf(stderr, "Default: loss %4.1f dB PER %.4f\n", tuner_sim_loss_db(&sim, defaults),
+        tuner_sim_block_error_rate(sim.margin_db - tuner_sim_loss_db(&sim, defaults)));
+    fprintf(stderr, "Tuned  : loss %4.1f dB PER %.4f\n", tuner_sim_loss_db(&sim, values),
+        tuner_sim_block_error_rate(sim.margin_db - tuner_sim_loss_db(&sim, values)));
+}
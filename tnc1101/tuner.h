@@ -0,0 +1,53 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Modem register tuning against a peer and named register profiles          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _TUNER_H_
+#define _TUNER_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "serial.h"
+#include "msp430_interface.h"
+
+#define TUNER_NB_REGS        6     // FOCCFG, BSCFG, AGCCTRL2, AGCCTRL1, AGCCTRL0 and FREND1
+#define TUNER_REQUEST_MAGIC  0xA7  // First byte of a test burst request
+#define TUNER_BLOCK_MAGIC    0xA8  // First byte of a test burst block
+#define TUNER_HEADER_SIZE    3     // Magic, sequence number and block index
+#define TUNER_REQUEST_SIZE   4     // Magic, sequence number, number of blocks and Tx power index
+#define TUNER_PER_LOW        0.05  // Below this PER the responder power is lowered to keep measurements meaningful
+#define TUNER_PER_HIGH       0.5   // Lowering the responder power must not bring PER above this
+#define TUNER_MAX_PASSES     4     // Maximum number of passes over all the register fields
+#define TUNER_MAX_RETRIES    3     // Requests sent for one measurement before giving up
+#define TUNER_TURNAROUND_US  5000  // Time given to the tuner to get back to reception after a request
+#define TUNER_MAX_PROFILES   32    // Maximum number of profiles in the profiles file
+#define TUNER_NAME_SIZE      32    // Maximum size of a profile name including the terminating zero
+
+typedef struct tuner_result_s
+{
+    float per; // Packet (block) error rate
+    float ber; // Bit error rate of the blocks received
+} tuner_result_t;
+
+void     tuner_default_registers(uint8_t *values);
+int      tuner_load_profile(char *filename, char *name, uint8_t *values);
+int      tuner_save_profile(char *filename, char *name, uint8_t *values);
+int      tuner_apply_profile(serial_t *serial_parms, arguments_t *arguments);
+
+int      tuner_run(serial_t *serial_parms,
+            msp430_radio_parms_t *radio_parms,
+            arguments_t          *arguments);
+
+int      tuner_respond(serial_t *serial_parms,
+            msp430_radio_parms_t *radio_parms,
+            arguments_t          *arguments);
+
+void     tuner_simulate(arguments_t *arguments);
+
+#endif // _TUNER_H_
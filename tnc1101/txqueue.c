@@ -0,0 +1,254 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Transmission queues with priority scheduling                               */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "txqueue.h"
+#include "util.h"
+
+char *txq_class_names[] = {
+    "control",
+    "interactive",
+    "bulk"
+};
+
+static const uint32_t txq_byte_limits[NUM_TXQ_CLASS] = {
+    4096,              // control
+    8192,              // interactive
+    TXQ_CLASS_BUFSIZE  // bulk
+};
+
+static const uint32_t txq_weights[NUM_TXQ_CLASS] = {
+    0, // control: strict priority
+    3, // interactive
+    1  // bulk
+};
+
+// === Static functions declarations ==============================================================
+
+static void txq_pop(txq_t *txq, txq_class_queue_t *queue, uint8_t *dest);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Remove the head frame of a class queue and copy it to the destination
+void txq_pop(txq_t *txq, txq_class_queue_t *queue, uint8_t *dest)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t size = queue->frame_sizes[queue->frame_head];
+
+    memcpy(dest, &queue->data[queue->read_index], size);
+
+    queue->read_index  += size;
+    queue->frame_head   = (queue->frame_head + 1) % TXQ_MAX_FRAMES;
+    queue->frame_count--;
+    queue->bytes       -= size;
+    txq->bytes         -= size;
+
+    if (queue->frame_count == 0) // rewind storage when empty
+    {
+        queue->read_index  = 0;
+        queue->write_index = 0;
+    }
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize the transmission queues
+void txq_init(txq_t *txq)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    memset(txq, 0, sizeof(txq_t));
+
+    for (i=0; i<NUM_TXQ_CLASS; i++)
+    {
+        txq->classes[i].byte_limit = txq_byte_limits[i];
+        txq->classes[i].weight     = txq_weights[i];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Append a frame to the queue of the given class
+// Returns 0 if the frame is queued
+//         1 if the frame is dropped because it is larger than the class byte limit
+//        -1 if the class queue is full. The frame is not queued and can be presented again later.
+int txq_enqueue(txq_t *txq, txq_class_t txq_class, uint8_t *frame, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    txq_class_queue_t *queue = &txq->classes[txq_class];
+
+    if ((size > queue->byte_limit) || (size > 0xFFFF))
+    {
+        queue->drops++;
+        verbprintft(1, "TXQ: %d bytes frame too large for %s queue. Dropping...\n", 
+            size,
+            txq_class_names[txq_class]);
+        return 1;
+    }
+
+    if ((queue->bytes + size > queue->byte_limit) || (queue->frame_count == TXQ_MAX_FRAMES))
+    {
+        return -1;
+    }
+
+    if (queue->write_index + size > TXQ_CLASS_BUFSIZE) // compact storage to make room at the end
+    {
+        memmove(queue->data, &queue->data[queue->read_index], queue->bytes);
+        queue->read_index  = 0;
+        queue->write_index = queue->bytes;
+    }
+
+    memcpy(&queue->data[queue->write_index], frame, size);
+    queue->frame_sizes[(queue->frame_head + queue->frame_count) % TXQ_MAX_FRAMES] = size;
+    queue->write_index += size;
+    queue->frame_count++;
+    queue->frames_in++;
+    queue->bytes += size;
+    txq->bytes   += size;
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Build a burst of frames for transmission. Frames are never split. A burst is closed when the
+// next frame to be served does not fit in the maximum size unless the burst is still empty.
+// o Classes with a zero weight are served first in class order (strict priority)
+// o Other classes share what is left by deficit round robin according to their weights
+// Returns the size of the burst
+uint32_t txq_dequeue_burst(txq_t *txq, uint8_t *burst, uint32_t max_size)
+// ------------------------------------------------------------------------------------------------
+{
+    txq_class_queue_t *queue;
+    uint32_t burst_size, size;
+    int i;
+
+    burst_size = txq_dequeue_priority(txq, burst, max_size);
+
+    for (i=0; i<NUM_TXQ_CLASS; i++)
+    {
+        if (!txq->classes[i].weight && txq->classes[i].frame_count) // burst is full
+        {
+            return burst_size;
+        }
+    }
+
+    while (txq->bytes) // only weighted classes have frames left
+    {
+        queue = &txq->classes[txq->drr_class];
+
+        if (queue->weight && queue->frame_count)
+        {
+            if (!txq->drr_granted)
+            {
+                queue->deficit += queue->weight * TXQ_QUANTUM;
+                txq->drr_granted = 1;
+            }
+
+            while (queue->frame_count && (queue->frame_sizes[queue->frame_head] <= queue->deficit))
+            {
+                size = queue->frame_sizes[queue->frame_head];
+
+                if (burst_size && (burst_size + size > max_size)) // resume with this class next time
+                {
+                    return burst_size;
+                }
+
+                txq_pop(txq, queue, &burst[burst_size]);
+                burst_size += size;
+                queue->deficit -= size;
+            }
+        }
+
+        if (queue->frame_count == 0) // an idle class does not accumulate credit
+        {
+            queue->deficit = 0;
+        }
+
+        txq->drr_class = (txq->drr_class + 1) % NUM_TXQ_CLASS;
+        txq->drr_granted = 0;
+    }
+
+    return burst_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Build a burst with the frames of the strict priority classes only
+// Returns the size of the burst
+uint32_t txq_dequeue_priority(txq_t *txq, uint8_t *burst, uint32_t max_size)
+// ------------------------------------------------------------------------------------------------
+{
+    txq_class_queue_t *queue;
+    uint32_t burst_size = 0, size;
+    int i;
+
+    for (i=0; i<NUM_TXQ_CLASS; i++)
+    {
+        queue = &txq->classes[i];
+
+        if (queue->weight)
+        {
+            continue;
+        }
+
+        while (queue->frame_count)
+        {
+            size = queue->frame_sizes[queue->frame_head];
+
+            if (burst_size && (burst_size + size > max_size))
+            {
+                return burst_size;
+            }
+
+            txq_pop(txq, queue, &burst[burst_size]);
+            burst_size += size;
+        }
+    }
+
+    return burst_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tells if intake should be paused because the radio does not keep up. Intake is paused when the
+// total queued bytes reach the high watermark and resumes when they fall to the low watermark.
+uint8_t txq_backpressure(txq_t *txq)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!txq->throttled && (txq->bytes >= TXQ_HIGH_WATERMARK))
+    {
+        txq->throttled = 1;
+        verbprintft(2, "TXQ: %d bytes queued. Pausing intake\n", txq->bytes);
+    }
+    else if (txq->throttled && (txq->bytes <= TXQ_LOW_WATERMARK))
+    {
+        txq->throttled = 0;
+        verbprintft(2, "TXQ: %d bytes queued. Resuming intake\n", txq->bytes);
+    }
+
+    return txq->throttled;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print queues statistics
+void txq_print_stats(txq_t *txq, int verb_level)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<NUM_TXQ_CLASS; i++)
+    {
+        verbprintf(verb_level, "TXQ: %-11s: %d frames queued, %d dropped, %d bytes pending\n",
+            txq_class_names[i],
+            txq->classes[i].frames_in,
+            txq->classes[i].drops,
+            txq->classes[i].bytes);
+    }
+}
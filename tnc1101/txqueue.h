@@ -0,0 +1,65 @@
+/******************************************************************************/
+/* TNC1101  - Radio serial link using CC1101 module                           */
+/*                                                                            */
+/* Transmission queues with priority scheduling                               */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _TXQUEUE_H_
+#define _TXQUEUE_H_
+
+#include <stdint.h>
+
+#include "main.h"
+
+#define TXQ_CLASS_BUFSIZE (1<<15) // Bytes storage of one class queue
+#define TXQ_MAX_FRAMES    512     // Maximum number of frames in one class queue
+#define TXQ_QUANTUM       256     // Deficit round robin quantum in bytes for a weight of 1
+#define TXQ_HIGH_WATERMARK (1<<14) // Total queued bytes above which intake is paused
+#define TXQ_LOW_WATERMARK  (1<<12) // Total queued bytes below which intake resumes
+
+typedef enum txq_class_e
+{
+    TXQ_CLASS_CONTROL = 0,  // Link control frames. Served with strict priority
+    TXQ_CLASS_INTERACTIVE,  // Small data frames. Weighted fair share with bulk
+    TXQ_CLASS_BULK,         // Large data frames. Weighted fair share with interactive
+    NUM_TXQ_CLASS
+} txq_class_t;
+
+extern char *txq_class_names[];
+
+typedef struct txq_class_queue_s
+{
+    uint8_t  data[TXQ_CLASS_BUFSIZE];    // Frames bytes
+    uint32_t read_index;                 // Index of the first byte of the head frame
+    uint32_t write_index;                // Index past the last byte of the tail frame
+    uint16_t frame_sizes[TXQ_MAX_FRAMES]; // Ring of frame sizes in queue order
+    uint32_t frame_head;                 // Index of the head frame size in the ring
+    uint32_t frame_count;                // Number of frames queued
+    uint32_t bytes;                      // Number of bytes queued
+    uint32_t byte_limit;                 // Maximum number of bytes that can be queued
+    uint32_t weight;                     // Weight in the fair share (0: strict priority)
+    int32_t  deficit;                    // Deficit round robin counter in bytes
+    uint32_t frames_in;                  // Statistics: number of frames queued
+    uint32_t drops;                      // Statistics: number of frames dropped
+} txq_class_queue_t;
+
+typedef struct txq_s
+{
+    txq_class_queue_t classes[NUM_TXQ_CLASS];
+    uint32_t          bytes;       // Total number of bytes queued
+    uint8_t           drr_class;   // Class currently served by the deficit round robin
+    uint8_t           drr_granted; // Quantum already granted to the class currently served
+    uint8_t           throttled;   // Intake is paused until the low watermark is reached
+} txq_t;
+
+void     txq_init(txq_t *txq);
+int      txq_enqueue(txq_t *txq, txq_class_t txq_class, uint8_t *frame, uint32_t size);
+uint32_t txq_dequeue_burst(txq_t *txq, uint8_t *burst, uint32_t max_size);
+uint32_t txq_dequeue_priority(txq_t *txq, uint8_t *burst, uint32_t max_size);
+uint8_t  txq_backpressure(txq_t *txq);
+void     txq_print_stats(txq_t *txq, int verb_level);
+
+#endif // _TXQUEUE_H_
@@ -137,6 +137,29 @@ uint32_t ts_us(struct timeval *x)
     return 1000000 * x->tv_sec + x->tv_usec;
 }
 
+// -------------------------------------------------------------------------------------------------
+// Get the current time as a 64 bit timestamp in microseconds
+uint64_t now_us()
+// -------------------------------------------------------------------------------------------------
+{
+    struct timeval tp;
+
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec * 1000000ULL + tp.tv_usec;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Get the monotonic clock as a 64 bit timestamp in microseconds. It is not affected by changes of
+// the system time and is used for intervals measured over long periods.
+uint64_t monotonic_us()
+// -------------------------------------------------------------------------------------------------
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1000000ULL + tp.tv_nsec / 1000;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Calculate RSSI in dBm from decimal RSSI read out of RSSI status register
 float rssi_dbm(uint8_t rssi_dec)
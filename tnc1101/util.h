@@ -20,6 +20,8 @@ void     _print_block(int verb_level, const uint8_t *pblock, int size);
 
 int      timeval_subtract(struct timeval *result, struct timeval *x, struct timeval *y);
 uint32_t ts_us(struct timeval *x);
+uint64_t now_us();
+uint64_t monotonic_us();
 
 float    rssi_dbm(uint8_t rssi_dec);
 uint8_t  get_crc_lqi(uint8_t crc_lqi, uint8_t *lqi);